@@ -0,0 +1,789 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <bsl.h>
+
+/* Compiles a generated corpus repeatedly and reports per-phase times from
+ * BSLCompileStats, so the library has to be built with stats. Splitting
+ * lexing from parsing reads the clock per token, which parse and lex
+ * throughput include. */
+
+typedef struct
+{
+  unsigned long seed;
+  int records;
+  int fields;
+  int procs;
+  int stmts;
+  int depth;
+  int nesting;
+  int outputs;
+  int widths[4];
+  int width_count;
+  double comments;
+} CorpusInfo;
+
+typedef struct
+{
+  char *buf;
+  size_t len, cap;
+  uint64_t rng;
+  const CorpusInfo *info;
+} Corpus;
+
+typedef struct Chunk
+{
+  struct Chunk *next;
+  size_t size, used;
+  unsigned char data[];
+} Chunk;
+
+/* Compiled modules keep their AST, so every repetition allocates from an
+ * arena that is reset afterwards. */
+typedef struct
+{
+  Chunk *chunks;
+} Arena;
+
+typedef struct
+{
+  const char *name;
+  double min, median, p99;
+} Timing;
+
+static const char *phase_names[BSL_PHASE_COUNT] = {
+  [BSL_PHASE_CACHE] = "cache",
+  [BSL_PHASE_LEX] = "lex",
+  [BSL_PHASE_PARSE] = "parse",
+  [BSL_PHASE_IMPORT] = "import",
+  [BSL_PHASE_RESOLVE] = "resolve",
+  [BSL_PHASE_SPECIALIZE] = "specialize",
+  [BSL_PHASE_DCE] = "dce",
+  [BSL_PHASE_LINK] = "link",
+  [BSL_PHASE_HASH] = "hash",
+  [BSL_PHASE_SLP] = "slp",
+  [BSL_PHASE_FMA] = "fma",
+  [BSL_PHASE_CODEGEN] = "codegen",
+};
+
+static void out(Corpus *corpus, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static void out(Corpus *corpus, const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+
+  if (corpus->len + len + 1 > corpus->cap)
+  {
+    corpus->cap = (corpus->len + len + 1) * 2;
+    corpus->buf = realloc(corpus->buf, corpus->cap);
+  }
+  va_start(args, fmt);
+  vsnprintf(corpus->buf + corpus->len, len + 1, fmt, args);
+  va_end(args);
+  corpus->len += len;
+}
+
+/* xorshift64*, so a seed always gives the same corpus. */
+static uint64_t next_random(Corpus *corpus)
+{
+  corpus->rng ^= corpus->rng >> 12;
+  corpus->rng ^= corpus->rng << 25;
+  corpus->rng ^= corpus->rng >> 27;
+  return corpus->rng * 2685821657736338717ull;
+}
+
+static int pick(Corpus *corpus, int n)
+{
+  return (int) (next_random(corpus) >> 33) % n;
+}
+
+static bool chance(Corpus *corpus, double p)
+{
+  return (next_random(corpus) >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+static void maybe_comment(Corpus *corpus, const char *indent)
+{
+  if (chance(corpus, corpus->info->comments))
+  {
+    out(corpus, "%s# generated comment %08x\n", indent,
+        (unsigned) next_random(corpus));
+  }
+}
+
+static int field_width(const CorpusInfo *info, int field)
+{
+  return info->widths[field % info->width_count];
+}
+
+static void out_type(Corpus *corpus, int width)
+{
+  if (width == 1)
+  {
+    out(corpus, "f32");
+  } else
+  {
+    out(corpus, "vec%d<f32>", width);
+  }
+}
+
+static void out_number(Corpus *corpus)
+{
+  out(corpus, "%d.%d", pick(corpus, 9) + 1, pick(corpus, 10));
+}
+
+/* Leaves are fields of the parameter, earlier variables of the proc or
+ * literals; scalars only ever multiply or divide vectors from the right. */
+static void out_leaf(Corpus *corpus, int width, int vars)
+{
+  const CorpusInfo *info = corpus->info;
+  int choice = pick(corpus, 3);
+  if (choice == 0)
+  {
+    int field = pick(corpus, info->fields);
+    for (int i = 0; i < info->fields; i++)
+    {
+      int candidate = (field + i) % info->fields;
+      if (field_width(info, candidate) == width)
+      {
+        out(corpus, "v.f%d", candidate);
+        return;
+      }
+    }
+  } else if (choice == 1 && vars > 0 && width == info->widths[0])
+  {
+    out(corpus, "t%d", pick(corpus, vars));
+    return;
+  }
+
+  if (width == 1)
+  {
+    out_number(corpus);
+    return;
+  }
+  out(corpus, "{");
+  for (int i = 0; i < width; i++)
+  {
+    out(corpus, i == 0 ? "" : ", ");
+    out_number(corpus);
+  }
+  out(corpus, "}");
+}
+
+static void out_op(Corpus *corpus)
+{
+  static const char ops[] = "+-*/";
+  out(corpus, " %c ", ops[pick(corpus, 4)]);
+}
+
+static void out_expr(Corpus *corpus, int width, int depth, int vars)
+{
+  if (depth == 0)
+  {
+    out_leaf(corpus, width, vars);
+    return;
+  }
+
+  static const char ops[] = "+-*/";
+  char op = ops[pick(corpus, 4)];
+  bool scalar_rhs = width > 1 && (op == '*' || op == '/') &&
+    chance(corpus, 0.25);
+  out(corpus, "(");
+  out_expr(corpus, width, depth - 1, vars);
+  out(corpus, " %c ", op);
+  out_expr(corpus, scalar_rhs ? 1 : width, depth - 1, vars);
+  out(corpus, ")");
+}
+
+/* Nesting grows linearly, unlike depth: ((e op a) op b) and so on. */
+static void out_nested(Corpus *corpus, int width, int vars)
+{
+  const CorpusInfo *info = corpus->info;
+  for (int i = 0; i < info->nesting; i++)
+  {
+    out(corpus, "(");
+  }
+  out_expr(corpus, width, info->depth, vars);
+  for (int i = 0; i < info->nesting; i++)
+  {
+    out_op(corpus);
+    out_leaf(corpus, width, vars);
+    out(corpus, ")");
+  }
+}
+
+static void out_result(Corpus *corpus, int width)
+{
+  if (corpus->info->stmts > 0)
+  {
+    out(corpus, "t%d", corpus->info->stmts - 1);
+  } else
+  {
+    out_leaf(corpus, width, 0);
+  }
+}
+
+/* Procs are vertex entry points over one record each. Every statement
+ * extends the one before it and the last feeds the position, so dead code
+ * elimination keeps all of them. */
+static size_t generate(const CorpusInfo *info, char **src, size_t *len)
+{
+  Corpus corpus = {
+    .rng = info->seed * 0x9e3779b97f4a7c15ull + 1,
+    .info = info,
+  };
+
+  for (int i = 0; i < info->records; i++)
+  {
+    maybe_comment(&corpus, "");
+    out(&corpus, "record R%d\n", i);
+    for (int j = 0; j < info->fields; j++)
+    {
+      maybe_comment(&corpus, "  ");
+      out(&corpus, "  [input(%d)] f%d: ", j, j);
+      out_type(&corpus, field_width(info, j));
+      out(&corpus, "\n");
+    }
+    out(&corpus, "end\n");
+  }
+  /* Variables all have the first width, so any of them can be a leaf. */
+  int width = info->widths[0];
+  out(&corpus, "record Out\n  [builtin(position)] pos: vec4<f32>\n");
+  for (int k = 0; k < info->outputs; k++)
+  {
+    out(&corpus, "  [output(%d)] o%d: ", k, k);
+    out_type(&corpus, width);
+    out(&corpus, "\n");
+  }
+  out(&corpus, "end\n");
+
+  for (int i = 0; i < info->procs; i++)
+  {
+    maybe_comment(&corpus, "");
+    out(&corpus, "[entry_point(vertex)]\nproc p%d(v: R%d) Out\n", i,
+        i % info->records);
+    for (int j = 0; j < info->stmts; j++)
+    {
+      maybe_comment(&corpus, "  ");
+      out(&corpus, "  var t%d = ", j);
+      if (j > 0)
+      {
+        out(&corpus, "t%d + ", j - 1);
+      }
+      out_nested(&corpus, width, j);
+      out(&corpus, "\n");
+    }
+
+    out(&corpus, "  return record Out .pos = {");
+    out_result(&corpus, width);
+    for (int k = width; k < 4; k++)
+    {
+      out(&corpus, k == 3 ? ", 1.0" : ", 0.0");
+    }
+    out(&corpus, "}");
+    for (int k = 0; k < info->outputs; k++)
+    {
+      out(&corpus, ", .o%d = ", k);
+      out_result(&corpus, width);
+    }
+    out(&corpus, ", end\nend\n");
+  }
+
+  *src = corpus.buf;
+  *len = corpus.len;
+  return (size_t) info->records + 1 + (size_t) info->procs;
+}
+
+static void *arena_alloc(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  Arena *arena = ud;
+  if (nsz == 0 || nsz <= osz)
+  {
+    return nsz == 0 ? NULL : ptr;
+  }
+
+  nsz = (nsz + 15) & ~(size_t) 15;
+  Chunk *chunk = arena->chunks;
+  if (chunk == NULL || chunk->size - chunk->used < nsz)
+  {
+    size_t size = nsz > (1u << 20) ? nsz : (1u << 20);
+    chunk = malloc(sizeof(Chunk) + size);
+    chunk->next = arena->chunks;
+    chunk->size = size;
+    chunk->used = 0;
+    arena->chunks = chunk;
+  }
+
+  void *new = chunk->data + chunk->used;
+  chunk->used += nsz;
+  if (ptr != NULL)
+  {
+    memcpy(new, ptr, osz);
+  }
+  memset((char *) new + osz, 0, nsz - osz);
+  return new;
+}
+
+static void arena_reset(Arena *arena)
+{
+  while (arena->chunks != NULL)
+  {
+    Chunk *next = arena->chunks->next;
+    free(arena->chunks);
+    arena->chunks = next;
+  }
+}
+
+/* ns holds reps times per phase, phase after phase, then the totals. */
+static bool run_compiles(const char *src, size_t src_len, int reps,
+    uint64_t *ns)
+{
+  Arena arena = {NULL};
+  for (int rep = 0; rep < reps; rep++)
+  {
+    BSLCompileStats stats;
+    BSLCompileInfo compile_info = {
+      .internal_ud = &arena,
+      .internal_fn = arena_alloc,
+      .src = (const uint8_t *) src,
+      .src_len = src_len,
+      .contract_fma = true,
+      .backend = BSL_BACKEND_C,
+      .stats = &stats,
+    };
+    BSLCompileResult result;
+    if (!bsl_compile(&compile_info, &result))
+    {
+      fprintf(stderr, "corpus does not compile: %d:%d: %s\n", result.line,
+          result.col, result.msg);
+      return false;
+    }
+    if (stats.total_ns == 0)
+    {
+      fprintf(stderr, "the library was built without stats\n");
+      return false;
+    }
+
+    for (int phase = 0; phase < BSL_PHASE_COUNT; phase++)
+    {
+      ns[phase * reps + rep] = stats.phase_ns[phase];
+    }
+    ns[BSL_PHASE_COUNT * reps + rep] = stats.total_ns;
+    arena_reset(&arena);
+  }
+  return true;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+static Timing summarize(const char *name, uint64_t *ns, int reps)
+{
+  qsort(ns, reps, sizeof(uint64_t), compare_u64);
+  int p99 = (reps * 99 + 99) / 100 - 1;
+  Timing timing = {
+    .name = name,
+    .min = ns[0] * 1e-9,
+    .median = (reps % 2 ? ns[reps / 2] : (ns[reps / 2 - 1] + ns[reps / 2]) / 2)
+      * 1e-9,
+    .p99 = ns[p99] * 1e-9,
+  };
+  return timing;
+}
+
+static double rate(double amount, double seconds)
+{
+  return seconds > 0.0 ? amount / seconds : 0.0;
+}
+
+/* Rates are taken from the min, median and p99 times, so the p99 rate is
+ * the slow tail. */
+static void write_triple(FILE *file, double min, double median, double p99)
+{
+  fprintf(file, "{\"min\": %.9g, \"median\": %.9g, \"p99\": %.9g}", min,
+      median, p99);
+}
+
+static void parse_widths(CorpusInfo *info, const char *arg)
+{
+  info->width_count = 0;
+  while (*arg != '\0' && info->width_count < 4)
+  {
+    int width = (int) strtol(arg, (char **) &arg, 10);
+    if (width < 1 || width > 4)
+    {
+      fprintf(stderr, "widths are between 1 and 4\n");
+      exit(1);
+    }
+    info->widths[info->width_count++] = width;
+    if (*arg == ',')
+    {
+      arg++;
+    }
+  }
+}
+
+/* Each axis grows one dimension of a small corpus 1, 2, 4 and 8 times. */
+typedef struct
+{
+  const char *name;
+  int *knob;
+  int *also;
+  int base;
+} Axis;
+
+#define SCALING_STEPS 4
+/* Linear growth fits a log-log slope of 1; n log n over these sizes stays
+ * below 1.2, quadratic is 2. */
+#define SCALING_MAX_SLOPE 1.35
+
+/* The work counters of BSLCompileStats, which unlike times do not depend
+ * on the machine or its load. */
+typedef enum
+{
+  WORK_TOKENS,
+  WORK_NODES,
+  WORK_ALLOCS,
+  WORK_BYTES,
+  WORK_SCOPE_LOOKUPS,
+  WORK_SCOPE_COMPARES,
+  WORK_RECORD_LOOKUPS,
+  WORK_RECORD_COMPARES,
+  WORK_COUNT,
+} Work;
+
+static const char *work_names[WORK_COUNT] = {
+  [WORK_TOKENS] = "tokens",
+  [WORK_NODES] = "nodes",
+  [WORK_ALLOCS] = "allocs",
+  [WORK_BYTES] = "bytes",
+  [WORK_SCOPE_LOOKUPS] = "scope lookups",
+  [WORK_SCOPE_COMPARES] = "scope compares",
+  [WORK_RECORD_LOOKUPS] = "record lookups",
+  [WORK_RECORD_COMPARES] = "record compares",
+};
+
+static double fit_slope(const double *x, const double *y, int n)
+{
+  double mx = 0.0, my = 0.0;
+  for (int i = 0; i < n; i++)
+  {
+    mx += log(x[i]) / n;
+    my += log(y[i]) / n;
+  }
+
+  double sxy = 0.0, sxx = 0.0;
+  for (int i = 0; i < n; i++)
+  {
+    sxy += (log(x[i]) - mx) * (log(y[i]) - my);
+    sxx += (log(x[i]) - mx) * (log(x[i]) - mx);
+  }
+  return sxy / sxx;
+}
+
+static bool count_work(const char *src, size_t src_len,
+    double work[WORK_COUNT])
+{
+  Arena arena = {NULL};
+  BSLCompileStats stats;
+  BSLCompileInfo compile_info = {
+    .internal_ud = &arena,
+    .internal_fn = arena_alloc,
+    .src = (const uint8_t *) src,
+    .src_len = src_len,
+    .contract_fma = true,
+    .backend = BSL_BACKEND_C,
+    .stats = &stats,
+  };
+  BSLCompileResult result;
+  bool ok = bsl_compile(&compile_info, &result);
+  arena_reset(&arena);
+  if (!ok)
+  {
+    fprintf(stderr, "corpus does not compile: %d:%d: %s\n", result.line,
+        result.col, result.msg);
+    return false;
+  }
+  if (stats.total_ns == 0)
+  {
+    fprintf(stderr, "the library was built without stats\n");
+    return false;
+  }
+
+  size_t nodes = 0;
+  for (int kind = 0; kind < BSL_NODE_COUNT; kind++)
+  {
+    nodes += stats.nodes[kind];
+  }
+  work[WORK_TOKENS] = (double) stats.tokens;
+  work[WORK_NODES] = (double) nodes;
+  work[WORK_ALLOCS] = (double) stats.alloc_calls;
+  work[WORK_BYTES] = (double) stats.bytes_requested;
+  work[WORK_SCOPE_LOOKUPS] = (double) stats.scope_lookups;
+  work[WORK_SCOPE_COMPARES] = (double) stats.scope_compares;
+  work[WORK_RECORD_LOOKUPS] = (double) stats.record_lookups;
+  work[WORK_RECORD_COMPARES] = (double) stats.record_compares;
+  return true;
+}
+
+/* Work grows against the size of the source, so an axis that also adds
+ * fixed text is not mistaken for a superlinear one. Counters that stay
+ * at zero on an axis are skipped. */
+static bool run_scaling(void)
+{
+  CorpusInfo info = {
+    .seed = 1,
+    .records = 2,
+    .fields = 8,
+    .procs = 8,
+    .stmts = 8,
+    .depth = 1,
+    .widths = {3, 1},
+    .width_count = 2,
+  };
+  Axis axes[] = {
+    {"toplevels", &info.procs, NULL, 1024},
+    {"locals", &info.stmts, NULL, 1024},
+    {"fields", &info.fields, &info.outputs, 64},
+    {"nesting", &info.nesting, NULL, 256},
+  };
+
+  bool ok = true;
+  for (size_t a = 0; a < sizeof(axes) / sizeof(axes[0]); a++)
+  {
+    Axis *axis = &axes[a];
+    CorpusInfo saved = info;
+    double bytes[SCALING_STEPS];
+    double work[SCALING_STEPS][WORK_COUNT];
+    double counts[WORK_COUNT][SCALING_STEPS];
+
+    for (int step = 0; step < SCALING_STEPS; step++)
+    {
+      *axis->knob = axis->base << step;
+      if (axis->also != NULL)
+      {
+        *axis->also = axis->base << step;
+      }
+
+      char *src;
+      size_t src_len;
+      generate(&info, &src, &src_len);
+      bool compiled = count_work(src, src_len, work[step]);
+      free(src);
+      if (!compiled)
+      {
+        return false;
+      }
+      bytes[step] = (double) src_len;
+    }
+    info = saved;
+
+    for (int w = 0; w < WORK_COUNT; w++)
+    {
+      if (work[SCALING_STEPS - 1][w] == 0.0)
+      {
+        continue;
+      }
+
+      for (int step = 0; step < SCALING_STEPS; step++)
+      {
+        counts[w][step] = work[step][w] > 0.0 ? work[step][w] : 1.0;
+      }
+      double slope = fit_slope(bytes, counts[w], SCALING_STEPS);
+      bool fits = slope <= SCALING_MAX_SLOPE;
+      printf("%-10s %-16s slope %5.2f %s\n", axis->name, work_names[w],
+          slope, fits ? "ok" : "SUPERLINEAR");
+      ok = ok && fits;
+    }
+  }
+  return ok;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+      "usage: %s [--seed N] [--records N] [--fields N] [--procs N]\n"
+      "  [--stmts N] [--depth N] [--nesting N] [--outputs N]\n"
+      "  [--widths W,W,..] [--comments P] [--reps N] [--json PATH]\n"
+      "  [--source PATH]\n"
+      "       %s --scaling\n", argv0, argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  CorpusInfo info = {
+    .seed = 1,
+    .records = 16,
+    .fields = 8,
+    .procs = 256,
+    .stmts = 16,
+    .depth = 3,
+    .widths = {3, 1, 2, 4},
+    .width_count = 4,
+    .comments = 0.1,
+  };
+  int reps = 20;
+  const char *json_path = NULL;
+  const char *source_path = NULL;
+
+  if (argc == 2 && strcmp(argv[1], "--scaling") == 0)
+  {
+    return run_scaling() ? 0 : 1;
+  }
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      usage(argv[0]);
+    }
+    const char *value = argv[++i];
+    if (strcmp(arg, "--seed") == 0)
+    {
+      info.seed = strtoul(value, NULL, 10);
+    } else if (strcmp(arg, "--records") == 0)
+    {
+      info.records = atoi(value);
+    } else if (strcmp(arg, "--fields") == 0)
+    {
+      info.fields = atoi(value);
+    } else if (strcmp(arg, "--procs") == 0)
+    {
+      info.procs = atoi(value);
+    } else if (strcmp(arg, "--stmts") == 0)
+    {
+      info.stmts = atoi(value);
+    } else if (strcmp(arg, "--depth") == 0)
+    {
+      info.depth = atoi(value);
+    } else if (strcmp(arg, "--nesting") == 0)
+    {
+      info.nesting = atoi(value);
+    } else if (strcmp(arg, "--outputs") == 0)
+    {
+      info.outputs = atoi(value);
+    } else if (strcmp(arg, "--widths") == 0)
+    {
+      parse_widths(&info, value);
+    } else if (strcmp(arg, "--comments") == 0)
+    {
+      info.comments = atof(value);
+    } else if (strcmp(arg, "--reps") == 0)
+    {
+      reps = atoi(value);
+    } else if (strcmp(arg, "--json") == 0)
+    {
+      json_path = value;
+    } else if (strcmp(arg, "--source") == 0)
+    {
+      source_path = value;
+    } else
+    {
+      usage(argv[0]);
+    }
+  }
+  if (info.records < 1 || info.fields < 1 || info.procs < 0 ||
+      info.stmts < 0 || info.depth < 0 || info.nesting < 0 ||
+      info.outputs < 0 || info.width_count == 0 || reps < 1)
+  {
+    usage(argv[0]);
+  }
+
+  char *src;
+  size_t src_len;
+  size_t toplevels = generate(&info, &src, &src_len);
+  if (source_path != NULL)
+  {
+    FILE *file = fopen(source_path, "w");
+    if (file == NULL || fwrite(src, 1, src_len, file) != src_len)
+    {
+      fprintf(stderr, "could not write '%s'\n", source_path);
+      return 1;
+    }
+    fclose(file);
+  }
+
+  uint64_t *ns = malloc(sizeof(uint64_t) * (BSL_PHASE_COUNT + 1) * reps);
+  if (!run_compiles(src, src_len, reps, ns))
+  {
+    return 1;
+  }
+
+  Timing timings[BSL_PHASE_COUNT + 1];
+  for (int phase = 0; phase < BSL_PHASE_COUNT; phase++)
+  {
+    timings[phase] = summarize(phase_names[phase], ns + phase * reps, reps);
+  }
+  timings[BSL_PHASE_COUNT] = summarize("total", ns + BSL_PHASE_COUNT * reps,
+      reps);
+
+  double mb = src_len * 1e-6;
+  printf("corpus: %zu bytes, %zu toplevels, %d repetitions\n", src_len,
+      toplevels, reps);
+  printf("%-10s %30s %36s\n", "", "MB/s (min/median/p99)",
+      "toplevels/s (min/median/p99)");
+  for (int i = 0; i <= BSL_PHASE_COUNT; i++)
+  {
+    Timing *t = &timings[i];
+    printf("%-10s %10.1f %9.1f %9.1f %12.0f %11.0f %11.0f\n", t->name,
+        rate(mb, t->min), rate(mb, t->median), rate(mb, t->p99),
+        rate(toplevels, t->min), rate(toplevels, t->median),
+        rate(toplevels, t->p99));
+  }
+
+  if (json_path != NULL)
+  {
+    FILE *file = fopen(json_path, "w");
+    if (file == NULL)
+    {
+      fprintf(stderr, "could not open '%s' for writing\n", json_path);
+      return 1;
+    }
+
+    fprintf(file, "{\n  \"version\": \"%s\",\n", BSL_VERSION);
+    fprintf(file, "  \"corpus\": {\"seed\": %lu, \"records\": %d, "
+        "\"fields\": %d, \"procs\": %d, \"stmts\": %d, \"depth\": %d, "
+        "\"nesting\": %d, \"outputs\": %d, \"widths\": [", info.seed,
+        info.records, info.fields, info.procs, info.stmts, info.depth,
+        info.nesting, info.outputs);
+    for (int i = 0; i < info.width_count; i++)
+    {
+      fprintf(file, "%s%d", i == 0 ? "" : ", ", info.widths[i]);
+    }
+    fprintf(file, "], \"comments\": %g, \"bytes\": %zu, \"toplevels\": %zu},\n",
+        info.comments, src_len, toplevels);
+    fprintf(file, "  \"repetitions\": %d,\n  \"phases\": {\n", reps);
+    for (int i = 0; i <= BSL_PHASE_COUNT; i++)
+    {
+      Timing *t = &timings[i];
+      fprintf(file, "    \"%s\": {\"seconds\": ", t->name);
+      write_triple(file, t->min, t->median, t->p99);
+      fprintf(file, ", \"mb_per_s\": ");
+      write_triple(file, rate(mb, t->min), rate(mb, t->median),
+          rate(mb, t->p99));
+      fprintf(file, ", \"toplevels_per_s\": ");
+      write_triple(file, rate(toplevels, t->min), rate(toplevels, t->median),
+          rate(toplevels, t->p99));
+      fprintf(file, "}%s\n", i == BSL_PHASE_COUNT ? "" : ",");
+    }
+    fprintf(file, "  }\n}\n");
+    fclose(file);
+  }
+
+  free(ns);
+  free(src);
+  return 0;
+}
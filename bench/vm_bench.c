@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <bsl.h>
+
+#define INVOCATIONS 4000000
+
+typedef struct
+{
+  const char *name;
+  const char *entry_point;
+  const char *src;
+} Shader;
+
+static const Shader shaders[] = {
+  {
+    "transform",
+    "vs",
+    "record In\n"
+    "  [input(0)] pos: vec3<f32>\n"
+    "  [input(1)] uv: vec2<f32>\n"
+    "end\n"
+    "record Out\n"
+    "  [builtin(position)] pos: vec4<f32>\n"
+    "  [output(0)] uv: vec2<f32>\n"
+    "end\n"
+    "[entry_point(vertex)]\n"
+    "proc vs(v: In) Out\n"
+    "  var scaled = v.pos * 0.5 + {1.0, 2.0, 3.0}\n"
+    "  return record Out .pos = {scaled, 1.0}, .uv = v.uv, end\n"
+    "end\n",
+  },
+  {
+    "lighting",
+    "fs",
+    "record In\n"
+    "  [input(0)] normal: vec3<f32>\n"
+    "  [input(1)] light: vec3<f32>\n"
+    "  [input(2)] albedo: vec3<f32>\n"
+    "end\n"
+    "record Out\n"
+    "  [output(0)] color: vec4<f32>\n"
+    "end\n"
+    "[entry_point(fragment)]\n"
+    "proc fs(i: In) Out\n"
+    "  var n = i.normal * i.light\n"
+    "  var ambient = i.albedo * 0.1\n"
+    "  var lit = i.albedo * n + ambient\n"
+    "  return record Out .color = {lit / 2.0, 1.0}, end\n"
+    "end\n",
+  },
+};
+
+static void *bench_alloc(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  (void) ud;
+  if (nsz == 0)
+  {
+    free(ptr);
+    return NULL;
+  }
+
+  void *new = realloc(ptr, nsz);
+  if (nsz > osz)
+  {
+    memset((char *) new + osz, 0, nsz - osz);
+  }
+  return new;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+  for (size_t i = 0; i < sizeof(shaders) / sizeof(shaders[0]); i++)
+  {
+    const Shader *shader = &shaders[i];
+    BSLCompileInfo info = {
+      .internal_fn = bench_alloc,
+      .src = (const uint8_t *) shader->src,
+      .src_len = strlen(shader->src),
+    };
+    BSLCompileResult result;
+    BSLProgram *program;
+
+    if (!bsl_compile(&info, &result) ||
+        !bsl_vm_compile(result.module, shader->entry_point, &program, &result))
+    {
+      fprintf(stderr, "%s: %d:%d: %s\n", shader->name, result.line, 
+          result.col, result.msg);
+      return 1;
+    }
+
+    float input[4 * 4] = {0.25f, 0.5f, 0.75f, 0.0f, 1.0f, 0.5f, 0.25f, 0.0f,
+      0.5f, 0.5f, 0.5f, 0.0f};
+    const float *inputs[1] = {input};
+    float output[16];
+    float sink = 0.0f;
+
+    double start = now();
+    for (size_t n = 0; n < INVOCATIONS; n++)
+    {
+      input[0] = (float) n;
+      bsl_vm_run(program, inputs, output);
+      sink += output[0];
+    }
+    double elapsed = now() - start;
+
+    printf("%-10s vm  %8.2f M invocations/s (checksum %g)\n", shader->name,
+        INVOCATIONS / elapsed * 1e-6, sink);
+
+    BSLJitFn fn;
+    if (!bsl_jit_compile(program, &fn, &result))
+    {
+      printf("%-10s jit unavailable: %s\n", shader->name, result.msg);
+      bsl_vm_free(program);
+      continue;
+    }
+
+    /* The JIT must agree with the interpreter bit for bit. */
+    size_t size = bsl_vm_output_size(program);
+    float expected[16];
+    input[0] = 0.5f;
+    bsl_vm_run(program, inputs, expected);
+    fn(inputs, output);
+    if (memcmp(expected, output, size * sizeof(float)) != 0)
+    {
+      fprintf(stderr, "%s: jit output differs from the vm\n", shader->name);
+      return 1;
+    }
+
+    sink = 0.0f;
+    start = now();
+    for (size_t n = 0; n < INVOCATIONS; n++)
+    {
+      input[0] = (float) n;
+      fn(inputs, output);
+      sink += output[0];
+    }
+    elapsed = now() - start;
+
+    printf("%-10s jit %8.2f M invocations/s (checksum %g)\n", shader->name,
+        INVOCATIONS / elapsed * 1e-6, sink);
+    bsl_jit_free(fn);
+    bsl_vm_free(program);
+  }
+  return 0;
+}
@@ -1,7 +1,10 @@
 #ifndef BSL_H
 #define BSL_H
 
+#define BSL_VERSION "0.1.0"
+
 #define BSL_RESULT_MAX_MESSAGE_LEN 512
+#define BSL_LOCATION_POSITION -1
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -9,20 +12,416 @@
 
 typedef void*(*BSLAllocFn)(void *ptr, size_t osz, size_t nsz, void *ud);
 
+typedef struct BSLModule BSLModule;
+typedef struct BSLPackWriter BSLPackWriter;
+typedef struct BSLPack BSLPack;
+typedef struct BSLTrace BSLTrace;
+typedef struct BSLProgram BSLProgram;
+
+/* C output prefixes every name from the source with bsl_u_. Each entry
+ * point also gets a bsl_batch_<name> function that runs it over arrays. */
+typedef enum
+{
+  BSL_BACKEND_NONE,
+  BSL_BACKEND_C,
+} BSLBackend;
+
+typedef enum
+{
+  BSL_STAGE_VERTEX = 1 << 0,
+  BSL_STAGE_FRAGMENT = 1 << 1,
+} BSLStage;
+
+#define BSL_HASH_LEN 32
+
+/* A location an entry point reads or writes, or BSL_LOCATION_POSITION for
+ * the clip position. */
+typedef struct
+{
+  int location;
+  int component;
+  int components;
+} BSLInterfaceVarying;
+
+/* Structural hash of an entry point and the records it uses. Names,
+ * comments and formatting do not contribute, interface locations do.
+ * Varyings holds the inputs, then the outputs, in declaration order; it
+ * comes from internal_fn like the name, with
+ * (input_count + output_count) * sizeof(BSLInterfaceVarying) bytes. */
+typedef struct
+{
+  const char *name;
+  BSLStage stage;
+  uint8_t hash[BSL_HASH_LEN];
+  BSLInterfaceVarying *varyings;
+  size_t input_count, output_count;
+} BSLEntryPointHash;
+
+/* What kind of error a diagnostic is. Values are stable across versions. */
+typedef enum
+{
+  BSL_ERROR_NONE,
+  /* Anything without a code of its own, and all errors outside compiles. */
+  BSL_ERROR_OTHER,
+  BSL_ERROR_SYNTAX,
+  BSL_ERROR_UNDECLARED,
+  BSL_ERROR_REDECLARED,
+  BSL_ERROR_TYPE,
+  BSL_ERROR_IMPORT,
+  BSL_ERROR_CONSTANT,
+  BSL_ERROR_INTERFACE,
+  BSL_ERROR_LIMIT,
+  /* A state the compiler should never reach, a bug to report. */
+  BSL_ERROR_INTERNAL,
+} BSLErrorCode;
+
 typedef struct
 {
   int line, col;
+  BSLErrorCode code;
   char msg[BSL_RESULT_MAX_MESSAGE_LEN];
+} BSLDiagnostic;
+
+/* Where linking put a vertex output declared at declared_location; the
+ * fragment input of that location moved with it. Outputs the fragment stage
+ * does not read were removed and have location and component -1.
+ * Components is how much of the location the output takes. */
+typedef struct
+{
+  int declared_location;
+  int location;
+  int component;
+  int components;
+} BSLVaryingLocation;
+
+typedef struct
+{
+  /* The first error in the source; a failed compile lists all of them in
+   * diagnostics. */
+  int line, col;
+  BSLErrorCode code;
+  char msg[BSL_RESULT_MAX_MESSAGE_LEN];
+  /* Compiles go on past a failed statement, toplevel or operand, and
+   * resolve what parsed after a parse error, so one compile reports every
+   * independent error up to the phase that failed, in source order; those
+   * without a position last. Uses of what failed are not reported again.
+   * Going past a limit stops it. From internal_fn,
+   * diagnostic_count * sizeof(BSLDiagnostic) bytes. */
+  BSLDiagnostic *diagnostics;
+  size_t diagnostic_count;
+  size_t removed_vars;
+  size_t removed_toplevels;
+  size_t removed_varyings;
+  /* Every vertex output when stages were linked, by declared location. From
+   * internal_fn, varying_count * sizeof(BSLVaryingLocation) bytes. */
+  BSLVaryingLocation *varyings;
+  size_t varying_count;
+  BSLModule *module;
+  /* Generated source when a backend was requested, from internal_fn,
+   * output_len + 1 bytes with the terminating NUL. */
+  const char *output;
+  size_t output_len;
+  BSLEntryPointHash *entry_hashes;
+  size_t entry_hash_count;
+  /* Set when the result came from cache_dir; there is no module then. */
+  bool cache_hit;
+  /* Set when the compile failed by going past one of the limits in
+   * BSLCompileInfo. Such failures are not cached. */
+  bool limit_exceeded;
 } BSLCompileResult;
 
+typedef enum
+{
+  BSL_PHASE_CACHE,
+  BSL_PHASE_LEX,
+  BSL_PHASE_PARSE,
+  BSL_PHASE_IMPORT,
+  BSL_PHASE_RESOLVE,
+  BSL_PHASE_SPECIALIZE,
+  BSL_PHASE_DCE,
+  BSL_PHASE_LINK,
+  BSL_PHASE_HASH,
+  BSL_PHASE_SLP,
+  BSL_PHASE_FMA,
+  BSL_PHASE_CODEGEN,
+  BSL_PHASE_COUNT,
+} BSLPhase;
+
+typedef enum
+{
+  BSL_NODE_TOPLEVEL,
+  BSL_NODE_RECORD_ENTRY,
+  BSL_NODE_TYPE,
+  BSL_NODE_PARAMETER,
+  BSL_NODE_STATEMENT,
+  BSL_NODE_EXPR,
+  BSL_NODE_MEMBER,
+  BSL_NODE_VAR_ENTRY,
+  BSL_NODE_OTHER,
+  BSL_NODE_COUNT,
+} BSLNodeKind;
+
+/* Only collected when the library is built with the stats option, zero
+ * otherwise. Parse time excludes the lexing it drives, which is estimated
+ * from a sample of the tokens. Bytes count what was asked of internal_fn,
+ * growth only for reallocations. Current bytes are those still held when
+ * the compile returns, the module and output among them;
+ * node_bytes[k] / nodes[k] is the average size of a node. Compares count
+ * the names checked by scans of unindexed scopes and records. */
+typedef struct
+{
+  uint64_t phase_ns[BSL_PHASE_COUNT];
+  uint64_t total_ns;
+  size_t tokens;
+  size_t nodes[BSL_NODE_COUNT];
+  size_t node_bytes[BSL_NODE_COUNT];
+  size_t alloc_calls;
+  size_t bytes_requested;
+  size_t bytes_current;
+  size_t bytes_peak;
+  size_t scope_lookups;
+  size_t scope_compares;
+  size_t record_lookups;
+  size_t record_compares;
+} BSLCompileStats;
+
 typedef struct
 {
   void *internal_ud;
   BSLAllocFn internal_fn;
   const uint8_t *src;
   size_t src_len;
+  /* When non-empty, only these entry points and what they reach are compiled. */
+  const char **entry_points;
+  size_t entry_point_count;
+  /* Contract a * b + c into fused multiply-adds, changing rounding. */
+  bool contract_fma;
+  /* Let specialization fold x * 0 to 0, and x + 0, x - 0, x * 1 and x / 1
+   * to x, which is wrong when x is NaN, infinite or -0. Constant operands
+   * fold either way. */
+  bool fast_math;
+  /* Drop vertex outputs the fragment stage does not read and pack the rest
+   * into as few locations as they fit, which moves them. Needs at most one
+   * vertex and one fragment entry point, after entry_points. */
+  bool link_stages;
+  BSLBackend backend;
+  /* Results of backend compiles are cached here, keyed by a hash of the
+   * source, version and options, when set. Zero max bytes means unbounded.
+   * Import summaries are kept in the same directory and count against the
+   * same limit. */
+  const char *cache_dir;
+  size_t cache_max_bytes;
+  /* Searched in order for <name>.bsl by 'import name'. Imported modules are
+   * compiled on their own, and their interface is kept in cache_dir. */
+  const char **import_dirs;
+  size_t import_dir_count;
+  /* Reset and filled by each compile when set. */
+  BSLCompileStats *stats;
+  /* Phases and toplevels are recorded here when set. */
+  BSLTrace *trace;
+  /* Bounds on one compile, none when zero. Depth counts nested
+   * expressions and vector types, bytes are what the compile holds of
+   * internal_fn at once and time is wall clock. Imports compile under the
+   * same limits with whatever time is left. Whatever the limits, vector
+   * types nested more than 1024 deep are refused, as later passes recurse
+   * over them. */
+  size_t max_depth;
+  size_t max_tokens;
+  size_t max_bytes;
+  uint64_t max_time_ns;
 } BSLCompileInfo;
 
+/* Overrides the default of a 'const' declared in the source. */
+typedef struct
+{
+  const char *name;
+  float value;
+} BSLConstant;
+
+typedef struct
+{
+  const BSLConstant *constants;
+  size_t constant_count;
+} BSLVariantInfo;
+
+typedef struct
+{
+  BSLModule *module;
+  const char *output;
+  size_t output_len;
+  BSLEntryPointHash *entry_hashes;
+  size_t entry_hash_count;
+  BSLVaryingLocation *varyings;
+  size_t varying_count;
+  /* Index of the first variant that folded to the same code, whose module
+   * and output this one shares. Its own index otherwise. */
+  size_t same_as;
+} BSLVariant;
+
+typedef struct
+{
+  int location;
+  int components;
+  const float *data;
+} BSLVertexInput;
+
+typedef struct
+{
+  int location;
+  int components;
+  float *data;
+} BSLVertexOutput;
+
+typedef enum
+{
+  BSL_FORMAT_F32,
+  BSL_FORMAT_U8_UNORM,
+  BSL_FORMAT_I8_SNORM,
+  BSL_FORMAT_U16_UNORM,
+  BSL_FORMAT_I16_SNORM,
+} BSLVertexFormat;
+
+/* Vertex i of a location is read from base + offset + i * stride. The
+ * buffer stays owned by the caller and is read in place. */
+typedef struct
+{
+  int location;
+  int components;
+  BSLVertexFormat format;
+  const void *base;
+  size_t stride;
+  size_t offset;
+} BSLVertexBinding;
+
+/* Varyings are interpolated linearly across the framebuffer, each
+ * component as a + dx * x + dy * y at pixel centers. */
+typedef struct
+{
+  int location;
+  int components;
+  float a[4];
+  float dx[4];
+  float dy[4];
+} BSLFragmentInput;
+
+/* Row-major, width * height * components floats. */
+typedef struct
+{
+  int location;
+  int components;
+  float *data;
+} BSLFragmentOutput;
+
 bool bsl_compile(BSLCompileInfo *compile_info, BSLCompileResult *result);
 
+/* Parses and resolves the source once, then specializes its constants for
+ * each variant. Errors in a variant name its index, and a failed compile
+ * frees what earlier variants made and clears variants. The compile cache
+ * is not consulted. */
+bool bsl_compile_variants(BSLCompileInfo *compile_info,
+    const BSLVariantInfo *variant_infos, BSLVariant *variants,
+    size_t variant_count, BSLCompileResult *result);
+
+/* Traces record begin and end events of compile phases and toplevels on
+ * every thread that compiles with them. Each thread appends to its own
+ * buffer, so alloc_fn must be thread safe when threads share a trace.
+ * Write it once no compile uses it; the file is Chrome trace event JSON,
+ * as read by Perfetto and chrome://tracing. */
+BSLTrace *bsl_trace_create(BSLAllocFn alloc_fn, void *alloc_ud);
+/* Brackets work of the caller's own, like one file of a batch. */
+void bsl_trace_begin(BSLTrace *trace, const char *name);
+void bsl_trace_end(BSLTrace *trace);
+bool bsl_trace_write(BSLTrace *trace, const char *path,
+    BSLCompileResult *result);
+void bsl_trace_free(BSLTrace *trace);
+
+/* Archives hold a resolved module in a position independent layout. Loading
+ * maps the file privately and patches it in place, which copies the pages
+ * holding nodes; the module stays valid until bsl_module_unload. Archives
+ * only load on the ABI that wrote them. */
+bool bsl_module_save(BSLModule *module, const char *path, 
+    BSLCompileResult *result);
+bool bsl_module_load(const char *path, BSLAllocFn alloc_fn, void *alloc_ud,
+    BSLModule **module, BSLCompileResult *result);
+void bsl_module_unload(BSLModule *module);
+
+/* A shader in a pack: its code and what it reads and writes. Varyings are
+ * sorted by location and component. */
+typedef struct
+{
+  const char *name;
+  BSLStage stage;
+  const uint8_t *hash;
+  const char *code;
+  size_t code_len;
+  const BSLInterfaceVarying *inputs;
+  size_t input_count;
+  const BSLInterfaceVarying *outputs;
+  size_t output_count;
+} BSLPackEntry;
+
+/* Packs collect shaders under unique names into one file, with indexes
+ * sorted by name and by semantic hash. Entries are copied in, identical
+ * code is stored once; adding a name twice fails. Entries added without a
+ * hash are only found by name and read back with a NULL hash. */
+BSLPackWriter *bsl_pack_writer_create(BSLAllocFn alloc_fn, void *alloc_ud);
+bool bsl_pack_add(BSLPackWriter *writer, const BSLPackEntry *entry,
+    BSLCompileResult *result);
+/* Adds an entry point of a compile, cached or not, taking varyings from
+ * its entry hash and code from the backend output. */
+bool bsl_pack_add_result(BSLPackWriter *writer, const char *name,
+    const BSLCompileResult *compile_result, const char *entry_point,
+    BSLStage stage, BSLCompileResult *result);
+bool bsl_pack_write(BSLPackWriter *writer, const char *path,
+    BSLCompileResult *result);
+void bsl_pack_writer_free(BSLPackWriter *writer);
+
+/* Opening maps the file read-only. Entries point into the mapping and stay
+ * valid until bsl_pack_close; lookups are binary searches. */
+bool bsl_pack_open(const char *path, BSLAllocFn alloc_fn, void *alloc_ud,
+    BSLPack **pack, BSLCompileResult *result);
+size_t bsl_pack_count(const BSLPack *pack);
+bool bsl_pack_get(const BSLPack *pack, size_t index, BSLPackEntry *entry);
+bool bsl_pack_find(const BSLPack *pack, const char *name,
+    BSLPackEntry *entry);
+bool bsl_pack_find_hash(const BSLPack *pack,
+    const uint8_t hash[BSL_HASH_LEN], BSLPackEntry *entry);
+void bsl_pack_close(BSLPack *pack);
+
+bool bsl_eval_vertex(BSLModule *module, const char *entry_point,
+    const BSLVertexInput *inputs, size_t input_count,
+    BSLVertexOutput *outputs, size_t output_count,
+    size_t vertex_count, BSLCompileResult *result);
+bool bsl_eval_vertex_bound(BSLModule *module, const char *entry_point,
+    const BSLVertexBinding *bindings, size_t binding_count,
+    BSLVertexOutput *outputs, size_t output_count,
+    size_t vertex_count, BSLCompileResult *result);
+
+/* Runs on thread_count threads, or one per online CPU when zero. The
+ * threads come from a pool that outlives the call; concurrent calls take
+ * turns on it. */
+bool bsl_eval_fragment(BSLModule *module, const char *entry_point,
+    const BSLFragmentInput *inputs, size_t input_count,
+    BSLFragmentOutput *outputs, size_t output_count,
+    int width, int height, int thread_count, BSLCompileResult *result);
+
+/* Programs read one record per parameter from inputs, in declaration
+ * order, and write the returned value to output. Records are laid out as
+ * four floats per entry in declaration order. A program is allocated from
+ * its module and has to be freed before it. */
+bool bsl_vm_compile(BSLModule *module, const char *entry_point,
+    BSLProgram **program, BSLCompileResult *result);
+void bsl_vm_free(BSLProgram *program);
+size_t bsl_vm_output_size(const BSLProgram *program);
+void bsl_vm_run(const BSLProgram *program, const float *const *inputs, 
+    float *output);
+
+/* Native code for a VM program, called the same way as bsl_vm_run. Only
+ * available on x86-64 Linux. */
+typedef void (*BSLJitFn)(const float *const *inputs, float *output);
+
+bool bsl_jit_compile(const BSLProgram *program, BSLJitFn *fn, 
+    BSLCompileResult *result);
+void bsl_jit_free(BSLJitFn fn);
+
 #endif
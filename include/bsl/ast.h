@@ -5,16 +5,20 @@
 #include <stddef.h>
 
 #include <bsl/util.h>
+#include <bsl/limits.h>
 
 struct Type;
 struct Toplevel;
 
+struct VarEntry;
+
 typedef struct Parameter
 {
   int line, col;
   const uint8_t *name;
   size_t name_len;
   struct Type *type;
+  struct VarEntry *entry;
   struct Parameter *next;
 } Parameter;
 
@@ -50,6 +54,9 @@ typedef struct RecordEntry
     int pos;
     BuiltinType builtin;
   };
+  int component;
+  int index;
+  bool live;
   const uint8_t *name;
   size_t name_len;
   struct Type *type;
@@ -71,6 +78,7 @@ typedef struct Type
       RecordEntry *entries;
       const uint8_t *name;
       size_t name_len;
+      struct Toplevel *toplevel;
     } record; 
     struct
     {
@@ -103,12 +111,24 @@ typedef struct VarEntry
   size_t name_len;
   Type *type;
   struct Toplevel *record;
+  bool live;
+  /* Its declaration failed, so uses of it fail without another error. */
+  bool poisoned;
+  /* Position in its scope, in declaration order. Passes that number
+   * variables map from this in tables of their own and leave the AST as
+   * it is, so compiled modules can be used from several threads. */
+  size_t index;
+  /* Default value of a specialization constant, a number. */
+  struct Expr *constant;
   struct VarEntry *next;
 } VarEntry;
 
+/* Entries are indexed by name once there are NAME_TABLE_MIN of them. */
 typedef struct Scope
 {
   struct VarEntry *entries;
+  size_t entry_count;
+  NameTable index;
   struct Scope *up;
 } Scope;
 
@@ -128,8 +148,14 @@ typedef enum
   EXPR_MEMBER,
   EXPR_VECTOR,
   EXPR_BINARY,
+  EXPR_FMA,
 } ExprType;
 
+/* Passes recurse over types, so the parser refuses vector types nested
+ * deeper than this and archives are checked against it. Expressions have
+ * no such bound; passes walk them with an ExprWalk. */
+#define AST_MAX_TYPE_DEPTH 1024
+
 typedef struct Expr
 {
   ExprType t;
@@ -154,6 +180,9 @@ typedef struct Expr
       struct Expr *lhs, *rhs;
       Binop op;
     } binary;
+    struct {
+      struct Expr *lhs, *rhs, *addend;
+    } fma;
     struct
     {
       struct Expr *lhs;
@@ -170,6 +199,45 @@ typedef struct Expr
   struct Expr *next;
 } Expr;
 
+/* Visits an expression over a stack of its own rather than by recursion,
+ * so a pass costs no native stack however deep the expression is. Every
+ * node is returned once entering it, before its operands, and once
+ * leaving it, after them. Operands come in source order: lhs, rhs and
+ * addend, vector elements, then record member values. A node may be
+ * rewritten when it is left, and a record's members when it is entered. */
+typedef struct
+{
+  Expr *expr;
+  /* Operands handed out so far, and the last of them. */
+  size_t index;
+  Expr *operand;
+  RecordExprMember *member;
+} ExprVisit;
+
+#define EXPR_WALK_INLINE 32
+
+typedef struct
+{
+  BSLAlloc *alloc;
+  ExprVisit inline_stack[EXPR_WALK_INLINE];
+  ExprVisit *stack;
+  size_t depth, cap;
+  bool started, leaving, skip;
+} ExprWalk;
+
+void expr_walk_init(ExprWalk *walk, BSLAlloc *alloc, Expr *root);
+/* The next node, with leaving set the second time it comes; NULL once the
+ * root was left. */
+Expr *expr_walk_next(ExprWalk *walk, bool *leaving);
+/* Leaves the operands of the node just entered unvisited. */
+void expr_walk_skip(ExprWalk *walk);
+/* The visit of the node the last one returned is an operand of, NULL for
+ * the root. Its index counts that operand in and its member holds it when
+ * the parent is a record. */
+const ExprVisit *expr_walk_parent(const ExprWalk *walk);
+/* Needed only when a walk stops before it is done. */
+void expr_walk_release(ExprWalk *walk);
+
 typedef enum
 {
   STATEMENT_VAR,
@@ -180,6 +248,9 @@ typedef struct Statement
 {
   StatementType t;
   int line, col;
+  /* Parsing it failed; a variable it names is declared, poisoned, and
+   * nothing else of it is resolved. */
+  bool broken;
   union {
     struct
     {
@@ -213,12 +284,19 @@ typedef struct Toplevel
 {
   ToplevelType t;
   int line, col;
+  bool resolved;
+  bool live;
+  /* Parsing it failed; its name is declared, poisoned, and nothing else
+   * of it is resolved. */
+  bool broken;
   union {
     struct
     {
       const uint8_t *name;
       size_t name_len;
       RecordEntry *entries;
+      size_t entry_count;
+      NameTable index;
       VarEntry *entry;
     } record;
     struct
@@ -236,14 +314,51 @@ typedef struct Toplevel
   struct Toplevel *next;
 } Toplevel;
 
+typedef struct Import
+{
+  int line, col;
+  const uint8_t *name;
+  size_t name_len;
+  BSLModule *module;
+  struct Import *next;
+} Import;
+
+typedef struct Constant
+{
+  int line, col;
+  const uint8_t *name;
+  size_t name_len;
+  Type *type;
+  Expr *value;
+  struct Constant *next;
+} Constant;
+
+/* Which counter an allocation of type goes to with BSL_STATS. */
+#define AST_NODE_KIND(type) _Generic((type *) NULL, \
+    Toplevel *: BSL_NODE_TOPLEVEL, \
+    RecordEntry *: BSL_NODE_RECORD_ENTRY, \
+    Type *: BSL_NODE_TYPE, \
+    Parameter *: BSL_NODE_PARAMETER, \
+    Statement *: BSL_NODE_STATEMENT, \
+    Expr *: BSL_NODE_EXPR, \
+    RecordExprMember *: BSL_NODE_MEMBER, \
+    VarEntry *: BSL_NODE_VAR_ENTRY, \
+    default: BSL_NODE_OTHER)
 
 typedef struct
 {
   Toplevel *toplevels;
+  Import *imports;
+  Constant *constants;
   Scope scope;
   Scope type_scope;
+  const char **entry_points;
+  size_t entry_point_count;
   BSLAlloc *alloc;
   BSLCompileResult *result;
+  BSLTrace *trace;
+  /* Only set while a compile runs. */
+  Limits *limits;
 } AST;
 
 #endif
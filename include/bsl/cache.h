@@ -0,0 +1,26 @@
+#ifndef BSL_CACHE_H
+#define BSL_CACHE_H
+
+#include <bsl.h>
+#include <bsl/sha256.h>
+
+#define CACHE_PATH_MAX 4096
+
+bool cache_key(BSLCompileInfo *info, uint8_t key[SHA256_DIGEST_LEN]);
+bool cache_load(BSLCompileInfo *info, const uint8_t key[SHA256_DIGEST_LEN],
+    bool *ok, BSLCompileResult *result);
+void cache_store(BSLCompileInfo *info, const uint8_t key[SHA256_DIGEST_LEN],
+    bool ok, BSLCompileResult *result);
+/* Entries and import summaries are named by the hex digits of their key,
+ * which must fit CACHE_PATH_MAX. */
+bool cache_path(BSLCompileInfo *info, const uint8_t key[SHA256_DIGEST_LEN],
+    char *path);
+/* Creates a file to write into before it is committed, unique to the call,
+ * and returns it open for writing, or -1. */
+int cache_temp(BSLCompileInfo *info, char *tmp_path);
+/* Renames a finished file into the cache and evicts once the directory
+ * outgrows cache_max_bytes. */
+bool cache_commit(BSLCompileInfo *info, const char *tmp_path,
+    const char *path);
+
+#endif
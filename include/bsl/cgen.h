@@ -0,0 +1,8 @@
+#ifndef BSL_CGEN_H
+#define BSL_CGEN_H
+
+#include <bsl/ast.h>
+
+bool generate_c(AST *ast, const char **output, size_t *output_len);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef BSL_DCE_H
+#define BSL_DCE_H
+
+#include <bsl/ast.h>
+
+void eliminate_dead_code(AST *ast);
+
+#endif
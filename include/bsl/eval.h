@@ -0,0 +1,45 @@
+#ifndef BSL_EVAL_H
+#define BSL_EVAL_H
+
+#include <bsl/ast.h>
+
+#ifndef BSL_EVAL_LANES
+#define BSL_EVAL_LANES 8
+#endif
+
+#if BSL_EVAL_LANES % 8 != 0
+#error "BSL_EVAL_LANES must be a multiple of 8"
+#endif
+
+/* One value per lane for each of up to four components. Scalars only use
+ * the first component, records use one register per entry. */
+typedef struct
+{
+  float c[4][BSL_EVAL_LANES];
+} EvalReg;
+
+/* Frame slots are indexed by VarEntry index, the proc stays untouched.
+ * Every statement's expression is laid out in postorder, one after the
+ * other, so runs need neither recursion nor a walk of their own; the
+ * values of pending operands go on a stack kept at the end of scratch. */
+typedef struct
+{
+  Toplevel *proc;
+  BSLAlloc *alloc;
+  size_t *slots;
+  size_t slot_count;
+  Expr **order;
+  size_t order_count, order_cap;
+  size_t frame_size;
+  size_t scratch_size;
+  size_t stack_offset;
+} EvalProc;
+
+Toplevel *eval_find_entry_point(AST *ast, const char *name, 
+    ProcedureEntryPoint stage, BSLCompileResult *result);
+bool eval_prepare(Toplevel *proc, BSLAlloc *alloc, EvalProc *eval,
+    BSLCompileResult *result);
+EvalReg *eval_run(EvalProc *eval, EvalReg *frame, EvalReg *scratch);
+void eval_release(EvalProc *eval);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef BSL_HASH_H
+#define BSL_HASH_H
+
+#include <bsl/ast.h>
+#include <bsl/sha256.h>
+
+void hash_entry_points(AST *ast);
+void hash_module(AST *ast, uint8_t digest[SHA256_DIGEST_LEN]);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef BSL_IMPORT_H
+#define BSL_IMPORT_H
+
+#include <bsl/ast.h>
+#include <bsl/sha256.h>
+
+bool import_key(BSLCompileInfo *info, uint8_t key[SHA256_DIGEST_LEN]);
+bool load_imports(AST *ast, BSLCompileInfo *info);
+void unload_imports(Import *import);
+
+#endif
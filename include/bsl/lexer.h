@@ -18,6 +18,8 @@ typedef enum
   TOKEN_KW_VAR,
   TOKEN_KW_RETURN,
   TOKEN_KW_END,
+  TOKEN_KW_IMPORT,
+  TOKEN_KW_CONST,
 
   TOKEN_COMMA,
   TOKEN_PERIOD,
@@ -72,6 +74,12 @@ typedef struct
   Token peek;
   int line, col;
   size_t cur, start;
+  BSLCompileStats *stats;
+  /* Estimated time spent scanning, kept when stats are, and the cost of
+   * the clock reads taken out of it. */
+  uint64_t lex_ns, clock_ns;
+  /* Past max_tokens, when non-zero, every token is an error. */
+  size_t tokens, max_tokens;
 } Lexer;
 
 bool lexer_init(Lexer *lexer, const uint8_t *src, size_t src_len, 
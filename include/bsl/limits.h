@@ -0,0 +1,38 @@
+#ifndef BSL_LIMITS_H
+#define BSL_LIMITS_H
+
+#include <bsl/util.h>
+
+/* Polls only read the clock this often. */
+#define LIMITS_CLOCK_POLLS 256
+
+/* One compile's view of the limits in BSLCompileInfo. While a byte limit
+ * is set, bytes are counted between the compile and internal_fn like
+ * stats are. No allocation can fail, so a compile stops where it next
+ * checks. */
+typedef struct
+{
+  BSLAlloc inner;
+  size_t max_depth;
+  size_t max_bytes;
+  size_t bytes;
+  uint64_t deadline;
+  unsigned polls;
+} Limits;
+
+void limits_init(Limits *limits, BSLAlloc *alloc, BSLCompileInfo *info);
+void limits_unwrap(BSLAlloc *alloc);
+
+/* Everything below passes on a NULL limits. A failed check reports the
+ * limit at line and col and marks the result. */
+bool limits_check(Limits *limits, BSLCompileResult *result, int line,
+    int col);
+/* As limits_check, but cheap enough to call per node. */
+bool limits_poll(Limits *limits, BSLCompileResult *result, int line,
+    int col);
+bool limits_check_depth(Limits *limits, size_t depth,
+    BSLCompileResult *result, int line, int col);
+/* What is left for a nested compile, zero when unbounded. */
+uint64_t limits_time_left(Limits *limits);
+
+#endif
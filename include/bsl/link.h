@@ -0,0 +1,8 @@
+#ifndef BSL_LINK_H
+#define BSL_LINK_H
+
+#include <bsl/ast.h>
+
+bool link_stages(AST *ast);
+
+#endif
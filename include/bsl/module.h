@@ -0,0 +1,18 @@
+#ifndef BSL_MODULE_H
+#define BSL_MODULE_H
+
+#include <bsl.h>
+#include <bsl/ast.h>
+
+struct BSLModule
+{
+  BSLAlloc alloc;
+  AST ast;
+  /* Set for modules opened from an archive, which the AST points into.
+   * The image is either mapped from a file or allocated. */
+  void *mapping;
+  size_t mapping_size;
+  bool mapped;
+};
+
+#endif
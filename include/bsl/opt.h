@@ -0,0 +1,9 @@
+#ifndef BSL_OPT_H
+#define BSL_OPT_H
+
+#include <bsl/ast.h>
+
+void vectorize_slp(AST *ast);
+void contract_fma(AST *ast);
+
+#endif
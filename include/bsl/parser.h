@@ -5,6 +5,26 @@
 #include <bsl/lexer.h>
 #include <bsl/util.h>
 
+typedef enum
+{
+  PENDING_BINOP,
+  PENDING_PAREN,
+  PENDING_VECTOR,
+  PENDING_RECORD,
+} PendingType;
+
+/* An operator waiting for its right operand, or a construct still open
+ * around the expression being parsed. */
+typedef struct
+{
+  PendingType t;
+  Binop op;
+  int precedence;
+  Expr *expr;
+  Expr *last;
+  RecordExprMember *member;
+} Pending;
+
 typedef struct
 {
   Lexer *lex;
@@ -12,9 +32,25 @@ typedef struct
   BSLAlloc *alloc;
   ProcedureEntryPoint next_entry_point;
   AST *ast;
+  size_t depth;
+  /* Expressions are parsed on these instead of the native stack. */
+  Expr **operands;
+  size_t operand_count, operand_cap;
+  Pending *pending;
+  size_t pending_count, pending_cap;
+  /* Record expressions a failed expression left open, whose 'end's
+   * recovery skips. */
+  size_t open_records;
+  /* The toplevel or constant being parsed, once it has a name, which is
+   * still declared when the rest of it fails. */
+  Toplevel *named;
+  Constant *named_constant;
+  /* Likewise the statement being parsed, once it is known to be one. */
+  Statement *named_statement;
 } Parser;
 
 bool parser_init(Parser *parser, Lexer *lex, BSLAlloc *alloc, BSLCompileResult *result);
+void parser_free(Parser *parser);
 
 Toplevel *parse_toplevel(Parser *parser);
 Type *parse_type(Parser *parser);
@@ -4,5 +4,6 @@
 #include <bsl/ast.h>
 
 bool resolve_names(AST *ast);
+void number_record_entries(Toplevel *record);
 
 #endif
@@ -0,0 +1,9 @@
+#ifndef BSL_SERIALIZE_H
+#define BSL_SERIALIZE_H
+
+#include <bsl/module.h>
+
+void archive_module(BSLModule *module, uint8_t **data, size_t *size);
+BSLModule *copy_archive(const uint8_t *data, size_t size, BSLAlloc *alloc);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef BSL_SHA256_H
+#define BSL_SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_LEN 32
+
+typedef struct
+{
+  uint32_t h[8];
+  uint64_t len;
+  uint8_t block[64];
+  size_t block_len;
+} Sha256;
+
+void sha256_init(Sha256 *sha);
+void sha256_update(Sha256 *sha, const void *data, size_t len);
+void sha256_final(Sha256 *sha, uint8_t digest[SHA256_DIGEST_LEN]);
+
+#endif
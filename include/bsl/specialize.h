@@ -0,0 +1,9 @@
+#ifndef BSL_SPECIALIZE_H
+#define BSL_SPECIALIZE_H
+
+#include <bsl/ast.h>
+
+bool specialize_constants(AST *ast, const BSLConstant *constants,
+    size_t constant_count, bool fast_math);
+
+#endif
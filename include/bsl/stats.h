@@ -0,0 +1,65 @@
+#ifndef BSL_STATS_H
+#define BSL_STATS_H
+
+#include <bsl/util.h>
+
+/* Counting sits between the compile and internal_fn for the duration of a
+ * compile. With BSL_STATS undefined everything here compiles away. */
+typedef struct
+{
+  BSLAlloc inner;
+  BSLCompileStats *stats;
+} StatsAlloc;
+
+#ifdef BSL_STATS
+
+void stats_wrap(StatsAlloc *wrap, BSLAlloc *alloc, BSLCompileStats *stats);
+void stats_unwrap(BSLAlloc *alloc);
+BSLCompileStats *stats_of(BSLAlloc *alloc);
+
+#define STATS_ADD(_stats, _field, _n) \
+  do \
+  { \
+    BSLCompileStats *_stats_ptr = (_stats); \
+    if (_stats_ptr != NULL) \
+    { \
+      _stats_ptr->_field += (_n); \
+    } \
+  } while (0)
+#define STATS_BEGIN(_name) uint64_t _name = now_ns()
+#define STATS_END(_stats, _phase, _name) \
+  STATS_ADD(_stats, phase_ns[_phase], now_ns() - (_name))
+/* Ends a phase that drove another, whose estimated time _inner_ns moves to
+ * _inner, up to all of the phase's. */
+#define STATS_END_SPLIT(_stats, _phase, _name, _inner, _inner_ns) \
+  do \
+  { \
+    uint64_t _total_ns = now_ns() - (_name); \
+    uint64_t _part_ns = (_inner_ns) < _total_ns ? (_inner_ns) : _total_ns; \
+    STATS_ADD(_stats, phase_ns[_inner], _part_ns); \
+    STATS_ADD(_stats, phase_ns[_phase], _total_ns - _part_ns); \
+  } while (0)
+
+#else
+
+static inline void stats_wrap(StatsAlloc *wrap, BSLAlloc *alloc,
+    BSLCompileStats *stats)
+{
+  (void) wrap;
+  (void) alloc;
+  (void) stats;
+}
+
+static inline void stats_unwrap(BSLAlloc *alloc)
+{
+  (void) alloc;
+}
+
+#define STATS_ADD(_stats, _field, _n) ((void) 0)
+#define STATS_BEGIN(_name) ((void) 0)
+#define STATS_END(_stats, _phase, _name) ((void) 0)
+#define STATS_END_SPLIT(_stats, _phase, _name, _inner, _inner_ns) ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef BSL_TRACE_H
+#define BSL_TRACE_H
+
+#include <bsl/ast.h>
+
+/* Everything here does nothing on a NULL trace, so compiles call it
+ * unconditionally. */
+void trace_begin(BSLTrace *trace, const char *cat, const char *name,
+    size_t name_len);
+void trace_phase(BSLTrace *trace, BSLPhase phase);
+/* Names are only known once a toplevel is parsed, so its begin event is
+ * recorded afterwards, back at start. */
+void trace_toplevel(BSLTrace *trace, Toplevel *toplevel, uint64_t start);
+void trace_end(BSLTrace *trace);
+
+#endif
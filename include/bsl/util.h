@@ -26,11 +26,76 @@ typedef struct
   };
 } Number;
 
+/* Open addressing over names, for scopes and records that outgrow a
+ * linear search. */
+typedef struct
+{
+  const uint8_t *name;
+  size_t name_len;
+  void *value;
+} NameSlot;
+
+typedef struct
+{
+  NameSlot *slots;
+  size_t cap, count;
+} NameTable;
+
+#define NAME_TABLE_MIN 8
+
+/* FNV-1a, which pack files store, so it must not change. */
+uint64_t hash_name(const uint8_t *name, size_t name_len);
+
+void *name_table_find(const NameTable *table, const uint8_t *name,
+    size_t name_len);
+void name_table_add(NameTable *table, BSLAlloc *alloc, const uint8_t *name,
+    size_t name_len, void *value);
+
+#ifdef BSL_STATS
+void *stats_new(BSLAlloc *alloc, size_t size, BSLNodeKind kind);
+#define BSL_NEW(alloc, type) \
+  stats_new((alloc), sizeof(type), AST_NODE_KIND(type))
+#else
 #define BSL_NEW(alloc, type) ((alloc)->fn(NULL, 0, sizeof(type), (alloc)->ud))
+#endif
+
+/* Remembers every block allocated through it that is still live, so
+ * memory nothing else keeps track of, like the nodes of a module, can be
+ * released at once. Blocks are plain blocks of the inner allocator. */
+typedef struct
+{
+  const void *ptr;
+  size_t size;
+} TrackSlot;
+
+typedef struct
+{
+  BSLAlloc inner;
+  TrackSlot *slots;
+  size_t cap, count;
+} TrackAlloc;
+
+void track_wrap(TrackAlloc *track, BSLAlloc *alloc);
+/* Leaves ptr to whoever took it over, so releasing will not free it. */
+void track_forget(TrackAlloc *track, const void *ptr);
+void track_release(TrackAlloc *track);
+
+/* Monotonic, in nanoseconds. */
+uint64_t now_ns(void);
+
+/* Whether the CPU running this has fused multiply-add instructions and the
+ * OS keeps their registers. */
+bool cpu_has_fma(void);
 
 void result_error(BSLCompileResult *result, int line, int col,
     const char *msg, ...);
-void vresult_error(BSLCompileResult *result, int line, int col, 
-    const char *msg, va_list args);
+void result_error_code(BSLCompileResult *result, BSLErrorCode code, int line,
+    int col, const char *msg, ...);
+void vresult_error(BSLCompileResult *result, BSLErrorCode code, int line,
+    int col, const char *msg, va_list args);
+/* An error stays pending, with a code other than BSL_ERROR_NONE, until
+ * this moves it to the diagnostics. Failures that leave nothing pending
+ * were already reported. */
+void result_report(BSLCompileResult *result, BSLAlloc *alloc);
 
 #endif
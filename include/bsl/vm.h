@@ -0,0 +1,51 @@
+#ifndef BSL_VM_H
+#define BSL_VM_H
+
+#include <bsl.h>
+#include <bsl/ast.h>
+#include <bsl/util.h>
+
+#define VM_MAX_REGS 256
+
+/* Every register holds four floats, scalars live in the first one. */
+typedef enum
+{
+  OP_CONST,   /* dst = splat(consts[a | b << 8]) */
+  OP_MOV,     /* dst = a */
+  OP_INSERT,  /* dst[(b & 3)..] = a[0..(b >> 2)] */
+  OP_LOAD,    /* dst = inputs[a][b] */
+  OP_STORE,   /* output[dst] = a */
+  OP_ADD,     /* dst = a + b */
+  OP_SUB,     /* dst = a - b */
+  OP_MUL,     /* dst = a * b */
+  OP_DIV,     /* dst = a / b */
+  OP_MULS,    /* dst = a * b.x */
+  OP_DIVS,    /* dst = a / b.x */
+  OP_SDIV,    /* dst = a.x / b */
+  OP_FMA,     /* dst = a * b + dst */
+  OP_FMAS,    /* dst = a * b.x + dst */
+  OP_RET,
+  OP_COUNT,
+} Opcode;
+
+typedef struct
+{
+  uint8_t op;
+  uint8_t dst;
+  uint8_t a;
+  uint8_t b;
+} Instr;
+
+struct BSLProgram
+{
+  BSLAlloc *alloc;
+  Instr *code;
+  size_t code_len, code_cap;
+  float *consts;
+  size_t const_count, const_cap;
+  size_t reg_count;
+  size_t param_count;
+  size_t output_size;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include <string.h>
+
+#include <bsl/ast.h>
+
+/* === PROTOTYPES === */
+
+static Expr *next_operand(ExprVisit *visit);
+
+/* === PUBLIC FUNCTIONS === */
+
+void expr_walk_init(ExprWalk *walk, BSLAlloc *alloc, Expr *root)
+{
+  walk->alloc = alloc;
+  walk->stack = walk->inline_stack;
+  walk->cap = EXPR_WALK_INLINE;
+  walk->depth = 1;
+  walk->started = false;
+  walk->leaving = false;
+  walk->skip = false;
+  memset(&walk->stack[0], 0, sizeof(ExprVisit));
+  walk->stack[0].expr = root;
+}
+
+Expr *expr_walk_next(ExprWalk *walk, bool *leaving)
+{
+  if (walk->depth == 0)
+  {
+    expr_walk_release(walk);
+    return NULL;
+  }
+
+  ExprVisit *top = &walk->stack[walk->depth - 1];
+  if (!walk->started)
+  {
+    walk->started = true;
+    *leaving = walk->leaving = false;
+    return top->expr;
+  }
+
+  Expr *operand = walk->skip ? NULL : next_operand(top);
+  walk->skip = false;
+  if (operand == NULL)
+  {
+    walk->depth--;
+    *leaving = walk->leaving = true;
+    return top->expr;
+  }
+
+  if (walk->depth == walk->cap)
+  {
+    ExprVisit *grown = walk->alloc->fn(NULL, 0,
+        walk->cap * 2 * sizeof(ExprVisit), walk->alloc->ud);
+    memcpy(grown, walk->stack, walk->depth * sizeof(ExprVisit));
+    if (walk->stack != walk->inline_stack)
+    {
+      walk->alloc->fn(walk->stack, walk->cap * sizeof(ExprVisit), 0,
+          walk->alloc->ud);
+    }
+    walk->stack = grown;
+    walk->cap *= 2;
+  }
+  ExprVisit *visit = &walk->stack[walk->depth++];
+  memset(visit, 0, sizeof(ExprVisit));
+  visit->expr = operand;
+  *leaving = walk->leaving = false;
+  return operand;
+}
+
+void expr_walk_skip(ExprWalk *walk)
+{
+  walk->skip = true;
+}
+
+const ExprVisit *expr_walk_parent(const ExprWalk *walk)
+{
+  /* A node that was left is off the stack already. */
+  size_t depth = walk->leaving ? walk->depth : walk->depth - 1;
+  return depth == 0 ? NULL : &walk->stack[depth - 1];
+}
+
+void expr_walk_release(ExprWalk *walk)
+{
+  if (walk->stack != walk->inline_stack)
+  {
+    walk->alloc->fn(walk->stack, walk->cap * sizeof(ExprVisit), 0,
+        walk->alloc->ud);
+    walk->stack = walk->inline_stack;
+    walk->cap = EXPR_WALK_INLINE;
+  }
+  walk->depth = 0;
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static Expr *next_operand(ExprVisit *visit)
+{
+  Expr *expr = visit->expr;
+  Expr *operand = NULL;
+  switch (expr->t)
+  {
+    case EXPR_BINARY:
+      operand = visit->index == 0 ? expr->binary.lhs :
+        visit->index == 1 ? expr->binary.rhs : NULL;
+      break;
+    case EXPR_FMA:
+      operand = visit->index == 0 ? expr->fma.lhs :
+        visit->index == 1 ? expr->fma.rhs :
+        visit->index == 2 ? expr->fma.addend : NULL;
+      break;
+    case EXPR_MEMBER:
+      operand = visit->index == 0 ? expr->member.lhs : NULL;
+      break;
+    case EXPR_VECTOR:
+      operand = visit->index == 0 ? expr->vec.exprs : visit->operand->next;
+      break;
+    case EXPR_RECORD:
+      visit->member = visit->index == 0 ? expr->record.members :
+        visit->member->next;
+      operand = visit->member != NULL ? visit->member->expr : NULL;
+      break;
+    default:
+      break;
+  }
+
+  if (operand != NULL)
+  {
+    visit->index++;
+    visit->operand = operand;
+  }
+  return operand;
+}
@@ -1,38 +1,617 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <bsl.h>
 
+#include <bsl/module.h>
 #include <bsl/lexer.h>
 #include <bsl/parser.h>
 #include <bsl/resolve.h>
+#include <bsl/dce.h>
+#include <bsl/link.h>
+#include <bsl/opt.h>
+#include <bsl/cgen.h>
+#include <bsl/cache.h>
+#include <bsl/hash.h>
+#include <bsl/import.h>
+#include <bsl/serialize.h>
+#include <bsl/specialize.h>
+#include <bsl/stats.h>
+#include <bsl/trace.h>
+#include <bsl/limits.h>
+
+/* A diagnostic's place in the source, with where it was reported breaking
+ * ties. */
+typedef struct
+{
+  int line, col;
+  size_t index;
+} DiagnosticSort;
+
+static bool compile(BSLCompileInfo *compile_info, BSLCompileResult *result);
+static void reset_result(BSLCompileResult *result);
+static void finish_errors(BSLCompileInfo *compile_info,
+    BSLCompileResult *result);
+static void sort_diagnostics(BSLAlloc *alloc, BSLCompileResult *result);
+static int compare_diagnostics(const void *a, const void *b);
+static BSLModule *parse_module(BSLCompileInfo *compile_info, BSLAlloc *alloc,
+    Limits *limits, BSLCompileResult *result);
+static bool lower_module(BSLModule *module, BSLCompileInfo *compile_info,
+    const BSLConstant *constants, size_t constant_count);
+static bool finish_module(BSLModule *module, BSLCompileInfo *compile_info);
+static void free_variant(BSLAlloc *alloc, BSLVariant *variant);
 
 bool bsl_compile(BSLCompileInfo *compile_info, BSLCompileResult *result)
 {
-  Lexer lexer; 
-  Parser parser;
-  AST ast;
+  BSLCompileStats *stats = compile_info->stats;
+  if (stats != NULL)
+  {
+    memset(stats, 0, sizeof(*stats));
+  }
+  STATS_BEGIN(start);
+  trace_begin(compile_info->trace, "compile", "compile", 7);
+
+  /* Only backend output can be replayed, a module cannot. */
+  bool cached = compile_info->cache_dir != NULL && 
+    compile_info->backend != BSL_BACKEND_NONE;
+  uint8_t key[SHA256_DIGEST_LEN];
+  bool ok;
+
+  result->cache_hit = false;
+  result->limit_exceeded = false;
+  STATS_BEGIN(cache_start);
+  trace_phase(compile_info->trace, BSL_PHASE_CACHE);
+  cached = cached && cache_key(compile_info, key);
+  bool hit = cached && cache_load(compile_info, key, &ok, result);
+  trace_end(compile_info->trace);
+  STATS_END(stats, BSL_PHASE_CACHE, cache_start);
+  if (hit)
+  {
+    result->module = NULL;
+    result->cache_hit = true;
+  } else
+  {
+    ok = compile(compile_info, result);
+    /* Running out of a limit says nothing about the source. */
+    if (cached && !result->limit_exceeded)
+    {
+      STATS_BEGIN(store_start);
+      trace_phase(compile_info->trace, BSL_PHASE_CACHE);
+      cache_store(compile_info, key, ok, result);
+      trace_end(compile_info->trace);
+      STATS_END(stats, BSL_PHASE_CACHE, store_start);
+    }
+  }
+
+  trace_end(compile_info->trace);
+  STATS_ADD(stats, total_ns, now_ns() - start);
+  return ok;
+}
+
+bool bsl_compile_variants(BSLCompileInfo *compile_info,
+    const BSLVariantInfo *variant_infos, BSLVariant *variants,
+    size_t variant_count, BSLCompileResult *result)
+{
+  BSLCompileStats *stats = compile_info->stats;
+  if (stats != NULL)
+  {
+    memset(stats, 0, sizeof(*stats));
+  }
+  STATS_BEGIN(start);
+
+  BSLAlloc counted_alloc = {
+    .ud = compile_info->internal_ud,
+    .fn = compile_info->internal_fn,
+  };
+  Limits limits;
+  limits_init(&limits, &counted_alloc, compile_info);
+  StatsAlloc counted;
+  stats_wrap(&counted, &counted_alloc, stats);
+  trace_begin(compile_info->trace, "compile", "compile", 7);
+
+  /* Nothing owns the nodes of the base module and its imports, so what
+   * their parse allocates is tracked and released together once the
+   * variants are made. Diagnostics go back to the caller. */
+  BSLAlloc base_alloc = counted_alloc;
+  TrackAlloc base_track;
+  track_wrap(&base_track, &base_alloc);
+  BSLAlloc import_alloc = {
+    .ud = compile_info->internal_ud,
+    .fn = compile_info->internal_fn,
+  };
+  TrackAlloc import_track;
+  track_wrap(&import_track, &import_alloc);
+  BSLCompileInfo base_info = *compile_info;
+  base_info.internal_fn = import_alloc.fn;
+  base_info.internal_ud = import_alloc.ud;
+
+  reset_result(result);
+  BSLModule *base = parse_module(&base_info, &base_alloc, &limits, result);
+  track_forget(&base_track, result->diagnostics);
+  if (base == NULL)
+  {
+    track_release(&import_track);
+    track_release(&base_track);
+    finish_errors(compile_info, result);
+    trace_end(compile_info->trace);
+    return false;
+  }
+
+  /* Every variant specializes its own copy of the resolved module, made
+   * from an in-memory archive instead of another parse. */
+  uint8_t *archive;
+  size_t archive_size;
+  archive_module(base, &archive, &archive_size);
+  track_forget(&base_track, archive);
+
+  BSLAlloc *alloc = &counted_alloc;
+  size_t digests_size = variant_count * SHA256_DIGEST_LEN;
+  uint8_t *digests = alloc->fn(NULL, 0, digests_size, alloc->ud);
+
+  bool ok = true;
+  size_t made = 0;
+  for (size_t i = 0; ok && i < variant_count; i++)
+  {
+    BSLCompileResult variant_result;
+    reset_result(&variant_result);
+    BSLModule *module = copy_archive(archive, archive_size, alloc);
+    if (module == NULL)
+    {
+      result_error(result, 0, 0, "could not copy module for variant %zu", i);
+      ok = false;
+      break;
+    }
+    /* Only code generation reads the imports, before they are released. */
+    module->ast.imports = base->ast.imports;
+    module->ast.entry_points = base->ast.entry_points;
+    module->ast.entry_point_count = base->ast.entry_point_count;
+    module->ast.result = &variant_result;
+    module->ast.trace = base->ast.trace;
+    module->ast.limits = base->ast.limits;
+
+    char label[32];
+    int label_len = snprintf(label, sizeof(label), "variant %zu", i);
+    trace_begin(compile_info->trace, "variant", label, (size_t) label_len);
+
+    uint8_t *digest = digests + i * SHA256_DIGEST_LEN;
+    ok = lower_module(module, compile_info, variant_infos[i].constants,
+        variant_infos[i].constant_count);
+    if (ok)
+    {
+      hash_module(&module->ast, digest);
+      variants[i].same_as = i;
+      for (size_t j = 0; j < i; j++)
+      {
+        if (variants[j].same_as == j &&
+            memcmp(digests + j * SHA256_DIGEST_LEN, digest,
+              SHA256_DIGEST_LEN) == 0)
+        {
+          variants[i] = variants[j];
+          break;
+        }
+      }
+
+      if (variants[i].same_as != i)
+      {
+        bsl_module_unload(module);
+        trace_end(compile_info->trace);
+        made++;
+        continue;
+      }
+      ok = finish_module(module, compile_info);
+    }
+    trace_end(compile_info->trace);
+
+    module->ast.imports = NULL;
+    module->ast.result = NULL;
+
+    if (!ok)
+    {
+      BSLVariant failed = {
+        .module = module,
+        .output = variant_result.output,
+        .output_len = variant_result.output_len,
+        .entry_hashes = variant_result.entry_hashes,
+        .entry_hash_count = variant_result.entry_hash_count,
+        .varyings = variant_result.varyings,
+        .varying_count = variant_result.varying_count,
+      };
+      free_variant(alloc, &failed);
+      result_report(&variant_result, alloc);
+      for (size_t j = 0; j < variant_result.diagnostic_count; j++)
+      {
+        BSLDiagnostic *diagnostic = &variant_result.diagnostics[j];
+        result_error_code(result, diagnostic->code, diagnostic->line,
+            diagnostic->col, "in variant %zu: %s", i, diagnostic->msg);
+        result_report(result, alloc);
+      }
+      alloc->fn(variant_result.diagnostics,
+          variant_result.diagnostic_count * sizeof(BSLDiagnostic), 0,
+          alloc->ud);
+      result->limit_exceeded = variant_result.limit_exceeded;
+      break;
+    }
+
+    variants[i].module = module;
+    variants[i].output = variant_result.output;
+    variants[i].output_len = variant_result.output_len;
+    variants[i].entry_hashes = variant_result.entry_hashes;
+    variants[i].entry_hash_count = variant_result.entry_hash_count;
+    variants[i].varyings = variant_result.varyings;
+    variants[i].varying_count = variant_result.varying_count;
+    made++;
+  }
+
+  alloc->fn(digests, digests_size, 0, alloc->ud);
+  alloc->fn(archive, archive_size, 0, alloc->ud);
+
+  /* A failed compile leaves the caller nothing to free. Otherwise the
+   * modules outlive the counters. */
+  for (size_t i = 0; i < made; i++)
+  {
+    if (variants[i].same_as != i)
+    {
+      continue;
+    }
+
+    if (ok)
+    {
+      stats_unwrap(&variants[i].module->alloc);
+      limits_unwrap(&variants[i].module->alloc);
+      variants[i].module->ast.limits = NULL;
+    } else
+    {
+      free_variant(alloc, &variants[i]);
+    }
+  }
+  if (!ok)
+  {
+    memset(variants, 0, variant_count * sizeof(BSLVariant));
+  }
+
+  unload_imports(base->ast.imports);
+  track_release(&import_track);
+  track_release(&base_track);
+  if (!ok)
+  {
+    finish_errors(compile_info, result);
+  }
+  trace_end(compile_info->trace);
+  STATS_ADD(stats, total_ns, now_ns() - start);
+  return ok;
+}
+
+/* Frees what a variant holds, the way a caller would. */
+static void free_variant(BSLAlloc *alloc, BSLVariant *variant)
+{
+  if (variant->output != NULL)
+  {
+    alloc->fn((char *) variant->output, variant->output_len + 1, 0,
+        alloc->ud);
+  }
+  for (size_t i = 0; i < variant->entry_hash_count; i++)
+  {
+    BSLEntryPointHash *hash = &variant->entry_hashes[i];
+    alloc->fn((char *) hash->name, strlen(hash->name) + 1, 0, alloc->ud);
+    if (hash->varyings != NULL)
+    {
+      alloc->fn(hash->varyings, (hash->input_count + hash->output_count) *
+          sizeof(BSLInterfaceVarying), 0, alloc->ud);
+    }
+  }
+  if (variant->entry_hash_count > 0)
+  {
+    alloc->fn(variant->entry_hashes,
+        variant->entry_hash_count * sizeof(BSLEntryPointHash), 0, alloc->ud);
+  }
+  if (variant->varying_count > 0)
+  {
+    alloc->fn(variant->varyings,
+        variant->varying_count * sizeof(BSLVaryingLocation), 0, alloc->ud);
+  }
+  bsl_module_unload(variant->module);
+}
+
+static void reset_result(BSLCompileResult *result)
+{
+  result->module = NULL;
+  result->removed_vars = 0;
+  result->removed_toplevels = 0;
+  result->removed_varyings = 0;
+  result->varyings = NULL;
+  result->varying_count = 0;
+  result->output = NULL;
+  result->output_len = 0;
+  result->entry_hashes = NULL;
+  result->entry_hash_count = 0;
+  result->limit_exceeded = false;
+  result->code = BSL_ERROR_NONE;
+  result->diagnostics = NULL;
+  result->diagnostic_count = 0;
+}
+
+/* Reports what stopped the compile, if not reported already, and puts the
+ * first error in the source in the result's own fields. */
+static void finish_errors(BSLCompileInfo *compile_info,
+    BSLCompileResult *result)
+{
   BSLAlloc alloc = {
     .ud = compile_info->internal_ud,
     .fn = compile_info->internal_fn,
   };
+  result_report(result, &alloc);
+  sort_diagnostics(&alloc, result);
+  if (result->diagnostic_count > 0)
+  {
+    BSLDiagnostic *first = &result->diagnostics[0];
+    result->line = first->line;
+    result->col = first->col;
+    result->code = first->code;
+    memcpy(result->msg, first->msg, BSL_RESULT_MAX_MESSAGE_LEN);
+  }
+}
 
-  if (!lexer_init(&lexer, compile_info->src, compile_info->src_len, result))
+/* Each phase reports in its own order, records before procedures, so the
+ * diagnostics are put back in the order of the source. Those with no
+ * position go last. */
+static void sort_diagnostics(BSLAlloc *alloc, BSLCompileResult *result)
+{
+  size_t count = result->diagnostic_count;
+  if (count < 2)
+  {
+    return;
+  }
+
+  DiagnosticSort *sorted = alloc->fn(NULL, 0, count * sizeof(DiagnosticSort),
+      alloc->ud);
+  for (size_t i = 0; i < count; i++)
+  {
+    sorted[i].line = result->diagnostics[i].line;
+    sorted[i].col = result->diagnostics[i].col;
+    sorted[i].index = i;
+  }
+  qsort(sorted, count, sizeof(DiagnosticSort), compare_diagnostics);
+
+  BSLDiagnostic *diagnostics = alloc->fn(NULL, 0,
+      count * sizeof(BSLDiagnostic), alloc->ud);
+  for (size_t i = 0; i < count; i++)
+  {
+    diagnostics[i] = result->diagnostics[sorted[i].index];
+  }
+  alloc->fn(result->diagnostics, count * sizeof(BSLDiagnostic), 0, alloc->ud);
+  alloc->fn(sorted, count * sizeof(DiagnosticSort), 0, alloc->ud);
+  result->diagnostics = diagnostics;
+}
+
+static int compare_diagnostics(const void *a, const void *b)
+{
+  const DiagnosticSort *diag1 = a, *diag2 = b;
+  if ((diag1->line == 0) != (diag2->line == 0))
+  {
+    return diag1->line == 0 ? 1 : -1;
+  }
+  if (diag1->line != diag2->line)
+  {
+    return diag1->line < diag2->line ? -1 : 1;
+  }
+  if (diag1->col != diag2->col)
+  {
+    return diag1->col < diag2->col ? -1 : 1;
+  }
+  return diag1->index < diag2->index ? -1 : 1;
+}
+
+static bool compile(BSLCompileInfo *compile_info, BSLCompileResult *result)
+{
+  BSLAlloc alloc = {
+    .ud = compile_info->internal_ud,
+    .fn = compile_info->internal_fn,
+  };
+  Limits limits;
+  limits_init(&limits, &alloc, compile_info);
+  StatsAlloc counted;
+  stats_wrap(&counted, &alloc, compile_info->stats);
+
+  reset_result(result);
+  BSLModule *module = parse_module(compile_info, &alloc, &limits, result);
+  bool ok = module != NULL && lower_module(module, compile_info, NULL, 0) &&
+    finish_module(module, compile_info);
+  if (module != NULL)
+  {
+    stats_unwrap(&module->alloc);
+    limits_unwrap(&module->alloc);
+    module->ast.limits = NULL;
+  }
+  if (!ok)
   {
+    /* What a later phase failed in is released as a failed variant is. */
+    if (module != NULL)
+    {
+      BSLVariant failed = {
+        .module = module,
+        .output = result->output,
+        .output_len = result->output_len,
+        .entry_hashes = result->entry_hashes,
+        .entry_hash_count = result->entry_hash_count,
+        .varyings = result->varyings,
+        .varying_count = result->varying_count,
+      };
+      unload_imports(module->ast.imports);
+      free_variant(&alloc, &failed);
+      result->output = NULL;
+      result->output_len = 0;
+      result->entry_hashes = NULL;
+      result->entry_hash_count = 0;
+      result->varyings = NULL;
+      result->varying_count = 0;
+    }
+    finish_errors(compile_info, result);
     return false;
   }
 
-  if (!parser_init(&parser, &lexer, &alloc, result))
+  result->module = module;
+  return true;
+}
+
+/* Everything up to name resolution, which variants share. */
+static BSLModule *parse_module(BSLCompileInfo *compile_info, BSLAlloc *alloc,
+    Limits *limits, BSLCompileResult *result)
+{
+  BSLCompileStats *stats = compile_info->stats;
+  Lexer lexer; 
+  Parser parser;
+
+  BSLModule *module = BSL_NEW(alloc, BSLModule);
+  module->alloc = *alloc;
+  module->mapping = NULL;
+  module->mapping_size = 0;
+  module->mapped = false;
+  AST *ast = &module->ast;
+
+  if (!lexer_init(&lexer, compile_info->src, compile_info->src_len, result))
+  {
+    return NULL;
+  }
+  lexer.stats = stats;
+  lexer.max_tokens = compile_info->max_tokens;
+  ast->trace = compile_info->trace;
+  ast->limits = limits;
+
+  if (!parser_init(&parser, &lexer, &module->alloc, result))
+  {
+    return NULL;
+  }
+
+  STATS_BEGIN(parse_start);
+  trace_phase(ast->trace, BSL_PHASE_PARSE);
+  bool parsed = parse_ast(&parser, ast);
+  parser_free(&parser);
+  trace_end(ast->trace);
+  STATS_END_SPLIT(stats, BSL_PHASE_PARSE, parse_start, BSL_PHASE_LEX,
+      lexer.lex_ns);
+  /* What parsed is still imported and resolved after a parse error, to
+   * report the errors in it too; only a limit stops here. */
+  if (result->limit_exceeded || !limits_check(limits, result, 0, 0))
+  {
+    return NULL;
+  }
+
+  ast->entry_points = compile_info->entry_points;
+  ast->entry_point_count = compile_info->entry_point_count;
+
+  STATS_BEGIN(import_start);
+  trace_phase(ast->trace, BSL_PHASE_IMPORT);
+  bool ok = load_imports(ast, compile_info);
+  trace_end(ast->trace);
+  STATS_END(stats, BSL_PHASE_IMPORT, import_start);
+  if (!ok || !limits_check(limits, result, 0, 0))
+  {
+    unload_imports(ast->imports);
+    return NULL;
+  }
+
+  STATS_BEGIN(resolve_start);
+  trace_phase(ast->trace, BSL_PHASE_RESOLVE);
+  ok = resolve_names(ast);
+  trace_end(ast->trace);
+  STATS_END(stats, BSL_PHASE_RESOLVE, resolve_start);
+  if (!ok || !parsed)
+  {
+    unload_imports(ast->imports);
+    return NULL;
+  }
+  return module;
+}
+
+static bool lower_module(BSLModule *module, BSLCompileInfo *compile_info,
+    const BSLConstant *constants, size_t constant_count)
+{
+  AST *ast = &module->ast;
+  STATS_BEGIN(specialize_start);
+  trace_phase(ast->trace, BSL_PHASE_SPECIALIZE);
+  bool ok = specialize_constants(ast, constants, constant_count,
+      compile_info->fast_math);
+  trace_end(ast->trace);
+  STATS_END(stats_of(ast->alloc), BSL_PHASE_SPECIALIZE, specialize_start);
+  if (!ok || !limits_check(ast->limits, ast->result, 0, 0))
   {
     return false;
   }
 
-  if (!parse_ast(&parser, &ast))
+  STATS_BEGIN(dce_start);
+  trace_phase(ast->trace, BSL_PHASE_DCE);
+  eliminate_dead_code(ast);
+  trace_end(ast->trace);
+  STATS_END(stats_of(ast->alloc), BSL_PHASE_DCE, dce_start);
+
+  if (!compile_info->link_stages)
+  {
+    return true;
+  }
+
+  STATS_BEGIN(link_start);
+  trace_phase(ast->trace, BSL_PHASE_LINK);
+  ok = link_stages(ast);
+  trace_end(ast->trace);
+  STATS_END(stats_of(ast->alloc), BSL_PHASE_LINK, link_start);
+  if (!ok || !limits_check(ast->limits, ast->result, 0, 0))
   {
     return false;
   }
 
-  if (!resolve_names(&ast))
+  if (ast->result->removed_varyings > 0)
+  {
+    STATS_BEGIN(relink_start);
+    trace_phase(ast->trace, BSL_PHASE_DCE);
+    eliminate_dead_code(ast);
+    trace_end(ast->trace);
+    STATS_END(stats_of(ast->alloc), BSL_PHASE_DCE, relink_start);
+  }
+  return true;
+}
+
+static bool finish_module(BSLModule *module, BSLCompileInfo *compile_info)
+{
+  AST *ast = &module->ast;
+  BSLCompileResult *result = ast->result;
+  if (!limits_check(ast->limits, result, 0, 0))
   {
     return false;
   }
 
+  STATS_BEGIN(hash_start);
+  trace_phase(ast->trace, BSL_PHASE_HASH);
+  hash_entry_points(ast);
+  trace_end(ast->trace);
+  STATS_END(compile_info->stats, BSL_PHASE_HASH, hash_start);
+
+  STATS_BEGIN(slp_start);
+  trace_phase(ast->trace, BSL_PHASE_SLP);
+  vectorize_slp(ast);
+  trace_end(ast->trace);
+  STATS_END(compile_info->stats, BSL_PHASE_SLP, slp_start);
+
+  if (compile_info->contract_fma)
+  {
+    STATS_BEGIN(fma_start);
+    trace_phase(ast->trace, BSL_PHASE_FMA);
+    contract_fma(ast);
+    trace_end(ast->trace);
+    STATS_END(compile_info->stats, BSL_PHASE_FMA, fma_start);
+  }
+
+  if (compile_info->backend == BSL_BACKEND_C)
+  {
+    STATS_BEGIN(codegen_start);
+    trace_phase(ast->trace, BSL_PHASE_CODEGEN);
+    bool ok = generate_c(ast, &result->output, &result->output_len);
+    trace_end(ast->trace);
+    STATS_END(compile_info->stats, BSL_PHASE_CODEGEN, codegen_start);
+    if (!ok)
+    {
+      return false;
+    }
+  }
   return true;
 }
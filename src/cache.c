@@ -0,0 +1,628 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <bsl/cache.h>
+#include <bsl/import.h>
+#include <bsl/util.h>
+
+#define CACHE_MAGIC "BSLC"
+#define CACHE_FORMAT 7
+#define CACHE_MAX_DIRS 16
+#define CACHE_MAX_ENTRY_HASHES 4096
+#define CACHE_MAX_DIAGNOSTICS 4096
+#define CACHE_MAX_VARYINGS 4096
+
+typedef struct
+{
+  char name[SHA256_DIGEST_LEN * 2 + 1];
+  off_t size;
+  struct timespec mtime;
+} CacheFile;
+
+/* What a cache directory held at its last scan, plus what this process
+ * has committed to it since. Writes by other processes show up at the
+ * next scan. */
+typedef struct
+{
+  char path[CACHE_PATH_MAX];
+  uint64_t total;
+} CacheDir;
+
+/* Everything stored after the magic, in native layout. */
+typedef struct
+{
+  uint32_t format;
+  uint8_t ok;
+  int32_t line, col;
+  int32_t code;
+  uint64_t removed_vars;
+  uint64_t removed_toplevels;
+  uint64_t removed_varyings;
+  uint64_t msg_len;
+  uint64_t output_len;
+  uint64_t entry_hash_count;
+  uint64_t diagnostic_count;
+  uint64_t varying_count;
+} CacheHeader;
+
+/* Followed by the name, then the interface varyings. */
+typedef struct
+{
+  uint32_t stage;
+  uint32_t name_len;
+  uint32_t input_count;
+  uint32_t output_count;
+  uint8_t hash[BSL_HASH_LEN];
+} CacheEntryHash;
+
+static pthread_mutex_t dirs_lock = PTHREAD_MUTEX_INITIALIZER;
+static CacheDir dirs[CACHE_MAX_DIRS];
+static size_t dir_count;
+
+/* === PROTOTYPES === */
+
+static void hash_field(Sha256 *sha, const void *data, size_t len);
+static bool entry_path(char *path, const char *dir, const char *name);
+static void key_name(char *name, const uint8_t key[SHA256_DIGEST_LEN]);
+static bool is_entry_name(const char *name);
+static int compare_mtime(const void *a, const void *b);
+static bool load_diagnostics(BSLCompileInfo *info, FILE *file, size_t count,
+    BSLCompileResult *result);
+static bool load_entry_hashes(BSLCompileInfo *info, FILE *file, size_t count,
+    BSLCompileResult *result);
+static bool load_varyings(BSLCompileInfo *info, FILE *file, size_t count,
+    BSLCompileResult *result);
+static void free_entry_hashes(BSLCompileInfo *info, BSLEntryPointHash *hashes,
+    size_t named, size_t count);
+static CacheDir *find_dir(const char *path, bool add);
+static uint64_t evict(BSLCompileInfo *info);
+
+/* === PUBLIC FUNCTIONS === */
+
+bool cache_key(BSLCompileInfo *info, uint8_t key[SHA256_DIGEST_LEN])
+{
+  Sha256 sha;
+  uint8_t imports[SHA256_DIGEST_LEN];
+  uint8_t backend = (uint8_t) info->backend;
+  uint8_t contract_fma = info->contract_fma;
+  uint8_t fast_math = info->fast_math;
+  uint8_t link_stages = info->link_stages;
+  uint64_t entry_point_count = info->entry_point_count;
+
+  sha256_init(&sha);
+  hash_field(&sha, BSL_VERSION, strlen(BSL_VERSION));
+  hash_field(&sha, &backend, 1);
+  hash_field(&sha, &contract_fma, 1);
+  hash_field(&sha, &fast_math, 1);
+  hash_field(&sha, &link_stages, 1);
+  hash_field(&sha, &entry_point_count, sizeof(entry_point_count));
+  for (size_t i = 0; i < info->entry_point_count; i++)
+  {
+    hash_field(&sha, info->entry_points[i], strlen(info->entry_points[i]));
+  }
+  hash_field(&sha, info->src, info->src_len);
+
+  /* Imported modules take part through their own keys. Without import
+   * directories any import fails to compile, so there is nothing to find. */
+  if (info->import_dir_count > 0)
+  {
+    if (!import_key(info, imports))
+    {
+      return false;
+    }
+    hash_field(&sha, imports, sizeof(imports));
+  }
+  sha256_final(&sha, key);
+  return true;
+}
+
+bool cache_load(BSLCompileInfo *info, const uint8_t key[SHA256_DIGEST_LEN],
+    bool *ok, BSLCompileResult *result)
+{
+  char path[CACHE_PATH_MAX];
+  if (!cache_path(info, key, path))
+  {
+    return false;
+  }
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return false;
+  }
+
+  char magic[4];
+  CacheHeader header;
+  if (fread(magic, 1, 4, file) != 4 || memcmp(magic, CACHE_MAGIC, 4) != 0 ||
+      fread(&header, sizeof(header), 1, file) != 1 ||
+      header.format != CACHE_FORMAT ||
+      header.msg_len >= BSL_RESULT_MAX_MESSAGE_LEN)
+  {
+    fclose(file);
+    return false;
+  }
+
+  char *output = NULL;
+  if (header.output_len > 0)
+  {
+    output = info->internal_fn(NULL, 0, header.output_len + 1,
+        info->internal_ud);
+  }
+
+  result->diagnostics = NULL;
+  result->diagnostic_count = 0;
+  result->varyings = NULL;
+  result->varying_count = 0;
+  if (fread(result->msg, 1, header.msg_len, file) != header.msg_len ||
+      (output != NULL &&
+       fread(output, 1, header.output_len, file) != header.output_len) ||
+      !load_diagnostics(info, file, header.diagnostic_count, result) ||
+      !load_varyings(info, file, header.varying_count, result) ||
+      !load_entry_hashes(info, file, header.entry_hash_count, result))
+  {
+    if (output != NULL)
+    {
+      info->internal_fn(output, header.output_len + 1, 0, info->internal_ud);
+    }
+    if (result->diagnostics != NULL)
+    {
+      info->internal_fn(result->diagnostics,
+          result->diagnostic_count * sizeof(BSLDiagnostic), 0,
+          info->internal_ud);
+      result->diagnostics = NULL;
+      result->diagnostic_count = 0;
+    }
+    if (result->varyings != NULL)
+    {
+      info->internal_fn(result->varyings,
+          result->varying_count * sizeof(BSLVaryingLocation), 0,
+          info->internal_ud);
+      result->varyings = NULL;
+      result->varying_count = 0;
+    }
+    fclose(file);
+    return false;
+  }
+  fclose(file);
+
+  if (output != NULL)
+  {
+    output[header.output_len] = '\0';
+  }
+
+  result->msg[header.msg_len] = '\0';
+  result->line = header.line;
+  result->col = header.col;
+  result->code = (BSLErrorCode) header.code;
+  result->removed_vars = header.removed_vars;
+  result->removed_toplevels = header.removed_toplevels;
+  result->removed_varyings = header.removed_varyings;
+  result->output = output;
+  result->output_len = header.output_len;
+  *ok = header.ok;
+
+  /* Hits refresh the mtime, which is what eviction orders by. */
+  utimensat(AT_FDCWD, path, NULL, 0);
+  return true;
+}
+
+void cache_store(BSLCompileInfo *info, const uint8_t key[SHA256_DIGEST_LEN],
+    bool ok, BSLCompileResult *result)
+{
+  /* Past what a load takes, the entry would only ever miss. */
+  if (result->diagnostic_count > CACHE_MAX_DIAGNOSTICS ||
+      result->varying_count > CACHE_MAX_VARYINGS)
+  {
+    return;
+  }
+
+  char path[CACHE_PATH_MAX];
+  char tmp_path[CACHE_PATH_MAX];
+  int fd = -1;
+  if (!cache_path(info, key, path) || (fd = cache_temp(info, tmp_path)) < 0)
+  {
+    return;
+  }
+
+  FILE *file = fdopen(fd, "wb");
+  if (file == NULL)
+  {
+    close(fd);
+    unlink(tmp_path);
+    return;
+  }
+
+  CacheHeader header = {
+    .format = CACHE_FORMAT,
+    .ok = ok,
+    .line = result->line,
+    .col = result->col,
+    .code = ok ? BSL_ERROR_NONE : result->code,
+    .removed_vars = result->removed_vars,
+    .removed_toplevels = result->removed_toplevels,
+    .removed_varyings = result->removed_varyings,
+    .msg_len = ok ? 0 : strlen(result->msg),
+    .output_len = ok ? result->output_len : 0,
+    .entry_hash_count = ok ? result->entry_hash_count : 0,
+    .diagnostic_count = ok ? 0 : result->diagnostic_count,
+    .varying_count = ok ? result->varying_count : 0,
+  };
+
+  bool written = fwrite(CACHE_MAGIC, 1, 4, file) == 4 &&
+    fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(result->msg, 1, header.msg_len, file) == header.msg_len &&
+    (header.output_len == 0 ||
+     fwrite(result->output, 1, header.output_len, file) == header.output_len) &&
+    (header.diagnostic_count == 0 ||
+     fwrite(result->diagnostics, sizeof(BSLDiagnostic),
+       header.diagnostic_count, file) == header.diagnostic_count) &&
+    (header.varying_count == 0 ||
+     fwrite(result->varyings, sizeof(BSLVaryingLocation),
+       header.varying_count, file) == header.varying_count);
+  for (size_t i = 0; written && i < header.entry_hash_count; i++)
+  {
+    BSLEntryPointHash *hash = &result->entry_hashes[i];
+    CacheEntryHash stored = {
+      .stage = hash->stage,
+      .name_len = (uint32_t) strlen(hash->name),
+      .input_count = (uint32_t) hash->input_count,
+      .output_count = (uint32_t) hash->output_count,
+    };
+    size_t varying_count = hash->input_count + hash->output_count;
+    memcpy(stored.hash, hash->hash, BSL_HASH_LEN);
+    written = fwrite(&stored, sizeof(stored), 1, file) == 1 &&
+      fwrite(hash->name, 1, stored.name_len, file) == stored.name_len &&
+      (varying_count == 0 ||
+       fwrite(hash->varyings, sizeof(BSLInterfaceVarying), varying_count,
+         file) == varying_count);
+  }
+  if (fclose(file) != 0 || !written)
+  {
+    unlink(tmp_path);
+    return;
+  }
+  cache_commit(info, tmp_path, path);
+}
+
+bool cache_path(BSLCompileInfo *info, const uint8_t key[SHA256_DIGEST_LEN],
+    char *path)
+{
+  char name[SHA256_DIGEST_LEN * 2 + 1];
+  key_name(name, key);
+  return entry_path(path, info->cache_dir, name);
+}
+
+/* Temporary names never look like entries, so eviction leaves them to the
+ * writer. */
+int cache_temp(BSLCompileInfo *info, char *tmp_path)
+{
+  if (!entry_path(tmp_path, info->cache_dir, ".tmp.XXXXXX"))
+  {
+    return -1;
+  }
+  mkdir(info->cache_dir, 0777);
+  return mkstemp(tmp_path);
+}
+
+bool cache_commit(BSLCompileInfo *info, const char *tmp_path,
+    const char *path)
+{
+  struct stat old_st, new_st;
+  uint64_t old_size = stat(path, &old_st) == 0 ? old_st.st_size : 0;
+  if (stat(tmp_path, &new_st) != 0 || rename(tmp_path, path) != 0)
+  {
+    unlink(tmp_path);
+    return false;
+  }
+
+  if (info->cache_max_bytes == 0)
+  {
+    return true;
+  }
+
+  /* The directory is only scanned the first time this process writes to
+   * it and whenever the running total crosses the limit. */
+  pthread_mutex_lock(&dirs_lock);
+  CacheDir *dir = find_dir(info->cache_dir, false);
+  if (dir != NULL)
+  {
+    dir->total = dir->total + new_st.st_size > old_size ?
+      dir->total + new_st.st_size - old_size : 0;
+  }
+  if (dir == NULL || dir->total > info->cache_max_bytes)
+  {
+    uint64_t total = evict(info);
+    dir = find_dir(info->cache_dir, true);
+    if (dir != NULL)
+    {
+      dir->total = total;
+    }
+  }
+  pthread_mutex_unlock(&dirs_lock);
+  return true;
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+/* Length-prefixed so adjacent fields cannot run into each other. */
+static void hash_field(Sha256 *sha, const void *data, size_t len)
+{
+  uint64_t len64 = len;
+  sha256_update(sha, &len64, sizeof(len64));
+  sha256_update(sha, data, len);
+}
+
+static bool entry_path(char *path, const char *dir, const char *name)
+{
+  int len = snprintf(path, CACHE_PATH_MAX, "%s/%s", dir, name);
+  return len > 0 && len < CACHE_PATH_MAX;
+}
+
+static void key_name(char *name, const uint8_t key[SHA256_DIGEST_LEN])
+{
+  static const char hex[] = "0123456789abcdef";
+  for (int i = 0; i < SHA256_DIGEST_LEN; i++)
+  {
+    name[i * 2] = hex[key[i] >> 4];
+    name[i * 2 + 1] = hex[key[i] & 0xf];
+  }
+  name[SHA256_DIGEST_LEN * 2] = '\0';
+}
+
+static bool is_entry_name(const char *name)
+{
+  size_t len = 0;
+  while (name[len] != '\0')
+  {
+    if (!((name[len] >= '0' && name[len] <= '9') ||
+          (name[len] >= 'a' && name[len] <= 'f')))
+    {
+      return false;
+    }
+    len++;
+  }
+  return len == SHA256_DIGEST_LEN * 2;
+}
+
+static int compare_mtime(const void *a, const void *b)
+{
+  const CacheFile *fa = a, *fb = b;
+  if (fa->mtime.tv_sec != fb->mtime.tv_sec)
+  {
+    return fa->mtime.tv_sec < fb->mtime.tv_sec ? -1 : 1;
+  }
+  if (fa->mtime.tv_nsec != fb->mtime.tv_nsec)
+  {
+    return fa->mtime.tv_nsec < fb->mtime.tv_nsec ? -1 : 1;
+  }
+  return 0;
+}
+
+static bool load_diagnostics(BSLCompileInfo *info, FILE *file, size_t count,
+    BSLCompileResult *result)
+{
+  if (count == 0)
+  {
+    return true;
+  }
+  if (count > CACHE_MAX_DIAGNOSTICS)
+  {
+    return false;
+  }
+
+  BSLDiagnostic *diagnostics = info->internal_fn(NULL, 0,
+      count * sizeof(BSLDiagnostic), info->internal_ud);
+  if (fread(diagnostics, sizeof(BSLDiagnostic), count, file) != count)
+  {
+    info->internal_fn(diagnostics, count * sizeof(BSLDiagnostic), 0,
+        info->internal_ud);
+    return false;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    diagnostics[i].msg[BSL_RESULT_MAX_MESSAGE_LEN - 1] = '\0';
+  }
+
+  result->diagnostics = diagnostics;
+  result->diagnostic_count = count;
+  return true;
+}
+
+static bool load_varyings(BSLCompileInfo *info, FILE *file, size_t count,
+    BSLCompileResult *result)
+{
+  if (count == 0)
+  {
+    return true;
+  }
+  if (count > CACHE_MAX_VARYINGS)
+  {
+    return false;
+  }
+
+  BSLVaryingLocation *varyings = info->internal_fn(NULL, 0,
+      count * sizeof(BSLVaryingLocation), info->internal_ud);
+  if (fread(varyings, sizeof(BSLVaryingLocation), count, file) != count)
+  {
+    info->internal_fn(varyings, count * sizeof(BSLVaryingLocation), 0,
+        info->internal_ud);
+    return false;
+  }
+
+  result->varyings = varyings;
+  result->varying_count = count;
+  return true;
+}
+
+static bool load_entry_hashes(BSLCompileInfo *info, FILE *file, size_t count,
+    BSLCompileResult *result)
+{
+  result->entry_hashes = NULL;
+  result->entry_hash_count = 0;
+  if (count == 0)
+  {
+    return true;
+  }
+  if (count > CACHE_MAX_ENTRY_HASHES)
+  {
+    return false;
+  }
+
+  BSLEntryPointHash *hashes = info->internal_fn(NULL, 0,
+      count * sizeof(BSLEntryPointHash), info->internal_ud);
+  for (size_t i = 0; i < count; i++)
+  {
+    CacheEntryHash stored;
+    if (fread(&stored, sizeof(stored), 1, file) != 1 ||
+        stored.name_len > CACHE_PATH_MAX ||
+        stored.input_count > CACHE_MAX_VARYINGS ||
+        stored.output_count > CACHE_MAX_VARYINGS - stored.input_count)
+    {
+      free_entry_hashes(info, hashes, i, count);
+      return false;
+    }
+
+    BSLEntryPointHash *hash = &hashes[i];
+    size_t varying_count = stored.input_count + stored.output_count;
+    char *name = info->internal_fn(NULL, 0, stored.name_len + 1,
+        info->internal_ud);
+    if (name == NULL)
+    {
+      free_entry_hashes(info, hashes, i, count);
+      return false;
+    }
+    name[stored.name_len] = '\0';
+    hash->name = name;
+    hash->stage = (BSLStage) stored.stage;
+    memcpy(hash->hash, stored.hash, BSL_HASH_LEN);
+    hash->varyings = NULL;
+    hash->input_count = stored.input_count;
+    hash->output_count = stored.output_count;
+    if (varying_count > 0)
+    {
+      hash->varyings = info->internal_fn(NULL, 0,
+          varying_count * sizeof(BSLInterfaceVarying), info->internal_ud);
+    }
+    if (fread(name, 1, stored.name_len, file) != stored.name_len ||
+        (varying_count > 0 &&
+         fread(hash->varyings, sizeof(BSLInterfaceVarying), varying_count,
+           file) != varying_count))
+    {
+      free_entry_hashes(info, hashes, i + 1, count);
+      return false;
+    }
+  }
+
+  result->entry_hashes = hashes;
+  result->entry_hash_count = count;
+  return true;
+}
+
+static void free_entry_hashes(BSLCompileInfo *info, BSLEntryPointHash *hashes,
+    size_t named, size_t count)
+{
+  for (size_t i = 0; i < named; i++)
+  {
+    BSLEntryPointHash *hash = &hashes[i];
+    info->internal_fn((char *) hash->name, strlen(hash->name) + 1, 0,
+        info->internal_ud);
+    if (hash->varyings != NULL)
+    {
+      info->internal_fn(hash->varyings,
+          (hash->input_count + hash->output_count) *
+          sizeof(BSLInterfaceVarying), 0, info->internal_ud);
+    }
+  }
+  info->internal_fn(hashes, count * sizeof(BSLEntryPointHash), 0,
+      info->internal_ud);
+}
+
+/* Past CACHE_MAX_DIRS directories, every commit scans. */
+static CacheDir *find_dir(const char *path, bool add)
+{
+  for (size_t i = 0; i < dir_count; i++)
+  {
+    if (strcmp(dirs[i].path, path) == 0)
+    {
+      return &dirs[i];
+    }
+  }
+
+  if (!add || dir_count == CACHE_MAX_DIRS ||
+      strlen(path) >= sizeof(dirs[0].path))
+  {
+    return NULL;
+  }
+  strcpy(dirs[dir_count].path, path);
+  return &dirs[dir_count++];
+}
+
+/* Once the directory outgrows cache_max_bytes, drops the least recently
+ * used entries until it is back under three quarters of it, so a full
+ * cache is not rescanned on every commit. Returns what is left. Races
+ * with other processes only cost extra misses. */
+static uint64_t evict(BSLCompileInfo *info)
+{
+  DIR *dir = opendir(info->cache_dir);
+  if (dir == NULL)
+  {
+    return 0;
+  }
+
+  CacheFile *files = NULL;
+  size_t count = 0, cap = 0;
+  uint64_t total = 0;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL)
+  {
+    char path[CACHE_PATH_MAX];
+    struct stat st;
+    if (!is_entry_name(ent->d_name) ||
+        !entry_path(path, info->cache_dir, ent->d_name) ||
+        stat(path, &st) != 0)
+    {
+      continue;
+    }
+
+    if (count == cap)
+    {
+      size_t new_cap = cap == 0 ? 64 : cap * 2;
+      files = info->internal_fn(files, cap * sizeof(CacheFile),
+          new_cap * sizeof(CacheFile), info->internal_ud);
+      cap = new_cap;
+    }
+    memcpy(files[count].name, ent->d_name, sizeof(files[count].name));
+    files[count].size = st.st_size;
+    files[count].mtime = st.st_mtim;
+    total += st.st_size;
+    count++;
+  }
+  closedir(dir);
+
+  if (total > info->cache_max_bytes)
+  {
+    uint64_t target = info->cache_max_bytes - info->cache_max_bytes / 4;
+    qsort(files, count, sizeof(CacheFile), compare_mtime);
+    for (size_t i = 0; i < count && total > target; i++)
+    {
+      char path[CACHE_PATH_MAX];
+      if (entry_path(path, info->cache_dir, files[i].name) &&
+          unlink(path) == 0)
+      {
+        total -= files[i].size;
+      }
+    }
+  }
+
+  if (cap > 0)
+  {
+    info->internal_fn(files, cap * sizeof(CacheFile), 0, info->internal_ud);
+  }
+  return total;
+}
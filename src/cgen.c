@@ -0,0 +1,547 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <bsl/cgen.h>
+#include <bsl/module.h>
+#include <bsl/trace.h>
+
+typedef struct
+{
+  AST *ast;
+  char *buf;
+  size_t len, cap;
+  Toplevel **records;
+  size_t record_count, record_cap;
+  int temps;
+  /* Temporaries of the vectors and vector FMAs being written, one per
+   * operand handed out so far. */
+  int *temp_stack;
+  size_t temp_count, temp_cap;
+} CGen;
+
+/* Names from the source all get this prefix, so they can clash neither
+ * with C nor with the names generated around them. */
+#define USER_PREFIX "bsl_u_"
+
+/* === PROTOTYPES === */
+
+static void out(CGen *gen, const char *fmt, ...);
+static void out_name(CGen *gen, const uint8_t *name, size_t name_len);
+static void out_type(CGen *gen, Type *type);
+static void out_record(CGen *gen, Toplevel *record);
+static void out_expr(CGen *gen, Expr *expr);
+static void enter_expr(CGen *gen, Expr *expr, const ExprVisit *parent);
+static void leave_expr(CGen *gen, Expr *expr, const ExprVisit *parent);
+static bool has_temps(Expr *expr);
+static void push_temp(CGen *gen);
+static const char *fma_fn(Expr *expr);
+static void out_proc(CGen *gen, Toplevel *proc);
+static void out_batch(CGen *gen, Toplevel *proc);
+static Parameter *nth_param(Toplevel *proc, size_t n, size_t *count);
+
+/* === PUBLIC FUNCTIONS === */
+
+bool generate_c(AST *ast, const char **output, size_t *output_len)
+{
+  CGen gen = {
+    .ast = ast,
+    .buf = NULL,
+    .len = 0,
+    .cap = 0,
+    .records = NULL,
+    .record_count = 0,
+    .record_cap = 0,
+    .temps = 0,
+    .temp_stack = NULL,
+    .temp_count = 0,
+    .temp_cap = 0,
+  };
+
+  out(&gen,
+      "/* Generated by bsl. */\n"
+      "#include <stddef.h>\n"
+      "\n"
+      "typedef float bsl_vec2 __attribute__((vector_size(8)));\n"
+      "typedef float bsl_vec3 __attribute__((vector_size(16)));\n"
+      "typedef float bsl_vec4 __attribute__((vector_size(16)));\n"
+      "typedef double bsl_dvec2 __attribute__((vector_size(16)));\n"
+      "typedef double bsl_dvec3 __attribute__((vector_size(32)));\n"
+      "typedef double bsl_dvec4 __attribute__((vector_size(32)));\n");
+
+  Import *import = ast->imports;
+  while (import != NULL)
+  {
+    Toplevel *iter = import->module->ast.toplevels;
+    while (iter != NULL)
+    {
+      if (iter->t == TOPLEVEL_RECORD)
+      {
+        out_record(&gen, iter);
+      }
+      iter = iter->next;
+    }
+    import = import->next;
+  }
+
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_RECORD)
+    {
+      out_record(&gen, iter);
+    }
+    iter = iter->next;
+  }
+
+  iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC)
+    {
+      trace_begin(ast->trace, "codegen", (const char *) iter->proc.name,
+          iter->proc.name_len);
+      out_proc(&gen, iter);
+      if (iter->proc.entry_point != 0)
+      {
+        out_batch(&gen, iter);
+      }
+      trace_end(ast->trace);
+    }
+    iter = iter->next;
+  }
+
+  if (gen.record_cap > 0)
+  {
+    ast->alloc->fn(gen.records, gen.record_cap * sizeof(Toplevel *), 0,
+        ast->alloc->ud);
+  }
+  if (gen.temp_cap > 0)
+  {
+    ast->alloc->fn(gen.temp_stack, gen.temp_cap * sizeof(int), 0,
+        ast->alloc->ud);
+  }
+
+  /* Callers free output_len + 1 bytes. */
+  if (gen.cap > gen.len + 1)
+  {
+    gen.buf = ast->alloc->fn(gen.buf, gen.cap, gen.len + 1, ast->alloc->ud);
+  }
+  *output = gen.buf;
+  *output_len = gen.len;
+  return true;
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static void out(CGen *gen, const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  int size = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+
+  if (gen->len + size + 1 > gen->cap)
+  {
+    size_t cap = gen->cap == 0 ? 4096 : gen->cap;
+    while (gen->len + size + 1 > cap)
+    {
+      cap *= 2;
+    }
+    gen->buf = gen->ast->alloc->fn(gen->buf, gen->cap, cap, gen->ast->alloc->ud);
+    gen->cap = cap;
+  }
+
+  va_start(args, fmt);
+  vsnprintf(gen->buf + gen->len, size + 1, fmt, args);
+  va_end(args);
+  gen->len += size;
+}
+
+static void out_name(CGen *gen, const uint8_t *name, size_t name_len)
+{
+  out(gen, USER_PREFIX "%.*s", (int) name_len, name);
+}
+
+static void out_type(CGen *gen, Type *type)
+{
+  switch (type->t)
+  {
+    case TYPE_F32:
+      out(gen, "float");
+      break;
+    case TYPE_F64:
+      out(gen, "double");
+      break;
+    case TYPE_VOID:
+      out(gen, "void");
+      break;
+    case TYPE_VECTOR:
+      out(gen, "bsl_%svec%d", type->vec.type->t == TYPE_F64 ? "d" : "",
+          type->vec.size);
+      break;
+    case TYPE_RECORD:
+      out_name(gen, type->record.name, type->record.name_len);
+      break;
+    default:
+      break;
+  }
+}
+
+/* Records used by value inside other records have to come first. */
+static void out_record(CGen *gen, Toplevel *record)
+{
+  for (size_t i = 0; i < gen->record_count; i++)
+  {
+    if (gen->records[i] == record)
+    {
+      return;
+    }
+  }
+
+  if (gen->record_count == gen->record_cap)
+  {
+    size_t cap = gen->record_cap == 0 ? 16 : gen->record_cap * 2;
+    gen->records = gen->ast->alloc->fn(gen->records,
+        gen->record_cap * sizeof(Toplevel *), cap * sizeof(Toplevel *),
+        gen->ast->alloc->ud);
+    gen->record_cap = cap;
+  }
+  gen->records[gen->record_count++] = record;
+
+  RecordEntry *entry = record->record.entries;
+  while (entry != NULL)
+  {
+    if (entry->type->t == TYPE_RECORD)
+    {
+      out_record(gen, entry->type->record.toplevel);
+    }
+    entry = entry->next;
+  }
+
+  out(gen, "\ntypedef struct\n{\n");
+  for (size_t i = 0; i < record->record.entry_count; i++)
+  {
+    entry = record->record.entries;
+    while (entry->index != (int) i)
+    {
+      entry = entry->next;
+    }
+
+    out(gen, "  ");
+    out_type(gen, entry->type);
+    out(gen, " ");
+    out_name(gen, entry->name, entry->name_len);
+    out(gen, ";\n");
+  }
+  out(gen, "} ");
+  out_name(gen, record->record.name, record->record.name_len);
+  out(gen, ";\n");
+}
+
+/* Vector elements and the operands of vector FMAs go through temporaries,
+ * so they are evaluated once however many components are taken from them. */
+static void out_expr(CGen *gen, Expr *expr)
+{
+  ExprWalk walk;
+  expr_walk_init(&walk, gen->ast->alloc, expr);
+  bool leaving;
+  while ((expr = expr_walk_next(&walk, &leaving)) != NULL)
+  {
+    if (leaving)
+    {
+      leave_expr(gen, expr, expr_walk_parent(&walk));
+    } else
+    {
+      enter_expr(gen, expr, expr_walk_parent(&walk));
+    }
+  }
+}
+
+static void enter_expr(CGen *gen, Expr *expr, const ExprVisit *parent)
+{
+  static const char *ops[] = {
+    [BINOP_ADD] = "+",
+    [BINOP_SUB] = "-",
+    [BINOP_MUL] = "*",
+    [BINOP_DIV] = "/",
+  };
+
+  if (parent != NULL && has_temps(parent->expr))
+  {
+    push_temp(gen);
+    out_type(gen, expr->type);
+    out(gen, " _t%d = ", gen->temp_stack[gen->temp_count - 1]);
+  } else if (parent != NULL && parent->index > 1)
+  {
+    if (parent->expr->t == EXPR_BINARY)
+    {
+      out(gen, " %s ", ops[parent->expr->binary.op]);
+    } else if (parent->expr->t == EXPR_FMA)
+    {
+      out(gen, ", ");
+    } else if (parent->expr->t == EXPR_RECORD)
+    {
+      out(gen, ",");
+    }
+  }
+  if (parent != NULL && parent->expr->t == EXPR_RECORD)
+  {
+    out(gen, " .");
+    out_name(gen, (const uint8_t *) parent->member->name,
+        parent->member->name_len);
+    out(gen, " = ");
+  }
+
+  switch (expr->t)
+  {
+    case EXPR_VAR:
+      out_name(gen, expr->var.name, expr->var.name_len);
+      break;
+    case EXPR_NUM: {
+      char num[64];
+      if (expr->num.t == NUMBER_INT)
+      {
+        snprintf(num, sizeof(num), "%lld.0", (long long) expr->num.i);
+      } else
+      {
+        snprintf(num, sizeof(num), "%.9g", expr->num.f);
+        if (strpbrk(num, ".e") == NULL)
+        {
+          strcat(num, ".0");
+        }
+      }
+      out(gen, "%sf", num);
+      break;
+    }
+    case EXPR_BINARY:
+      out(gen, "(");
+      break;
+    case EXPR_FMA:
+      out(gen, has_temps(expr) ? "({ " : "%s(", fma_fn(expr));
+      break;
+    case EXPR_VECTOR:
+      out(gen, "({ ");
+      break;
+    case EXPR_RECORD:
+      out(gen, "(");
+      out_type(gen, expr->type);
+      out(gen, ") {");
+      break;
+    default:
+      break;
+  }
+}
+
+/* The builtins round once whatever the host compiler's contraction
+ * settings. Vector FMAs go component by component, which the host compiler
+ * turns back into vector FMAs where it has them. */
+static void leave_expr(CGen *gen, Expr *expr, const ExprVisit *parent)
+{
+  switch (expr->t)
+  {
+    case EXPR_BINARY:
+      out(gen, ")");
+      break;
+    case EXPR_FMA: {
+      if (!has_temps(expr))
+      {
+        out(gen, ")");
+        break;
+      }
+
+      Expr *operands[3] = { expr->fma.lhs, expr->fma.rhs, expr->fma.addend };
+      gen->temp_count -= 3;
+      int *temps = &gen->temp_stack[gen->temp_count];
+      out(gen, "(");
+      out_type(gen, expr->type);
+      out(gen, ") {");
+      for (int c = 0; c < expr->type->vec.size; c++)
+      {
+        out(gen, "%s%s(", c == 0 ? "" : ", ", fma_fn(expr));
+        for (int i = 0; i < 3; i++)
+        {
+          out(gen, "%s_t%d", i == 0 ? "" : ", ", temps[i]);
+          if (operands[i]->type->t == TYPE_VECTOR)
+          {
+            out(gen, "[%d]", c);
+          }
+        }
+        out(gen, ")");
+      }
+      out(gen, "}; })");
+      break;
+    }
+    case EXPR_MEMBER:
+      out(gen, ".");
+      out_name(gen, expr->member.name, expr->member.name_len);
+      break;
+    case EXPR_VECTOR: {
+      size_t count = 0;
+      Expr *iter = expr->vec.exprs;
+      while (iter != NULL)
+      {
+        count++;
+        iter = iter->next;
+      }
+      gen->temp_count -= count;
+      int *temps = &gen->temp_stack[gen->temp_count];
+
+      out(gen, "(");
+      out_type(gen, expr->type);
+      out(gen, ") {");
+      size_t i = 0;
+      iter = expr->vec.exprs;
+      while (iter != NULL)
+      {
+        if (iter->type->t == TYPE_VECTOR)
+        {
+          for (int c = 0; c < iter->type->vec.size; c++)
+          {
+            out(gen, "%s_t%d[%d]", c == 0 ? "" : ", ", temps[i], c);
+          }
+        } else
+        {
+          out(gen, "_t%d", temps[i]);
+        }
+        i++;
+        iter = iter->next;
+        out(gen, iter != NULL ? ", " : "");
+      }
+      out(gen, "}; })");
+      break;
+    }
+    case EXPR_RECORD:
+      out(gen, expr->record.members != NULL ? " }" : "}");
+      break;
+    default:
+      break;
+  }
+
+  if (parent != NULL && has_temps(parent->expr))
+  {
+    out(gen, "; ");
+  }
+}
+
+static bool has_temps(Expr *expr)
+{
+  return expr->t == EXPR_VECTOR ||
+    (expr->t == EXPR_FMA && expr->type->t == TYPE_VECTOR);
+}
+
+static void push_temp(CGen *gen)
+{
+  if (gen->temp_count == gen->temp_cap)
+  {
+    size_t cap = gen->temp_cap == 0 ? 16 : gen->temp_cap * 2;
+    gen->temp_stack = gen->ast->alloc->fn(gen->temp_stack,
+        gen->temp_cap * sizeof(int), cap * sizeof(int), gen->ast->alloc->ud);
+    gen->temp_cap = cap;
+  }
+  gen->temp_stack[gen->temp_count++] = gen->temps++;
+}
+
+static const char *fma_fn(Expr *expr)
+{
+  Type *elem = expr->type->t == TYPE_VECTOR ? expr->type->vec.type :
+    expr->type;
+  return elem->t == TYPE_F64 ? "__builtin_fma" : "__builtin_fmaf";
+}
+
+static void out_proc(CGen *gen, Toplevel *proc)
+{
+  out(gen, "\nstatic inline ");
+  out_type(gen, proc->proc.return_type);
+  out(gen, " ");
+  out_name(gen, proc->proc.name, proc->proc.name_len);
+  out(gen, "(");
+
+  size_t count;
+  nth_param(proc, 0, &count);
+  for (size_t i = 0; i < count; i++)
+  {
+    Parameter *param = nth_param(proc, i, &count);
+    out(gen, i == 0 ? "" : ", ");
+    out_type(gen, param->type);
+    out(gen, " ");
+    out_name(gen, param->name, param->name_len);
+  }
+  out(gen, count == 0 ? "void)\n{\n" : ")\n{\n");
+
+  Statement *stmt = proc->proc.stmts;
+  while (stmt != NULL)
+  {
+    gen->temps = 0;
+    switch (stmt->t)
+    {
+      case STATEMENT_VAR:
+        out(gen, "  ");
+        out_type(gen, stmt->var.type);
+        out(gen, " ");
+        out_name(gen, stmt->var.name, stmt->var.name_len);
+        out(gen, " = ");
+        out_expr(gen, stmt->var.expr);
+        out(gen, ";\n");
+        break;
+      case STATEMENT_RETURN:
+        out(gen, "  return ");
+        out_expr(gen, stmt->ret.expr);
+        out(gen, ";\n");
+        break;
+    }
+    stmt = stmt->next;
+  }
+  out(gen, "}\n");
+}
+
+/* One array per parameter and one for the results, written so the host
+ * compiler can vectorize across invocations. */
+static void out_batch(CGen *gen, Toplevel *proc)
+{
+  size_t count;
+  nth_param(proc, 0, &count);
+
+  out(gen, "\nvoid bsl_batch_%.*s(", (int) proc->proc.name_len,
+      proc->proc.name);
+  for (size_t i = 0; i < count; i++)
+  {
+    Parameter *param = nth_param(proc, i, &count);
+    out(gen, "const ");
+    out_type(gen, param->type);
+    out(gen, " *restrict ");
+    out_name(gen, param->name, param->name_len);
+    out(gen, ", ");
+  }
+  out_type(gen, proc->proc.return_type);
+  out(gen, " *restrict out, size_t n)\n{\n  for (size_t i = 0; i < n; i++)\n  {\n"
+      "    out[i] = ");
+  out_name(gen, proc->proc.name, proc->proc.name_len);
+  out(gen, "(");
+  for (size_t i = 0; i < count; i++)
+  {
+    Parameter *param = nth_param(proc, i, &count);
+    out(gen, i == 0 ? "" : ", ");
+    out_name(gen, param->name, param->name_len);
+    out(gen, "[i]");
+  }
+  out(gen, ");\n  }\n}\n");
+}
+
+/* Parameters are kept in reverse declaration order. */
+static Parameter *nth_param(Toplevel *proc, size_t n, size_t *count)
+{
+  *count = 0;
+  Parameter *iter = proc->proc.params;
+  while (iter != NULL)
+  {
+    (*count)++;
+    iter = iter->next;
+  }
+
+  iter = proc->proc.params;
+  for (size_t i = 0; iter != NULL && i + n + 1 < *count; i++)
+  {
+    iter = iter->next;
+  }
+  return iter;
+}
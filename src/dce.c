@@ -0,0 +1,188 @@
+#include <bsl/dce.h>
+
+/* === PROTOTYPES === */
+
+static void mark_type(Type *type);
+static void mark_expr(AST *ast, Expr *expr);
+static void eliminate_proc(AST *ast, Toplevel *proc);
+static Statement *reverse_stmts(Statement *stmts);
+
+/* === PUBLIC FUNCTIONS === */
+
+void eliminate_dead_code(AST *ast)
+{
+  bool has_entry_point = false;
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    iter->live = false;
+    if (iter->t == TOPLEVEL_PROC && iter->proc.entry_point != 0)
+    {
+      has_entry_point = true;
+    }
+    iter = iter->next;
+  }
+
+  /* A file without entry points is a library, every toplevel is a root. */
+  iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC && 
+        (!has_entry_point || iter->proc.entry_point != 0))
+    {
+      iter->live = true;
+      eliminate_proc(ast, iter);
+    } else if (iter->t == TOPLEVEL_RECORD && !has_entry_point)
+    {
+      iter->live = true;
+    }
+    iter = iter->next;
+  }
+
+  Toplevel **link = &ast->toplevels;
+  while (*link != NULL)
+  {
+    if (!(*link)->live)
+    {
+      *link = (*link)->next;
+      ast->result->removed_toplevels++;
+    } else
+    {
+      link = &(*link)->next;
+    }
+  }
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static void mark_type(Type *type)
+{
+  switch (type->t)
+  {
+    case TYPE_VECTOR:
+      mark_type(type->vec.type);
+      break;
+    case TYPE_RECORD: {
+      Toplevel *record = type->record.toplevel;
+      if (record->live)
+      {
+        break;
+      }
+
+      record->live = true;
+      RecordEntry *iter = record->record.entries;
+      while (iter != NULL)
+      {
+        mark_type(iter->type);
+        iter = iter->next;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static void mark_expr(AST *ast, Expr *expr)
+{
+  ExprWalk walk;
+  expr_walk_init(&walk, ast->alloc, expr);
+  bool leaving;
+  while ((expr = expr_walk_next(&walk, &leaving)) != NULL)
+  {
+    if (leaving)
+    {
+      continue;
+    }
+
+    if (expr->t == EXPR_VAR)
+    {
+      expr->var.entry->live = true;
+    } else if (expr->t == EXPR_RECORD)
+    {
+      mark_type(expr->type);
+    }
+  }
+}
+
+static void eliminate_proc(AST *ast, Toplevel *proc)
+{
+  VarEntry *entry = proc->proc.scope.entries;
+  while (entry != NULL)
+  {
+    entry->live = false;
+    entry = entry->next;
+  }
+
+  mark_type(proc->proc.return_type);
+
+  Parameter *param = proc->proc.params;
+  while (param != NULL)
+  {
+    mark_type(param->type);
+    param = param->next;
+  }
+
+  /* Everything after the first return is unreachable. */
+  Statement *iter = proc->proc.stmts;
+  while (iter != NULL)
+  {
+    if (iter->t == STATEMENT_RETURN)
+    {
+      while (iter->next != NULL)
+      {
+        if (iter->next->t == STATEMENT_VAR)
+        {
+          ast->result->removed_vars++;
+        }
+        iter->next = iter->next->next;
+      }
+      break;
+    }
+    iter = iter->next;
+  }
+
+  /* Walk backwards so every use is seen before its definition. */
+  Statement *live = NULL;
+  iter = reverse_stmts(proc->proc.stmts);
+  while (iter != NULL)
+  {
+    Statement *next = iter->next;
+    switch (iter->t)
+    {
+      case STATEMENT_RETURN:
+        mark_expr(ast, iter->ret.expr);
+        break;
+      case STATEMENT_VAR:
+        if (!iter->var.entry->live)
+        {
+          ast->result->removed_vars++;
+          iter = next;
+          continue;
+        }
+        mark_expr(ast, iter->var.expr);
+        mark_type(iter->var.type);
+        break;
+    }
+
+    iter->next = live;
+    live = iter;
+    iter = next;
+  }
+  proc->proc.stmts = live;
+}
+
+static Statement *reverse_stmts(Statement *stmts)
+{
+  Statement *first, *follow, *tmp;
+  first = stmts;
+  follow = tmp = NULL;
+  while (first != NULL)
+  {
+    tmp = first->next;
+    first->next = follow;
+    follow = first;
+    first = tmp;
+  }
+  return follow;
+}
@@ -0,0 +1,786 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX__) || (defined(__GNUC__) && defined(__x86_64__))
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include <bsl/eval.h>
+#include <bsl/module.h>
+
+typedef struct
+{
+  EvalReg *frame;
+  EvalReg *scratch;
+  const size_t *slots;
+  size_t top;
+  EvalReg **stack;
+  size_t depth;
+} EvalState;
+
+#define LANE_BYTES (sizeof(float) * BSL_EVAL_LANES)
+
+#if defined(__AVX__)
+#define LANE_KERNEL(_name, _avx, _sse, _op)                                   \
+  static void _name(float *d, const float *a, const float *b)                 \
+  {                                                                           \
+    for (int i = 0; i < BSL_EVAL_LANES; i += 8)                               \
+    {                                                                         \
+      _mm256_storeu_ps(d + i, _avx(_mm256_loadu_ps(a + i),                    \
+            _mm256_loadu_ps(b + i)));                                         \
+    }                                                                         \
+  }
+#elif defined(__SSE__)
+#define LANE_KERNEL(_name, _avx, _sse, _op)                                   \
+  static void _name(float *d, const float *a, const float *b)                 \
+  {                                                                           \
+    for (int i = 0; i < BSL_EVAL_LANES; i += 4)                               \
+    {                                                                         \
+      _mm_storeu_ps(d + i, _sse(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));   \
+    }                                                                         \
+  }
+#else
+#define LANE_KERNEL(_name, _avx, _sse, _op)                                   \
+  static void _name(float *d, const float *a, const float *b)                 \
+  {                                                                           \
+    for (int i = 0; i < BSL_EVAL_LANES; i++)                                  \
+    {                                                                         \
+      d[i] = a[i] _op b[i];                                                   \
+    }                                                                         \
+  }
+#endif
+
+LANE_KERNEL(lanes_add, _mm256_add_ps, _mm_add_ps, +)
+LANE_KERNEL(lanes_sub, _mm256_sub_ps, _mm_sub_ps, -)
+LANE_KERNEL(lanes_mul, _mm256_mul_ps, _mm_mul_ps, *)
+LANE_KERNEL(lanes_div, _mm256_div_ps, _mm_div_ps, /)
+
+/* === PROTOTYPES === */
+
+static bool prepare_slots(Toplevel *proc, EvalProc *eval,
+    BSLCompileResult *result);
+static void lanes_fma(float *d, const float *a, const float *b, const float *c);
+static void lanes_splat(float *d, float v);
+static size_t type_size(Type *type);
+static size_t type_components(Type *type);
+static bool order_expr(EvalProc *eval, Expr *expr, size_t *temps,
+    size_t *stack_size, BSLCompileResult *result);
+static size_t operand_count(Expr *expr);
+static EvalReg *push_regs(EvalState *state, size_t count);
+static void eval_expr(EvalState *state, Expr *expr);
+static bool bind_inputs(Toplevel *proc, const BSLVertexBinding *bindings, 
+    size_t binding_count, BSLCompileResult *result);
+static void gather(float *lanes, const BSLVertexBinding *binding, int comp,
+    size_t first, size_t count);
+static bool output_matches(RecordEntry *entry, int location);
+static bool check_outputs(Toplevel *proc, const BSLVertexOutput *outputs,
+    size_t output_count, BSLCompileResult *result);
+
+/* === PUBLIC FUNCTIONS === */
+
+bool bsl_eval_vertex(BSLModule *module, const char *entry_point,
+    const BSLVertexInput *inputs, size_t input_count,
+    BSLVertexOutput *outputs, size_t output_count,
+    size_t vertex_count, BSLCompileResult *result)
+{
+  BSLAlloc *alloc = &module->alloc;
+  size_t bindings_bytes = input_count * sizeof(BSLVertexBinding);
+  BSLVertexBinding *bindings = alloc->fn(NULL, 0, bindings_bytes, alloc->ud);
+  for (size_t i = 0; i < input_count; i++)
+  {
+    bindings[i] = (BSLVertexBinding) {
+      .location = inputs[i].location,
+      .components = inputs[i].components,
+      .format = BSL_FORMAT_F32,
+      .base = inputs[i].data,
+      .stride = inputs[i].components * sizeof(float),
+      .offset = 0,
+    };
+  }
+
+  bool ok = bsl_eval_vertex_bound(module, entry_point, bindings, input_count,
+      outputs, output_count, vertex_count, result);
+  alloc->fn(bindings, bindings_bytes, 0, alloc->ud);
+  return ok;
+}
+
+bool bsl_eval_vertex_bound(BSLModule *module, const char *entry_point,
+    const BSLVertexBinding *bindings, size_t binding_count,
+    BSLVertexOutput *outputs, size_t output_count,
+    size_t vertex_count, BSLCompileResult *result)
+{
+  EvalProc eval;
+  BSLAlloc *alloc = &module->alloc;
+  Toplevel *proc = eval_find_entry_point(&module->ast, entry_point, 
+      ENTRY_POINT_VERTEX, result);
+  if (proc == NULL || !eval_prepare(proc, alloc, &eval, result))
+  {
+    return false;
+  }
+
+  if (proc->proc.return_type->t != TYPE_RECORD)
+  {
+    result_error(result, proc->line, proc->col, 
+        "vertex entry point must return a record");
+    eval_release(&eval);
+    return false;
+  }
+
+  if (!bind_inputs(proc, bindings, binding_count, result) ||
+      !check_outputs(proc, outputs, output_count, result))
+  {
+    eval_release(&eval);
+    return false;
+  }
+
+  size_t frame_bytes = eval.frame_size * sizeof(EvalReg);
+  size_t scratch_bytes = eval.scratch_size * sizeof(EvalReg);
+  EvalReg *frame = alloc->fn(NULL, 0, frame_bytes, alloc->ud);
+  EvalReg *scratch = alloc->fn(NULL, 0, scratch_bytes, alloc->ud);
+  memset(frame, 0, frame_bytes);
+
+  RecordEntry *ret_entries = proc->proc.return_type->record.entries;
+  for (size_t base = 0; base < vertex_count; base += BSL_EVAL_LANES)
+  {
+    size_t lanes = vertex_count - base;
+    if (lanes > BSL_EVAL_LANES)
+    {
+      lanes = BSL_EVAL_LANES;
+    }
+
+    Parameter *param = proc->proc.params;
+    while (param != NULL)
+    {
+      RecordEntry *entry = param->type->record.entries;
+      while (entry != NULL)
+      {
+        if (entry->t == RECORD_ENTRY_INPUT)
+        {
+          const BSLVertexBinding *binding = bindings;
+          while (binding->location != entry->pos)
+          {
+            binding++;
+          }
+
+          EvalReg *reg = frame + eval.slots[param->entry->index] +
+            entry->index;
+          size_t comps = type_components(entry->type);
+          for (size_t c = 0; c < comps; c++)
+          {
+            gather(reg->c[c], binding, (int) c, base, lanes);
+          }
+        }
+        entry = entry->next;
+      }
+      param = param->next;
+    }
+
+    EvalReg *ret = eval_run(&eval, frame, scratch);
+
+    for (size_t i = 0; i < output_count; i++)
+    {
+      BSLVertexOutput *output = &outputs[i];
+      RecordEntry *entry = ret_entries;
+      while (entry != NULL)
+      {
+        if (output_matches(entry, output->location))
+        {
+          size_t comps = type_components(entry->type);
+          int first = entry->t == RECORD_ENTRY_OUTPUT ? entry->component : 0;
+          for (size_t c = 0; c < comps && first + (int) c < output->components; c++)
+          {
+            for (size_t l = 0; l < lanes; l++)
+            {
+              output->data[(base + l) * output->components + first + c] = 
+                ret[entry->index].c[c][l];
+            }
+          }
+        }
+        entry = entry->next;
+      }
+    }
+  }
+
+  alloc->fn(scratch, scratch_bytes, 0, alloc->ud);
+  alloc->fn(frame, frame_bytes, 0, alloc->ud);
+  eval_release(&eval);
+  return true;
+}
+
+Toplevel *eval_find_entry_point(AST *ast, const char *name, 
+    ProcedureEntryPoint stage, BSLCompileResult *result)
+{
+  size_t name_len = strlen(name);
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC && (iter->proc.entry_point & stage) &&
+        iter->proc.name_len == name_len && 
+        strncmp((const char *) iter->proc.name, name, name_len) == 0)
+    {
+      return iter;
+    }
+    iter = iter->next;
+  }
+
+  const char *stage_name = "";
+  if (stage == ENTRY_POINT_VERTEX)
+  {
+    stage_name = "vertex ";
+  } else if (stage == ENTRY_POINT_FRAGMENT)
+  {
+    stage_name = "fragment ";
+  }
+  result_error(result, 0, 0, "no %sentry point named '%s'", stage_name, name);
+  return NULL;
+}
+
+bool eval_prepare(Toplevel *proc, BSLAlloc *alloc, EvalProc *eval,
+    BSLCompileResult *result)
+{
+  eval->proc = proc;
+  eval->alloc = alloc;
+  eval->slot_count = proc->proc.scope.entry_count;
+  eval->slots = alloc->fn(NULL, 0, eval->slot_count * sizeof(size_t),
+      alloc->ud);
+  eval->order = NULL;
+  eval->order_count = 0;
+  eval->order_cap = 0;
+  eval->frame_size = 0;
+  eval->scratch_size = 0;
+  eval->stack_offset = 0;
+  if (!prepare_slots(proc, eval, result))
+  {
+    eval_release(eval);
+    return false;
+  }
+  return true;
+}
+
+EvalReg *eval_run(EvalProc *eval, EvalReg *frame, EvalReg *scratch)
+{
+  EvalState state = {
+    .frame = frame,
+    .scratch = scratch,
+    .slots = eval->slots,
+    .stack = (EvalReg **) (scratch + eval->stack_offset),
+  };
+
+  Expr **order = eval->order;
+  Statement *stmt = eval->proc->proc.stmts;
+  while (stmt != NULL)
+  {
+    state.top = 0;
+    state.depth = 0;
+    Expr *root = stmt->t == STATEMENT_VAR ? stmt->var.expr : stmt->ret.expr;
+    Expr *expr;
+    do
+    {
+      expr = *order++;
+      eval_expr(&state, expr);
+    } while (expr != root);
+
+    EvalReg *value = state.stack[0];
+    switch (stmt->t)
+    {
+      case STATEMENT_VAR:
+        memcpy(frame + eval->slots[stmt->var.entry->index], value, 
+            type_size(stmt->var.type) * sizeof(EvalReg));
+        break;
+      case STATEMENT_RETURN:
+        return value;
+    }
+    stmt = stmt->next;
+  }
+
+  return NULL;
+}
+
+void eval_release(EvalProc *eval)
+{
+  eval->alloc->fn(eval->slots, eval->slot_count * sizeof(size_t), 0,
+      eval->alloc->ud);
+  eval->slots = NULL;
+  if (eval->order_cap > 0)
+  {
+    eval->alloc->fn(eval->order, eval->order_cap * sizeof(Expr *), 0,
+        eval->alloc->ud);
+  }
+  eval->order = NULL;
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static bool prepare_slots(Toplevel *proc, EvalProc *eval,
+    BSLCompileResult *result)
+{
+  Parameter *param = proc->proc.params;
+  while (param != NULL)
+  {
+    size_t size = type_size(param->type);
+    if (size == 0)
+    {
+      result_error(result, param->line, param->col,
+          "type of parameter '%.*s' is not supported by the CPU evaluator",
+          param->name_len, param->name);
+      return false;
+    }
+    eval->slots[param->entry->index] = eval->frame_size;
+    eval->frame_size += size;
+    param = param->next;
+  }
+
+  if (type_size(proc->proc.return_type) == 0)
+  {
+    result_error(result, proc->line, proc->col,
+        "return type is not supported by the CPU evaluator");
+    return false;
+  }
+
+  size_t stack_size = 0;
+  Statement *stmt = proc->proc.stmts;
+  while (stmt != NULL)
+  {
+    size_t temps = 0;
+    switch (stmt->t)
+    {
+      case STATEMENT_VAR: {
+        size_t size = type_size(stmt->var.type);
+        if (size == 0)
+        {
+          result_error(result, stmt->line, stmt->col,
+              "type of variable '%.*s' is not supported by the CPU evaluator",
+              stmt->var.name_len, stmt->var.name);
+          return false;
+        }
+        eval->slots[stmt->var.entry->index] = eval->frame_size;
+        eval->frame_size += size;
+        if (!order_expr(eval, stmt->var.expr, &temps, &stack_size, result))
+        {
+          return false;
+        }
+        break;
+      }
+      case STATEMENT_RETURN:
+        if (!order_expr(eval, stmt->ret.expr, &temps, &stack_size, result))
+        {
+          return false;
+        }
+        break;
+    }
+
+    if (temps > eval->scratch_size)
+    {
+      eval->scratch_size = temps;
+    }
+    stmt = stmt->next;
+  }
+
+  eval->stack_offset = eval->scratch_size;
+  eval->scratch_size += (stack_size * sizeof(EvalReg *) + sizeof(EvalReg) - 1)
+    / sizeof(EvalReg);
+  return true;
+}
+
+/* Rounds once whatever the CPU, in software when it has no FMA. */
+#if defined(__GNUC__) && defined(__x86_64__)
+#if !defined(__FMA__)
+__attribute__((target("avx,fma")))
+#endif
+static void lanes_fma_fused(float *d, const float *a, const float *b,
+    const float *c)
+{
+  for (int i = 0; i < BSL_EVAL_LANES; i += 8)
+  {
+    _mm256_storeu_ps(d + i, _mm256_fmadd_ps(_mm256_loadu_ps(a + i),
+          _mm256_loadu_ps(b + i), _mm256_loadu_ps(c + i)));
+  }
+}
+#endif
+
+static void lanes_fma(float *d, const float *a, const float *b, const float *c)
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+  if (cpu_has_fma())
+  {
+    lanes_fma_fused(d, a, b, c);
+    return;
+  }
+#endif
+  for (int i = 0; i < BSL_EVAL_LANES; i++)
+  {
+    d[i] = fmaf(a[i], b[i], c[i]);
+  }
+}
+
+static void lanes_splat(float *d, float v)
+{
+  for (int i = 0; i < BSL_EVAL_LANES; i++)
+  {
+    d[i] = v;
+  }
+}
+
+static size_t type_size(Type *type)
+{
+  switch (type->t)
+  {
+    case TYPE_F32:
+      return 1;
+    case TYPE_VECTOR:
+      return type->vec.type->t == TYPE_F32 ? 1 : 0;
+    case TYPE_RECORD: {
+      RecordEntry *iter = type->record.entries;
+      while (iter != NULL)
+      {
+        if (iter->type->t == TYPE_RECORD || type_size(iter->type) == 0)
+        {
+          return 0;
+        }
+        iter = iter->next;
+      }
+      return type->record.toplevel->record.entry_count;
+    }
+    default:
+      return 0;
+  }
+}
+
+static size_t type_components(Type *type)
+{
+  return type->t == TYPE_VECTOR ? type->vec.size : 1;
+}
+
+/* Appends expr in postorder, counting the temporaries a run takes for it
+ * and the most operand values it keeps at once. */
+static bool order_expr(EvalProc *eval, Expr *expr, size_t *temps,
+    size_t *stack_size, BSLCompileResult *result)
+{
+  BSLAlloc *alloc = eval->alloc;
+  size_t depth = 0;
+  ExprWalk walk;
+  expr_walk_init(&walk, alloc, expr);
+  bool leaving;
+  while ((expr = expr_walk_next(&walk, &leaving)) != NULL)
+  {
+    if (!leaving)
+    {
+      if (type_size(expr->type) == 0)
+      {
+        result_error(result, expr->line, expr->col,
+            "expression type is not supported by the CPU evaluator");
+        expr_walk_release(&walk);
+        return false;
+      }
+      continue;
+    }
+
+    switch (expr->t)
+    {
+      case EXPR_NUM:
+      case EXPR_BINARY:
+      case EXPR_FMA:
+      case EXPR_VECTOR:
+        *temps += 1;
+        break;
+      case EXPR_RECORD:
+        *temps += type_size(expr->type);
+        break;
+      default:
+        break;
+    }
+
+    depth = depth - operand_count(expr) + 1;
+    if (depth > *stack_size)
+    {
+      *stack_size = depth;
+    }
+
+    if (eval->order_count == eval->order_cap)
+    {
+      size_t cap = eval->order_cap == 0 ? 64 : eval->order_cap * 2;
+      eval->order = alloc->fn(eval->order, eval->order_cap * sizeof(Expr *),
+          cap * sizeof(Expr *), alloc->ud);
+      eval->order_cap = cap;
+    }
+    eval->order[eval->order_count++] = expr;
+  }
+  return true;
+}
+
+static size_t operand_count(Expr *expr)
+{
+  size_t count = 0;
+  switch (expr->t)
+  {
+    case EXPR_MEMBER:
+      return 1;
+    case EXPR_BINARY:
+      return 2;
+    case EXPR_FMA:
+      return 3;
+    case EXPR_VECTOR: {
+      Expr *iter = expr->vec.exprs;
+      while (iter != NULL)
+      {
+        count++;
+        iter = iter->next;
+      }
+      return count;
+    }
+    case EXPR_RECORD: {
+      RecordExprMember *iter = expr->record.members;
+      while (iter != NULL)
+      {
+        count++;
+        iter = iter->next;
+      }
+      return count;
+    }
+    default:
+      return 0;
+  }
+}
+
+static EvalReg *push_regs(EvalState *state, size_t count)
+{
+  EvalReg *regs = state->scratch + state->top;
+  state->top += count;
+  return regs;
+}
+
+/* Takes the values of the operands off the stack and pushes the value of
+ * expr in their place. */
+static void eval_expr(EvalState *state, Expr *expr)
+{
+  EvalReg **stack = state->stack;
+  switch (expr->t)
+  {
+    case EXPR_VAR:
+      stack[state->depth++] = state->frame +
+        state->slots[expr->var.entry->index];
+      break;
+    case EXPR_MEMBER:
+      stack[state->depth - 1] += expr->member.entry->index;
+      break;
+    case EXPR_NUM: {
+      EvalReg *out = push_regs(state, 1);
+      lanes_splat(out->c[0], expr->num.t == NUMBER_INT ? 
+          (float) expr->num.i : (float) expr->num.f);
+      stack[state->depth++] = out;
+      break;
+    }
+    case EXPR_BINARY: {
+      EvalReg *lhs = stack[state->depth - 2];
+      EvalReg *rhs = stack[state->depth - 1];
+      EvalReg *out = push_regs(state, 1);
+      bool lhs_vec = expr->binary.lhs->type->t == TYPE_VECTOR;
+      bool rhs_vec = expr->binary.rhs->type->t == TYPE_VECTOR;
+      size_t comps = type_components(expr->type);
+      for (size_t c = 0; c < comps; c++)
+      {
+        const float *a = lhs->c[lhs_vec ? c : 0];
+        const float *b = rhs->c[rhs_vec ? c : 0];
+        switch (expr->binary.op)
+        {
+          case BINOP_ADD:
+            lanes_add(out->c[c], a, b);
+            break;
+          case BINOP_SUB:
+            lanes_sub(out->c[c], a, b);
+            break;
+          case BINOP_MUL:
+            lanes_mul(out->c[c], a, b);
+            break;
+          case BINOP_DIV:
+            lanes_div(out->c[c], a, b);
+            break;
+        }
+      }
+      state->depth -= 2;
+      stack[state->depth++] = out;
+      break;
+    }
+    case EXPR_FMA: {
+      EvalReg *lhs = stack[state->depth - 3];
+      EvalReg *rhs = stack[state->depth - 2];
+      EvalReg *addend = stack[state->depth - 1];
+      EvalReg *out = push_regs(state, 1);
+      bool lhs_vec = expr->fma.lhs->type->t == TYPE_VECTOR;
+      bool rhs_vec = expr->fma.rhs->type->t == TYPE_VECTOR;
+      size_t comps = type_components(expr->type);
+      for (size_t c = 0; c < comps; c++)
+      {
+        lanes_fma(out->c[c], lhs->c[lhs_vec ? c : 0], rhs->c[rhs_vec ? c : 0],
+            addend->c[c]);
+      }
+      state->depth -= 3;
+      stack[state->depth++] = out;
+      break;
+    }
+    case EXPR_VECTOR: {
+      size_t count = operand_count(expr);
+      EvalReg **values = &stack[state->depth - count];
+      EvalReg *out = push_regs(state, 1);
+      size_t c = 0;
+      Expr *iter = expr->vec.exprs;
+      while (iter != NULL)
+      {
+        size_t comps = type_components(iter->type);
+        memcpy(out->c[c], (*values++)->c[0], comps * LANE_BYTES);
+        c += comps;
+        iter = iter->next;
+      }
+      state->depth -= count;
+      stack[state->depth++] = out;
+      break;
+    }
+    case EXPR_RECORD: {
+      size_t count = operand_count(expr);
+      EvalReg **values = &stack[state->depth - count];
+      size_t size = type_size(expr->type);
+      EvalReg *out = push_regs(state, size);
+      memset(out, 0, size * sizeof(EvalReg));
+      RecordExprMember *iter = expr->record.members;
+      while (iter != NULL)
+      {
+        out[iter->entry->index] = **values++;
+        iter = iter->next;
+      }
+      state->depth -= count;
+      stack[state->depth++] = out;
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static bool bind_inputs(Toplevel *proc, const BSLVertexBinding *bindings, 
+    size_t binding_count, BSLCompileResult *result)
+{
+  Parameter *param = proc->proc.params;
+  while (param != NULL)
+  {
+    if (param->type->t != TYPE_RECORD)
+    {
+      result_error(result, param->line, param->col,
+          "entry point parameters must be records");
+      return false;
+    }
+
+    RecordEntry *entry = param->type->record.entries;
+    while (entry != NULL)
+    {
+      if (entry->t == RECORD_ENTRY_INPUT)
+      {
+        size_t i = 0;
+        while (i < binding_count && bindings[i].location != entry->pos)
+        {
+          i++;
+        }
+
+        if (i == binding_count)
+        {
+          result_error(result, param->line, param->col,
+              "no vertex input bound to location %d", entry->pos);
+          return false;
+        }
+      }
+      entry = entry->next;
+    }
+    param = param->next;
+  }
+  return true;
+}
+
+/* Reads one component of count vertices straight from the caller's
+ * buffer, converting to float. Components past the binding read as 0. */
+static void gather(float *lanes, const BSLVertexBinding *binding, int comp,
+    size_t first, size_t count)
+{
+  if (comp >= binding->components)
+  {
+    memset(lanes, 0, count * sizeof(float));
+    return;
+  }
+
+  const uint8_t *src = (const uint8_t *) binding->base + binding->offset + 
+    first * binding->stride;
+  size_t stride = binding->stride;
+  switch (binding->format)
+  {
+    case BSL_FORMAT_F32:
+      for (size_t l = 0; l < count; l++)
+      {
+        memcpy(&lanes[l], src + l * stride + comp * sizeof(float), 
+            sizeof(float));
+      }
+      break;
+    case BSL_FORMAT_U8_UNORM:
+      for (size_t l = 0; l < count; l++)
+      {
+        lanes[l] = src[l * stride + comp] * (1.0f / 255.0f);
+      }
+      break;
+    case BSL_FORMAT_I8_SNORM:
+      for (size_t l = 0; l < count; l++)
+      {
+        float v = (int8_t) src[l * stride + comp] * (1.0f / 127.0f);
+        lanes[l] = v < -1.0f ? -1.0f : v;
+      }
+      break;
+    case BSL_FORMAT_U16_UNORM:
+      for (size_t l = 0; l < count; l++)
+      {
+        uint16_t v;
+        memcpy(&v, src + l * stride + comp * sizeof(v), sizeof(v));
+        lanes[l] = v * (1.0f / 65535.0f);
+      }
+      break;
+    case BSL_FORMAT_I16_SNORM:
+      for (size_t l = 0; l < count; l++)
+      {
+        int16_t v;
+        memcpy(&v, src + l * stride + comp * sizeof(v), sizeof(v));
+        float f = v * (1.0f / 32767.0f);
+        lanes[l] = f < -1.0f ? -1.0f : f;
+      }
+      break;
+  }
+}
+
+static bool output_matches(RecordEntry *entry, int location)
+{
+  if (location == BSL_LOCATION_POSITION)
+  {
+    return entry->t == RECORD_ENTRY_BUILTIN && 
+      entry->builtin == BUILTIN_CLIP_POSITION;
+  }
+  return entry->t == RECORD_ENTRY_OUTPUT && entry->pos == location;
+}
+
+/* Linking moves and removes outputs, so a location the caller still has
+ * from the source may be gone. */
+static bool check_outputs(Toplevel *proc, const BSLVertexOutput *outputs,
+    size_t output_count, BSLCompileResult *result)
+{
+  for (size_t i = 0; i < output_count; i++)
+  {
+    RecordEntry *entry = proc->proc.return_type->record.entries;
+    while (entry != NULL && !output_matches(entry, outputs[i].location))
+    {
+      entry = entry->next;
+    }
+
+    if (entry == NULL)
+    {
+      result_error(result, proc->line, proc->col,
+          "no vertex output at location %d", outputs[i].location);
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,436 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <bsl/eval.h>
+#include <bsl/module.h>
+
+/* Lanes are filled with 2x2 quads side by side, so one batch covers two
+ * rows of QUAD_COLS pixels. */
+#define QUAD_COLS (BSL_EVAL_LANES / 2)
+#define TILE_W (((32 + QUAD_COLS - 1) / QUAD_COLS) * QUAD_COLS)
+#define TILE_H 32
+
+#define MAX_WORKERS 256
+
+typedef struct
+{
+  atomic_size_t next;
+  size_t end;
+} TileRange;
+
+typedef struct Raster
+{
+  EvalProc eval;
+  const BSLFragmentInput *inputs;
+  size_t input_count;
+  BSLFragmentOutput *outputs;
+  size_t output_count;
+  int width, height;
+  int tiles_x;
+  TileRange ranges[MAX_WORKERS];
+  size_t worker_count;
+} Raster;
+
+typedef struct
+{
+  Raster *raster;
+  size_t index;
+  EvalReg *frame;
+  EvalReg *scratch;
+} Worker;
+
+/* Worker threads are started on first use and then parked on wake for the
+ * life of the process. A render hands pool thread i the worker i + 1 and
+ * runs worker 0 itself; one render holds the pool at a time. */
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  pthread_cond_t idle;
+  size_t thread_count;
+  uint64_t generation;
+  Worker *workers;
+  size_t worker_count;
+  size_t pending;
+  bool busy;
+} Pool;
+
+static Pool pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+  .idle = PTHREAD_COND_INITIALIZER,
+};
+
+/* === PROTOTYPES === */
+
+static bool check_inputs(Toplevel *proc, const BSLFragmentInput *inputs,
+    size_t input_count, BSLCompileResult *result);
+static bool check_outputs(const BSLFragmentOutput *outputs,
+    size_t output_count, int width, int height, BSLCompileResult *result);
+static void run_workers(Worker *workers, size_t worker_count);
+static void *pool_thread(void *ud);
+static void run_worker(Worker *worker);
+static void run_tile(Worker *worker, size_t tile);
+static void run_batch(Worker *worker, int x, int y, int x_end, int y_end);
+
+/* === PUBLIC FUNCTIONS === */
+
+bool bsl_eval_fragment(BSLModule *module, const char *entry_point,
+    const BSLFragmentInput *inputs, size_t input_count,
+    BSLFragmentOutput *outputs, size_t output_count,
+    int width, int height, int thread_count, BSLCompileResult *result)
+{
+  if (!check_outputs(outputs, output_count, width, height, result))
+  {
+    return false;
+  }
+
+  Raster raster;
+  BSLAlloc *alloc = &module->alloc;
+  Toplevel *proc = eval_find_entry_point(&module->ast, entry_point,
+      ENTRY_POINT_FRAGMENT, result);
+  if (proc == NULL || !eval_prepare(proc, alloc, &raster.eval, result))
+  {
+    return false;
+  }
+
+  if (proc->proc.return_type->t != TYPE_RECORD)
+  {
+    result_error(result, proc->line, proc->col,
+        "fragment entry point must return a record");
+    eval_release(&raster.eval);
+    return false;
+  }
+
+  if (!check_inputs(proc, inputs, input_count, result))
+  {
+    eval_release(&raster.eval);
+    return false;
+  }
+
+  if (thread_count <= 0)
+  {
+    thread_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (thread_count < 1)
+  {
+    thread_count = 1;
+  } else if (thread_count > MAX_WORKERS)
+  {
+    thread_count = MAX_WORKERS;
+  }
+
+  raster.inputs = inputs;
+  raster.input_count = input_count;
+  raster.outputs = outputs;
+  raster.output_count = output_count;
+  raster.width = width;
+  raster.height = height;
+  raster.tiles_x = (width + TILE_W - 1) / TILE_W;
+  raster.worker_count = thread_count;
+
+  /* Each worker starts on its own contiguous run of tiles and steals from
+   * the others' counters once it runs dry. */
+  size_t tile_count = (size_t) raster.tiles_x * ((height + TILE_H - 1) / TILE_H);
+  for (size_t i = 0; i < raster.worker_count; i++)
+  {
+    atomic_init(&raster.ranges[i].next, tile_count * i / raster.worker_count);
+    raster.ranges[i].end = tile_count * (i + 1) / raster.worker_count;
+  }
+
+  size_t frame_bytes = raster.eval.frame_size * sizeof(EvalReg);
+  size_t scratch_bytes = raster.eval.scratch_size * sizeof(EvalReg);
+  size_t workers_bytes = raster.worker_count * sizeof(Worker);
+  Worker *workers = alloc->fn(NULL, 0, workers_bytes, alloc->ud);
+  for (size_t i = 0; i < raster.worker_count; i++)
+  {
+    workers[i].raster = &raster;
+    workers[i].index = i;
+    workers[i].frame = alloc->fn(NULL, 0, frame_bytes, alloc->ud);
+    workers[i].scratch = alloc->fn(NULL, 0, scratch_bytes, alloc->ud);
+    memset(workers[i].frame, 0, frame_bytes);
+  }
+
+  run_workers(workers, raster.worker_count);
+
+  for (size_t i = 0; i < raster.worker_count; i++)
+  {
+    alloc->fn(workers[i].scratch, scratch_bytes, 0, alloc->ud);
+    alloc->fn(workers[i].frame, frame_bytes, 0, alloc->ud);
+  }
+  alloc->fn(workers, workers_bytes, 0, alloc->ud);
+  eval_release(&raster.eval);
+  return true;
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static bool check_inputs(Toplevel *proc, const BSLFragmentInput *inputs,
+    size_t input_count, BSLCompileResult *result)
+{
+  Parameter *param = proc->proc.params;
+  while (param != NULL)
+  {
+    if (param->type->t != TYPE_RECORD)
+    {
+      result_error(result, param->line, param->col,
+          "entry point parameters must be records");
+      return false;
+    }
+
+    RecordEntry *entry = param->type->record.entries;
+    while (entry != NULL)
+    {
+      if (entry->t == RECORD_ENTRY_INPUT)
+      {
+        size_t i = 0;
+        while (i < input_count && inputs[i].location != entry->pos)
+        {
+          i++;
+        }
+
+        if (i == input_count)
+        {
+          result_error(result, param->line, param->col,
+              "no fragment input bound to location %d", entry->pos);
+          return false;
+        }
+      }
+      entry = entry->next;
+    }
+    param = param->next;
+  }
+  return true;
+}
+
+static bool check_outputs(const BSLFragmentOutput *outputs,
+    size_t output_count, int width, int height, BSLCompileResult *result)
+{
+  if (width <= 0 || height <= 0)
+  {
+    result_error(result, 0, 0, "invalid fragment size %dx%d", width, height);
+    return false;
+  }
+
+  size_t pixels = (size_t) width * (size_t) height;
+  for (size_t i = 0; i < output_count; i++)
+  {
+    if (outputs[i].components <= 0 ||
+        pixels > SIZE_MAX / sizeof(float) / (size_t) outputs[i].components)
+    {
+      result_error(result, 0, 0,
+          "fragment output at location %d does not fit %dx%d pixels",
+          outputs[i].location, width, height);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void run_workers(Worker *workers, size_t worker_count)
+{
+  pthread_mutex_lock(&pool.lock);
+  while (pool.busy)
+  {
+    pthread_cond_wait(&pool.idle, &pool.lock);
+  }
+  pool.busy = true;
+
+  while (pool.thread_count + 1 < worker_count)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, pool_thread,
+          (void *) (uintptr_t) pool.thread_count) != 0)
+    {
+      break;
+    }
+    pthread_detach(thread);
+    pool.thread_count++;
+  }
+
+  size_t helped = pool.thread_count + 1 < worker_count ?
+    pool.thread_count + 1 : worker_count;
+  pool.workers = workers;
+  pool.worker_count = helped;
+  pool.pending = helped - 1;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+
+  /* Workers without a thread simply have their tiles stolen. */
+  run_worker(&workers[0]);
+  for (size_t i = helped; i < worker_count; i++)
+  {
+    run_worker(&workers[i]);
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  while (pool.pending > 0)
+  {
+    pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pool.busy = false;
+  pthread_cond_signal(&pool.idle);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+/* Starts with seen at 0 so a thread created for the current render still
+ * picks it up. */
+static void *pool_thread(void *ud)
+{
+  size_t index = (size_t) (uintptr_t) ud + 1;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool.lock);
+  for (;;)
+  {
+    while (pool.generation == seen)
+    {
+      pthread_cond_wait(&pool.wake, &pool.lock);
+    }
+    seen = pool.generation;
+    if (index >= pool.worker_count)
+    {
+      continue;
+    }
+
+    Worker *worker = &pool.workers[index];
+    pthread_mutex_unlock(&pool.lock);
+    run_worker(worker);
+    pthread_mutex_lock(&pool.lock);
+
+    if (--pool.pending == 0)
+    {
+      pthread_cond_signal(&pool.done);
+    }
+  }
+  return NULL;
+}
+
+static void run_worker(Worker *worker)
+{
+  Raster *raster = worker->raster;
+
+  for (size_t i = 0; i < raster->worker_count; i++)
+  {
+    TileRange *range = &raster->ranges[(worker->index + i) %
+      raster->worker_count];
+    size_t tile;
+    while ((tile = atomic_fetch_add(&range->next, 1)) < range->end)
+    {
+      run_tile(worker, tile);
+    }
+  }
+}
+
+static void run_tile(Worker *worker, size_t tile)
+{
+  Raster *raster = worker->raster;
+  int x0 = (int) (tile % raster->tiles_x) * TILE_W;
+  int y0 = (int) (tile / raster->tiles_x) * TILE_H;
+  int x1 = x0 + TILE_W < raster->width ? x0 + TILE_W : raster->width;
+  int y1 = y0 + TILE_H < raster->height ? y0 + TILE_H : raster->height;
+
+  for (int y = y0; y < y1; y += 2)
+  {
+    for (int x = x0; x < x1; x += QUAD_COLS)
+    {
+      run_batch(worker, x, y, x1, y1);
+    }
+  }
+}
+
+static void run_batch(Worker *worker, int x, int y, int x_end, int y_end)
+{
+  Raster *raster = worker->raster;
+  Toplevel *proc = raster->eval.proc;
+  float px[BSL_EVAL_LANES], py[BSL_EVAL_LANES];
+  for (int l = 0; l < BSL_EVAL_LANES; l++)
+  {
+    px[l] = (float) (x + (l / 4) * 2 + (l & 1)) + 0.5f;
+    py[l] = (float) (y + ((l >> 1) & 1)) + 0.5f;
+  }
+
+  Parameter *param = proc->proc.params;
+  while (param != NULL)
+  {
+    RecordEntry *entry = param->type->record.entries;
+    while (entry != NULL)
+    {
+      EvalReg *reg = worker->frame + raster->eval.slots[param->entry->index] +
+        entry->index;
+      int comps = entry->type->t == TYPE_VECTOR ? entry->type->vec.size : 1;
+      if (entry->t == RECORD_ENTRY_INPUT)
+      {
+        const BSLFragmentInput *input = raster->inputs;
+        while (input->location != entry->pos)
+        {
+          input++;
+        }
+
+        for (int c = 0; c < comps; c++)
+        {
+          int from = entry->component + c;
+          bool bound = from < input->components;
+          float a = bound ? input->a[from] : 0.0f;
+          float dx = bound ? input->dx[from] : 0.0f;
+          float dy = bound ? input->dy[from] : 0.0f;
+          for (int l = 0; l < BSL_EVAL_LANES; l++)
+          {
+            reg->c[c][l] = a + dx * px[l] + dy * py[l];
+          }
+        }
+      } else if (entry->t == RECORD_ENTRY_BUILTIN &&
+          entry->builtin == BUILTIN_CLIP_POSITION)
+      {
+        for (int l = 0; l < BSL_EVAL_LANES; l++)
+        {
+          float pos[4] = { px[l], py[l], 0.0f, 1.0f };
+          for (int c = 0; c < comps; c++)
+          {
+            reg->c[c][l] = pos[c];
+          }
+        }
+      }
+      entry = entry->next;
+    }
+    param = param->next;
+  }
+
+  EvalReg *ret = eval_run(&raster->eval, worker->frame, worker->scratch);
+
+  for (size_t i = 0; i < raster->output_count; i++)
+  {
+    BSLFragmentOutput *output = &raster->outputs[i];
+    RecordEntry *entry = proc->proc.return_type->record.entries;
+    while (entry != NULL)
+    {
+      if (entry->t == RECORD_ENTRY_OUTPUT && entry->pos == output->location)
+      {
+        int comps = entry->type->t == TYPE_VECTOR ? entry->type->vec.size : 1;
+        for (int l = 0; l < BSL_EVAL_LANES; l++)
+        {
+          int lx = (int) px[l], ly = (int) py[l];
+          if (lx >= x_end || ly >= y_end)
+          {
+            continue;
+          }
+
+          float *dst = output->data +
+            ((size_t) ly * raster->width + lx) * output->components;
+          for (int c = 0; c < comps &&
+              entry->component + c < output->components; c++)
+          {
+            dst[entry->component + c] = ret[entry->index].c[c][l];
+          }
+        }
+      }
+      entry = entry->next;
+    }
+  }
+}
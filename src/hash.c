@@ -0,0 +1,413 @@
+#include <string.h>
+
+#include <bsl/hash.h>
+
+typedef struct
+{
+  Expr *expr;
+  uint32_t value;
+} HashItem;
+
+#define HASH_INLINE_ITEMS 32
+
+/* === PROTOTYPES === */
+
+static void hash_u32(Sha256 *sha, uint32_t value);
+static void hash_type(Sha256 *sha, Type *type);
+static void hash_record_entries(Sha256 *sha, RecordEntry *entry);
+static void hash_expr(Sha256 *sha, BSLAlloc *alloc, const uint32_t *numbers,
+    Expr *expr);
+static void push_item(BSLAlloc *alloc, HashItem **items,
+    HashItem *inline_items, size_t *count, size_t *cap, Expr *expr,
+    uint32_t value);
+static void hash_proc(Sha256 *sha, BSLAlloc *alloc, Toplevel *proc);
+static void reflect_proc(BSLAlloc *alloc, Toplevel *proc,
+    BSLEntryPointHash *hash);
+static size_t reflect_record(Type *type, RecordEntryType t,
+    BSLInterfaceVarying *out);
+
+/* === PUBLIC FUNCTIONS === */
+
+void hash_entry_points(AST *ast)
+{
+  BSLCompileResult *result = ast->result;
+  size_t count = 0;
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    count += iter->t == TOPLEVEL_PROC && iter->proc.entry_point != 0;
+    iter = iter->next;
+  }
+
+  result->entry_hashes = NULL;
+  result->entry_hash_count = count;
+  if (count == 0)
+  {
+    return;
+  }
+
+  result->entry_hashes = ast->alloc->fn(NULL, 0,
+      count * sizeof(BSLEntryPointHash), ast->alloc->ud);
+
+  size_t i = 0;
+  iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC && iter->proc.entry_point != 0)
+    {
+      BSLEntryPointHash *hash = &result->entry_hashes[i++];
+      char *name = ast->alloc->fn(NULL, 0, iter->proc.name_len + 1,
+          ast->alloc->ud);
+      memcpy(name, iter->proc.name, iter->proc.name_len);
+      name[iter->proc.name_len] = '\0';
+      hash->name = name;
+      hash->stage = (BSLStage) iter->proc.entry_point;
+      reflect_proc(ast->alloc, iter, hash);
+
+      Sha256 sha;
+      sha256_init(&sha);
+      hash_proc(&sha, ast->alloc, iter);
+      sha256_final(&sha, hash->hash);
+    }
+    iter = iter->next;
+  }
+}
+
+/* Covers every proc by name, which is all that reaches backend output
+ * once dead code is gone. */
+void hash_module(AST *ast, uint8_t digest[SHA256_DIGEST_LEN])
+{
+  Sha256 sha;
+  sha256_init(&sha);
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC)
+    {
+      hash_u32(&sha, (uint32_t) iter->proc.name_len);
+      sha256_update(&sha, iter->proc.name, iter->proc.name_len);
+      hash_proc(&sha, ast->alloc, iter);
+    }
+    iter = iter->next;
+  }
+  sha256_final(&sha, digest);
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static void hash_u32(Sha256 *sha, uint32_t value)
+{
+  uint8_t bytes[4] = {
+    (uint8_t) value, (uint8_t) (value >> 8),
+    (uint8_t) (value >> 16), (uint8_t) (value >> 24),
+  };
+  sha256_update(sha, bytes, sizeof(bytes));
+}
+
+static void hash_type(Sha256 *sha, Type *type)
+{
+  hash_u32(sha, type->t);
+  switch (type->t)
+  {
+    case TYPE_VECTOR:
+      hash_u32(sha, type->vec.size);
+      hash_type(sha, type->vec.type);
+      break;
+    case TYPE_RECORD: {
+      /* Records are structural: names drop out, entries go in
+       * declaration order with their interface attributes. */
+      Toplevel *record = type->record.toplevel;
+      hash_u32(sha, record->record.entry_count);
+      hash_record_entries(sha, record->record.entries);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+/* Entries are kept in reverse declaration order, so the rest of the list
+ * goes first. */
+static void hash_record_entries(Sha256 *sha, RecordEntry *entry)
+{
+  if (entry == NULL)
+  {
+    return;
+  }
+
+  hash_record_entries(sha, entry->next);
+  hash_u32(sha, entry->t);
+  switch (entry->t)
+  {
+    case RECORD_ENTRY_INPUT:
+    case RECORD_ENTRY_OUTPUT:
+      hash_u32(sha, entry->pos);
+      hash_u32(sha, entry->component);
+      break;
+    case RECORD_ENTRY_BUILTIN:
+      hash_u32(sha, entry->builtin);
+      break;
+    default:
+      break;
+  }
+  hash_type(sha, entry->type);
+}
+
+/* Hashes in preorder over a stack of pending items rather than by
+ * recursion, so the depth of an expression costs no native stack. An item
+ * is an expression, or a value to hash when it has none; operands are
+ * pushed last first. */
+static void hash_expr(Sha256 *sha, BSLAlloc *alloc, const uint32_t *numbers,
+    Expr *expr)
+{
+  HashItem inline_items[HASH_INLINE_ITEMS];
+  HashItem *items = inline_items;
+  size_t count = 0, cap = HASH_INLINE_ITEMS;
+  push_item(alloc, &items, inline_items, &count, &cap, expr, 0);
+  while (count > 0)
+  {
+    HashItem item = items[--count];
+    expr = item.expr;
+    if (expr == NULL)
+    {
+      hash_u32(sha, item.value);
+      continue;
+    }
+
+    hash_u32(sha, expr->t);
+    switch (expr->t)
+    {
+      case EXPR_VAR:
+        hash_u32(sha, numbers[expr->var.entry->index]);
+        break;
+      case EXPR_NUM: {
+        /* 2 and 2.0 are the same value once typed as f32. */
+        double value = expr->num.t == NUMBER_INT ?
+          (double) expr->num.i : expr->num.f;
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        hash_u32(sha, (uint32_t) bits);
+        hash_u32(sha, (uint32_t) (bits >> 32));
+        break;
+      }
+      case EXPR_RECORD: {
+        /* Members go by entry, each after whether it is there. */
+        hash_type(sha, expr->type);
+        size_t entry_count = expr->type->record.toplevel->record.entry_count;
+        RecordExprMember **members = alloc->fn(NULL, 0,
+            entry_count * sizeof(RecordExprMember *), alloc->ud);
+        memset(members, 0, entry_count * sizeof(RecordExprMember *));
+        RecordExprMember *member = expr->record.members;
+        while (member != NULL)
+        {
+          members[member->entry->index] = member;
+          member = member->next;
+        }
+
+        for (size_t i = entry_count; i-- > 0;)
+        {
+          if (members[i] != NULL)
+          {
+            push_item(alloc, &items, inline_items, &count, &cap,
+                members[i]->expr, 0);
+          }
+          push_item(alloc, &items, inline_items, &count, &cap, NULL,
+              members[i] != NULL);
+        }
+        alloc->fn(members, entry_count * sizeof(RecordExprMember *), 0,
+            alloc->ud);
+        break;
+      }
+      case EXPR_MEMBER:
+        hash_u32(sha, expr->member.entry->index);
+        push_item(alloc, &items, inline_items, &count, &cap,
+            expr->member.lhs, 0);
+        break;
+      case EXPR_VECTOR: {
+        hash_type(sha, expr->type);
+        size_t first = count;
+        Expr *iter = expr->vec.exprs;
+        while (iter != NULL)
+        {
+          push_item(alloc, &items, inline_items, &count, &cap, iter, 0);
+          iter = iter->next;
+        }
+        for (size_t i = first, j = count - 1; i < j; i++, j--)
+        {
+          HashItem tmp = items[i];
+          items[i] = items[j];
+          items[j] = tmp;
+        }
+        break;
+      }
+      case EXPR_BINARY:
+        hash_u32(sha, expr->binary.op);
+        push_item(alloc, &items, inline_items, &count, &cap,
+            expr->binary.rhs, 0);
+        push_item(alloc, &items, inline_items, &count, &cap,
+            expr->binary.lhs, 0);
+        break;
+      case EXPR_FMA:
+        push_item(alloc, &items, inline_items, &count, &cap,
+            expr->fma.addend, 0);
+        push_item(alloc, &items, inline_items, &count, &cap,
+            expr->fma.rhs, 0);
+        push_item(alloc, &items, inline_items, &count, &cap,
+            expr->fma.lhs, 0);
+        break;
+    }
+  }
+
+  if (items != inline_items)
+  {
+    alloc->fn(items, cap * sizeof(HashItem), 0, alloc->ud);
+  }
+}
+
+static void push_item(BSLAlloc *alloc, HashItem **items,
+    HashItem *inline_items, size_t *count, size_t *cap, Expr *expr,
+    uint32_t value)
+{
+  if (*count == *cap)
+  {
+    HashItem *grown = alloc->fn(NULL, 0, *cap * 2 * sizeof(HashItem),
+        alloc->ud);
+    memcpy(grown, *items, *count * sizeof(HashItem));
+    if (*items != inline_items)
+    {
+      alloc->fn(*items, *cap * sizeof(HashItem), 0, alloc->ud);
+    }
+    *items = grown;
+    *cap *= 2;
+  }
+  (*items)[(*count)++] = (HashItem) { .expr = expr, .value = value };
+}
+
+/* Variables are hashed by the order they are defined in, so their names
+ * drop out. */
+static void hash_proc(Sha256 *sha, BSLAlloc *alloc, Toplevel *proc)
+{
+  size_t numbers_size = proc->proc.scope.entry_count * sizeof(uint32_t);
+  uint32_t *numbers = alloc->fn(NULL, 0, numbers_size, alloc->ud);
+  uint32_t next_var = 0;
+  size_t param_count = 0;
+  Parameter *param = proc->proc.params;
+  while (param != NULL)
+  {
+    param_count++;
+    param = param->next;
+  }
+
+  /* Parameters are kept in reverse declaration order. */
+  hash_u32(sha, proc->proc.entry_point);
+  hash_u32(sha, (uint32_t) param_count);
+  next_var = (uint32_t) param_count;
+  param = proc->proc.params;
+  while (param != NULL)
+  {
+    numbers[param->entry->index] = --next_var;
+    param = param->next;
+  }
+
+  for (uint32_t i = 0; i < param_count; i++)
+  {
+    param = proc->proc.params;
+    while (numbers[param->entry->index] != i)
+    {
+      param = param->next;
+    }
+    hash_type(sha, param->type);
+  }
+  hash_type(sha, proc->proc.return_type);
+
+  next_var = (uint32_t) param_count;
+  Statement *stmt = proc->proc.stmts;
+  while (stmt != NULL)
+  {
+    hash_u32(sha, stmt->t);
+    switch (stmt->t)
+    {
+      case STATEMENT_VAR:
+        hash_type(sha, stmt->var.type);
+        hash_expr(sha, alloc, numbers, stmt->var.expr);
+        numbers[stmt->var.entry->index] = next_var++;
+        break;
+      case STATEMENT_RETURN:
+        hash_expr(sha, alloc, numbers, stmt->ret.expr);
+        break;
+    }
+    stmt = stmt->next;
+  }
+  alloc->fn(numbers, numbers_size, 0, alloc->ud);
+}
+
+/* The interface is kept with the hash so it survives the module, as in
+ * cached results. */
+static void reflect_proc(BSLAlloc *alloc, Toplevel *proc,
+    BSLEntryPointHash *hash)
+{
+  Type *return_type = proc->proc.return_type;
+  size_t input_count = 0;
+  Parameter *param = proc->proc.params;
+  while (param != NULL)
+  {
+    input_count += reflect_record(param->type, RECORD_ENTRY_INPUT, NULL);
+    param = param->next;
+  }
+  size_t output_count =
+    reflect_record(return_type, RECORD_ENTRY_OUTPUT, NULL) +
+    reflect_record(return_type, RECORD_ENTRY_BUILTIN, NULL);
+
+  hash->varyings = NULL;
+  hash->input_count = input_count;
+  hash->output_count = output_count;
+  if (input_count + output_count == 0)
+  {
+    return;
+  }
+
+  BSLInterfaceVarying *varyings = alloc->fn(NULL, 0,
+      (input_count + output_count) * sizeof(BSLInterfaceVarying), alloc->ud);
+  BSLInterfaceVarying *out = varyings;
+  param = proc->proc.params;
+  while (param != NULL)
+  {
+    out += reflect_record(param->type, RECORD_ENTRY_INPUT, out);
+    param = param->next;
+  }
+  out += reflect_record(return_type, RECORD_ENTRY_OUTPUT, out);
+  reflect_record(return_type, RECORD_ENTRY_BUILTIN, out);
+  hash->varyings = varyings;
+}
+
+/* Counts the entries of kind t, filling out when given. */
+static size_t reflect_record(Type *type, RecordEntryType t,
+    BSLInterfaceVarying *out)
+{
+  if (type->t != TYPE_RECORD)
+  {
+    return 0;
+  }
+
+  size_t count = 0;
+  RecordEntry *entry = type->record.entries;
+  while (entry != NULL)
+  {
+    if (entry->t == t && (t != RECORD_ENTRY_BUILTIN ||
+          entry->builtin == BUILTIN_CLIP_POSITION))
+    {
+      if (out != NULL)
+      {
+        out[count].location = t == RECORD_ENTRY_BUILTIN ?
+          BSL_LOCATION_POSITION : entry->pos;
+        out[count].component = t == RECORD_ENTRY_BUILTIN ?
+          0 : entry->component;
+        out[count].components = entry->type->t == TYPE_VECTOR ?
+          entry->type->vec.size : 1;
+      }
+      count++;
+    }
+    entry = entry->next;
+  }
+  return count;
+}
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bsl/cache.h>
+#include <bsl/import.h>
+#include <bsl/lexer.h>
+#include <bsl/module.h>
+
+#define IMPORT_PATH_MAX 4096
+#define IMPORT_MAX_DEPTH 32
+
+/* === PROTOTYPES === */
+
+static bool find_module(BSLCompileInfo *info, const char *name,
+    size_t name_len, char *path);
+static uint8_t *read_file(BSLCompileInfo *info, const char *path,
+    size_t *len);
+static bool key_source(BSLCompileInfo *info, const uint8_t *src, size_t len,
+    uint8_t key[SHA256_DIGEST_LEN], int depth);
+static BSLModule *build_summary(BSLCompileInfo *info, Import *import,
+    uint8_t *src, size_t len, AST *ast);
+
+/* === PUBLIC FUNCTIONS === */
+
+bool import_key(BSLCompileInfo *info, uint8_t key[SHA256_DIGEST_LEN])
+{
+  return key_source(info, info->src, info->src_len, key, 0);
+}
+
+/* A module that fails is reported and the next one loaded regardless. */
+bool load_imports(AST *ast, BSLCompileInfo *info)
+{
+  bool ok = true;
+  Import *import = ast->imports;
+  for (; import != NULL; import = import->next)
+  {
+    if (!limits_check(ast->limits, ast->result, import->line, import->col))
+    {
+      return false;
+    }
+
+    char path[IMPORT_PATH_MAX];
+    if (!find_module(info, (const char *) import->name, import->name_len,
+          path))
+    {
+      result_error_code(ast->result, BSL_ERROR_IMPORT, import->line,
+          import->col, "could not find module '%.*s'", import->name_len,
+          import->name);
+      result_report(ast->result, ast->alloc);
+      ok = false;
+      continue;
+    }
+
+    size_t len;
+    uint8_t *src = read_file(info, path, &len);
+    uint8_t key[SHA256_DIGEST_LEN];
+    if (src == NULL || !key_source(info, src, len, key, 1))
+    {
+      if (src != NULL)
+      {
+        info->internal_fn(src, len + 1, 0, info->internal_ud);
+      }
+      result_error_code(ast->result, BSL_ERROR_IMPORT, import->line,
+          import->col, "could not read module '%.*s' or one of its imports",
+          import->name_len, import->name);
+      result_report(ast->result, ast->alloc);
+      ok = false;
+      continue;
+    }
+
+    /* Summaries are archives named by key next to the compile cache. */
+    char summary[CACHE_PATH_MAX] = "";
+    if (info->cache_dir != NULL && !cache_path(info, key, summary))
+    {
+      summary[0] = '\0';
+    }
+
+    BSLCompileResult load_result;
+    if (summary[0] != '\0' && bsl_module_load(summary, info->internal_fn,
+          info->internal_ud, &import->module, &load_result))
+    {
+      info->internal_fn(src, len + 1, 0, info->internal_ud);
+    } else
+    {
+      /* The summary keeps pointing into the source, which lives as long
+       * as the importing module. */
+      import->module = build_summary(info, import, src, len, ast);
+      if (import->module == NULL)
+      {
+        info->internal_fn(src, len + 1, 0, info->internal_ud);
+        if (ast->result->limit_exceeded)
+        {
+          return false;
+        }
+        ok = false;
+        continue;
+      }
+
+      char tmp[CACHE_PATH_MAX];
+      int fd = summary[0] != '\0' ? cache_temp(info, tmp) : -1;
+      if (fd >= 0)
+      {
+        close(fd);
+        if (bsl_module_save(import->module, tmp, &load_result))
+        {
+          cache_commit(info, tmp, summary);
+        } else
+        {
+          unlink(tmp);
+        }
+      }
+    }
+  }
+  return ok;
+}
+
+/* Summaries built here hold imports of their own. */
+void unload_imports(Import *import)
+{
+  for (; import != NULL; import = import->next)
+  {
+    if (import->module != NULL)
+    {
+      unload_imports(import->module->ast.imports);
+      bsl_module_unload(import->module);
+      import->module = NULL;
+    }
+  }
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static bool find_module(BSLCompileInfo *info, const char *name,
+    size_t name_len, char *path)
+{
+  for (size_t i = 0; i < info->import_dir_count; i++)
+  {
+    int len = snprintf(path, IMPORT_PATH_MAX, "%s/%.*s.bsl",
+        info->import_dirs[i], (int) name_len, name);
+    if (len > 0 && len < IMPORT_PATH_MAX && access(path, R_OK) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint8_t *read_file(BSLCompileInfo *info, const char *path, size_t *len)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return NULL;
+  }
+
+  long size;
+  if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 ||
+      fseek(file, 0, SEEK_SET) != 0)
+  {
+    fclose(file);
+    return NULL;
+  }
+
+  /* Never zero bytes, so an empty module still has a buffer. */
+  uint8_t *src = info->internal_fn(NULL, 0, size + 1, info->internal_ud);
+  if (fread(src, 1, size, file) != (size_t) size)
+  {
+    info->internal_fn(src, size + 1, 0, info->internal_ud);
+    fclose(file);
+    return NULL;
+  }
+  fclose(file);
+  *len = size;
+  return src;
+}
+
+/* A module's key covers its source and, transitively, the keys of what it
+ * imports. Finding the imports only takes a pass of the lexer. */
+static bool key_source(BSLCompileInfo *info, const uint8_t *src, size_t len,
+    uint8_t key[SHA256_DIGEST_LEN], int depth)
+{
+  if (depth > IMPORT_MAX_DEPTH)
+  {
+    return false;
+  }
+
+  Sha256 sha;
+  uint64_t len64 = len;
+  sha256_init(&sha);
+  sha256_update(&sha, "import " BSL_VERSION, strlen("import " BSL_VERSION));
+  sha256_update(&sha, &len64, sizeof(len64));
+  sha256_update(&sha, src, len);
+
+  Lexer lexer;
+  BSLCompileResult result;
+  lexer_init(&lexer, src, len, &result);
+  Token tok;
+  while ((tok = lexer_next(&lexer)).t != TOKEN_EOF && tok.t != TOKEN_ERR)
+  {
+    if (tok.t != TOKEN_KW_IMPORT)
+    {
+      continue;
+    }
+
+    tok = lexer_next(&lexer);
+    char path[IMPORT_PATH_MAX];
+    if (tok.t != TOKEN_SYM)
+    {
+      break;
+    }
+    if (!find_module(info, tok.sym.data, tok.sym.size, path))
+    {
+      return false;
+    }
+
+    size_t dep_len;
+    uint8_t *dep = read_file(info, path, &dep_len);
+    uint8_t dep_key[SHA256_DIGEST_LEN];
+    bool ok = dep != NULL &&
+      key_source(info, dep, dep_len, dep_key, depth + 1);
+    if (dep != NULL)
+    {
+      info->internal_fn(dep, dep_len + 1, 0, info->internal_ud);
+    }
+    if (!ok)
+    {
+      return false;
+    }
+    sha256_update(&sha, dep_key, sizeof(dep_key));
+  }
+
+  sha256_final(&sha, key);
+  return true;
+}
+
+/* Compiles the module on its own and drops everything but the interface:
+ * records and proc signatures. Its errors are reported at the import. */
+static BSLModule *build_summary(BSLCompileInfo *info, Import *import,
+    uint8_t *src, size_t len, AST *ast)
+{
+  BSLCompileInfo module_info = *info;
+  module_info.src = src;
+  module_info.src_len = len;
+  module_info.entry_points = NULL;
+  module_info.entry_point_count = 0;
+  module_info.backend = BSL_BACKEND_NONE;
+  module_info.link_stages = false;
+  /* Its time is already counted as the importer's import phase. */
+  module_info.stats = NULL;
+  module_info.max_time_ns = limits_time_left(ast->limits);
+
+  BSLCompileResult module_result;
+  if (!bsl_compile(&module_info, &module_result))
+  {
+    for (size_t i = 0; i < module_result.diagnostic_count; i++)
+    {
+      BSLDiagnostic *diagnostic = &module_result.diagnostics[i];
+      result_error_code(ast->result, diagnostic->code, import->line,
+          import->col, "in module '%.*s' at %d:%d: %s", import->name_len,
+          import->name, diagnostic->line, diagnostic->col, diagnostic->msg);
+      result_report(ast->result, ast->alloc);
+    }
+    info->internal_fn(module_result.diagnostics,
+        module_result.diagnostic_count * sizeof(BSLDiagnostic), 0,
+        info->internal_ud);
+    ast->result->limit_exceeded = module_result.limit_exceeded;
+    return NULL;
+  }
+
+  Toplevel *iter = module_result.module->ast.toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC)
+    {
+      iter->proc.entry_point = 0;
+      iter->proc.stmts = NULL;
+      iter->proc.scope.entries = NULL;
+      iter->proc.scope.entry_count = 0;
+      iter->proc.scope.index.cap = 0;
+    }
+    iter = iter->next;
+  }
+  return module_result.module;
+}
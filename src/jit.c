@@ -0,0 +1,587 @@
+#include <string.h>
+
+#include <bsl/vm.h>
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(BSL_NO_JIT)
+
+#include <sys/mman.h>
+
+#define XMM_ALLOCATABLE 14
+#define XMM_SCRATCH0 14
+#define XMM_SCRATCH1 15
+
+#define REG_RAX 0
+#define REG_RSP 4
+#define REG_RSI 6
+#define REG_RDI 7
+#define REG_R8 8
+
+/* Bytes at the bottom of the frame used to shuffle vector components. */
+#define FRAME_SCRATCH 32
+
+#define SSE_MOVUPS_LOAD 0x10
+#define SSE_MOVUPS_STORE 0x11
+#define SSE_MOVAPS 0x28
+#define SSE_ADDPS 0x58
+#define SSE_MULPS 0x59
+#define SSE_SUBPS 0x5C
+#define SSE_DIVPS 0x5E
+#define SSE_SHUFPS 0xC6
+#define VEX_VFMADD231PS 0xB8
+
+/* Where a value lives: an xmm register, or a spill slot when negative. */
+typedef struct
+{
+  int start, end;
+  int loc;
+} Interval;
+
+typedef struct
+{
+  BSLAlloc *alloc;
+  uint8_t *buf;
+  size_t len, cap;
+} Code;
+
+/* === PROTOTYPES === */
+
+static bool instr_reads_dst(Opcode op);
+static bool instr_writes_dst(Opcode op);
+static int new_interval(Interval **intervals, size_t *count, size_t *cap,
+    BSLAlloc *alloc, int start);
+static size_t allocate_registers(Interval *intervals, size_t count);
+static void put_byte(Code *code, uint8_t byte);
+static void put_u32(Code *code, uint32_t value);
+static void put_u64(Code *code, uint64_t value);
+static void emit_sse_reg(Code *code, uint8_t op, int reg, int rm);
+static void emit_sse_mem(Code *code, uint8_t op, int reg, int base, int32_t disp);
+static void emit_broadcast(Code *code, int reg);
+static void emit_vex_0f38(Code *code, int reg, int vreg, int rm);
+static void emit_fma_reg(Code *code, int acc, int lhs, int rhs);
+static void emit_fma_mem(Code *code, int acc, int lhs, int base, int32_t disp);
+static int32_t spill_disp(int loc);
+static int load_value(Code *code, Interval *value, int scratch);
+static void store_value(Code *code, Interval *value, int reg);
+
+/* === PUBLIC FUNCTIONS === */
+
+bool bsl_jit_compile(const BSLProgram *program, BSLJitFn *fn,
+    BSLCompileResult *result)
+{
+  BSLAlloc *alloc = program->alloc;
+  size_t code_len = program->code_len;
+
+  /* Fused multiply-adds must round once, which SSE alone cannot do. The VM
+   * runs such programs exactly on any CPU. */
+  for (size_t i = 0; i < code_len && !cpu_has_fma(); i++)
+  {
+    if (program->code[i].op == OP_FMA || program->code[i].op == OP_FMAS)
+    {
+      result_error(result, 0, 0,
+          "the program uses fused multiply-adds, which this CPU does not have");
+      return false;
+    }
+  }
+
+  /* Split every VM register into values, one per definition, and record
+   * which value each operand refers to. */
+  int current[VM_MAX_REGS];
+  for (size_t i = 0; i < VM_MAX_REGS; i++)
+  {
+    current[i] = -1;
+  }
+
+  Interval *intervals = NULL;
+  size_t interval_count = 0, interval_cap = 0;
+  size_t operands_bytes = code_len * 3 * sizeof(int);
+  int *operands = alloc->fn(NULL, 0, operands_bytes, alloc->ud);
+
+  for (size_t i = 0; i < code_len; i++)
+  {
+    Instr in = program->code[i];
+    int *ops = &operands[i * 3];
+    ops[0] = ops[1] = ops[2] = -1;
+
+    bool uses_a = in.op != OP_CONST && in.op != OP_LOAD && in.op != OP_RET;
+    bool uses_b = in.op >= OP_ADD && in.op <= OP_FMAS;
+    if (uses_a)
+    {
+      if (current[in.a] < 0)
+      {
+        current[in.a] = new_interval(&intervals, &interval_count,
+            &interval_cap, alloc, i);
+      }
+      ops[1] = current[in.a];
+      intervals[ops[1]].end = i;
+    }
+    if (uses_b)
+    {
+      if (current[in.b] < 0)
+      {
+        current[in.b] = new_interval(&intervals, &interval_count,
+            &interval_cap, alloc, i);
+      }
+      ops[2] = current[in.b];
+      intervals[ops[2]].end = i;
+    }
+
+    if (instr_reads_dst(in.op) && current[in.dst] >= 0)
+    {
+      ops[0] = current[in.dst];
+      intervals[ops[0]].end = i;
+    } else if (instr_writes_dst(in.op))
+    {
+      ops[0] = current[in.dst] = new_interval(&intervals, &interval_count,
+          &interval_cap, alloc, i);
+    }
+  }
+
+  size_t spills = allocate_registers(intervals, interval_count);
+  uint32_t frame = FRAME_SCRATCH + spills * 16;
+
+  Code code = {
+    .alloc = alloc,
+    .buf = NULL,
+    .len = 0,
+    .cap = 0,
+  };
+
+  /* sub rsp, frame; movabs r8, consts */
+  put_byte(&code, 0x48);
+  put_byte(&code, 0x81);
+  put_byte(&code, 0xEC);
+  put_u32(&code, frame);
+  put_byte(&code, 0x49);
+  put_byte(&code, 0xB8);
+  size_t consts_patch = code.len;
+  put_u64(&code, 0);
+
+  for (size_t i = 0; i < code_len; i++)
+  {
+    Instr in = program->code[i];
+    int *ops = &operands[i * 3];
+    Interval *dst = ops[0] >= 0 ? &intervals[ops[0]] : NULL;
+    Interval *a = ops[1] >= 0 ? &intervals[ops[1]] : NULL;
+    Interval *b = ops[2] >= 0 ? &intervals[ops[2]] : NULL;
+
+    switch (in.op)
+    {
+      case OP_CONST: {
+        int reg = dst->loc >= 0 ? dst->loc : XMM_SCRATCH0;
+        emit_sse_mem(&code, SSE_MOVUPS_LOAD, reg, REG_R8, (in.a | in.b << 8) * 16);
+        store_value(&code, dst, reg);
+        break;
+      }
+      case OP_MOV: {
+        int reg = load_value(&code, a, XMM_SCRATCH0);
+        store_value(&code, dst, reg);
+        break;
+      }
+      case OP_LOAD: {
+        /* mov rax, [rdi + a * 8] */
+        put_byte(&code, 0x48);
+        put_byte(&code, 0x8B);
+        put_byte(&code, 0x87);
+        put_u32(&code, in.a * 8);
+        int reg = dst->loc >= 0 ? dst->loc : XMM_SCRATCH0;
+        emit_sse_mem(&code, SSE_MOVUPS_LOAD, reg, REG_RAX, in.b * 16);
+        store_value(&code, dst, reg);
+        break;
+      }
+      case OP_STORE: {
+        int reg = load_value(&code, a, XMM_SCRATCH0);
+        emit_sse_mem(&code, SSE_MOVUPS_STORE, reg, REG_RSI, in.dst * 16);
+        break;
+      }
+      case OP_INSERT: {
+        /* Go through memory, the frame scratch area holds dst at 0 and the
+         * source at 16. */
+        if (ops[0] == ops[1])
+        {
+          break;
+        }
+        int32_t dst_disp = dst->loc >= 0 ? 0 : spill_disp(dst->loc);
+        int32_t src_disp = a->loc >= 0 ? 16 : spill_disp(a->loc);
+        if (dst->loc >= 0)
+        {
+          emit_sse_mem(&code, SSE_MOVUPS_STORE, dst->loc, REG_RSP, dst_disp);
+        }
+        if (a->loc >= 0)
+        {
+          emit_sse_mem(&code, SSE_MOVUPS_STORE, a->loc, REG_RSP, src_disp);
+        }
+        for (int c = 0; c < in.b >> 2; c++)
+        {
+          /* mov eax, [rsp + src]; mov [rsp + dst], eax */
+          put_byte(&code, 0x8B);
+          put_byte(&code, 0x84);
+          put_byte(&code, 0x24);
+          put_u32(&code, src_disp + c * 4);
+          put_byte(&code, 0x89);
+          put_byte(&code, 0x84);
+          put_byte(&code, 0x24);
+          put_u32(&code, dst_disp + ((in.b & 3) + c) * 4);
+        }
+        if (dst->loc >= 0)
+        {
+          emit_sse_mem(&code, SSE_MOVUPS_LOAD, dst->loc, REG_RSP, dst_disp);
+        }
+        break;
+      }
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_DIV:
+      case OP_MULS:
+      case OP_DIVS: {
+        static const uint8_t sse_ops[] = {
+          [OP_ADD] = SSE_ADDPS,
+          [OP_SUB] = SSE_SUBPS,
+          [OP_MUL] = SSE_MULPS,
+          [OP_DIV] = SSE_DIVPS,
+          [OP_MULS] = SSE_MULPS,
+          [OP_DIVS] = SSE_DIVPS,
+        };
+        int rhs = load_value(&code, b, XMM_SCRATCH1);
+        if (in.op == OP_MULS || in.op == OP_DIVS)
+        {
+          if (rhs != XMM_SCRATCH1)
+          {
+            emit_sse_reg(&code, SSE_MOVAPS, XMM_SCRATCH1, rhs);
+          }
+          emit_broadcast(&code, XMM_SCRATCH1);
+          rhs = XMM_SCRATCH1;
+        }
+
+        int reg = dst->loc >= 0 && dst->loc != rhs ? dst->loc : XMM_SCRATCH0;
+        int lhs = load_value(&code, a, reg);
+        if (lhs != reg)
+        {
+          emit_sse_reg(&code, SSE_MOVAPS, reg, lhs);
+        }
+        emit_sse_reg(&code, sse_ops[in.op], reg, rhs);
+        store_value(&code, dst, reg);
+        break;
+      }
+      case OP_SDIV: {
+        int lhs = load_value(&code, a, XMM_SCRATCH0);
+        if (lhs != XMM_SCRATCH0)
+        {
+          emit_sse_reg(&code, SSE_MOVAPS, XMM_SCRATCH0, lhs);
+        }
+        emit_broadcast(&code, XMM_SCRATCH0);
+        int rhs = load_value(&code, b, XMM_SCRATCH1);
+        emit_sse_reg(&code, SSE_DIVPS, XMM_SCRATCH0, rhs);
+        store_value(&code, dst, XMM_SCRATCH0);
+        break;
+      }
+      case OP_FMA:
+      case OP_FMAS: {
+        /* vfmadd231ps acc, rhs, lhs; lhs may stay in its spill slot. */
+        int rhs = load_value(&code, b, XMM_SCRATCH1);
+        if (in.op == OP_FMAS)
+        {
+          if (rhs != XMM_SCRATCH1)
+          {
+            emit_sse_reg(&code, SSE_MOVAPS, XMM_SCRATCH1, rhs);
+          }
+          emit_broadcast(&code, XMM_SCRATCH1);
+          rhs = XMM_SCRATCH1;
+        }
+        int acc = load_value(&code, dst, XMM_SCRATCH0);
+        if (a->loc >= 0)
+        {
+          emit_fma_reg(&code, acc, rhs, a->loc);
+        } else
+        {
+          emit_fma_mem(&code, acc, rhs, REG_RSP, spill_disp(a->loc));
+        }
+        store_value(&code, dst, acc);
+        break;
+      }
+      case OP_RET:
+        /* add rsp, frame; ret */
+        put_byte(&code, 0x48);
+        put_byte(&code, 0x81);
+        put_byte(&code, 0xC4);
+        put_u32(&code, frame);
+        put_byte(&code, 0xC3);
+        break;
+      default:
+        break;
+    }
+  }
+
+  alloc->fn(operands, operands_bytes, 0, alloc->ud);
+  alloc->fn(intervals, interval_cap * sizeof(Interval), 0, alloc->ud);
+
+  size_t code_start = 16;
+  size_t consts_start = (code_start + code.len + 15) & ~(size_t) 15;
+  size_t total = consts_start + program->const_count * 16;
+  uint8_t *mem = mmap(NULL, total, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+  {
+    alloc->fn(code.buf, code.cap, 0, alloc->ud);
+    result_error(result, 0, 0, "could not map memory for the JIT");
+    return false;
+  }
+
+  memcpy(mem, &total, sizeof(total));
+  memcpy(mem + code_start, code.buf, code.len);
+  for (size_t i = 0; i < program->const_count; i++)
+  {
+    for (size_t c = 0; c < 4; c++)
+    {
+      memcpy(mem + consts_start + i * 16 + c * 4, &program->consts[i],
+          sizeof(float));
+    }
+  }
+  uint64_t consts_addr = (uint64_t) (uintptr_t) (mem + consts_start);
+  memcpy(mem + code_start + consts_patch, &consts_addr, sizeof(consts_addr));
+  alloc->fn(code.buf, code.cap, 0, alloc->ud);
+
+  if (mprotect(mem, total, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(mem, total);
+    result_error(result, 0, 0, "could not make JIT memory executable");
+    return false;
+  }
+
+  *fn = (BSLJitFn) (void *) (mem + code_start);
+  return true;
+}
+
+void bsl_jit_free(BSLJitFn fn)
+{
+  uint8_t *mem = (uint8_t *) (void *) fn - 16;
+  size_t total;
+  memcpy(&total, mem, sizeof(total));
+  munmap(mem, total);
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static bool instr_reads_dst(Opcode op)
+{
+  return op == OP_INSERT || op == OP_FMA || op == OP_FMAS;
+}
+
+static bool instr_writes_dst(Opcode op)
+{
+  return op != OP_STORE && op != OP_RET;
+}
+
+static int new_interval(Interval **intervals, size_t *count, size_t *cap,
+    BSLAlloc *alloc, int start)
+{
+  if (*count == *cap)
+  {
+    size_t new_cap = *cap == 0 ? 64 : *cap * 2;
+    *intervals = alloc->fn(*intervals, *cap * sizeof(Interval),
+        new_cap * sizeof(Interval), alloc->ud);
+    *cap = new_cap;
+  }
+
+  Interval *interval = &(*intervals)[*count];
+  interval->start = interval->end = start;
+  interval->loc = 0;
+  return (*count)++;
+}
+
+/* Plain linear scan, intervals are created in order of their start. When
+ * no register is free the interval that ends last goes to memory. Returns
+ * the number of spill slots. */
+static size_t allocate_registers(Interval *intervals, size_t count)
+{
+  Interval *active[XMM_ALLOCATABLE];
+  size_t active_count = 0;
+  bool used[XMM_ALLOCATABLE] = {false};
+  size_t spills = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    Interval *cur = &intervals[i];
+
+    size_t kept = 0;
+    for (size_t j = 0; j < active_count; j++)
+    {
+      if (active[j]->end < cur->start)
+      {
+        used[active[j]->loc] = false;
+      } else
+      {
+        active[kept++] = active[j];
+      }
+    }
+    active_count = kept;
+
+    if (active_count < XMM_ALLOCATABLE)
+    {
+      int reg = 0;
+      while (used[reg])
+      {
+        reg++;
+      }
+      used[reg] = true;
+      cur->loc = reg;
+      active[active_count++] = cur;
+      continue;
+    }
+
+    size_t furthest = 0;
+    for (size_t j = 1; j < active_count; j++)
+    {
+      if (active[j]->end > active[furthest]->end)
+      {
+        furthest = j;
+      }
+    }
+
+    if (active[furthest]->end > cur->end)
+    {
+      cur->loc = active[furthest]->loc;
+      active[furthest]->loc = -1 - (int) spills++;
+      active[furthest] = cur;
+    } else
+    {
+      cur->loc = -1 - (int) spills++;
+    }
+  }
+
+  return spills;
+}
+
+static void put_byte(Code *code, uint8_t byte)
+{
+  if (code->len == code->cap)
+  {
+    size_t cap = code->cap == 0 ? 256 : code->cap * 2;
+    code->buf = code->alloc->fn(code->buf, code->cap, cap, code->alloc->ud);
+    code->cap = cap;
+  }
+  code->buf[code->len++] = byte;
+}
+
+static void put_u32(Code *code, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    put_byte(code, value >> (i * 8));
+  }
+}
+
+static void put_u64(Code *code, uint64_t value)
+{
+  for (int i = 0; i < 8; i++)
+  {
+    put_byte(code, value >> (i * 8));
+  }
+}
+
+static void emit_sse_reg(Code *code, uint8_t op, int reg, int rm)
+{
+  if (reg >= 8 || rm >= 8)
+  {
+    put_byte(code, 0x40 | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0));
+  }
+  put_byte(code, 0x0F);
+  put_byte(code, op);
+  put_byte(code, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void emit_sse_mem(Code *code, uint8_t op, int reg, int base, int32_t disp)
+{
+  if (reg >= 8 || base >= 8)
+  {
+    put_byte(code, 0x40 | (reg >= 8 ? 4 : 0) | (base >= 8 ? 1 : 0));
+  }
+  put_byte(code, 0x0F);
+  put_byte(code, op);
+  put_byte(code, 0x80 | (reg & 7) << 3 | (base & 7));
+  if ((base & 7) == REG_RSP)
+  {
+    put_byte(code, 0x24);
+  }
+  put_u32(code, disp);
+}
+
+static void emit_broadcast(Code *code, int reg)
+{
+  emit_sse_reg(code, SSE_SHUFPS, reg, reg);
+  put_byte(code, 0x00);
+}
+
+/* Three byte VEX prefix for the 66 0F38 map, 128 bit. */
+static void emit_vex_0f38(Code *code, int reg, int vreg, int rm)
+{
+  put_byte(code, 0xC4);
+  put_byte(code, (reg >= 8 ? 0 : 0x80) | 0x40 | (rm >= 8 ? 0 : 0x20) | 0x02);
+  put_byte(code, (~vreg & 15) << 3 | 0x01);
+}
+
+static void emit_fma_reg(Code *code, int acc, int lhs, int rhs)
+{
+  emit_vex_0f38(code, acc, lhs, rhs);
+  put_byte(code, VEX_VFMADD231PS);
+  put_byte(code, 0xC0 | (acc & 7) << 3 | (rhs & 7));
+}
+
+static void emit_fma_mem(Code *code, int acc, int lhs, int base, int32_t disp)
+{
+  emit_vex_0f38(code, acc, lhs, base);
+  put_byte(code, VEX_VFMADD231PS);
+  put_byte(code, 0x80 | (acc & 7) << 3 | (base & 7));
+  if ((base & 7) == REG_RSP)
+  {
+    put_byte(code, 0x24);
+  }
+  put_u32(code, disp);
+}
+
+static int32_t spill_disp(int loc)
+{
+  return FRAME_SCRATCH + (-1 - loc) * 16;
+}
+
+static int load_value(Code *code, Interval *value, int scratch)
+{
+  if (value->loc >= 0)
+  {
+    return value->loc;
+  }
+  emit_sse_mem(code, SSE_MOVUPS_LOAD, scratch, REG_RSP, spill_disp(value->loc));
+  return scratch;
+}
+
+static void store_value(Code *code, Interval *value, int reg)
+{
+  if (value->loc >= 0)
+  {
+    if (value->loc != reg)
+    {
+      emit_sse_reg(code, SSE_MOVAPS, value->loc, reg);
+    }
+  } else
+  {
+    emit_sse_mem(code, SSE_MOVUPS_STORE, reg, REG_RSP, spill_disp(value->loc));
+  }
+}
+
+#else
+
+bool bsl_jit_compile(const BSLProgram *program, BSLJitFn *fn,
+    BSLCompileResult *result)
+{
+  (void) program;
+  (void) fn;
+  result_error(result, 0, 0, "the JIT is only available on x86-64 Linux");
+  return false;
+}
+
+void bsl_jit_free(BSLJitFn fn)
+{
+  (void) fn;
+}
+
+#endif
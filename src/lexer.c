@@ -5,12 +5,15 @@
 #include <inttypes.h>
 
 #include <bsl/lexer.h>
+#include <bsl/stats.h>
 
 #define PEEK_C(_lexer) ((_lexer)->src[(_lexer)->cur])
 #define NEXT_C(_lexer) ((_lexer)->col++, (_lexer)->src[(_lexer)->cur++])
 #define SKIP_C(_lexer) ((_lexer)->col++, (_lexer)->cur++)
 #define IS_EOF(_lexer) ((_lexer)->cur >= (_lexer)->src_len)
 #define RESET(_lexer) ((_lexer)->start = (_lexer)->cur)
+/* One token in this many is timed to stand for the rest. */
+#define LEX_SAMPLE 64
 
 const char *keyword_to_token_type[] = {
   [TOKEN_KW_PROC] = "proc",
@@ -18,17 +21,21 @@ const char *keyword_to_token_type[] = {
   [TOKEN_KW_VAR] = "var",
   [TOKEN_KW_RETURN] = "return",
   [TOKEN_KW_END] = "end",
+  [TOKEN_KW_IMPORT] = "import",
+  [TOKEN_KW_CONST] = "const",
 };
 
 TokenType keyword_start = TOKEN_KW_PROC;
-TokenType keyword_end = TOKEN_KW_END;
+TokenType keyword_end = TOKEN_KW_CONST;
 
 /* === PROTOTYPES === */
 
 static Token next_token(Lexer *lexer);
+static Token scan_token(Lexer *lexer);
 static void fill_token(Token *tok, Lexer *lexer, TokenType t);
 static void lexer_error(Lexer *lexer, const char *msg, ...);
 static bool skip_whitespace(Lexer *lexer);
+static bool is_unknown_char(int c);
 static Token lex_sym(Lexer *lexer);
 static Token lex_num(Lexer *lexer);
 
@@ -43,6 +50,21 @@ bool lexer_init(Lexer *lexer,
   lexer->has_peek = false;
   lexer->line = lexer->col = 1;
   lexer->start = lexer->cur = 0;
+  lexer->stats = NULL;
+  lexer->lex_ns = 0;
+  lexer->clock_ns = 0;
+#ifdef BSL_STATS
+  /* What reading the clock adds to a timed token, the least of a few
+   * back to back reads. */
+  lexer->clock_ns = UINT64_MAX;
+  for (int i = 0; i < 4; i++)
+  {
+    uint64_t start = now_ns();
+    uint64_t elapsed = now_ns() - start;
+    lexer->clock_ns = elapsed < lexer->clock_ns ? elapsed : lexer->clock_ns;
+  }
+#endif
+  lexer->tokens = lexer->max_tokens = 0;
   return true;
 }
 
@@ -108,6 +130,12 @@ void lexer_print(Token tok)
     case TOKEN_KW_END:
       printf("End\n");
       break;
+    case TOKEN_KW_IMPORT:
+      printf("Import\n");
+      break;
+    case TOKEN_KW_CONST:
+      printf("Const\n");
+      break;
     case TOKEN_COMMA:
       printf("Comma\n");
       break;
@@ -179,7 +207,41 @@ void lexer_print(Token tok)
 
 /* === PRIVATE FUNCTIONS === */
 
+/* Reading the clock costs about as much as scanning a token, so only a
+ * sample of them is timed. The parse that drives the lexer moves the
+ * estimate from its own time to lexing. */
 static Token next_token(Lexer *lexer)
+{
+#ifdef BSL_STATS
+  Token tok;
+  if (lexer->stats != NULL && lexer->stats->tokens % LEX_SAMPLE == 0)
+  {
+    uint64_t start = now_ns();
+    tok = scan_token(lexer);
+    uint64_t elapsed = now_ns() - start;
+    elapsed -= elapsed < lexer->clock_ns ? elapsed : lexer->clock_ns;
+    lexer->lex_ns += elapsed * LEX_SAMPLE;
+  } else
+  {
+    tok = scan_token(lexer);
+  }
+  STATS_ADD(lexer->stats, tokens, 1);
+#else
+  Token tok = scan_token(lexer);
+#endif
+
+  if (lexer->max_tokens != 0 && tok.t != TOKEN_EOF &&
+      ++lexer->tokens > lexer->max_tokens)
+  {
+    result_error_code(lexer->result, BSL_ERROR_LIMIT, tok.line, tok.col,
+        "more than %zu tokens", lexer->max_tokens);
+    lexer->result->limit_exceeded = true;
+    tok.t = TOKEN_ERR;
+  }
+  return tok;
+}
+
+static Token scan_token(Lexer *lexer)
 {
   Token tok;
 
@@ -291,6 +353,12 @@ static Token next_token(Lexer *lexer)
 
   lexer_error(lexer, "unknown char '%c'", lexer->src[lexer->cur]);
   fill_token(&tok, lexer, TOKEN_ERR);
+  /* A run of them is one error, past which the parser can go on. */
+  while (!IS_EOF(lexer) && is_unknown_char(PEEK_C(lexer)))
+  {
+    SKIP_C(lexer);
+  }
+  RESET(lexer);
   return tok;
 }
 
@@ -307,7 +375,8 @@ static void lexer_error(Lexer *lexer, const char *msg, ...)
   va_list args;
   va_start(args, msg);
 
-  vresult_error(lexer->result, lexer->line, lexer->col, msg, args);
+  vresult_error(lexer->result, BSL_ERROR_SYNTAX, lexer->line, lexer->col,
+      msg, args);
 }
 
 static bool skip_whitespace(Lexer *lexer)
@@ -326,6 +395,12 @@ static bool skip_whitespace(Lexer *lexer)
   return !IS_EOF(lexer);
 }
 
+static bool is_unknown_char(int c)
+{
+  return !(isalnum(c) || isspace(c) || c == '_' ||
+      (c != '\0' && strchr("#:.,=+-*/<>{}[]()", c) != NULL));
+}
+
 static Token lex_sym(Lexer *lexer)
 {
   Token tok;
@@ -0,0 +1,113 @@
+#include <bsl/limits.h>
+
+/* === PROTOTYPES === */
+
+static void *limits_alloc_fn(void *ptr, size_t osz, size_t nsz, void *ud);
+
+/* === PUBLIC FUNCTIONS === */
+
+void limits_init(Limits *limits, BSLAlloc *alloc, BSLCompileInfo *info)
+{
+  limits->max_depth = info->max_depth;
+  limits->max_bytes = info->max_bytes;
+  limits->bytes = 0;
+  limits->deadline = info->max_time_ns != 0 ?
+    now_ns() + info->max_time_ns : 0;
+  limits->polls = 0;
+  if (info->max_bytes != 0)
+  {
+    limits->inner = *alloc;
+    alloc->fn = limits_alloc_fn;
+    alloc->ud = limits;
+  }
+}
+
+void limits_unwrap(BSLAlloc *alloc)
+{
+  if (alloc->fn == limits_alloc_fn)
+  {
+    *alloc = ((Limits *) alloc->ud)->inner;
+  }
+}
+
+bool limits_check(Limits *limits, BSLCompileResult *result, int line,
+    int col)
+{
+  if (limits == NULL)
+  {
+    return true;
+  }
+
+  if (limits->max_bytes != 0 && limits->bytes > limits->max_bytes)
+  {
+    result_error_code(result, BSL_ERROR_LIMIT, line, col,
+        "compile holds more than %zu bytes", limits->max_bytes);
+    result->limit_exceeded = true;
+    return false;
+  }
+
+  if (limits->deadline != 0 && now_ns() > limits->deadline)
+  {
+    result_error_code(result, BSL_ERROR_LIMIT, line, col,
+        "compile ran past its time limit");
+    result->limit_exceeded = true;
+    return false;
+  }
+  return true;
+}
+
+bool limits_poll(Limits *limits, BSLCompileResult *result, int line,
+    int col)
+{
+  if (limits == NULL)
+  {
+    return true;
+  }
+
+  if (++limits->polls % LIMITS_CLOCK_POLLS == 0)
+  {
+    return limits_check(limits, result, line, col);
+  }
+
+  if (limits->max_bytes != 0 && limits->bytes > limits->max_bytes)
+  {
+    return limits_check(limits, result, line, col);
+  }
+  return true;
+}
+
+bool limits_check_depth(Limits *limits, size_t depth,
+    BSLCompileResult *result, int line, int col)
+{
+  if (limits == NULL || limits->max_depth == 0 || depth <= limits->max_depth)
+  {
+    return true;
+  }
+
+  result_error_code(result, BSL_ERROR_LIMIT, line, col,
+      "nesting is deeper than %zu", limits->max_depth);
+  result->limit_exceeded = true;
+  return false;
+}
+
+uint64_t limits_time_left(Limits *limits)
+{
+  if (limits == NULL || limits->deadline == 0)
+  {
+    return 0;
+  }
+
+  /* A spent budget still has to stay bounded. */
+  uint64_t now = now_ns();
+  return limits->deadline > now ? limits->deadline - now : 1;
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static void *limits_alloc_fn(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  Limits *limits = ud;
+  limits->bytes += nsz;
+  limits->bytes -= osz;
+  return limits->inner.fn(ptr, osz, nsz, limits->inner.ud);
+}
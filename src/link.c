@@ -0,0 +1,428 @@
+#include <bsl/link.h>
+#include <bsl/resolve.h>
+
+#define MAX_VARYINGS 32
+
+typedef struct
+{
+  RecordEntry *output;
+  RecordEntry *input;
+  int declared;
+  int size;
+} Varying;
+
+/* === PROTOTYPES === */
+
+static bool find_stage(AST *ast, ProcedureEntryPoint stage,
+    Toplevel **found);
+static RecordEntry *find_location(Type *record, RecordEntryType t, int pos);
+static bool same_type(Type *type1, Type *type2);
+static int varying_size(Type *type);
+static void clear_live(Type *record);
+static void mark_reads(AST *ast, Expr *expr);
+static void remove_dead_entries(AST *ast, Type *record, RecordEntryType t);
+static void strip_members(AST *ast, Expr *expr);
+static void pack_varyings(Varying *varyings, size_t count);
+static void sort_locations(BSLVaryingLocation *locations, size_t count);
+
+/* === PUBLIC FUNCTIONS === */
+
+bool link_stages(AST *ast)
+{
+  Toplevel *vert, *frag;
+  if (!find_stage(ast, ENTRY_POINT_VERTEX, &vert) ||
+      !find_stage(ast, ENTRY_POINT_FRAGMENT, &frag))
+  {
+    return false;
+  }
+  if (vert == NULL || frag == NULL || vert == frag || 
+      vert->proc.return_type->t != TYPE_RECORD)
+  {
+    return true;
+  }
+
+  Type *outputs = vert->proc.return_type;
+  clear_live(outputs);
+
+  Parameter *param = frag->proc.params;
+  while (param != NULL)
+  {
+    if (param->type->t == TYPE_RECORD)
+    {
+      clear_live(param->type);
+      RecordEntry *input = param->type->record.entries;
+      while (input != NULL)
+      {
+        if (input->t == RECORD_ENTRY_INPUT)
+        {
+          RecordEntry *output = find_location(outputs, RECORD_ENTRY_OUTPUT, input->pos);
+          if (output == NULL)
+          {
+            result_error_code(ast->result, BSL_ERROR_INTERFACE, param->line,
+                param->col, "fragment input %d has no matching vertex output",
+                input->pos);
+            return false;
+          }
+          if (!same_type(input->type, output->type))
+          {
+            result_error_code(ast->result, BSL_ERROR_INTERFACE, param->line,
+                param->col,
+                "vertex output and fragment input %d have different types", 
+                input->pos);
+            return false;
+          }
+        }
+        input = input->next;
+      }
+    }
+    param = param->next;
+  }
+
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC)
+    {
+      Statement *stmt = iter->proc.stmts;
+      while (stmt != NULL)
+      {
+        mark_reads(ast,
+            stmt->t == STATEMENT_VAR ? stmt->var.expr : stmt->ret.expr);
+        stmt = stmt->next;
+      }
+    }
+    iter = iter->next;
+  }
+
+  /* An output is needed if the fragment stage reads the matching input. */
+  Varying varyings[MAX_VARYINGS];
+  size_t count = 0;
+  size_t location_count = 0;
+  param = frag->proc.params;
+  while (param != NULL)
+  {
+    if (param->type->t == TYPE_RECORD)
+    {
+      RecordEntry *input = param->type->record.entries;
+      while (input != NULL)
+      {
+        if (input->t == RECORD_ENTRY_INPUT && input->live)
+        {
+          find_location(outputs, RECORD_ENTRY_OUTPUT, input->pos)->live = true;
+        }
+        input = input->next;
+      }
+    }
+    param = param->next;
+  }
+
+  RecordEntry *output = outputs->record.entries;
+  while (output != NULL)
+  {
+    location_count += output->t == RECORD_ENTRY_OUTPUT;
+    output = output->next;
+  }
+
+  /* Every declared output is reported, removed ones without a location. */
+  BSLAlloc *alloc = ast->alloc;
+  size_t locations_size = location_count * sizeof(BSLVaryingLocation);
+  BSLVaryingLocation *locations = location_count == 0 ? NULL :
+    alloc->fn(NULL, 0, locations_size, alloc->ud);
+  size_t reported = 0;
+
+  output = outputs->record.entries;
+  while (output != NULL)
+  {
+    if (output->t == RECORD_ENTRY_OUTPUT)
+    {
+      if (!output->live)
+      {
+        ast->result->removed_varyings++;
+        locations[reported++] = (BSLVaryingLocation) {
+          .declared_location = output->pos,
+          .location = -1,
+          .component = -1,
+          .components = varying_size(output->type),
+        };
+      } else if (count == MAX_VARYINGS)
+      {
+        result_error_code(ast->result, BSL_ERROR_INTERFACE, vert->line,
+            vert->col, "too many vertex outputs, maximum is %d", MAX_VARYINGS);
+        alloc->fn(locations, locations_size, 0, alloc->ud);
+        return false;
+      } else
+      {
+        varyings[count].output = output;
+        varyings[count].input = NULL;
+        varyings[count].declared = output->pos;
+        varyings[count].size = varying_size(output->type);
+        param = frag->proc.params;
+        while (param != NULL && varyings[count].input == NULL)
+        {
+          if (param->type->t == TYPE_RECORD)
+          {
+            varyings[count].input = find_location(param->type, 
+                RECORD_ENTRY_INPUT, output->pos);
+          }
+          param = param->next;
+        }
+        count++;
+      }
+    }
+    output = output->next;
+  }
+
+  remove_dead_entries(ast, outputs, RECORD_ENTRY_OUTPUT);
+  param = frag->proc.params;
+  while (param != NULL)
+  {
+    if (param->type->t == TYPE_RECORD)
+    {
+      remove_dead_entries(ast, param->type, RECORD_ENTRY_INPUT);
+    }
+    param = param->next;
+  }
+
+  pack_varyings(varyings, count);
+  for (size_t i = 0; i < count; i++)
+  {
+    locations[reported++] = (BSLVaryingLocation) {
+      .declared_location = varyings[i].declared,
+      .location = varyings[i].output->pos,
+      .component = varyings[i].output->component,
+      .components = varyings[i].size,
+    };
+  }
+  sort_locations(locations, reported);
+  ast->result->varyings = locations;
+  ast->result->varying_count = reported;
+  return true;
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+/* Only what entry_points asked for is left by now, so more than one
+ * candidate means the caller has to pick the pair. */
+static bool find_stage(AST *ast, ProcedureEntryPoint stage,
+    Toplevel **found)
+{
+  *found = NULL;
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC && (iter->proc.entry_point & stage))
+    {
+      if (*found != NULL)
+      {
+        result_error_code(ast->result, BSL_ERROR_INTERFACE, iter->line,
+            iter->col, "cannot link stages with more than one %s entry "
+            "point, name the pair to link in entry_points",
+            stage == ENTRY_POINT_VERTEX ? "vertex" : "fragment");
+        return false;
+      }
+      *found = iter;
+    }
+    iter = iter->next;
+  }
+  return true;
+}
+
+static RecordEntry *find_location(Type *record, RecordEntryType t, int pos)
+{
+  RecordEntry *iter = record->record.entries;
+  while (iter != NULL)
+  {
+    if (iter->t == t && iter->pos == pos)
+    {
+      return iter;
+    }
+    iter = iter->next;
+  }
+  return NULL;
+}
+
+static bool same_type(Type *type1, Type *type2)
+{
+  if (type1->t != type2->t)
+  {
+    return false;
+  }
+
+  switch (type1->t)
+  {
+    case TYPE_VECTOR:
+      return type1->vec.size == type2->vec.size && 
+        same_type(type1->vec.type, type2->vec.type);
+    case TYPE_RECORD:
+      return type1 == type2;
+    default:
+      return true;
+  }
+}
+
+static int varying_size(Type *type)
+{
+  if (type->t == TYPE_F32)
+  {
+    return 1;
+  } else if (type->t == TYPE_VECTOR && type->vec.type->t == TYPE_F32)
+  {
+    return type->vec.size;
+  }
+  /* Doubles and anything else get an interpolator of their own. */
+  return 4;
+}
+
+static void clear_live(Type *record)
+{
+  RecordEntry *iter = record->record.entries;
+  while (iter != NULL)
+  {
+    iter->live = false;
+    iter = iter->next;
+  }
+}
+
+static void mark_reads(AST *ast, Expr *expr)
+{
+  ExprWalk walk;
+  expr_walk_init(&walk, ast->alloc, expr);
+  bool leaving;
+  while ((expr = expr_walk_next(&walk, &leaving)) != NULL)
+  {
+    if (!leaving && expr->t == EXPR_MEMBER)
+    {
+      expr->member.entry->live = true;
+    }
+  }
+}
+
+static void remove_dead_entries(AST *ast, Type *record, RecordEntryType t)
+{
+  bool removed = false;
+  RecordEntry **link = &record->record.toplevel->record.entries;
+  while (*link != NULL)
+  {
+    if ((*link)->t == t && !(*link)->live)
+    {
+      *link = (*link)->next;
+      removed = true;
+    } else
+    {
+      link = &(*link)->next;
+    }
+  }
+  record->record.entries = record->record.toplevel->record.entries;
+  number_record_entries(record->record.toplevel);
+
+  if (!removed)
+  {
+    return;
+  }
+
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC)
+    {
+      Statement *stmt = iter->proc.stmts;
+      while (stmt != NULL)
+      {
+        strip_members(ast,
+            stmt->t == STATEMENT_VAR ? stmt->var.expr : stmt->ret.expr);
+        stmt = stmt->next;
+      }
+    }
+    iter = iter->next;
+  }
+}
+
+/* Members go on entering a record, before the walk reaches them. */
+static void strip_members(AST *ast, Expr *expr)
+{
+  ExprWalk walk;
+  expr_walk_init(&walk, ast->alloc, expr);
+  bool leaving;
+  while ((expr = expr_walk_next(&walk, &leaving)) != NULL)
+  {
+    if (leaving || expr->t != EXPR_RECORD)
+    {
+      continue;
+    }
+
+    RecordExprMember **link = &expr->record.members;
+    while (*link != NULL)
+    {
+      RecordEntry *entry = expr->type->record.entries;
+      while (entry != NULL && entry != (*link)->entry)
+      {
+        entry = entry->next;
+      }
+
+      if (entry == NULL)
+      {
+        *link = (*link)->next;
+      } else
+      {
+        link = &(*link)->next;
+      }
+    }
+  }
+}
+
+static void pack_varyings(Varying *varyings, size_t count)
+{
+  /* Largest first, ties keep their original location order. */
+  for (size_t i = 1; i < count; i++)
+  {
+    Varying tmp = varyings[i];
+    size_t j = i;
+    while (j > 0 && (varyings[j - 1].size < tmp.size || 
+          (varyings[j - 1].size == tmp.size && 
+           varyings[j - 1].output->pos > tmp.output->pos)))
+    {
+      varyings[j] = varyings[j - 1];
+      j--;
+    }
+    varyings[j] = tmp;
+  }
+
+  int used[MAX_VARYINGS] = {0};
+  int slots = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    int slot = 0;
+    while (slot < slots && used[slot] + varyings[i].size > 4)
+    {
+      slot++;
+    }
+    if (slot == slots)
+    {
+      slots++;
+    }
+
+    varyings[i].output->pos = slot;
+    varyings[i].output->component = used[slot];
+    if (varyings[i].input != NULL)
+    {
+      varyings[i].input->pos = slot;
+      varyings[i].input->component = used[slot];
+    }
+    used[slot] += varyings[i].size;
+  }
+}
+
+static void sort_locations(BSLVaryingLocation *locations, size_t count)
+{
+  for (size_t i = 1; i < count; i++)
+  {
+    BSLVaryingLocation tmp = locations[i];
+    size_t j = i;
+    while (j > 0 && locations[j - 1].declared_location > tmp.declared_location)
+    {
+      locations[j] = locations[j - 1];
+      j--;
+    }
+    locations[j] = tmp;
+  }
+}
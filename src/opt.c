@@ -0,0 +1,263 @@
+#include <string.h>
+
+#include <bsl/opt.h>
+
+/* === PROTOTYPES === */
+
+static void vectorize_expr(AST *ast, Expr *expr);
+static void vectorize_vectors(AST *ast, Expr *expr);
+static bool vectorize_vector(AST *ast, Expr *expr);
+static Expr *gather_operands(AST *ast, Expr *expr, size_t count, bool lhs);
+static bool same_leaf(Expr *expr1, Expr *expr2);
+static void contract_expr(AST *ast, Expr *expr);
+static void contract_binary(Expr *expr);
+
+/* === PUBLIC FUNCTIONS === */
+
+void vectorize_slp(AST *ast)
+{
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC)
+    {
+      Statement *stmt = iter->proc.stmts;
+      while (stmt != NULL)
+      {
+        vectorize_expr(ast,
+            stmt->t == STATEMENT_VAR ? stmt->var.expr : stmt->ret.expr);
+        stmt = stmt->next;
+      }
+    }
+    iter = iter->next;
+  }
+}
+
+void contract_fma(AST *ast)
+{
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC)
+    {
+      Statement *stmt = iter->proc.stmts;
+      while (stmt != NULL)
+      {
+        contract_expr(ast,
+            stmt->t == STATEMENT_VAR ? stmt->var.expr : stmt->ret.expr);
+        stmt = stmt->next;
+      }
+    }
+    iter = iter->next;
+  }
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static void vectorize_expr(AST *ast, Expr *expr)
+{
+  ExprWalk walk;
+  expr_walk_init(&walk, ast->alloc, expr);
+  bool leaving;
+  while ((expr = expr_walk_next(&walk, &leaving)) != NULL)
+  {
+    if (leaving && expr->t == EXPR_VECTOR)
+    {
+      vectorize_vectors(ast, expr);
+    }
+  }
+}
+
+/* The operand vectors a rewrite gathers may vectorize in turn, as deep as
+ * the elements are alike, so they wait on a list rather than recursing. */
+static void vectorize_vectors(AST *ast, Expr *expr)
+{
+  Expr *inline_pending[EXPR_WALK_INLINE];
+  Expr **pending = inline_pending;
+  size_t count = 0, cap = EXPR_WALK_INLINE;
+  while (true)
+  {
+    if (vectorize_vector(ast, expr))
+    {
+      Expr *operands[2] = {expr->binary.lhs, expr->binary.rhs};
+      for (size_t i = 0; i < 2; i++)
+      {
+        if (operands[i]->t != EXPR_VECTOR)
+        {
+          continue;
+        }
+        if (count == cap)
+        {
+          Expr **grown = ast->alloc->fn(NULL, 0, cap * 2 * sizeof(Expr *),
+              ast->alloc->ud);
+          memcpy(grown, pending, count * sizeof(Expr *));
+          if (pending != inline_pending)
+          {
+            ast->alloc->fn(pending, cap * sizeof(Expr *), 0, ast->alloc->ud);
+          }
+          pending = grown;
+          cap *= 2;
+        }
+        pending[count++] = operands[i];
+      }
+    }
+
+    if (count == 0)
+    {
+      break;
+    }
+    expr = pending[--count];
+  }
+
+  if (pending != inline_pending)
+  {
+    ast->alloc->fn(pending, cap * sizeof(Expr *), 0, ast->alloc->ud);
+  }
+}
+
+/* Rewrites {a0 op b0, a1 op b1, ...} into {a0, a1, ...} op {b0, b1, ...}, or
+ * into {a0, a1, ...} op b when every b is the same scalar and op allows a
+ * mixed vector/scalar operation. */
+static bool vectorize_vector(AST *ast, Expr *expr)
+{
+  Expr *first = expr->vec.exprs;
+  size_t count = 0;
+  bool same_lhs = true, same_rhs = true;
+  Expr *iter = first;
+  while (iter != NULL)
+  {
+    if (iter->t != EXPR_BINARY || iter->type->t == TYPE_VECTOR ||
+        iter->binary.op != first->binary.op)
+    {
+      return false;
+    }
+
+    same_lhs = same_lhs && same_leaf(iter->binary.lhs, first->binary.lhs);
+    same_rhs = same_rhs && same_leaf(iter->binary.rhs, first->binary.rhs);
+    count++;
+    iter = iter->next;
+  }
+
+  if (count < 2)
+  {
+    return false;
+  }
+
+  Binop op = first->binary.op;
+  bool scalar_ok = op == BINOP_MUL || op == BINOP_DIV;
+  Expr *lhs, *rhs;
+  if (same_rhs && scalar_ok)
+  {
+    lhs = gather_operands(ast, expr, count, true);
+    rhs = first->binary.rhs;
+  } else if (same_lhs && scalar_ok)
+  {
+    lhs = first->binary.lhs;
+    rhs = gather_operands(ast, expr, count, false);
+  } else
+  {
+    lhs = gather_operands(ast, expr, count, true);
+    rhs = gather_operands(ast, expr, count, false);
+  }
+
+  expr->t = EXPR_BINARY;
+  expr->binary.lhs = lhs;
+  expr->binary.rhs = rhs;
+  expr->binary.op = op;
+  return true;
+}
+
+static Expr *gather_operands(AST *ast, Expr *expr, size_t count, bool lhs)
+{
+  Type *type = BSL_NEW(ast->alloc, Type);
+  type->t = TYPE_VECTOR;
+  type->line = expr->line;
+  type->col = expr->col;
+  type->vec.size = count;
+  type->vec.type = expr->vec.exprs->type;
+
+  Expr *vec = BSL_NEW(ast->alloc, Expr);
+  vec->t = EXPR_VECTOR;
+  vec->line = expr->line;
+  vec->col = expr->col;
+  vec->type = type;
+  vec->next = NULL;
+
+  Expr **link = &vec->vec.exprs;
+  Expr *iter = expr->vec.exprs;
+  while (iter != NULL)
+  {
+    *link = lhs ? iter->binary.lhs : iter->binary.rhs;
+    link = &(*link)->next;
+    iter = iter->next;
+  }
+  *link = NULL;
+
+  return vec;
+}
+
+static bool same_leaf(Expr *expr1, Expr *expr2)
+{
+  if (expr1->t != expr2->t)
+  {
+    return false;
+  }
+
+  switch (expr1->t)
+  {
+    case EXPR_VAR:
+      return expr1->var.entry == expr2->var.entry;
+    case EXPR_NUM:
+      if (expr1->num.t != expr2->num.t)
+      {
+        return false;
+      }
+      return expr1->num.t == NUMBER_INT ? expr1->num.i == expr2->num.i :
+        expr1->num.f == expr2->num.f;
+    case EXPR_MEMBER:
+      return expr1->member.entry == expr2->member.entry &&
+        same_leaf(expr1->member.lhs, expr2->member.lhs);
+    default:
+      return false;
+  }
+}
+
+static void contract_expr(AST *ast, Expr *expr)
+{
+  ExprWalk walk;
+  expr_walk_init(&walk, ast->alloc, expr);
+  bool leaving;
+  while ((expr = expr_walk_next(&walk, &leaving)) != NULL)
+  {
+    if (leaving && expr->t == EXPR_BINARY && expr->binary.op == BINOP_ADD)
+    {
+      contract_binary(expr);
+    }
+  }
+}
+
+/* Both sides of an addition have the type of the result, so the product
+ * can be fused without further checks. */
+static void contract_binary(Expr *expr)
+{
+  Expr *lhs = expr->binary.lhs;
+  Expr *rhs = expr->binary.rhs;
+  Expr *mul, *addend;
+  if (lhs->t == EXPR_BINARY && lhs->binary.op == BINOP_MUL)
+  {
+    mul = lhs;
+    addend = rhs;
+  } else if (rhs->t == EXPR_BINARY && rhs->binary.op == BINOP_MUL)
+  {
+    mul = rhs;
+    addend = lhs;
+  } else
+  {
+    return;
+  }
+
+  expr->t = EXPR_FMA;
+  expr->fma.lhs = mul->binary.lhs;
+  expr->fma.rhs = mul->binary.rhs;
+  expr->fma.addend = addend;
+}
@@ -0,0 +1,671 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <bsl/module.h>
+#include <bsl/sha256.h>
+
+/* A pack is a header, then fixed size records, an index sorted by name
+ * hash, an index sorted by semantic hash, the varyings and finally a data
+ * section with names and code. Offsets in records are into the data. Only
+ * records with a hash are in the hash index. */
+
+#define PACK_MAGIC "BSLP"
+#define PACK_FORMAT 2
+#define PACK_ENDIAN 0x01020304u
+#define PACK_ALIGN 8
+#define ALIGN_UP(_x) \
+  (((uint64_t) (_x) + PACK_ALIGN - 1) & ~(uint64_t) (PACK_ALIGN - 1))
+
+typedef struct
+{
+  char magic[4];
+  uint32_t format;
+  uint32_t endian;
+  uint32_t entry_count;
+  uint64_t file_size;
+  uint64_t records_offset;
+  uint64_t names_offset;
+  uint64_t hashes_offset;
+  uint64_t hash_count;
+  uint64_t varyings_offset;
+  uint64_t varying_count;
+  uint64_t data_offset;
+  uint64_t data_size;
+} PackHeader;
+
+typedef struct
+{
+  uint64_t name_offset;
+  uint64_t name_len;
+  uint64_t code_offset;
+  uint64_t code_len;
+  uint32_t stage;
+  uint32_t input_first, input_count;
+  uint32_t output_first, output_count;
+  uint32_t hashed;
+  uint8_t hash[BSL_HASH_LEN];
+} PackRecord;
+
+typedef struct
+{
+  uint64_t key;
+  uint32_t entry;
+  uint32_t pad;
+} PackName;
+
+typedef struct
+{
+  uint8_t hash[BSL_HASH_LEN];
+  uint32_t entry;
+  uint32_t pad;
+} PackHash;
+
+typedef struct
+{
+  uint64_t key;
+  uint32_t entry;
+  const char *name;
+} NameSort;
+
+typedef struct
+{
+  uint8_t digest[SHA256_DIGEST_LEN];
+  uint64_t offset;
+  uint64_t len;
+  bool used;
+} CodeSlot;
+
+struct BSLPackWriter
+{
+  BSLAlloc alloc;
+  PackRecord *records;
+  size_t record_count, record_cap;
+  BSLInterfaceVarying *varyings;
+  size_t varying_count, varying_cap;
+  uint8_t *data;
+  size_t data_len, data_cap;
+  /* Code already in data, so identical outputs are stored once. */
+  CodeSlot *code;
+  size_t code_count, code_cap;
+  /* Copies of the names added, data moves as it grows. */
+  NameTable names;
+};
+
+struct BSLPack
+{
+  BSLAlloc alloc;
+  const uint8_t *base;
+  size_t size;
+  const PackHeader *header;
+  const PackRecord *records;
+  const PackName *names;
+  const PackHash *hashes;
+  const BSLInterfaceVarying *varyings;
+  const uint8_t *data;
+};
+
+/* === PROTOTYPES === */
+
+static void *grow(BSLAlloc *alloc, void *ptr, size_t *cap, size_t need,
+    size_t size);
+static uint64_t append_data(BSLPackWriter *writer, const void *data,
+    size_t len);
+static uint64_t add_code(BSLPackWriter *writer, const char *code,
+    size_t len);
+static uint32_t add_varyings(BSLPackWriter *writer,
+    const BSLInterfaceVarying *varyings, size_t count);
+static int compare_names(const void *a, const void *b);
+static int compare_hashes(const void *a, const void *b);
+static bool section_fits(size_t size, uint64_t offset, uint64_t count,
+    size_t stride);
+
+/* === PUBLIC FUNCTIONS === */
+
+BSLPackWriter *bsl_pack_writer_create(BSLAllocFn alloc_fn, void *alloc_ud)
+{
+  BSLAlloc alloc = {
+    .ud = alloc_ud,
+    .fn = alloc_fn,
+  };
+  BSLPackWriter *writer = BSL_NEW(&alloc, BSLPackWriter);
+  memset(writer, 0, sizeof(*writer));
+  writer->alloc = alloc;
+  return writer;
+}
+
+bool bsl_pack_add(BSLPackWriter *writer, const BSLPackEntry *entry,
+    BSLCompileResult *result)
+{
+  if (entry->name == NULL || entry->name[0] == '\0')
+  {
+    result_error(result, 0, 0, "pack entries need a name");
+    return false;
+  }
+
+  if (entry->stage != BSL_STAGE_VERTEX && entry->stage != BSL_STAGE_FRAGMENT)
+  {
+    result_error(result, 0, 0, "pack entry '%s' has no valid stage",
+        entry->name);
+    return false;
+  }
+
+  if (writer->record_count >= UINT32_MAX)
+  {
+    result_error(result, 0, 0, "too many pack entries");
+    return false;
+  }
+
+  size_t name_len = strlen(entry->name);
+  if (name_table_find(&writer->names, (const uint8_t *) entry->name,
+        name_len) != NULL)
+  {
+    result_error(result, 0, 0, "duplicate pack entry '%s'", entry->name);
+    return false;
+  }
+
+  writer->records = grow(&writer->alloc, writer->records,
+      &writer->record_cap, writer->record_count + 1, sizeof(PackRecord));
+  PackRecord *record = &writer->records[writer->record_count++];
+  memset(record, 0, sizeof(*record));
+
+  uint8_t *name = writer->alloc.fn(NULL, 0, name_len + 1, writer->alloc.ud);
+  memcpy(name, entry->name, name_len + 1);
+  name_table_add(&writer->names, &writer->alloc, name, name_len,
+      (void *) (uintptr_t) writer->record_count);
+
+  record->name_len = name_len;
+  record->name_offset = append_data(writer, entry->name,
+      record->name_len + 1);
+  record->code_len = entry->code_len;
+  record->code_offset = add_code(writer, entry->code, entry->code_len);
+  record->stage = entry->stage;
+  record->input_count = entry->input_count;
+  record->input_first = add_varyings(writer, entry->inputs,
+      entry->input_count);
+  record->output_count = entry->output_count;
+  record->output_first = add_varyings(writer, entry->outputs,
+      entry->output_count);
+  if (entry->hash != NULL)
+  {
+    memcpy(record->hash, entry->hash, BSL_HASH_LEN);
+    record->hashed = 1;
+  }
+  return true;
+}
+
+bool bsl_pack_add_result(BSLPackWriter *writer, const char *name,
+    const BSLCompileResult *compile_result, const char *entry_point,
+    BSLStage stage, BSLCompileResult *result)
+{
+  const BSLEntryPointHash *hash = NULL;
+  for (size_t i = 0; hash == NULL && i < compile_result->entry_hash_count;
+      i++)
+  {
+    const BSLEntryPointHash *iter = &compile_result->entry_hashes[i];
+    if ((iter->stage & stage) && strcmp(iter->name, entry_point) == 0)
+    {
+      hash = iter;
+    }
+  }
+
+  if (hash == NULL)
+  {
+    const char *stage_name = stage == BSL_STAGE_VERTEX ? "vertex " :
+      stage == BSL_STAGE_FRAGMENT ? "fragment " : "";
+    result_error(result, 0, 0, "no %sentry point named '%s'", stage_name,
+        entry_point);
+    return false;
+  }
+
+  BSLPackEntry entry = {
+    .name = name,
+    .stage = stage,
+    .hash = hash->hash,
+    .code = compile_result->output,
+    .code_len = compile_result->output_len,
+    .inputs = hash->varyings,
+    .input_count = hash->input_count,
+    .outputs = hash->varyings != NULL ?
+      hash->varyings + hash->input_count : NULL,
+    .output_count = hash->output_count,
+  };
+  return bsl_pack_add(writer, &entry, result);
+}
+
+bool bsl_pack_write(BSLPackWriter *writer, const char *path,
+    BSLCompileResult *result)
+{
+  BSLAlloc *alloc = &writer->alloc;
+  size_t count = writer->record_count;
+
+  /* One extra element keeps the scratch allocations non-empty. */
+  NameSort *sorted = alloc->fn(NULL, 0, (count + 1) * sizeof(NameSort),
+      alloc->ud);
+  for (size_t i = 0; i < count; i++)
+  {
+    PackRecord *record = &writer->records[i];
+    sorted[i].name = (const char *) writer->data + record->name_offset;
+    sorted[i].key = hash_name((const uint8_t *) sorted[i].name,
+        record->name_len);
+    sorted[i].entry = (uint32_t) i;
+  }
+  qsort(sorted, count, sizeof(NameSort), compare_names);
+
+  PackHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PACK_MAGIC, 4);
+  header.format = PACK_FORMAT;
+  header.endian = PACK_ENDIAN;
+  header.entry_count = (uint32_t) count;
+  header.records_offset = ALIGN_UP(sizeof(header));
+  header.names_offset = ALIGN_UP(header.records_offset +
+      count * sizeof(PackRecord));
+  header.hashes_offset = ALIGN_UP(header.names_offset +
+      count * sizeof(PackName));
+  for (size_t i = 0; i < count; i++)
+  {
+    header.hash_count += writer->records[i].hashed;
+  }
+  header.varyings_offset = ALIGN_UP(header.hashes_offset +
+      header.hash_count * sizeof(PackHash));
+  header.varying_count = writer->varying_count;
+  header.data_offset = ALIGN_UP(header.varyings_offset +
+      writer->varying_count * sizeof(BSLInterfaceVarying));
+  header.data_size = writer->data_len;
+  header.file_size = header.data_offset + writer->data_len;
+
+  uint8_t *out = alloc->fn(NULL, 0, header.file_size, alloc->ud);
+  memset(out, 0, header.file_size);
+  memcpy(out, &header, sizeof(header));
+  if (count > 0)
+  {
+    memcpy(out + header.records_offset, writer->records,
+        count * sizeof(PackRecord));
+  }
+
+  PackName *names = (PackName *) (out + header.names_offset);
+  PackHash *hashes = (PackHash *) (out + header.hashes_offset);
+  for (size_t i = 0; i < count; i++)
+  {
+    names[i].key = sorted[i].key;
+    names[i].entry = sorted[i].entry;
+  }
+  size_t hash_count = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (writer->records[i].hashed)
+    {
+      memcpy(hashes[hash_count].hash, writer->records[i].hash, BSL_HASH_LEN);
+      hashes[hash_count++].entry = (uint32_t) i;
+    }
+  }
+  qsort(hashes, hash_count, sizeof(PackHash), compare_hashes);
+  alloc->fn(sorted, (count + 1) * sizeof(NameSort), 0, alloc->ud);
+
+  if (writer->varying_count > 0)
+  {
+    memcpy(out + header.varyings_offset, writer->varyings,
+        writer->varying_count * sizeof(BSLInterfaceVarying));
+  }
+  if (writer->data_len > 0)
+  {
+    memcpy(out + header.data_offset, writer->data, writer->data_len);
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    alloc->fn(out, header.file_size, 0, alloc->ud);
+    result_error(result, 0, 0, "could not open '%s' for writing", path);
+    return false;
+  }
+
+  bool written = fwrite(out, 1, header.file_size, file) == header.file_size;
+  alloc->fn(out, header.file_size, 0, alloc->ud);
+  if (fclose(file) != 0 || !written)
+  {
+    result_error(result, 0, 0, "could not write '%s'", path);
+    return false;
+  }
+  return true;
+}
+
+void bsl_pack_writer_free(BSLPackWriter *writer)
+{
+  BSLAlloc alloc = writer->alloc;
+  alloc.fn(writer->records, writer->record_cap * sizeof(PackRecord), 0,
+      alloc.ud);
+  alloc.fn(writer->varyings,
+      writer->varying_cap * sizeof(BSLInterfaceVarying), 0, alloc.ud);
+  alloc.fn(writer->data, writer->data_cap, 0, alloc.ud);
+  alloc.fn(writer->code, writer->code_cap * sizeof(CodeSlot), 0, alloc.ud);
+  for (size_t i = 0; i < writer->names.cap; i++)
+  {
+    NameSlot *slot = &writer->names.slots[i];
+    if (slot->name != NULL)
+    {
+      alloc.fn((uint8_t *) slot->name, slot->name_len + 1, 0, alloc.ud);
+    }
+  }
+  alloc.fn(writer->names.slots, writer->names.cap * sizeof(NameSlot), 0,
+      alloc.ud);
+  alloc.fn(writer, sizeof(BSLPackWriter), 0, alloc.ud);
+}
+
+bool bsl_pack_open(const char *path, BSLAllocFn alloc_fn, void *alloc_ud,
+    BSLPack **pack_out, BSLCompileResult *result)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    result_error(result, 0, 0, "could not open '%s'", path);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(PackHeader))
+  {
+    close(fd);
+    result_error(result, 0, 0, "'%s' is not a shader pack", path);
+    return false;
+  }
+
+  size_t size = st.st_size;
+  const uint8_t *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    result_error(result, 0, 0, "could not map '%s'", path);
+    return false;
+  }
+
+  /* Only the layout is checked here, records are checked as they are
+   * read so opening stays constant time. */
+  const PackHeader *header = (const PackHeader *) base;
+  bool valid = memcmp(header->magic, PACK_MAGIC, 4) == 0 &&
+    header->format == PACK_FORMAT && header->endian == PACK_ENDIAN &&
+    header->file_size == size &&
+    section_fits(size, header->records_offset, header->entry_count,
+        sizeof(PackRecord)) &&
+    section_fits(size, header->names_offset, header->entry_count,
+        sizeof(PackName)) &&
+    header->hash_count <= header->entry_count &&
+    section_fits(size, header->hashes_offset, header->hash_count,
+        sizeof(PackHash)) &&
+    section_fits(size, header->varyings_offset, header->varying_count,
+        sizeof(BSLInterfaceVarying)) &&
+    section_fits(size, header->data_offset, header->data_size, 1);
+  if (!valid)
+  {
+    munmap((void *) base, size);
+    result_error(result, 0, 0, "'%s' is not a compatible shader pack", path);
+    return false;
+  }
+
+  BSLAlloc alloc = {
+    .ud = alloc_ud,
+    .fn = alloc_fn,
+  };
+  BSLPack *pack = BSL_NEW(&alloc, BSLPack);
+  pack->alloc = alloc;
+  pack->base = base;
+  pack->size = size;
+  pack->header = header;
+  pack->records = (const PackRecord *) (base + header->records_offset);
+  pack->names = (const PackName *) (base + header->names_offset);
+  pack->hashes = (const PackHash *) (base + header->hashes_offset);
+  pack->varyings = (const BSLInterfaceVarying *)
+    (base + header->varyings_offset);
+  pack->data = base + header->data_offset;
+  *pack_out = pack;
+  return true;
+}
+
+size_t bsl_pack_count(const BSLPack *pack)
+{
+  return pack->header->entry_count;
+}
+
+bool bsl_pack_get(const BSLPack *pack, size_t index, BSLPackEntry *entry)
+{
+  const PackHeader *header = pack->header;
+  if (index >= header->entry_count)
+  {
+    return false;
+  }
+
+  const PackRecord *record = &pack->records[index];
+  uint64_t data_size = header->data_size;
+  uint64_t varying_count = header->varying_count;
+  if (record->name_offset >= data_size ||
+      record->name_len >= data_size - record->name_offset ||
+      pack->data[record->name_offset + record->name_len] != '\0' ||
+      record->code_offset > data_size ||
+      record->code_len > data_size - record->code_offset ||
+      record->input_first > varying_count ||
+      record->input_count > varying_count - record->input_first ||
+      record->output_first > varying_count ||
+      record->output_count > varying_count - record->output_first)
+  {
+    return false;
+  }
+
+  entry->name = (const char *) pack->data + record->name_offset;
+  entry->stage = (BSLStage) record->stage;
+  entry->hash = record->hashed ? record->hash : NULL;
+  entry->code = (const char *) pack->data + record->code_offset;
+  entry->code_len = record->code_len;
+  entry->inputs = pack->varyings + record->input_first;
+  entry->input_count = record->input_count;
+  entry->outputs = pack->varyings + record->output_first;
+  entry->output_count = record->output_count;
+  return true;
+}
+
+bool bsl_pack_find(const BSLPack *pack, const char *name, BSLPackEntry *entry)
+{
+  size_t len = strlen(name);
+  uint64_t key = hash_name((const uint8_t *) name, len);
+  size_t lo = 0, hi = pack->header->entry_count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (pack->names[mid].key < key)
+    {
+      lo = mid + 1;
+    } else
+    {
+      hi = mid;
+    }
+  }
+
+  /* Names sharing a key sit next to each other. */
+  for (; lo < pack->header->entry_count && pack->names[lo].key == key; lo++)
+  {
+    if (bsl_pack_get(pack, pack->names[lo].entry, entry) &&
+        strcmp(entry->name, name) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool bsl_pack_find_hash(const BSLPack *pack,
+    const uint8_t hash[BSL_HASH_LEN], BSLPackEntry *entry)
+{
+  size_t lo = 0, hi = pack->header->hash_count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (memcmp(pack->hashes[mid].hash, hash, BSL_HASH_LEN) < 0)
+    {
+      lo = mid + 1;
+    } else
+    {
+      hi = mid;
+    }
+  }
+
+  return lo < pack->header->hash_count &&
+    memcmp(pack->hashes[lo].hash, hash, BSL_HASH_LEN) == 0 &&
+    bsl_pack_get(pack, pack->hashes[lo].entry, entry);
+}
+
+void bsl_pack_close(BSLPack *pack)
+{
+  BSLAlloc alloc = pack->alloc;
+  munmap((void *) pack->base, pack->size);
+  alloc.fn(pack, sizeof(BSLPack), 0, alloc.ud);
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static void *grow(BSLAlloc *alloc, void *ptr, size_t *cap, size_t need,
+    size_t size)
+{
+  if (need <= *cap)
+  {
+    return ptr;
+  }
+
+  size_t new_cap = *cap == 0 ? 64 : *cap;
+  while (new_cap < need)
+  {
+    new_cap *= 2;
+  }
+  ptr = alloc->fn(ptr, *cap * size, new_cap * size, alloc->ud);
+  *cap = new_cap;
+  return ptr;
+}
+
+static uint64_t append_data(BSLPackWriter *writer, const void *data,
+    size_t len)
+{
+  uint64_t offset = writer->data_len;
+  writer->data = grow(&writer->alloc, writer->data, &writer->data_cap,
+      writer->data_len + len, 1);
+  memcpy(writer->data + writer->data_len, data, len);
+  writer->data_len += len;
+  return offset;
+}
+
+static uint64_t add_code(BSLPackWriter *writer, const char *code, size_t len)
+{
+  if (len == 0)
+  {
+    return 0;
+  }
+
+  if (writer->code_count * 2 >= writer->code_cap)
+  {
+    size_t old_cap = writer->code_cap;
+    CodeSlot *old = writer->code;
+    writer->code_cap = old_cap == 0 ? 64 : old_cap * 2;
+    writer->code = writer->alloc.fn(NULL, 0,
+        writer->code_cap * sizeof(CodeSlot), writer->alloc.ud);
+    memset(writer->code, 0, writer->code_cap * sizeof(CodeSlot));
+    for (size_t i = 0; i < old_cap; i++)
+    {
+      if (old[i].used)
+      {
+        size_t h;
+        memcpy(&h, old[i].digest, sizeof(h));
+        h &= writer->code_cap - 1;
+        while (writer->code[h].used)
+        {
+          h = (h + 1) & (writer->code_cap - 1);
+        }
+        writer->code[h] = old[i];
+      }
+    }
+    writer->alloc.fn(old, old_cap * sizeof(CodeSlot), 0, writer->alloc.ud);
+  }
+
+  Sha256 sha;
+  uint8_t digest[SHA256_DIGEST_LEN];
+  sha256_init(&sha);
+  sha256_update(&sha, code, len);
+  sha256_final(&sha, digest);
+
+  size_t h;
+  memcpy(&h, digest, sizeof(h));
+  h &= writer->code_cap - 1;
+  while (writer->code[h].used)
+  {
+    CodeSlot *slot = &writer->code[h];
+    if (slot->len == len && memcmp(slot->digest, digest, sizeof(digest)) == 0)
+    {
+      return slot->offset;
+    }
+    h = (h + 1) & (writer->code_cap - 1);
+  }
+
+  CodeSlot *slot = &writer->code[h];
+  memcpy(slot->digest, digest, sizeof(digest));
+  slot->len = len;
+  slot->offset = append_data(writer, code, len);
+  slot->used = true;
+  writer->code_count++;
+  return slot->offset;
+}
+
+/* Stored sorted by location, then component. */
+static uint32_t add_varyings(BSLPackWriter *writer,
+    const BSLInterfaceVarying *varyings, size_t count)
+{
+  uint32_t first = (uint32_t) writer->varying_count;
+  writer->varyings = grow(&writer->alloc, writer->varyings,
+      &writer->varying_cap, writer->varying_count + count,
+      sizeof(BSLInterfaceVarying));
+
+  BSLInterfaceVarying *out = writer->varyings + first;
+  for (size_t i = 0; i < count; i++)
+  {
+    BSLInterfaceVarying varying = varyings[i];
+    size_t j = i;
+    while (j > 0 && (out[j - 1].location > varying.location ||
+          (out[j - 1].location == varying.location &&
+           out[j - 1].component > varying.component)))
+    {
+      out[j] = out[j - 1];
+      j--;
+    }
+    out[j] = varying;
+  }
+  writer->varying_count += count;
+  return first;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+  const NameSort *name1 = a, *name2 = b;
+  if (name1->key != name2->key)
+  {
+    return name1->key < name2->key ? -1 : 1;
+  }
+  return strcmp(name1->name, name2->name);
+}
+
+static int compare_hashes(const void *a, const void *b)
+{
+  const PackHash *hash1 = a, *hash2 = b;
+  int order = memcmp(hash1->hash, hash2->hash, BSL_HASH_LEN);
+  if (order != 0)
+  {
+    return order;
+  }
+  return hash1->entry < hash2->entry ? -1 : hash1->entry > hash2->entry;
+}
+
+static bool section_fits(size_t size, uint64_t offset, uint64_t count,
+    size_t stride)
+{
+  return offset % PACK_ALIGN == 0 && offset >= sizeof(PackHeader) &&
+    offset <= size && count <= (size - offset) / stride;
+}
@@ -1,4 +1,7 @@
+#include <string.h>
+
 #include <bsl/parser.h>
+#include <bsl/trace.h>
 
 const char *builtin_type_to_type_type[] = {
   [TYPE_F32] = "f32",
@@ -9,21 +12,40 @@ const char *builtin_type_to_type_type[] = {
 TypeType type_start = TYPE_F32;
 TypeType type_end = TYPE_VOID;
 
+/* Binary operators by token, with how tightly they bind; zero for every
+ * other token. */
+static const struct
+{
+  int precedence;
+  Binop op;
+} binops[TOKEN_ERR + 1] = {
+  [TOKEN_ADD] = {1, BINOP_ADD},
+  [TOKEN_SUB] = {1, BINOP_SUB},
+  [TOKEN_MUL] = {2, BINOP_MUL},
+  [TOKEN_DIV] = {2, BINOP_DIV},
+};
+
 /* === PROTOTYPES === */
 
 static Expr *parse_expr(Parser *parser);
-static Expr *parse_atom_expr(Parser *parser);
+static Expr *climb_expr(Parser *parser, size_t base);
+static Expr *fold_binops(Parser *parser, Expr *rhs, int precedence);
+static bool parse_record_member(Parser *parser, RecordExprMember **member);
+static Expr *new_expr(Parser *parser, ExprType t, Token tok);
+static void push_operand(Parser *parser, Expr *expr);
+static Pending *push_pending(Parser *parser, PendingType t);
 static Parameter *parse_parameter(Parser *parser);
-static Expr *parse_vector_expr(Parser *parser, Token start_tok, Expr *expr);
 static Statement *parse_statement(Parser *parser);
-static Expr *parse_record_expr(Parser *parser, Token tok, Expr *expr);
 static Toplevel *parse_record_toplevel(Parser *parser, int line, int col);
 static Toplevel *parse_procedure(Parser *parser, int line, int col);
+static Constant *parse_constant(Parser *parser, int line, int col);
 static Type *parse_vector_type(Parser *parser, size_t size, Token start);
-static Expr *parse_mul_expr(Parser *parser);
-static Expr *parse_add_expr(Parser *parser);
-static Expr *parse_member_expr(Parser *parser);
 static Type *create_type(Parser *parser, TypeType t, int line, int col);
+static bool enter_nesting(Parser *parser, Token tok);
+static bool poll_limits(Parser *parser, Token tok);
+static bool recover(Parser *parser);
+static bool sync_statement(Parser *parser);
+static bool sync_toplevel(Parser *parser, bool inside);
 static void parser_error_tok(Parser *parser, Token tok, const char *msg, ...);
 static void handle_erratic_tok(Parser *parser, Token tok, 
     const char *expected_item);
@@ -40,9 +62,27 @@ bool parser_init(Parser *parser, Lexer *lex, BSLAlloc *alloc, BSLCompileResult *
   parser->result = result;
   parser->alloc = alloc;
   parser->next_entry_point = 0;
+  parser->ast = NULL;
+  parser->depth = 0;
+  parser->operands = NULL;
+  parser->operand_count = parser->operand_cap = 0;
+  parser->pending = NULL;
+  parser->pending_count = parser->pending_cap = 0;
+  parser->open_records = 0;
+  parser->named = NULL;
+  parser->named_constant = NULL;
+  parser->named_statement = NULL;
   return true;
 }
 
+void parser_free(Parser *parser)
+{
+  parser->alloc->fn(parser->operands, parser->operand_cap * sizeof(Expr *),
+      0, parser->alloc->ud);
+  parser->alloc->fn(parser->pending, parser->pending_cap * sizeof(Pending),
+      0, parser->alloc->ud);
+}
+
 Type *parse_type(Parser *parser)
 {
   Token tok = lexer_peek(parser->lex);
@@ -175,23 +215,87 @@ bool parse_ast(Parser *parser, AST *ast)
 
   ast->type_scope.entries = NULL;
   ast->type_scope.up = NULL;
+  ast->entry_points = NULL;
+  ast->entry_point_count = 0;
 
   Token tok;
+  Import **import_tail = &ast->imports;
+  Constant **constant_tail = &ast->constants;
   ast->toplevels = NULL;
-  while ((tok = lexer_peek(parser->lex)).t != TOKEN_EOF && tok.t != TOKEN_ERR)
+  ast->imports = NULL;
+  ast->constants = NULL;
+  size_t reported = parser->result->diagnostic_count;
+  while ((tok = lexer_peek(parser->lex)).t != TOKEN_EOF)
   {
-    Toplevel *toplvl = parse_toplevel(parser);
-    if (toplvl == NULL)
+    bool ok;
+    if (tok.t == TOKEN_KW_IMPORT)
     {
-      return false;
+      Token name_tok;
+      lexer_skip(parser->lex);
+      ok = expect_with(parser, TOKEN_SYM, "module name", &name_tok);
+      if (ok)
+      {
+        Import *import = BSL_NEW(parser->alloc, Import);
+        import->line = tok.line;
+        import->col = tok.col;
+        import->name = (const uint8_t *) name_tok.sym.data;
+        import->name_len = name_tok.sym.size;
+        import->module = NULL;
+        import->next = NULL;
+        *import_tail = import;
+        import_tail = &import->next;
+      }
+    } else if (tok.t == TOKEN_KW_CONST)
+    {
+      lexer_skip(parser->lex);
+      parser->named_constant = NULL;
+      Constant *constant = parse_constant(parser, tok.line, tok.col);
+      ok = constant != NULL;
+      /* One that failed has no value, which poisons it. */
+      if (!ok && parser->named_constant != NULL)
+      {
+        constant = parser->named_constant;
+        constant->value = NULL;
+      }
+      if (constant != NULL)
+      {
+        *constant_tail = constant;
+        constant_tail = &constant->next;
+      }
+    } else
+    {
+      uint64_t start = ast->trace != NULL ? now_ns() : 0;
+      parser->named = NULL;
+      Toplevel *toplvl = parse_toplevel(parser);
+      ok = toplvl != NULL;
+      if (ok)
+      {
+        trace_toplevel(ast->trace, toplvl, start);
+      } else if (parser->named != NULL)
+      {
+        toplvl = parser->named;
+        toplvl->broken = true;
+      }
+      if (toplvl != NULL)
+      {
+        toplvl->next = ast->toplevels;
+        ast->toplevels = toplvl;
+      }
     }
-    toplvl->next = ast->toplevels;
-    ast->toplevels = toplvl;
-  }
 
-  if (tok.t == TOKEN_ERR)
-  {
-    return false;
+    if (!ok)
+    {
+      /* A toplevel that failed is skipped past its 'end', tokens that
+       * start none only up to the next one that does. */
+      bool inside = tok.t == TOKEN_LBRACK || tok.t == TOKEN_KW_RECORD ||
+        tok.t == TOKEN_KW_PROC || tok.t == TOKEN_KW_IMPORT ||
+        tok.t == TOKEN_KW_CONST;
+      parser->next_entry_point = 0;
+      if (!recover(parser) || !sync_toplevel(parser, inside))
+      {
+        return false;
+      }
+    }
   }
 
   Toplevel *tmp, *follow, *first;
@@ -206,255 +310,325 @@ bool parse_ast(Parser *parser, AST *ast)
   }
   ast->toplevels = follow;
 
-  return true;
+  /* Recovered errors leave a tree with holes, which only gets this far to
+   * report what else is wrong with the source. */
+  return parser->result->diagnostic_count == reported;
 }
 
 /* === PRIVATE FUNCTIONS === */
 
-static Expr *parse_record_expr(Parser *parser, Token start_tok, Expr *expr)
+/* Precedence climbing over the parser's own stacks: operands wait on one,
+ * operators and the parentheses, vectors and records still open around
+ * them on the other. Nesting costs no native stack. */
+static Expr *parse_expr(Parser *parser)
 {
-  Token tok, name_tok;
-  expr->t = EXPR_RECORD;
-  expr->line = start_tok.line;
-  expr->col = start_tok.col;
-  if (!expect_with(parser, TOKEN_SYM, "record name", &name_tok))
+  size_t depth = parser->depth;
+  size_t operand_base = parser->operand_count;
+  size_t pending_base = parser->pending_count;
+  Expr *expr = NULL;
+  if (enter_nesting(parser, lexer_peek(parser->lex)))
   {
-    return NULL;
+    expr = climb_expr(parser, pending_base);
   }
+  for (size_t i = pending_base; expr == NULL && i < parser->pending_count; i++)
+  {
+    parser->open_records += parser->pending[i].t == PENDING_RECORD;
+  }
+  parser->depth = depth;
+  parser->operand_count = operand_base;
+  parser->pending_count = pending_base;
+  return expr;
+}
 
-  expr->record.members = NULL;
-  expr->record.name = name_tok.sym.data;
-  expr->record.name_len = name_tok.sym.size;
-  while ((tok = lexer_next(parser->lex)).t == TOKEN_PERIOD)
+static Expr *climb_expr(Parser *parser, size_t base)
+{
+  Expr *operand = NULL;
+  for (;;)
   {
-    RecordExprMember *member = BSL_NEW(parser->alloc, RecordExprMember);
-    Token member_name;
-    if (!expect_with(parser, TOKEN_SYM, "member name", &member_name))
+    if (operand == NULL)
     {
-      return NULL;
-    }
-    member->name = member_name.sym.data;
-    member->name_len = member_name.sym.size;
-    member->line = member_name.line;
-    member->col = member_name.col;
+      Token tok = lexer_peek(parser->lex);
+      switch (tok.t)
+      {
+        case TOKEN_LPAREN:
+          lexer_skip(parser->lex);
+          if (!enter_nesting(parser, tok))
+          {
+            return NULL;
+          }
+          push_pending(parser, PENDING_PAREN);
+          continue;
+        case TOKEN_LCURLY: {
+          lexer_skip(parser->lex);
+          if (!enter_nesting(parser, tok))
+          {
+            return NULL;
+          }
+          Expr *vec = new_expr(parser, EXPR_VECTOR, tok);
+          vec->vec.exprs = NULL;
+          push_pending(parser, PENDING_VECTOR)->expr = vec;
+          continue;
+        }
+        case TOKEN_KW_RECORD: {
+          lexer_skip(parser->lex);
+          Token name_tok;
+          if (!expect_with(parser, TOKEN_SYM, "record name", &name_tok))
+          {
+            return NULL;
+          }
+
+          Expr *rec = new_expr(parser, EXPR_RECORD, tok);
+          rec->record.members = NULL;
+          rec->record.name = name_tok.sym.data;
+          rec->record.name_len = name_tok.sym.size;
+          RecordExprMember *member;
+          if (!parse_record_member(parser, &member))
+          {
+            return NULL;
+          }
+          if (member == NULL)
+          {
+            operand = rec;
+            break;
+          }
+
+          if (!enter_nesting(parser, tok))
+          {
+            return NULL;
+          }
+          Pending *open = push_pending(parser, PENDING_RECORD);
+          open->expr = rec;
+          open->member = member;
+          continue;
+        }
+        case TOKEN_NUM:
+          lexer_skip(parser->lex);
+          operand = new_expr(parser, EXPR_NUM, tok);
+          operand->num = tok.num;
+          break;
+        case TOKEN_SYM:
+          lexer_skip(parser->lex);
+          operand = new_expr(parser, EXPR_VAR, tok);
+          operand->var.name = tok.sym.data;
+          operand->var.name_len = tok.sym.size;
+          break;
+        default:
+          handle_erratic_tok(parser, tok, "expression");
+          return NULL;
+      }
 
-    if (!expect(parser, TOKEN_EQ, "'='"))
-    {
-      return NULL;
+      if (!poll_limits(parser, tok))
+      {
+        return NULL;
+      }
     }
 
-    member->expr = parse_expr(parser);
-
-    if (member->expr == NULL)
+    /* Member access binds tightest, so it never waits on the stack. */
+    Token tok;
+    while ((tok = lexer_peek(parser->lex)).t == TOKEN_PERIOD)
     {
-      return NULL;
+      lexer_skip(parser->lex);
+      Token member_tok;
+      if (!expect_with(parser, TOKEN_SYM, "member name", &member_tok))
+      {
+        return NULL;
+      }
+      Expr *new = BSL_NEW(parser->alloc, Expr);
+      new->t = EXPR_MEMBER;
+      new->line = operand->line;
+      new->col = operand->col;
+      new->member.lhs = operand;
+      new->member.name = member_tok.sym.data;
+      new->member.name_len = member_tok.sym.size;
+      new->type = NULL;
+      new->next = NULL;
+      operand = new;
     }
 
-    if (!expect(parser, TOKEN_COMMA, "','"))
+    int precedence = binops[tok.t].precedence;
+    if (precedence > 0)
     {
-      return NULL;
+      lexer_skip(parser->lex);
+      push_operand(parser, fold_binops(parser, operand, precedence));
+      Pending *op = push_pending(parser, PENDING_BINOP);
+      op->op = binops[tok.t].op;
+      op->precedence = precedence;
+      operand = NULL;
+      continue;
     }
 
-    member->next = expr->record.members;
-    expr->record.members = member;
-  }
-
-  if (tok.t != TOKEN_KW_END)
-  {
-    handle_erratic_tok(parser, tok, "record member");
-    return NULL;
-  }
-
-  return expr;
-}
-
-static Expr *parse_vector_expr(Parser *parser, Token start_tok, Expr *expr)
-{
-  Token tok;
-  expr->t = EXPR_VECTOR;
-  expr->line = start_tok.line;
-  expr->col = start_tok.col;
-
-  expr->vec.exprs = parse_expr(parser);
-  if (expr->vec.exprs == NULL)
-  {
-    return NULL;
-  }
-
-  expr->vec.exprs->next = NULL;
-
-  while ((tok = lexer_next(parser->lex)).t == TOKEN_COMMA)
-  {
-    Expr *tmp = parse_expr(parser);
-    if (tmp == NULL)
+    /* Nothing binds any further, so the innermost open construct takes
+     * the operand. */
+    operand = fold_binops(parser, operand, 0);
+    if (parser->pending_count == base)
     {
-      return NULL;
+      return operand;
     }
 
-    tmp->next = expr->vec.exprs;
-    expr->vec.exprs = tmp;
-  }
+    Pending *open = &parser->pending[parser->pending_count - 1];
+    switch (open->t)
+    {
+      case PENDING_PAREN:
+        if (!expect(parser, TOKEN_RPAREN, "right parenthesis"))
+        {
+          return NULL;
+        }
+        break;
+      case PENDING_VECTOR:
+        tok = lexer_next(parser->lex);
+        operand->next = NULL;
+        if (open->last == NULL)
+        {
+          open->expr->vec.exprs = operand;
+        } else
+        {
+          open->last->next = operand;
+        }
+        open->last = operand;
 
-  if (tok.t != TOKEN_RCURLY)
-  {
-    handle_erratic_tok(parser, tok, "comma");
-    return NULL;
-  }
+        if (tok.t == TOKEN_COMMA)
+        {
+          operand = NULL;
+          continue;
+        }
+        if (tok.t != TOKEN_RCURLY)
+        {
+          handle_erratic_tok(parser, tok, "comma");
+          return NULL;
+        }
+        operand = open->expr;
+        break;
+      case PENDING_RECORD: {
+        if (!expect(parser, TOKEN_COMMA, "','"))
+        {
+          return NULL;
+        }
+        RecordExprMember *member = open->member;
+        member->expr = operand;
+        member->next = open->expr->record.members;
+        open->expr->record.members = member;
 
-  Expr *first, *follow, *tmp;
-  first = expr->vec.exprs;
-  follow = tmp = NULL;
-  while (first != NULL)
-  {
-    tmp = first->next;
-    first->next = follow;
-    follow = first;
-    first = tmp;
+        if (!parse_record_member(parser, &open->member))
+        {
+          return NULL;
+        }
+        if (open->member != NULL)
+        {
+          operand = NULL;
+          continue;
+        }
+        operand = open->expr;
+        break;
+      }
+      case PENDING_BINOP:
+        break;
+    }
+    parser->pending_count--;
+    parser->depth--;
   }
-  expr->vec.exprs = follow;
-
-  return expr;
 }
 
-static Expr *parse_expr(Parser *parser)
+/* Folds the operators pending above the innermost open construct that
+ * bind at least as tightly as precedence, with rhs as the last operand. */
+static Expr *fold_binops(Parser *parser, Expr *rhs, int precedence)
 {
-  return parse_add_expr(parser);
-}
-
-static Expr *parse_add_expr(Parser *parser)
-{
-  Expr *lhs = parse_mul_expr(parser);
-  if (lhs == NULL)
+  while (parser->pending_count > 0)
   {
-    return NULL;
-  }
-
-  Token tok;
-  while ((tok = lexer_peek(parser->lex)).t == TOKEN_ADD || tok.t == TOKEN_SUB)
-  {
-    lexer_skip(parser->lex);
-    Binop op = tok.t == TOKEN_ADD ? BINOP_ADD : TOKEN_SUB;
-    Expr *rhs = parse_mul_expr(parser);
-    if (rhs == NULL)
+    Pending *top = &parser->pending[parser->pending_count - 1];
+    if (top->t != PENDING_BINOP || top->precedence < precedence)
     {
-      return NULL;
+      break;
     }
 
+    Expr *lhs = parser->operands[--parser->operand_count];
     Expr *new = BSL_NEW(parser->alloc, Expr);
     new->t = EXPR_BINARY;
     new->line = lhs->line;
     new->col = lhs->col;
     new->binary.rhs = rhs;
     new->binary.lhs = lhs;
-    new->binary.op = op;
-
-    lhs = new;
+    new->binary.op = top->op;
+    new->type = NULL;
+    new->next = NULL;
+    rhs = new;
+    parser->pending_count--;
   }
-  return lhs;
+  return rhs;
 }
 
-static Expr *parse_mul_expr(Parser *parser)
+/* Starts the next '.name =' of a record expression, or leaves member NULL
+ * at its 'end'. */
+static bool parse_record_member(Parser *parser, RecordExprMember **member)
 {
-  Expr *lhs = parse_member_expr(parser);
-  if (lhs == NULL)
+  *member = NULL;
+  Token tok = lexer_next(parser->lex);
+  if (tok.t == TOKEN_KW_END)
   {
-    return NULL;
+    return true;
   }
-
-  Token tok;
-  while ((tok = lexer_peek(parser->lex)).t == TOKEN_MUL || tok.t == TOKEN_DIV)
+  if (tok.t != TOKEN_PERIOD)
   {
-    lexer_skip(parser->lex);
-    Binop op = tok.t == TOKEN_MUL ? BINOP_MUL : TOKEN_DIV;
-    Expr *rhs = parse_member_expr(parser);
-    if (rhs == NULL)
-    {
-      return NULL;
-    }
-
-    Expr *new = BSL_NEW(parser->alloc, Expr);
-    new->t = EXPR_BINARY;
-    new->line = lhs->line;
-    new->col = lhs->col;
-    new->binary.rhs = rhs;
-    new->binary.lhs = lhs;
-    new->binary.op = op;
-
-    lhs = new;
+    handle_erratic_tok(parser, tok, "record member");
+    return false;
   }
-  return lhs;
-}
 
-static Expr *parse_member_expr(Parser *parser)
-{
-  Token tok;
-  Expr *lhs = parse_atom_expr(parser);
-  if (lhs == NULL)
+  Token member_name;
+  if (!expect_with(parser, TOKEN_SYM, "member name", &member_name))
   {
-    return NULL;
+    return false;
   }
-
-  while ((tok = lexer_peek(parser->lex)).t == TOKEN_PERIOD)
+  RecordExprMember *new = BSL_NEW(parser->alloc, RecordExprMember);
+  new->name = member_name.sym.data;
+  new->name_len = member_name.sym.size;
+  new->line = member_name.line;
+  new->col = member_name.col;
+  if (!expect(parser, TOKEN_EQ, "'='"))
   {
-    lexer_next(parser->lex);
-    Token member_tok;
-    if (!expect_with(parser, TOKEN_SYM, "member name", &member_tok))
-    {
-      return NULL;
-    }
-    Expr *new = BSL_NEW(parser->alloc, Expr);
-    new->t = EXPR_MEMBER;
-    new->line = lhs->line;
-    new->col = lhs->col;
-    new->member.lhs = lhs;
-    new->member.name = member_tok.sym.data;
-    new->member.name_len = member_tok.sym.size;
-
-    lhs = new;
+    return false;
   }
-
-  return lhs;
+  *member = new;
+  return true;
 }
 
-static Expr *parse_atom_expr(Parser *parser)
+static Expr *new_expr(Parser *parser, ExprType t, Token tok)
 {
   Expr *expr = BSL_NEW(parser->alloc, Expr);
-  Token tok = lexer_peek(parser->lex);
+  expr->t = t;
   expr->line = tok.line;
   expr->col = tok.col;
-  switch (tok.t)
+  expr->type = NULL;
+  expr->next = NULL;
+  return expr;
+}
+
+static void push_operand(Parser *parser, Expr *expr)
+{
+  if (parser->operand_count == parser->operand_cap)
   {
-    case TOKEN_KW_RECORD:
-      lexer_skip(parser->lex);
-      return parse_record_expr(parser, tok, expr);
-    case TOKEN_LCURLY:
-      lexer_skip(parser->lex);
-      return parse_vector_expr(parser, tok, expr);
-    case TOKEN_LPAREN: {
-      lexer_skip(parser->lex);
-      Expr *expr = parse_expr(parser); 
-      if (!expect(parser, TOKEN_RPAREN, "right parenthesis"))
-      {
-        return false;
-      }
-      return expr;
-    }
-    case TOKEN_NUM:
-      lexer_skip(parser->lex);
-      expr->t = EXPR_NUM;
-      expr->num = tok.num;
-      return expr;
-    case TOKEN_SYM: {
-      lexer_skip(parser->lex);
-      expr->t = EXPR_VAR;
-      expr->var.name = tok.sym.data;
-      expr->var.name_len = tok.sym.size;
-      return expr;
-    }
-    default:
-      handle_erratic_tok(parser, tok, "expression");
-      return NULL;
+    size_t cap = parser->operand_cap == 0 ? 16 : parser->operand_cap * 2;
+    parser->operands = parser->alloc->fn(parser->operands,
+        parser->operand_cap * sizeof(Expr *), cap * sizeof(Expr *),
+        parser->alloc->ud);
+    parser->operand_cap = cap;
   }
+  parser->operands[parser->operand_count++] = expr;
+}
+
+static Pending *push_pending(Parser *parser, PendingType t)
+{
+  if (parser->pending_count == parser->pending_cap)
+  {
+    size_t cap = parser->pending_cap == 0 ? 16 : parser->pending_cap * 2;
+    parser->pending = parser->alloc->fn(parser->pending,
+        parser->pending_cap * sizeof(Pending), cap * sizeof(Pending),
+        parser->alloc->ud);
+    parser->pending_cap = cap;
+  }
+
+  Pending *pending = &parser->pending[parser->pending_count++];
+  memset(pending, 0, sizeof(*pending));
+  pending->t = t;
+  return pending;
 }
 
 static Statement *parse_statement(Parser *parser)
@@ -463,10 +637,14 @@ static Statement *parse_statement(Parser *parser)
   Token tok = lexer_peek(parser->lex);
   stmt->line = tok.line;
   stmt->col = tok.col;
+  stmt->broken = false;
   switch (tok.t)
   {
     case TOKEN_KW_VAR: {
       stmt->t = STATEMENT_VAR;
+      stmt->var.entry = NULL;
+      stmt->var.expr = NULL;
+      stmt->var.type = NULL;
       lexer_skip(parser->lex);
       Token name_tok;
       if (!expect_with(parser, TOKEN_SYM, "variable name", &name_tok))
@@ -476,6 +654,7 @@ static Statement *parse_statement(Parser *parser)
 
       stmt->var.name = name_tok.sym.data;
       stmt->var.name_len = name_tok.sym.size;
+      parser->named_statement = stmt;
 
       if (lexer_peek(parser->lex).t == TOKEN_COLON)
       {
@@ -483,7 +662,7 @@ static Statement *parse_statement(Parser *parser)
         stmt->var.type = parse_type(parser);
         if (stmt->var.type == NULL)
         {
-          return false;
+          return NULL;
         }
       }
 
@@ -501,7 +680,9 @@ static Statement *parse_statement(Parser *parser)
     }
     case TOKEN_KW_RETURN: {
       stmt->t = STATEMENT_RETURN;
+      stmt->ret.expr = NULL;
       lexer_skip(parser->lex);
+      parser->named_statement = stmt;
       stmt->ret.expr = parse_expr(parser);
       if (stmt->ret.expr == NULL)
       {
@@ -550,7 +731,10 @@ static Toplevel *parse_procedure(Parser *parser, int line, int col)
   toplevel->t = TOPLEVEL_PROC;
   toplevel->line = line;
   toplevel->col = col;
+  toplevel->broken = false;
   toplevel->proc.stmts = NULL;
+  toplevel->proc.params = NULL;
+  toplevel->proc.return_type = NULL;
 
   Token name_tok;
   if (!expect_with(parser, TOKEN_SYM, "procedure name", &name_tok))
@@ -559,6 +743,9 @@ static Toplevel *parse_procedure(Parser *parser, int line, int col)
   }
   toplevel->proc.name = name_tok.sym.data;
   toplevel->proc.name_len = name_tok.sym.size;
+  toplevel->proc.entry_point = parser->next_entry_point;
+  parser->next_entry_point = 0;
+  parser->named = toplevel;
 
   if (!expect(parser, TOKEN_LPAREN, "function arguments"))
   {
@@ -605,12 +792,25 @@ static Toplevel *parse_procedure(Parser *parser, int line, int col)
   }
 
   while ((tok = lexer_peek(parser->lex)).t != TOKEN_KW_END && 
-      tok.t != TOKEN_EOF && tok.t != TOKEN_ERR)
+      tok.t != TOKEN_EOF)
   {
+    parser->named_statement = NULL;
     Statement *stmt = parse_statement(parser);
     if (stmt == NULL)
     {
-      return NULL;
+      /* One that got as far as a variable name or 'return' is kept broken,
+       * so the variable is poisoned and the body misses no return. The
+       * other statements are resolved as usual. */
+      stmt = parser->named_statement;
+      if (!recover(parser) || !sync_statement(parser))
+      {
+        return NULL;
+      }
+      if (stmt == NULL)
+      {
+        continue;
+      }
+      stmt->broken = true;
     }
 
     stmt->next = toplevel->proc.stmts;
@@ -632,14 +832,75 @@ static Toplevel *parse_procedure(Parser *parser, int line, int col)
   if (tok.t != TOKEN_KW_END)
   {
     handle_erratic_tok(parser, tok, "statement");
+    return NULL;
   }
   lexer_skip(parser->lex);
-
-  toplevel->proc.entry_point = parser->next_entry_point;
-  parser->next_entry_point = 0;
   return toplevel;
 }
 
+static Constant *parse_constant(Parser *parser, int line, int col)
+{
+  Token name_tok;
+  if (!expect_with(parser, TOKEN_SYM, "constant name", &name_tok))
+  {
+    return NULL;
+  }
+
+  Constant *constant = BSL_NEW(parser->alloc, Constant);
+  constant->line = line;
+  constant->col = col;
+  constant->name = name_tok.sym.data;
+  constant->name_len = name_tok.sym.size;
+  constant->type = NULL;
+  constant->next = NULL;
+  parser->named_constant = constant;
+
+  if (lexer_peek(parser->lex).t == TOKEN_COLON)
+  {
+    lexer_skip(parser->lex);
+    constant->type = parse_type(parser);
+    if (constant->type == NULL)
+    {
+      return NULL;
+    }
+  }
+
+  if (!expect(parser, TOKEN_EQ, "'='"))
+  {
+    return NULL;
+  }
+
+  /* Defaults are plain numbers, so a variant only ever swaps a value. */
+  Token num_tok = lexer_next(parser->lex);
+  bool negate = num_tok.t == TOKEN_SUB;
+  if (negate)
+  {
+    num_tok = lexer_next(parser->lex);
+  }
+  if (num_tok.t != TOKEN_NUM)
+  {
+    handle_erratic_tok(parser, num_tok, "number");
+    return NULL;
+  }
+
+  Expr *value = BSL_NEW(parser->alloc, Expr);
+  value->t = EXPR_NUM;
+  value->line = num_tok.line;
+  value->col = num_tok.col;
+  value->num = num_tok.num;
+  value->type = NULL;
+  if (negate && value->num.t == NUMBER_INT)
+  {
+    value->num.i = -value->num.i;
+  } else if (negate)
+  {
+    value->num.f = -value->num.f;
+  }
+  value->next = NULL;
+  constant->value = value;
+  return constant;
+}
+
 static Toplevel *parse_record_toplevel(Parser *parser, int line, int col)
 {
   Token name_tok;
@@ -651,16 +912,24 @@ static Toplevel *parse_record_toplevel(Parser *parser, int line, int col)
   Toplevel *toplvl = BSL_NEW(parser->alloc, Toplevel);
 
   toplvl->record.entries = NULL;
+  toplvl->record.index.slots = NULL;
+  toplvl->record.index.cap = 0;
+  toplvl->record.index.count = 0;
   toplvl->record.name = name_tok.sym.data;
   toplvl->record.name_len = name_tok.sym.size;
   toplvl->t = TOPLEVEL_RECORD;
   toplvl->line = line;
   toplvl->col = col;
+  toplvl->broken = false;
+  parser->named = toplvl;
   Token sym_tok;
   while ((sym_tok = lexer_next(parser->lex)).t == TOKEN_SYM || 
       sym_tok.t == TOKEN_LBRACK)
   {
     RecordEntry *entry = BSL_NEW(parser->alloc, RecordEntry);
+    entry->component = 0;
+    entry->index = 0;
+    entry->live = false;
     if (sym_tok.t == TOKEN_LBRACK)
     {
       Token attr_tok;
@@ -799,14 +1068,25 @@ static Toplevel *parse_record_toplevel(Parser *parser, int line, int col)
   return toplvl;
 }
 
+/* Types are parsed by recursion, so their nesting is bounded whatever the
+ * limits are. */
 static Type *parse_vector_type(Parser *parser, size_t size, Token start)
 {
-  if (!expect(parser, TOKEN_LT, "vector parameter"))
+  if (parser->depth >= AST_MAX_TYPE_DEPTH)
+  {
+    result_error_code(parser->result, BSL_ERROR_LIMIT, start.line,
+        start.col, "vector type is nested deeper than %d",
+        AST_MAX_TYPE_DEPTH);
+    return NULL;
+  }
+  if (!expect(parser, TOKEN_LT, "vector parameter") ||
+      !enter_nesting(parser, start))
   {
     return NULL;
   }
 
   Type *subtype = parse_type(parser);
+  parser->depth--;
   if (subtype == NULL)
   {
     return NULL;
@@ -832,20 +1112,153 @@ static Type *create_type(Parser *parser, TypeType t, int line, int col)
   return type;
 }
 
+/* Every nested expression and type passes through here, and operands
+ * through poll_limits, so this is where a compile stops for going past
+ * its limits while parsing. */
+static bool enter_nesting(Parser *parser, Token tok)
+{
+  Limits *limits = parser->ast != NULL ? parser->ast->limits : NULL;
+  parser->depth++;
+  if (!limits_check_depth(limits, parser->depth, parser->result, tok.line,
+        tok.col) ||
+      !limits_poll(limits, parser->result, tok.line, tok.col))
+  {
+    parser->depth--;
+    return false;
+  }
+  return true;
+}
+
+static bool poll_limits(Parser *parser, Token tok)
+{
+  Limits *limits = parser->ast != NULL ? parser->ast->limits : NULL;
+  return limits_poll(limits, parser->result, tok.line, tok.col);
+}
+
+/* Reports the error that failed a statement or toplevel and lets parsing
+ * go on, unless a limit stopped it. */
+static bool recover(Parser *parser)
+{
+  if (parser->result->limit_exceeded)
+  {
+    return false;
+  }
+  result_report(parser->result, parser->alloc);
+  return true;
+}
+
+/* Skips the rest of a failed statement, up to the next one or the 'end' of
+ * its procedure, which cannot go on past the file or into the next
+ * toplevel. Errors in what is skipped are reported as well. */
+static bool sync_statement(Parser *parser)
+{
+  size_t records = parser->open_records;
+  parser->open_records = 0;
+  for (;;)
+  {
+    Token tok = lexer_peek(parser->lex);
+    switch (tok.t)
+    {
+      case TOKEN_KW_VAR:
+      case TOKEN_KW_RETURN:
+        return true;
+      case TOKEN_KW_END:
+        if (records == 0)
+        {
+          return true;
+        }
+        records--;
+        break;
+      case TOKEN_KW_RECORD:
+        records++;
+        break;
+      case TOKEN_EOF:
+      case TOKEN_KW_PROC:
+      case TOKEN_KW_IMPORT:
+      case TOKEN_KW_CONST:
+        return false;
+      case TOKEN_ERR:
+        if (!recover(parser))
+        {
+          return false;
+        }
+        break;
+      default:
+        break;
+    }
+    lexer_skip(parser->lex);
+  }
+}
+
+/* Skips the rest of a failed toplevel, past its 'end', or when the failure
+ * was outside of any, up to where the next one starts. 'record' also starts
+ * expressions, so only the keywords that never appear inside a toplevel
+ * cut a skip short. */
+static bool sync_toplevel(Parser *parser, bool inside)
+{
+  size_t records = parser->open_records;
+  parser->open_records = 0;
+  for (;;)
+  {
+    Token tok = lexer_peek(parser->lex);
+    switch (tok.t)
+    {
+      case TOKEN_EOF:
+      case TOKEN_KW_PROC:
+      case TOKEN_KW_IMPORT:
+      case TOKEN_KW_CONST:
+        return true;
+      case TOKEN_LBRACK:
+        if (!inside)
+        {
+          return true;
+        }
+        break;
+      case TOKEN_KW_RECORD:
+        if (!inside)
+        {
+          return true;
+        }
+        records++;
+        break;
+      case TOKEN_KW_END:
+        if (inside && records == 0)
+        {
+          lexer_skip(parser->lex);
+          return true;
+        }
+        records -= records > 0;
+        break;
+      case TOKEN_ERR:
+        if (!recover(parser))
+        {
+          return false;
+        }
+        break;
+      default:
+        break;
+    }
+    lexer_skip(parser->lex);
+  }
+}
+
 static void parser_error_tok(Parser *parser, Token tok, const char *msg, ...)
 {
   va_list args;
 
   va_start(args, msg);
-  vresult_error(parser->result, tok.line, tok.col, msg, args);
+  vresult_error(parser->result, BSL_ERROR_SYNTAX, tok.line, tok.col, msg,
+      args);
 }
 
+/* A token that is not the expected one stays, recovery may start on it. */
 static bool expect_with(Parser *parser, TokenType t, const char *expected, Token *tok_out)
 {
-  Token tok = lexer_next(parser->lex);
+  Token tok = lexer_peek(parser->lex);
   *tok_out = tok;
   if (tok.t == t)
   {
+    lexer_skip(parser->lex);
     return true;
   } else
   {
@@ -856,15 +1269,8 @@ static bool expect_with(Parser *parser, TokenType t, const char *expected, Token
 
 static bool expect(Parser *parser, TokenType t, const char *expected)
 {
-  Token tok = lexer_next(parser->lex);
-  if (tok.t == t)
-  {
-    return true;
-  } else
-  {
-    handle_erratic_tok(parser, tok, expected);
-    return false;
-  }
+  Token tok;
+  return expect_with(parser, t, expected, &tok);
 }
 
 static void handle_erratic_tok(Parser *parser, Token tok, const char *expected_item)
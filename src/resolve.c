@@ -1,14 +1,47 @@
+#include <string.h>
+
 #include <bsl/resolve.h>
 #include <bsl/util.h>
+#include <bsl/module.h>
+#include <bsl/stats.h>
+#include <bsl/trace.h>
+
+#define RESOLVE_INLINE_FRAMES 32
+
+/* An expression waiting on its operands in resolve_expr. */
+typedef struct
+{
+  Expr *expr;
+  /* The operand resolved last, NULL before the first. */
+  Expr *operand;
+  RecordExprMember *member;
+  Type *first_type;
+  size_t size;
+  /* Set once any operand or check fails, so the expression goes untyped;
+   * operand_failed only while the last operand is the one that failed. */
+  bool failed;
+  bool operand_failed;
+} ExprFrame;
 
 /* === PROTOTYPES === */
 
+static bool recover(AST *ast);
+static void init_scope(Scope *scope, Scope *up);
 static VarEntry *add_to_scope(AST *ast, Scope *scope, const uint8_t *name, size_t name_len);
-static VarEntry *lookup_scope(Scope *scope, const uint8_t *name, size_t name_len);
+static void add_imports(AST *ast);
+static bool add_constants(AST *ast);
+static VarEntry *lookup_scope(AST *ast, Scope *scope, const uint8_t *name,
+    size_t name_len);
+static RecordEntry *find_record_entry(AST *ast, Toplevel *record,
+    const uint8_t *name, size_t name_len);
+static bool resolve_entry_points(AST *ast);
+static bool resolve_record(AST *ast, Toplevel *record);
 static bool resolve_proc(AST *ast, Toplevel *proc);
+static bool resolve_proc_body(AST *ast, Toplevel *proc);
 static bool resolve_statement(AST *ast, Scope *scope, Statement *stmt, Type **type);
 static bool resolve_expr(AST *ast, Scope *scope, Expr *expr);
-static bool resolve_record_expr(AST *ast, Scope *scope, Expr *expr);
+static bool next_operand(AST *ast, ExprFrame *frame, Expr **next);
+static bool finish_expr(AST *ast, Scope *scope, ExprFrame *frame);
 static bool compare_types(AST *ast, int line, int col, Type *type1, Type *type2);
 static bool resolve_type(AST *ast, int line, int col, Type **_type);
 
@@ -16,13 +49,23 @@ static bool resolve_type(AST *ast, int line, int col, Type **_type);
 
 bool resolve_names(AST *ast)
 {
-  ast->scope.up = NULL;
-  ast->scope.entries = NULL;
+  init_scope(&ast->scope, NULL);
+  init_scope(&ast->type_scope, NULL);
+
+  /* Each toplevel, constant and statement that fails is reported and the
+   * rest resolved regardless, so only the errors in them remain. */
+  size_t reported = ast->result->diagnostic_count;
+  add_imports(ast);
+  if (!add_constants(ast))
+  {
+    return false;
+  }
 
   Toplevel *iter = ast->toplevels;
 
   while (iter != NULL)
   {
+    iter->resolved = false;
     switch (iter->t)
     {
       case TOPLEVEL_PROC:
@@ -30,10 +73,10 @@ bool resolve_names(AST *ast)
               iter->proc.name_len);
         if (iter->proc.entry == NULL)
         {
-          result_error(ast->result, iter->line, iter->col, 
-              "redeclaration of toplevel '%.*s'", iter->proc.name_len, 
-              iter->proc.name);
-          return false;
+          result_error_code(ast->result, BSL_ERROR_REDECLARED, iter->line,
+              iter->col, "redeclaration of toplevel '%.*s'",
+              iter->proc.name_len, iter->proc.name);
+          recover(ast);
         } 
         break;
       case TOPLEVEL_RECORD:
@@ -41,29 +84,48 @@ bool resolve_names(AST *ast)
             iter->record.name_len);
         if (iter->record.entry == NULL)
         {
-          result_error(ast->result, iter->line, iter->col,
-              "redeclaration of record type '%.*s'", iter->record.name_len,
-              iter->record.name);
-          return false;
+          result_error_code(ast->result, BSL_ERROR_REDECLARED, iter->line,
+              iter->col, "redeclaration of record type '%.*s'",
+              iter->record.name_len, iter->record.name);
+          recover(ast);
+          break;
         }
         Type *new_type = BSL_NEW(ast->alloc, Type);
         new_type->t = TYPE_RECORD;
         new_type->record.entries = iter->record.entries;
         new_type->record.name = iter->record.name;
         new_type->record.name_len = iter->record.name_len;
+        new_type->record.toplevel = iter;
         iter->record.entry->type = new_type;
         iter->record.entry->record = iter;
         break;
     }
+
+    /* What failed to parse was reported then, its uses fail silently. */
+    VarEntry *entry = iter->t == TOPLEVEL_PROC ? iter->proc.entry :
+      iter->record.entry;
+    if (iter->broken && entry != NULL)
+    {
+      entry->poisoned = true;
+      iter->resolved = true;
+    }
     iter = iter->next;
   }
 
+  if (ast->entry_point_count > 0)
+  {
+    return resolve_entry_points(ast) &&
+      ast->result->diagnostic_count == reported;
+  }
+
+  /* Redeclared toplevels have no entry to resolve into. */
   iter = ast->toplevels;
   while (iter != NULL)
   {
-    if (iter->t == TOPLEVEL_PROC)
+    if (iter->t == TOPLEVEL_RECORD && iter->record.entry != NULL &&
+        !iter->broken)
     {
-      if (!resolve_proc(ast, iter))
+      if (!resolve_record(ast, iter) && !recover(ast))
       {
         return false;
       }
@@ -72,52 +134,230 @@ bool resolve_names(AST *ast)
     iter = iter->next;
   }
 
-  return true;
+  iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC && iter->proc.entry != NULL &&
+        !iter->broken)
+    {
+      if (!resolve_proc(ast, iter) && !recover(ast))
+      {
+        return false;
+      }
+    }
+
+    iter = iter->next;
+  }
+
+  return ast->result->diagnostic_count == reported;
+}
+
+void number_record_entries(Toplevel *record)
+{
+  size_t count = 0;
+  RecordEntry *iter = record->record.entries;
+  while (iter != NULL)
+  {
+    count++;
+    iter = iter->next;
+  }
+
+  /* Entries are kept in reverse declaration order. */
+  size_t index = count;
+  iter = record->record.entries;
+  while (iter != NULL)
+  {
+    iter->index = --index;
+    iter = iter->next;
+  }
+  record->record.entry_count = count;
+
+  /* Renumbering follows removals, which the index would not see. */
+  record->record.index.slots = NULL;
+  record->record.index.cap = 0;
+  record->record.index.count = 0;
 }
 
 /* === PRIVATE FUNCTIONS === */
 
-static VarEntry *add_to_scope(AST *ast, Scope *scope, const uint8_t *name, 
-    size_t name_len)
+/* Reports the error that failed a part of the module, so the next can be
+ * resolved. Running out of a limit stops all of it. */
+static bool recover(AST *ast)
 {
-  Scope *scope_iter = scope;
-  while (scope_iter != NULL)
+  if (ast->result->limit_exceeded)
   {
-    VarEntry *iter = scope_iter->entries;
+    return false;
+  }
+  result_report(ast->result, ast->alloc);
+  return true;
+}
+
+/* Imported toplevels were resolved when their module was compiled, they
+ * only need names in this module's scopes. */
+static void add_imports(AST *ast)
+{
+  Import *import = ast->imports;
+  while (import != NULL)
+  {
+    Toplevel *iter = import->module->ast.toplevels;
     while (iter != NULL)
     {
-      if (name_len == iter->name_len && strncmp(name, iter->name, name_len) == 0)
+      VarEntry *entry;
+      VarEntry *imported;
+      if (iter->t == TOPLEVEL_PROC)
       {
-        return false;
+        imported = iter->proc.entry;
+        entry = add_to_scope(ast, &ast->scope, iter->proc.name, 
+            iter->proc.name_len);
+      } else
+      {
+        imported = iter->record.entry;
+        entry = add_to_scope(ast, &ast->type_scope, iter->record.name, 
+            iter->record.name_len);
+      }
+
+      if (entry == NULL)
+      {
+        result_error_code(ast->result, BSL_ERROR_REDECLARED, import->line,
+            import->col, "'%.*s' imported from '%.*s' is already declared", 
+            imported->name_len, imported->name, import->name_len, 
+            import->name);
+        recover(ast);
+      } else
+      {
+        entry->type = imported->type;
+        entry->record = imported->record;
       }
       iter = iter->next;
     }
+    import = import->next;
+  }
+}
 
-    scope_iter = scope_iter->up;
+static bool add_constants(AST *ast)
+{
+  Constant *constant = ast->constants;
+  for (; constant != NULL; constant = constant->next)
+  {
+    VarEntry *entry = add_to_scope(ast, &ast->scope, constant->name,
+        constant->name_len);
+    if (entry == NULL)
+    {
+      result_error_code(ast->result, BSL_ERROR_REDECLARED, constant->line,
+          constant->col, "redeclaration of toplevel '%.*s'",
+          constant->name_len, constant->name);
+      recover(ast);
+      continue;
+    }
+
+    /* Left without a value by a parse error, which was reported. */
+    if (constant->value == NULL)
+    {
+      entry->poisoned = true;
+      continue;
+    }
+
+    if (constant->type != NULL && constant->type->t != TYPE_F32)
+    {
+      result_error_code(ast->result, BSL_ERROR_CONSTANT,
+          constant->type->line, constant->type->col,
+          "specialization constants must be f32");
+      entry->poisoned = true;
+      recover(ast);
+      continue;
+    }
+
+    if (!resolve_expr(ast, &ast->scope, constant->value))
+    {
+      entry->poisoned = true;
+      if (!recover(ast))
+      {
+        return false;
+      }
+      continue;
+    }
+    entry->type = constant->value->type;
+    entry->constant = constant->value;
+  }
+  return true;
+}
+
+static void init_scope(Scope *scope, Scope *up)
+{
+  scope->entries = NULL;
+  scope->entry_count = 0;
+  scope->index.slots = NULL;
+  scope->index.cap = 0;
+  scope->index.count = 0;
+  scope->up = up;
+}
+
+static VarEntry *add_to_scope(AST *ast, Scope *scope, const uint8_t *name, 
+    size_t name_len)
+{
+  if (lookup_scope(ast, scope, name, name_len) != NULL)
+  {
+    return NULL;
   }
 
   VarEntry *entry = BSL_NEW(ast->alloc, VarEntry);
   entry->name = name;
   entry->name_len = name_len;
   entry->type = NULL;
+  entry->record = NULL;
+  entry->live = false;
+  entry->poisoned = false;
+  entry->constant = NULL;
+  entry->index = scope->entry_count;
 
   entry->next = scope->entries;
   scope->entries = entry;
 
+  if (++scope->entry_count == NAME_TABLE_MIN)
+  {
+    VarEntry *iter = scope->entries;
+    while (iter != NULL)
+    {
+      name_table_add(&scope->index, ast->alloc, iter->name, iter->name_len,
+          iter);
+      iter = iter->next;
+    }
+  } else if (scope->entry_count > NAME_TABLE_MIN)
+  {
+    name_table_add(&scope->index, ast->alloc, name, name_len, entry);
+  }
   return entry;
 }
 
-static VarEntry *lookup_scope(Scope *scope, const uint8_t *name, size_t name_len)
+static VarEntry *lookup_scope(AST *ast, Scope *scope, const uint8_t *name,
+    size_t name_len)
 {
+  (void) ast;
+  STATS_ADD(stats_of(ast->alloc), scope_lookups, 1);
   Scope *scope_iter = scope;
   while (scope_iter != NULL)
   {
+    if (scope_iter->index.cap > 0)
+    {
+      VarEntry *found = name_table_find(&scope_iter->index, name, name_len);
+      if (found != NULL)
+      {
+        return found;
+      }
+      scope_iter = scope_iter->up;
+      continue;
+    }
+
     VarEntry *iter = scope_iter->entries;
     while (iter != NULL)
     {
-      if (name_len == iter->name_len && strncmp(name, iter->name, name_len) == 0)
+      if (name_len == iter->name_len)
       {
-        return iter;
+        STATS_ADD(stats_of(ast->alloc), scope_compares, 1);
+        if (memcmp(name, iter->name, name_len) == 0)
+        {
+          return iter;
+        }
       }
       iter = iter->next;
     }
@@ -128,73 +368,243 @@ static VarEntry *lookup_scope(Scope *scope, const uint8_t *name, size_t name_len
   return NULL;
 }
 
-static bool resolve_record_expr(AST *ast, Scope *scope, Expr *expr)
+static RecordEntry *find_record_entry(AST *ast, Toplevel *record,
+    const uint8_t *name, size_t name_len)
 {
-  expr->record.entry = lookup_scope(&ast->type_scope, 
-      expr->record.name, expr->record.name_len);
-  if (expr->record.entry == NULL)
+  (void) ast;
+  STATS_ADD(stats_of(ast->alloc), record_lookups, 1);
+  if (record->record.index.cap > 0)
   {
-    result_error(ast->result, expr->line, expr->col,
-        "unknown record type '%.*s'", expr->record.name_len, expr->record.name);
-    return false;
+    return name_table_find(&record->record.index, name, name_len);
   }
 
-  RecordExprMember *iter = expr->record.members;
+  RecordEntry *iter = record->record.entries;
   while (iter != NULL)
   {
-    RecordEntry *iter2 = expr->record.entry->record->record.entries;
-    while (iter2 != NULL)
+    if (iter->name_len == name_len)
     {
-      if (iter2->name_len == iter->name_len && 
-          strncmp(iter2->name, iter->name, iter->name_len) == 0)
+      STATS_ADD(stats_of(ast->alloc), record_compares, 1);
+      if (memcmp(iter->name, name, name_len) == 0)
       {
-        iter->entry = iter2;
-        break;
+        return iter;
       }
+    }
+    iter = iter->next;
+  }
+  return NULL;
+}
 
-      iter2 = iter2->next;
+/* Expressions resolve in postorder over a stack of these rather than by
+ * recursion, so their depth costs no native stack. An operand that fails is reported and its
+ * siblings resolved regardless, only the expressions above it go untyped;
+ * false with nothing pending means every error was reported. */
+static bool resolve_expr(AST *ast, Scope *scope, Expr *expr)
+{
+  ExprFrame inline_frames[RESOLVE_INLINE_FRAMES];
+  ExprFrame *frames = inline_frames;
+  size_t count = 0, cap = RESOLVE_INLINE_FRAMES;
+  bool ok = true;
+  while (true)
+  {
+    if (expr != NULL)
+    {
+      if (count == cap)
+      {
+        ExprFrame *grown = ast->alloc->fn(NULL, 0,
+            cap * 2 * sizeof(ExprFrame), ast->alloc->ud);
+        memcpy(grown, frames, count * sizeof(ExprFrame));
+        if (frames != inline_frames)
+        {
+          ast->alloc->fn(frames, cap * sizeof(ExprFrame), 0, ast->alloc->ud);
+        }
+        frames = grown;
+        cap *= 2;
+      }
+      memset(&frames[count], 0, sizeof(ExprFrame));
+      frames[count++].expr = expr;
     }
-    if (iter->entry == NULL)
+
+    if (count == 0)
     {
-      result_error(ast->result, iter->line, iter->col,
-          "record type '%.*s' does not have a member '%.*s'",
-          expr->record.name_len, expr->record.name,
-          iter->name_len, iter->name);
-      return false;
+      break;
     }
 
-    if (!resolve_expr(ast, scope, iter->expr))
+    ExprFrame *frame = &frames[count - 1];
+    if (!next_operand(ast, frame, &expr) && !recover(ast))
     {
-      return false;
+      ok = false;
+      break;
+    }
+    if (expr != NULL)
+    {
+      continue;
     }
 
-    if (!compare_types(ast, iter->line, iter->col, iter->expr->type, iter2->type))
+    bool typed = !frame->failed && finish_expr(ast, scope, frame);
+    if (!typed && !recover(ast))
     {
-      return false;
+      ok = false;
+      break;
+    }
+    if (--count > 0)
+    {
+      frames[count - 1].operand_failed = !typed;
+      frames[count - 1].failed |= !typed;
+    } else
+    {
+      ok = typed;
     }
-    iter = iter->next;
   }
 
-  expr->type = expr->record.entry->type;
-  return true;
+  if (frames != inline_frames)
+  {
+    ast->alloc->fn(frames, cap * sizeof(ExprFrame), 0, ast->alloc->ud);
+  }
+  return ok;
 }
 
-static bool resolve_expr(AST *ast, Scope *scope, Expr *expr)
+/* Checks the operand resolved last against its parent, then picks the
+ * next one to resolve, or NULL once there are none left. The next is
+ * picked even when a check fails, which marks the frame failed and leaves
+ * the error pending. */
+static bool next_operand(AST *ast, ExprFrame *frame, Expr **next)
 {
+  Expr *expr = frame->expr;
+  Expr *done = frame->operand;
+  bool checked = done == NULL || !frame->operand_failed;
+  bool ok = true;
+  *next = NULL;
   switch (expr->t)
   {
-    case EXPR_BINARY: {
-      Expr *lhs = expr->binary.lhs;
-      Expr *rhs = expr->binary.rhs;
+    case EXPR_BINARY:
+      if (done == NULL)
+      {
+        *next = expr->binary.lhs;
+      } else if (done == expr->binary.lhs)
+      {
+        *next = expr->binary.rhs;
+      }
+      break;
+    case EXPR_MEMBER:
+      if (done == NULL)
+      {
+        *next = expr->member.lhs;
+      }
+      break;
+    case EXPR_VECTOR:
+      if (done == NULL)
+      {
+        *next = expr->vec.exprs;
+        break;
+      }
 
-      if (!resolve_expr(ast, scope, lhs))
+      *next = done->next;
+      if (!checked)
       {
-        return false;
+        break;
       }
-      if (!resolve_expr(ast, scope, rhs))
+      if (done == expr->vec.exprs)
       {
-        return false;
+        frame->first_type = done->type;
+        if (done->type->t == TYPE_VECTOR)
+        {
+          frame->size += done->type->vec.size;
+          frame->first_type = done->type->vec.type;
+        } else
+        {
+          frame->size++;
+        }
+      } else
+      {
+        if (done->type->t == TYPE_VECTOR)
+        {
+          frame->size += done->type->vec.size;
+        } else
+        {
+          frame->size++;
+        }
+
+        /* Without the first element's type there is nothing to compare
+         * the rest against. */
+        if (frame->first_type != NULL &&
+            !compare_types(ast, expr->line, expr->col, frame->first_type,
+              done->type))
+        {
+          ok = false;
+        }
       }
+      break;
+    case EXPR_RECORD: {
+      if (done == NULL)
+      {
+        frame->member = expr->record.members;
+        expr->record.entry = lookup_scope(ast, &ast->type_scope, 
+            expr->record.name, expr->record.name_len);
+        if (expr->record.entry == NULL)
+        {
+          result_error_code(ast->result, BSL_ERROR_UNDECLARED, expr->line,
+              expr->col, "unknown record type '%.*s'",
+              expr->record.name_len, expr->record.name);
+          ok = false;
+        } else if (!resolve_record(ast, expr->record.entry->record) ||
+            expr->record.entry->poisoned)
+        {
+          expr->record.entry = NULL;
+          ok = false;
+        }
+      } else
+      {
+        /* Members are looked up once their value is resolved, so either
+         * can fail without hiding the other. */
+        RecordExprMember *member = frame->member;
+        member->entry = NULL;
+        if (expr->record.entry != NULL)
+        {
+          member->entry = find_record_entry(ast, expr->record.entry->record,
+              member->name, member->name_len);
+          if (member->entry == NULL)
+          {
+            result_error_code(ast->result, BSL_ERROR_UNDECLARED,
+                member->line, member->col,
+                "record type '%.*s' does not have a member '%.*s'",
+                expr->record.name_len, expr->record.name,
+                member->name_len, member->name);
+            ok = false;
+          } else if (checked && !compare_types(ast, member->line,
+                member->col, done->type, member->entry->type))
+          {
+            ok = false;
+          }
+        }
+        frame->member = member->next;
+      }
+
+      /* The members of an unknown record are still resolved, there is
+       * just nothing to check them against. */
+      if (frame->member != NULL)
+      {
+        *next = frame->member->expr;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  frame->operand = *next;
+  frame->failed |= !ok;
+  return ok;
+}
+
+/* Types an expression whose operands are all resolved. */
+static bool finish_expr(AST *ast, Scope *scope, ExprFrame *frame)
+{
+  Expr *expr = frame->expr;
+  switch (expr->t)
+  {
+    case EXPR_BINARY: {
+      Expr *lhs = expr->binary.lhs;
+      Expr *rhs = expr->binary.rhs;
 
       if (lhs->type->t == TYPE_F32 && rhs->type->t == TYPE_F32 ||
           lhs->type->t == TYPE_F64 && rhs->type->t == TYPE_F64)
@@ -205,7 +615,7 @@ static bool resolve_expr(AST *ast, Scope *scope, Expr *expr)
         if (!compare_types(ast, expr->line, expr->col, lhs->type->vec.type, rhs->type->vec.type) || 
             lhs->type->vec.size != rhs->type->vec.size)
         {
-          result_error(ast->result, expr->line, expr->col,
+          result_error_code(ast->result, BSL_ERROR_TYPE, expr->line, expr->col,
               "cannot perform arithmetic on vectors of different types or sizes");
           return false;
         }
@@ -213,13 +623,13 @@ static bool resolve_expr(AST *ast, Scope *scope, Expr *expr)
       } else if (lhs->type->t == TYPE_VECTOR) {
         if (expr->binary.op == BINOP_ADD || expr->binary.op == BINOP_SUB)
         {
-          result_error(ast->result, expr->line, expr->col,
+          result_error_code(ast->result, BSL_ERROR_TYPE, expr->line, expr->col,
               "cannot perform addition or subtraction on mixed scalar and vector operands");
           return false;
         }
         if (!compare_types(ast, expr->line, expr->col, lhs->type->vec.type, rhs->type))
         {
-          result_error(ast->result, expr->line, expr->col,
+          result_error_code(ast->result, BSL_ERROR_TYPE, expr->line, expr->col,
               "cannot perform vector/scalar multiplication on mixed type operands");
           return false;
         }
@@ -227,56 +637,40 @@ static bool resolve_expr(AST *ast, Scope *scope, Expr *expr)
       } else if (rhs->type->t == TYPE_VECTOR) {
         if (expr->binary.op == BINOP_ADD || expr->binary.op == BINOP_SUB)
         {
-          result_error(ast->result, expr->line, expr->col,
+          result_error_code(ast->result, BSL_ERROR_TYPE, expr->line, expr->col,
               "cannot perform addition or subtraction on mixed scalar and vector operands");
           return false;
         }
         if (!compare_types(ast, expr->line, expr->col, rhs->type->vec.type, lhs->type))
         {
-          result_error(ast->result, expr->line, expr->col,
+          result_error_code(ast->result, BSL_ERROR_TYPE, expr->line, expr->col,
               "cannot perform vector/scalar multiplication on mixed type operands");
           return false;
         }
         expr->type = rhs->type;
       } else
       {
-        result_error(ast->result, expr->line, expr->col,
-            "invalid argument to arithmetic operation");
+        result_error_code(ast->result, BSL_ERROR_TYPE, expr->line,
+            expr->col, "invalid argument to arithmetic operation");
         return false;
       }
       return true;
     }
     case EXPR_MEMBER: {
-      if (!resolve_expr(ast, scope, expr->member.lhs))
-      {
-        return false;
-      }
-
       if (expr->member.lhs->type->t != TYPE_RECORD)
       {
-        result_error(ast->result, expr->line, expr->col,
-            "left hand side must be a record type");
+        result_error_code(ast->result, BSL_ERROR_TYPE, expr->line,
+            expr->col, "left hand side must be a record type");
         return false;
       }
 
       Type *rec = expr->member.lhs->type;
-      RecordEntry *iter = rec->record.entries;
-      while (iter != NULL)
-      {
-        if (iter->name_len == expr->member.name_len &&
-            strncmp(iter->name, expr->member.name, iter->name_len) == 0)
-        {
-          expr->member.entry = iter;
-          break;
-        }
-
-        iter = iter->next;
-      }
-      
+      expr->member.entry = find_record_entry(ast, rec->record.toplevel,
+          expr->member.name, expr->member.name_len);
       if (expr->member.entry == NULL)
       {
-        result_error(ast->result, expr->line, expr->col,
-            "record type '%.*s' does not have a member '%.*s'",
+        result_error_code(ast->result, BSL_ERROR_UNDECLARED, expr->line,
+            expr->col, "record type '%.*s' does not have a member '%.*s'",
             rec->record.name_len, rec->record.name, 
             expr->member.name_len, expr->member.name);
         return false;
@@ -291,77 +685,48 @@ static bool resolve_expr(AST *ast, Scope *scope, Expr *expr)
       expr->type->t = TYPE_F32;
       return true;
     case EXPR_VAR:
-      expr->var.entry = lookup_scope(scope, expr->var.name, expr->var.name_len);
+      expr->var.entry = lookup_scope(ast, scope, expr->var.name, expr->var.name_len);
       if (expr->var.entry == NULL)
       {
-        result_error(ast->result, expr->line, expr->col,
-            "variable '%.*s' not in scope", expr->var.name_len, expr->var.name);
+        result_error_code(ast->result, BSL_ERROR_UNDECLARED, expr->line,
+            expr->col, "variable '%.*s' not in scope", expr->var.name_len,
+            expr->var.name);
         return false;
       }
-      expr->type = expr->var.entry->type;
-      return true;
-    case EXPR_VECTOR: {
-      Expr *iter = expr->vec.exprs;
-      size_t size = 0;
-      if (!resolve_expr(ast, scope, iter))
+      if (expr->var.entry->poisoned)
       {
         return false;
       }
-      Type *first_type = iter->type;
-      if (first_type->t == TYPE_VECTOR)
+      /* Procedures only get their type once resolved, and are never
+       * values either way. */
+      if (expr->var.entry->type == NULL ||
+          expr->var.entry->type->t == TYPE_PROC)
       {
-        size += first_type->vec.size;
-        first_type = first_type->vec.type;
-      } else
-      {
-        size++;
-      }
-
-      iter = iter->next;
-
-      while (iter != NULL)
-      {
-        if (!resolve_expr(ast, scope, iter))
-        {
-          return false;
-        }
-        if (iter->type->t == TYPE_VECTOR)
-        {
-          size += iter->type->vec.size;
-        } else
-        {
-          size++;
-        }
-
-        if (!compare_types(ast, expr->line, expr->col, first_type, iter->type))
-        {
-          return false;
-        }
-
-        iter = iter->next;
+        result_error_code(ast->result, BSL_ERROR_TYPE, expr->line,
+            expr->col, "procedure '%.*s' is not a value", expr->var.name_len,
+            expr->var.name);
+        return false;
       }
-
-      if (size > 4)
+      expr->type = expr->var.entry->type;
+      return true;
+    case EXPR_VECTOR: {
+      if (frame->size > 4)
       {
-        result_error(ast->result, expr->line, expr->col,
-            "maximum vector size is 4");
+        result_error_code(ast->result, BSL_ERROR_TYPE, expr->line,
+            expr->col, "maximum vector size is 4");
         return false;
       }
 
       Type *new_type = BSL_NEW(ast->alloc, Type);
       new_type->t = TYPE_VECTOR;
-      new_type->vec.size = size;
-      new_type->vec.type = first_type;
+      new_type->vec.size = frame->size;
+      new_type->vec.type = frame->first_type;
       expr->type = new_type;
       return true;
     }
-    case EXPR_RECORD: {
-      if (!resolve_record_expr(ast, scope, expr))
-      {
-        return false;
-      }
+    case EXPR_RECORD:
+      expr->type = expr->record.entry->type;
       return true;
-    }
     default:
       return true;
   }
@@ -375,20 +740,21 @@ static bool resolve_statement(AST *ast, Scope *scope, Statement *stmt, Type **ty
   {
     case STATEMENT_VAR:
       {
+        /* The variable is not in scope in its own initializer, but is
+         * declared even when that fails, to be poisoned. */
+        bool ok = stmt->var.expr == NULL ||
+          resolve_expr(ast, scope, stmt->var.expr);
         stmt->var.entry = add_to_scope(ast, scope, stmt->var.name, stmt->var.name_len);
-        if (stmt->var.entry == NULL)
+        if (!ok)
         {
-          result_error(ast->result, stmt->line, stmt->col, 
-              "redeclaration of variable '%.*s'", stmt->var.name_len, 
-              stmt->var.name);
           return false;
         }
-        if (stmt->var.expr)
+        if (stmt->var.entry == NULL)
         {
-          if (!resolve_expr(ast, scope, stmt->var.expr))
-          {
-            return false;
-          }
+          result_error_code(ast->result, BSL_ERROR_REDECLARED, stmt->line,
+              stmt->col, "redeclaration of variable '%.*s'",
+              stmt->var.name_len, stmt->var.name);
+          return false;
         }
         if (stmt->var.type)
         {
@@ -428,13 +794,132 @@ static bool resolve_statement(AST *ast, Scope *scope, Statement *stmt, Type **ty
   }
 }
 
+static bool resolve_entry_points(AST *ast)
+{
+  bool ok = true;
+  for (size_t i = 0; i < ast->entry_point_count; i++)
+  {
+    const char *name = ast->entry_points[i];
+    size_t name_len = strlen(name);
+    Toplevel *iter = ast->toplevels;
+    while (iter != NULL)
+    {
+      if (iter->t == TOPLEVEL_PROC && iter->proc.name_len == name_len &&
+          strncmp((const char *) iter->proc.name, name, name_len) == 0)
+      {
+        break;
+      }
+      iter = iter->next;
+    }
+
+    if (iter == NULL || iter->proc.entry_point == 0)
+    {
+      result_error_code(ast->result, BSL_ERROR_UNDECLARED, 0, 0,
+          "no entry point named '%s'", name);
+      recover(ast);
+      ok = false;
+      continue;
+    }
+
+    if (!iter->resolved && iter->proc.entry != NULL &&
+        !resolve_proc(ast, iter))
+    {
+      if (!recover(ast))
+      {
+        return false;
+      }
+      ok = false;
+    }
+  }
+  if (!ok)
+  {
+    return false;
+  }
+
+  /* Anything not reached from the requested entry points is never looked at
+   * again, so drop it before later phases see it. */
+  Toplevel **link = &ast->toplevels;
+  while (*link != NULL)
+  {
+    if (!(*link)->resolved)
+    {
+      *link = (*link)->next;
+      ast->result->removed_toplevels++;
+    } else
+    {
+      link = &(*link)->next;
+    }
+  }
+
+  return true;
+}
+
+static bool resolve_record(AST *ast, Toplevel *record)
+{
+  if (record->resolved)
+  {
+    return true;
+  }
+  record->resolved = true;
+
+  /* Every member is checked, the record is poisoned if any fail. */
+  bool ok = true;
+  RecordEntry *iter = record->record.entries;
+  while (iter != NULL)
+  {
+    if (!resolve_type(ast, record->line, record->col, &iter->type))
+    {
+      if (!recover(ast))
+      {
+        return false;
+      }
+      ok = false;
+    }
+
+    iter = iter->next;
+  }
+  if (!ok)
+  {
+    record->record.entry->poisoned = true;
+    return false;
+  }
+
+  number_record_entries(record);
+  if (record->record.entry_count >= NAME_TABLE_MIN)
+  {
+    iter = record->record.entries;
+    while (iter != NULL)
+    {
+      name_table_add(&record->record.index, ast->alloc, iter->name,
+          iter->name_len, iter);
+      iter = iter->next;
+    }
+  }
+  return true;
+}
+
 static bool resolve_proc(AST *ast, Toplevel *proc)
 {
-  proc->proc.scope.up = &ast->scope;
-  proc->proc.scope.entries = NULL;
+  if (!limits_check(ast->limits, ast->result, proc->line, proc->col))
+  {
+    return false;
+  }
+
+  trace_begin(ast->trace, "resolve", (const char *) proc->proc.name,
+      proc->proc.name_len);
+  bool ok = resolve_proc_body(ast, proc);
+  trace_end(ast->trace);
+  return ok;
+}
+
+static bool resolve_proc_body(AST *ast, Toplevel *proc)
+{
+  proc->resolved = true;
+  init_scope(&proc->proc.scope, &ast->scope);
 
   if (!resolve_type(ast, proc->line, proc->col, &proc->proc.return_type))
   {
+    proc->proc.entry->poisoned = true;
     return false;
   }
 
@@ -443,67 +928,118 @@ static bool resolve_proc(AST *ast, Toplevel *proc)
   proc->proc.entry->type->proc.return_type = proc->proc.return_type;
   proc->proc.entry->type->proc.params = proc->proc.params;
 
+  /* Parameters and statements that fail are reported one by one; what
+   * they declare is poisoned for the rest of the body. */
+  bool ok = true;
   Parameter *param = proc->proc.params;
-  while (param != NULL)
+  for (; param != NULL; param = param->next)
   {
     VarEntry *entry = add_to_scope(ast, &proc->proc.scope, param->name, 
         param->name_len);
     if (entry == NULL)
     {
-      result_error(ast->result, param->line, param->col, 
-          "function parameter '%.*s' shadows variable", 
+      result_error_code(ast->result, BSL_ERROR_REDECLARED, param->line,
+          param->col, "function parameter '%.*s' shadows variable", 
           param->name_len, param->name);
-      return false;
+      if (!recover(ast))
+      {
+        return false;
+      }
+      ok = false;
+      continue;
     }
 
+    param->entry = entry;
     if (!resolve_type(ast, param->line, param->col, &param->type))
     {
-      return false;
+      entry->poisoned = true;
+      if (!recover(ast))
+      {
+        return false;
+      }
+      ok = false;
+      continue;
     }
     entry->type = param->type;
-    param = param->next;
   }
 
   int did_return = false;
   Statement *iter = proc->proc.stmts;
   Type *ret;
-  while (iter != NULL)
+  for (; iter != NULL; iter = iter->next)
   {
+    /* What failed to parse was reported then, the body no longer resolves
+     * but the statements after it are checked. */
+    if (iter->broken)
+    {
+      if (iter->t == STATEMENT_VAR)
+      {
+        iter->var.entry = add_to_scope(ast, &proc->proc.scope,
+            iter->var.name, iter->var.name_len);
+      }
+      if (iter->t == STATEMENT_VAR && iter->var.entry != NULL)
+      {
+        iter->var.entry->poisoned = true;
+      }
+      ok = false;
+      continue;
+    }
+
     if (!resolve_statement(ast, &proc->proc.scope, iter, &ret))
     {
-      return false;
+      if (iter->t == STATEMENT_VAR && iter->var.entry != NULL)
+      {
+        iter->var.entry->poisoned = true;
+      }
+      if (!recover(ast))
+      {
+        return false;
+      }
+      ok = false;
+      continue;
     }
 
     if (ret != NULL)
     {
       if (!compare_types(ast, iter->line, iter->col, ret, proc->proc.return_type))
       {
-        result_error(ast->result, iter->line, iter->col,
-            "incompatible return type");
-        return false;
+        result_error_code(ast->result, BSL_ERROR_TYPE, iter->line,
+            iter->col, "incompatible return type");
+        recover(ast);
+        ok = false;
       } else
       {
         did_return = true;
       }
     }
-
-    iter = iter->next; 
   }
 
-  if (proc->proc.return_type->t != TYPE_VOID && !did_return)
+  /* Only asked of bodies that resolved, where no return was dropped. */
+  if (ok && proc->proc.return_type->t != TYPE_VOID && !did_return)
   {
-    result_error(ast->result, proc->line, proc->col, "non-void function must return");
+    result_error_code(ast->result, BSL_ERROR_TYPE, proc->line, proc->col,
+        "non-void function must return");
     return false;
   }
 
-  return true;
+  return ok;
 }
 
+/* Vectors are compared from the element type out, so a mismatch there is
+ * reported before one in their sizes. */
 static bool compare_types(AST *ast, int line, int col, Type *type1, Type *type2)
 {
+  bool same_sizes = true;
+  while (type1->t == TYPE_VECTOR && type2->t == TYPE_VECTOR)
+  {
+    same_sizes = same_sizes && type1->vec.size == type2->vec.size;
+    type1 = type1->vec.type;
+    type2 = type2->vec.type;
+  }
+
   if (type1->t != type2->t)
   {
-    result_error(ast->result, line, col,
+    result_error_code(ast->result, BSL_ERROR_TYPE, line, col,
         "incompatible types");
     return false;
   }
@@ -512,34 +1048,30 @@ static bool compare_types(AST *ast, int line, int col, Type *type1, Type *type2)
   {
     case TYPE_F32:
     case TYPE_F64:
-      return true;
-    case TYPE_VECTOR:
-      if (!compare_types(ast, line, col, type1->vec.type, type2->vec.type))
-      {
-        return false;
-      }
-
-      if (type1->vec.size != type2->vec.size)
-      {
-        result_error(ast->result, line, col,
-            "different sized vectors");
-        return false;
-      }
-      return true;
+      break;
     case TYPE_RECORD:
       if (type1 != type2)
       {
-        result_error(ast->result, line, col,
+        result_error_code(ast->result, BSL_ERROR_TYPE, line, col,
             "incompatible record types '%.*s' and '%.*s'",
             type1->record.name_len, type1->record.name,
             type2->record.name_len, type2->record.name);
         return false;
       }
-      return true;
+      break;
     default:
-      printf("compare_types: VERY BAD SHOULD NOT HAPPEN");
+      result_error_code(ast->result, BSL_ERROR_INTERNAL, line, col,
+          "internal error: cannot compare types of kind %d", type1->t);
       return false;
   }
+
+  if (!same_sizes)
+  {
+    result_error_code(ast->result, BSL_ERROR_TYPE, line, col,
+        "different sized vectors");
+    return false;
+  }
+  return true;
 }
 
 static bool resolve_type(AST *ast, int line, int col, Type **_type)
@@ -549,13 +1081,17 @@ static bool resolve_type(AST *ast, int line, int col, Type **_type)
   {
     case TYPE_VAR:
     {
-      VarEntry *entry = lookup_scope(&ast->type_scope, type->var.name, type->var.name_len);
+      VarEntry *entry = lookup_scope(ast, &ast->type_scope, type->var.name, type->var.name_len);
       if (entry == NULL)
       {
-        result_error(ast->result, line, col,
+        result_error_code(ast->result, BSL_ERROR_UNDECLARED, line, col,
             "no type '%.*s' in scope", type->var.name_len, type->var.name);
         return false;
       }
+      if (!resolve_record(ast, entry->record) || entry->poisoned)
+      {
+        return false;
+      }
       *_type = entry->type;
       break;
     }
@@ -0,0 +1,1272 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <bsl/serialize.h>
+
+/* Modules are stored as one section per node kind, each an array of the
+ * nodes in their native layout, followed by a string table. Pointer fields
+ * hold file offsets, which loading validates and turns back into pointers
+ * in place. */
+
+#define ARCHIVE_MAGIC "BSLA"
+#define ARCHIVE_FORMAT 6
+#define ARCHIVE_ENDIAN 0x01020304u
+#define ARCHIVE_ALIGN 8
+#define ALIGN_UP(_x) \
+  (((uint64_t) (_x) + ARCHIVE_ALIGN - 1) & ~(uint64_t) (ARCHIVE_ALIGN - 1))
+#define MAX_CHILDREN 6
+
+typedef enum
+{
+  KIND_TOPLEVEL,
+  KIND_RECORD_ENTRY,
+  KIND_TYPE,
+  KIND_PARAMETER,
+  KIND_STATEMENT,
+  KIND_EXPR,
+  KIND_MEMBER,
+  KIND_VAR_ENTRY,
+  KIND_COUNT,
+
+  KIND_STRING = KIND_COUNT,
+} NodeKind;
+
+static const size_t kind_sizes[KIND_COUNT] = {
+  [KIND_TOPLEVEL] = sizeof(Toplevel),
+  [KIND_RECORD_ENTRY] = sizeof(RecordEntry),
+  [KIND_TYPE] = sizeof(Type),
+  [KIND_PARAMETER] = sizeof(Parameter),
+  [KIND_STATEMENT] = sizeof(Statement),
+  [KIND_EXPR] = sizeof(Expr),
+  [KIND_MEMBER] = sizeof(RecordExprMember),
+  [KIND_VAR_ENTRY] = sizeof(VarEntry),
+};
+
+typedef struct
+{
+  uint64_t offset;
+  uint64_t count;
+} Section;
+
+typedef struct
+{
+  Toplevel *toplevels;
+  VarEntry *scope;
+  VarEntry *type_scope;
+} Roots;
+
+typedef struct
+{
+  char magic[4];
+  uint32_t format;
+  uint32_t endian;
+  uint32_t pointer_size;
+  uint64_t file_size;
+  uint64_t kind_sizes[KIND_COUNT];
+  Section sections[KIND_COUNT];
+  Section strings;
+  Roots roots;
+} ArchiveHeader;
+
+typedef enum
+{
+  VISIT_SAVE,
+  VISIT_FINALIZE,
+  VISIT_LOAD,
+} VisitMode;
+
+typedef struct
+{
+  const void *ptr;
+  size_t len;
+  uint64_t value;
+} InternSlot;
+
+typedef struct
+{
+  VisitMode mode;
+  BSLAlloc *alloc;
+  bool ok;
+
+  /* Saving: nodes collect per kind, fields hold kind and index until the
+   * layout is known. */
+  uint8_t *nodes[KIND_COUNT];
+  size_t counts[KIND_COUNT];
+  size_t caps[KIND_COUNT];
+  char *strings;
+  size_t strings_len, strings_cap;
+  InternSlot *interned;
+  size_t interned_count, interned_cap;
+  uint64_t bases[KIND_COUNT + 1];
+
+  /* Loading. Nodes are numbered across sections for the checks that run
+   * once every pointer is patched. */
+  uint8_t *base;
+  const ArchiveHeader *header;
+  size_t firsts[KIND_COUNT];
+  size_t node_count;
+} Archive;
+
+typedef struct
+{
+  NodeKind kind;
+  void *node;
+} Child;
+
+typedef struct
+{
+  Child child;
+  size_t next;
+} Frame;
+
+/* The scope a variable entry was found in while checking, OWNER_PROC
+ * plus its index for a procedure's. */
+enum
+{
+  OWNER_NONE,
+  OWNER_GLOBAL,
+  OWNER_PROC,
+};
+
+typedef union
+{
+  Toplevel toplevel;
+  RecordEntry record_entry;
+  Type type;
+  Parameter parameter;
+  Statement statement;
+  Expr expr;
+  RecordExprMember member;
+  VarEntry var_entry;
+} AnyNode;
+
+/* === PROTOTYPES === */
+
+static void *grow(BSLAlloc *alloc, void *ptr, size_t *cap, size_t need,
+    size_t size);
+static uint64_t encode(NodeKind kind, uint64_t index);
+static uint64_t intern(Archive *ar, const void *ptr, NodeKind kind,
+    size_t len);
+static void field(Archive *ar, void *slot, NodeKind kind);
+static void string(Archive *ar, void *slot, size_t len);
+static void visit(Archive *ar, NodeKind kind, void *node);
+static void visit_toplevel(Archive *ar, Toplevel *node);
+static void visit_type(Archive *ar, Type *node);
+static void visit_expr(Archive *ar, Expr *node);
+static void visit_statement(Archive *ar, Statement *node);
+static void free_archive(Archive *ar);
+static void *zeroed(BSLAlloc *alloc, size_t size);
+static size_t node_id(const Archive *ar, NodeKind kind, const void *node);
+static size_t children(NodeKind kind, void *node, Child *out);
+static bool check_acyclic(Archive *ar);
+static uint32_t nest_height(Archive *ar, Child node, const Child *kids,
+    size_t count, const uint32_t *heights);
+static bool check_scope(Archive *ar, VarEntry *entries, size_t count,
+    size_t *owners, size_t owner);
+static bool check_refs(Archive *ar);
+static bool check_proc(Archive *ar, Toplevel *proc, const size_t *owners,
+    size_t owner, size_t *seen, Expr ***stack, size_t *cap);
+static BSLModule *open_archive(uint8_t *base, size_t size, BSLAlloc *alloc,
+    const char **problem);
+
+/* === PUBLIC FUNCTIONS === */
+
+void archive_module(BSLModule *module, uint8_t **data, size_t *size)
+{
+  Archive ar;
+  memset(&ar, 0, sizeof(ar));
+  ar.mode = VISIT_SAVE;
+  ar.alloc = &module->alloc;
+  ar.ok = true;
+
+  /* An empty string keeps offset zero of the table from meaning NULL. */
+  ar.strings = grow(ar.alloc, NULL, &ar.strings_cap, 1, 1);
+  ar.strings[0] = '\0';
+  ar.strings_len = 1;
+
+  Roots roots = {
+    .toplevels = module->ast.toplevels,
+    .scope = module->ast.scope.entries,
+    .type_scope = module->ast.type_scope.entries,
+  };
+  field(&ar, &roots.toplevels, KIND_TOPLEVEL);
+  field(&ar, &roots.scope, KIND_VAR_ENTRY);
+  field(&ar, &roots.type_scope, KIND_VAR_ENTRY);
+
+  /* Visiting a node can append more nodes of any kind, so sweep until
+   * every kind is done. Nodes are visited through a copy because the
+   * arrays move as they grow. */
+  size_t done[KIND_COUNT] = { 0 };
+  bool progress = true;
+  while (progress)
+  {
+    progress = false;
+    for (int kind = 0; kind < KIND_COUNT; kind++)
+    {
+      while (done[kind] < ar.counts[kind])
+      {
+        AnyNode node;
+        size_t node_size = kind_sizes[kind];
+        memcpy(&node, ar.nodes[kind] + done[kind] * node_size, node_size);
+        visit(&ar, kind, &node);
+        memcpy(ar.nodes[kind] + done[kind] * node_size, &node, node_size);
+        done[kind]++;
+        progress = true;
+      }
+    }
+  }
+
+  ArchiveHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ARCHIVE_MAGIC, 4);
+  header.format = ARCHIVE_FORMAT;
+  header.endian = ARCHIVE_ENDIAN;
+  header.pointer_size = sizeof(void *);
+
+  uint64_t offset = ALIGN_UP(sizeof(header));
+  for (int kind = 0; kind < KIND_COUNT; kind++)
+  {
+    header.kind_sizes[kind] = kind_sizes[kind];
+    header.sections[kind].offset = offset;
+    header.sections[kind].count = ar.counts[kind];
+    ar.bases[kind] = offset;
+    offset += ar.counts[kind] * kind_sizes[kind];
+    offset = ALIGN_UP(offset);
+  }
+  header.strings.offset = offset;
+  header.strings.count = ar.strings_len;
+  ar.bases[KIND_STRING] = offset;
+  header.file_size = offset + ar.strings_len;
+
+  ar.mode = VISIT_FINALIZE;
+  for (int kind = 0; kind < KIND_COUNT; kind++)
+  {
+    for (size_t i = 0; i < ar.counts[kind]; i++)
+    {
+      visit(&ar, kind, ar.nodes[kind] + i * kind_sizes[kind]);
+    }
+  }
+  header.roots = roots;
+  field(&ar, &header.roots.toplevels, KIND_TOPLEVEL);
+  field(&ar, &header.roots.scope, KIND_VAR_ENTRY);
+  field(&ar, &header.roots.type_scope, KIND_VAR_ENTRY);
+
+  uint8_t *out = ar.alloc->fn(NULL, 0, header.file_size, ar.alloc->ud);
+  memset(out, 0, header.file_size);
+  memcpy(out, &header, sizeof(header));
+  for (int kind = 0; kind < KIND_COUNT; kind++)
+  {
+    if (ar.counts[kind] > 0)
+    {
+      memcpy(out + header.sections[kind].offset, ar.nodes[kind],
+          ar.counts[kind] * kind_sizes[kind]);
+    }
+  }
+  memcpy(out + header.strings.offset, ar.strings, ar.strings_len);
+
+  free_archive(&ar);
+  *data = out;
+  *size = header.file_size;
+}
+
+BSLModule *copy_archive(const uint8_t *data, size_t size, BSLAlloc *alloc)
+{
+  uint8_t *base = alloc->fn(NULL, 0, size, alloc->ud);
+  memcpy(base, data, size);
+
+  const char *problem;
+  BSLModule *module = open_archive(base, size, alloc, &problem);
+  if (module == NULL)
+  {
+    alloc->fn(base, size, 0, alloc->ud);
+  }
+  return module;
+}
+
+bool bsl_module_save(BSLModule *module, const char *path,
+    BSLCompileResult *result)
+{
+  uint8_t *data;
+  size_t size;
+  archive_module(module, &data, &size);
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    module->alloc.fn(data, size, 0, module->alloc.ud);
+    result_error(result, 0, 0, "could not open '%s' for writing", path);
+    return false;
+  }
+
+  bool written = fwrite(data, 1, size, file) == size;
+  module->alloc.fn(data, size, 0, module->alloc.ud);
+  if (fclose(file) != 0 || !written)
+  {
+    result_error(result, 0, 0, "could not write '%s'", path);
+    return false;
+  }
+  return true;
+}
+
+bool bsl_module_load(const char *path, BSLAllocFn alloc_fn, void *alloc_ud,
+    BSLModule **module_out, BSLCompileResult *result)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    result_error(result, 0, 0, "could not open '%s'", path);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ArchiveHeader))
+  {
+    close(fd);
+    result_error(result, 0, 0, "'%s' is not a module archive", path);
+    return false;
+  }
+
+  /* Private and writable so pointers can be patched in place without
+   * touching the file. Patching writes to every page that holds nodes,
+   * so those pages are copied on load and not shared between processes;
+   * resolving offsets on every access instead would touch every pass. */
+  size_t size = st.st_size;
+  uint8_t *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    result_error(result, 0, 0, "could not map '%s'", path);
+    return false;
+  }
+
+  BSLAlloc alloc = {
+    .ud = alloc_ud,
+    .fn = alloc_fn,
+  };
+  const char *problem;
+  BSLModule *module = open_archive(base, size, &alloc, &problem);
+  if (module == NULL)
+  {
+    munmap(base, size);
+    result_error(result, 0, 0, "'%s' %s", path, problem);
+    return false;
+  }
+  module->mapped = true;
+
+  *module_out = module;
+  return true;
+}
+
+void bsl_module_unload(BSLModule *module)
+{
+  BSLAlloc alloc = module->alloc;
+  if (module->mapped)
+  {
+    munmap(module->mapping, module->mapping_size);
+  } else if (module->mapping != NULL)
+  {
+    alloc.fn(module->mapping, module->mapping_size, 0, alloc.ud);
+  }
+  alloc.fn(module, sizeof(BSLModule), 0, alloc.ud);
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+/* Validates an archive image and patches its offsets into pointers. Past
+ * the ranges, the nodes must own each other without cycles and every index
+ * a pass looks up must fit the table it is used with. */
+static BSLModule *open_archive(uint8_t *base, size_t size, BSLAlloc *alloc,
+    const char **problem)
+{
+  if (size < sizeof(ArchiveHeader))
+  {
+    *problem = "is not a module archive";
+    return NULL;
+  }
+
+  ArchiveHeader *header = (ArchiveHeader *) base;
+  bool valid = memcmp(header->magic, ARCHIVE_MAGIC, 4) == 0 &&
+    header->format == ARCHIVE_FORMAT && header->endian == ARCHIVE_ENDIAN &&
+    header->pointer_size == sizeof(void *) && header->file_size == size &&
+    header->strings.offset <= size &&
+    header->strings.count <= size - header->strings.offset;
+  for (int kind = 0; valid && kind < KIND_COUNT; kind++)
+  {
+    Section *section = &header->sections[kind];
+    valid = header->kind_sizes[kind] == kind_sizes[kind] &&
+      section->offset % ARCHIVE_ALIGN == 0 &&
+      section->offset >= sizeof(ArchiveHeader) && section->offset <= size &&
+      section->count <= (size - section->offset) / kind_sizes[kind];
+  }
+
+  if (!valid)
+  {
+    *problem = "is not a compatible module archive";
+    return NULL;
+  }
+
+  Archive ar;
+  memset(&ar, 0, sizeof(ar));
+  ar.mode = VISIT_LOAD;
+  ar.alloc = alloc;
+  ar.ok = true;
+  ar.base = base;
+  ar.header = header;
+  for (int kind = 0; ar.ok && kind < KIND_COUNT; kind++)
+  {
+    uint8_t *node = base + header->sections[kind].offset;
+    for (size_t i = 0; ar.ok && i < header->sections[kind].count; i++)
+    {
+      visit(&ar, kind, node + i * kind_sizes[kind]);
+    }
+  }
+  field(&ar, &header->roots.toplevels, KIND_TOPLEVEL);
+  field(&ar, &header->roots.scope, KIND_VAR_ENTRY);
+  field(&ar, &header->roots.type_scope, KIND_VAR_ENTRY);
+
+  if (ar.ok)
+  {
+    for (int kind = 0; kind < KIND_COUNT; kind++)
+    {
+      ar.firsts[kind] = ar.node_count;
+      ar.node_count += header->sections[kind].count;
+    }
+    ar.ok = check_acyclic(&ar) && check_refs(&ar);
+  }
+
+  if (!ar.ok)
+  {
+    *problem = "is a corrupt module archive";
+    return NULL;
+  }
+
+  BSLModule *module = BSL_NEW(alloc, BSLModule);
+  module->alloc = *alloc;
+  module->mapping = base;
+  module->mapping_size = size;
+  module->mapped = false;
+  module->ast.toplevels = header->roots.toplevels;
+  module->ast.imports = NULL;
+  module->ast.constants = NULL;
+  memset(&module->ast.scope, 0, sizeof(Scope));
+  memset(&module->ast.type_scope, 0, sizeof(Scope));
+  module->ast.scope.entries = header->roots.scope;
+  module->ast.type_scope.entries = header->roots.type_scope;
+  module->ast.entry_points = NULL;
+  module->ast.entry_point_count = 0;
+  module->ast.alloc = &module->alloc;
+  module->ast.result = NULL;
+  module->ast.trace = NULL;
+  module->ast.limits = NULL;
+
+  Toplevel *procs = (Toplevel *) (base + header->sections[KIND_TOPLEVEL].offset);
+  for (size_t i = 0; i < header->sections[KIND_TOPLEVEL].count; i++)
+  {
+    if (procs[i].t == TOPLEVEL_PROC)
+    {
+      procs[i].proc.scope.up = &module->ast.scope;
+    }
+  }
+
+  return module;
+}
+
+static void *grow(BSLAlloc *alloc, void *ptr, size_t *cap, size_t need,
+    size_t size)
+{
+  if (need <= *cap)
+  {
+    return ptr;
+  }
+
+  size_t new_cap = *cap == 0 ? 64 : *cap;
+  while (new_cap < need)
+  {
+    new_cap *= 2;
+  }
+  ptr = alloc->fn(ptr, *cap * size, new_cap * size, alloc->ud);
+  *cap = new_cap;
+  return ptr;
+}
+
+/* Zero stays NULL, so indices are stored plus one. */
+static uint64_t encode(NodeKind kind, uint64_t index)
+{
+  return (uint64_t) kind << 56 | (index + 1);
+}
+
+static uint64_t intern(Archive *ar, const void *ptr, NodeKind kind,
+    size_t len)
+{
+  if (ar->interned_count * 2 >= ar->interned_cap)
+  {
+    size_t old_cap = ar->interned_cap;
+    InternSlot *old = ar->interned;
+    ar->interned_cap = old_cap == 0 ? 256 : old_cap * 2;
+    ar->interned = ar->alloc->fn(NULL, 0,
+        ar->interned_cap * sizeof(InternSlot), ar->alloc->ud);
+    memset(ar->interned, 0, ar->interned_cap * sizeof(InternSlot));
+    for (size_t i = 0; i < old_cap; i++)
+    {
+      if (old[i].ptr != NULL)
+      {
+        size_t h = ((uintptr_t) old[i].ptr >> 3) & (ar->interned_cap - 1);
+        while (ar->interned[h].ptr != NULL)
+        {
+          h = (h + 1) & (ar->interned_cap - 1);
+        }
+        ar->interned[h] = old[i];
+      }
+    }
+    if (old_cap > 0)
+    {
+      ar->alloc->fn(old, old_cap * sizeof(InternSlot), 0, ar->alloc->ud);
+    }
+  }
+
+  size_t h = ((uintptr_t) ptr >> 3) & (ar->interned_cap - 1);
+  while (ar->interned[h].ptr != NULL)
+  {
+    if (ar->interned[h].ptr == ptr && ar->interned[h].len == len &&
+        (ar->interned[h].value >> 56) == (uint64_t) kind)
+    {
+      return ar->interned[h].value;
+    }
+    h = (h + 1) & (ar->interned_cap - 1);
+  }
+
+  uint64_t value;
+  if (kind == KIND_STRING)
+  {
+    ar->strings = grow(ar->alloc, ar->strings, &ar->strings_cap,
+        ar->strings_len + len + 1, 1);
+    memcpy(ar->strings + ar->strings_len, ptr, len);
+    ar->strings[ar->strings_len + len] = '\0';
+    value = (uint64_t) KIND_STRING << 56 | ar->strings_len;
+    ar->strings_len += len + 1;
+  } else
+  {
+    size_t size = kind_sizes[kind];
+    ar->nodes[kind] = grow(ar->alloc, ar->nodes[kind], &ar->caps[kind],
+        ar->counts[kind] + 1, size);
+    memcpy(ar->nodes[kind] + ar->counts[kind] * size, ptr, size);
+    value = encode(kind, ar->counts[kind]++);
+  }
+
+  ar->interned[h].ptr = ptr;
+  ar->interned[h].len = len;
+  ar->interned[h].value = value;
+  ar->interned_count++;
+  return value;
+}
+
+static void field(Archive *ar, void *slot, NodeKind kind)
+{
+  uintptr_t value;
+  memcpy(&value, slot, sizeof(value));
+  if (value == 0)
+  {
+    return;
+  }
+
+  switch (ar->mode)
+  {
+    case VISIT_SAVE:
+      value = intern(ar, (const void *) value, kind, 0);
+      break;
+    case VISIT_FINALIZE:
+      value = ar->bases[kind] + ((value & ((1ull << 56) - 1)) - 1) *
+        kind_sizes[kind];
+      break;
+    case VISIT_LOAD: {
+      const Section *section = &ar->header->sections[kind];
+      uint64_t end = section->offset + section->count * kind_sizes[kind];
+      if (value < section->offset || value >= end ||
+          (value - section->offset) % kind_sizes[kind] != 0)
+      {
+        ar->ok = false;
+        return;
+      }
+      value = (uintptr_t) (ar->base + value);
+      break;
+    }
+  }
+  memcpy(slot, &value, sizeof(value));
+}
+
+static void string(Archive *ar, void *slot, size_t len)
+{
+  uintptr_t value;
+  memcpy(&value, slot, sizeof(value));
+  if (value == 0)
+  {
+    return;
+  }
+
+  switch (ar->mode)
+  {
+    case VISIT_SAVE:
+      value = intern(ar, (const void *) value, KIND_STRING, len);
+      break;
+    case VISIT_FINALIZE:
+      value = ar->bases[KIND_STRING] + (value & ((1ull << 56) - 1));
+      break;
+    case VISIT_LOAD: {
+      const Section *section = &ar->header->strings;
+      if (value < section->offset ||
+          value - section->offset > section->count ||
+          len > section->count - (value - section->offset))
+      {
+        ar->ok = false;
+        return;
+      }
+      value = (uintptr_t) (ar->base + value);
+      break;
+    }
+  }
+  memcpy(slot, &value, sizeof(value));
+}
+
+static void visit(Archive *ar, NodeKind kind, void *node)
+{
+  switch (kind)
+  {
+    case KIND_TOPLEVEL:
+      visit_toplevel(ar, node);
+      break;
+    case KIND_RECORD_ENTRY: {
+      RecordEntry *entry = node;
+      if ((unsigned) entry->t > RECORD_ENTRY_NORMAL ||
+          (entry->t == RECORD_ENTRY_BUILTIN &&
+           entry->builtin != BUILTIN_CLIP_POSITION) ||
+          entry->index < 0 || entry->component < 0 || entry->component > 3)
+      {
+        ar->ok = false;
+        return;
+      }
+      string(ar, &entry->name, entry->name_len);
+      field(ar, &entry->type, KIND_TYPE);
+      field(ar, &entry->next, KIND_RECORD_ENTRY);
+      break;
+    }
+    case KIND_TYPE:
+      visit_type(ar, node);
+      break;
+    case KIND_PARAMETER: {
+      Parameter *param = node;
+      string(ar, &param->name, param->name_len);
+      field(ar, &param->type, KIND_TYPE);
+      field(ar, &param->entry, KIND_VAR_ENTRY);
+      field(ar, &param->next, KIND_PARAMETER);
+      break;
+    }
+    case KIND_STATEMENT:
+      visit_statement(ar, node);
+      break;
+    case KIND_EXPR:
+      visit_expr(ar, node);
+      break;
+    case KIND_MEMBER: {
+      RecordExprMember *member = node;
+      string(ar, &member->name, member->name_len);
+      field(ar, &member->expr, KIND_EXPR);
+      field(ar, &member->next, KIND_MEMBER);
+      field(ar, &member->entry, KIND_RECORD_ENTRY);
+      break;
+    }
+    case KIND_VAR_ENTRY: {
+      VarEntry *entry = node;
+      string(ar, &entry->name, entry->name_len);
+      field(ar, &entry->type, KIND_TYPE);
+      field(ar, &entry->record, KIND_TOPLEVEL);
+      field(ar, &entry->constant, KIND_EXPR);
+      field(ar, &entry->next, KIND_VAR_ENTRY);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static void visit_toplevel(Archive *ar, Toplevel *node)
+{
+  switch (node->t)
+  {
+    case TOPLEVEL_RECORD:
+      /* Name indexes are rebuilt by resolving, never stored. */
+      if (ar->mode == VISIT_SAVE)
+      {
+        node->record.index.slots = NULL;
+        node->record.index.cap = 0;
+        node->record.index.count = 0;
+      }
+      string(ar, &node->record.name, node->record.name_len);
+      field(ar, &node->record.entries, KIND_RECORD_ENTRY);
+      field(ar, &node->record.entry, KIND_VAR_ENTRY);
+      break;
+    case TOPLEVEL_PROC:
+      /* The parent scope is always the module scope, restored on load. */
+      if (ar->mode == VISIT_SAVE)
+      {
+        node->proc.scope.up = NULL;
+        node->proc.scope.index.slots = NULL;
+        node->proc.scope.index.cap = 0;
+        node->proc.scope.index.count = 0;
+      }
+      field(ar, &node->proc.entry, KIND_VAR_ENTRY);
+      field(ar, &node->proc.scope.entries, KIND_VAR_ENTRY);
+      string(ar, &node->proc.name, node->proc.name_len);
+      field(ar, &node->proc.stmts, KIND_STATEMENT);
+      field(ar, &node->proc.params, KIND_PARAMETER);
+      field(ar, &node->proc.return_type, KIND_TYPE);
+      break;
+    default:
+      ar->ok = false;
+      return;
+  }
+  field(ar, &node->next, KIND_TOPLEVEL);
+}
+
+static void visit_type(Archive *ar, Type *node)
+{
+  switch (node->t)
+  {
+    case TYPE_F32:
+    case TYPE_F64:
+    case TYPE_VOID:
+      break;
+    case TYPE_VECTOR:
+      ar->ok &= node->vec.size >= 1 && node->vec.size <= 4 &&
+        node->vec.type != NULL;
+      field(ar, &node->vec.type, KIND_TYPE);
+      break;
+    case TYPE_RECORD:
+      field(ar, &node->record.entries, KIND_RECORD_ENTRY);
+      string(ar, &node->record.name, node->record.name_len);
+      field(ar, &node->record.toplevel, KIND_TOPLEVEL);
+      break;
+    case TYPE_VAR:
+      string(ar, &node->var.name, node->var.name_len);
+      break;
+    case TYPE_PROC:
+      field(ar, &node->proc.return_type, KIND_TYPE);
+      field(ar, &node->proc.params, KIND_PARAMETER);
+      break;
+    default:
+      ar->ok = false;
+      break;
+  }
+}
+
+static void visit_expr(Archive *ar, Expr *node)
+{
+  switch (node->t)
+  {
+    case EXPR_VAR:
+      string(ar, &node->var.name, node->var.name_len);
+      field(ar, &node->var.entry, KIND_VAR_ENTRY);
+      break;
+    case EXPR_NUM:
+      ar->ok &= node->num.t == NUMBER_INT || node->num.t == NUMBER_REAL;
+      break;
+    case EXPR_RECORD:
+      string(ar, &node->record.name, node->record.name_len);
+      field(ar, &node->record.members, KIND_MEMBER);
+      field(ar, &node->record.entry, KIND_VAR_ENTRY);
+      break;
+    case EXPR_MEMBER:
+      ar->ok &= node->member.lhs != NULL;
+      field(ar, &node->member.lhs, KIND_EXPR);
+      string(ar, &node->member.name, node->member.name_len);
+      field(ar, &node->member.entry, KIND_RECORD_ENTRY);
+      break;
+    case EXPR_VECTOR:
+      field(ar, &node->vec.exprs, KIND_EXPR);
+      break;
+    case EXPR_BINARY:
+      ar->ok &= (unsigned) node->binary.op <= BINOP_DIV &&
+        node->binary.lhs != NULL && node->binary.rhs != NULL;
+      field(ar, &node->binary.lhs, KIND_EXPR);
+      field(ar, &node->binary.rhs, KIND_EXPR);
+      break;
+    case EXPR_FMA:
+      ar->ok &= node->fma.lhs != NULL && node->fma.rhs != NULL &&
+        node->fma.addend != NULL;
+      field(ar, &node->fma.lhs, KIND_EXPR);
+      field(ar, &node->fma.rhs, KIND_EXPR);
+      field(ar, &node->fma.addend, KIND_EXPR);
+      break;
+    default:
+      ar->ok = false;
+      return;
+  }
+  field(ar, &node->type, KIND_TYPE);
+  field(ar, &node->next, KIND_EXPR);
+}
+
+static void visit_statement(Archive *ar, Statement *node)
+{
+  switch (node->t)
+  {
+    case STATEMENT_RETURN:
+      field(ar, &node->ret.expr, KIND_EXPR);
+      break;
+    case STATEMENT_VAR:
+      field(ar, &node->var.entry, KIND_VAR_ENTRY);
+      string(ar, &node->var.name, node->var.name_len);
+      field(ar, &node->var.expr, KIND_EXPR);
+      field(ar, &node->var.type, KIND_TYPE);
+      break;
+    default:
+      ar->ok = false;
+      return;
+  }
+  field(ar, &node->next, KIND_STATEMENT);
+}
+
+static void free_archive(Archive *ar)
+{
+  for (int kind = 0; kind < KIND_COUNT; kind++)
+  {
+    if (ar->caps[kind] > 0)
+    {
+      ar->alloc->fn(ar->nodes[kind], ar->caps[kind] * kind_sizes[kind], 0,
+          ar->alloc->ud);
+    }
+  }
+  ar->alloc->fn(ar->strings, ar->strings_cap, 0, ar->alloc->ud);
+  if (ar->interned_cap > 0)
+  {
+    ar->alloc->fn(ar->interned, ar->interned_cap * sizeof(InternSlot), 0,
+        ar->alloc->ud);
+  }
+}
+
+/* Asking for zero bytes frees, so empty tables stay NULL. */
+static void *zeroed(BSLAlloc *alloc, size_t size)
+{
+  if (size == 0)
+  {
+    return NULL;
+  }
+
+  void *ptr = alloc->fn(NULL, 0, size, alloc->ud);
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+static size_t node_id(const Archive *ar, NodeKind kind, const void *node)
+{
+  const uint8_t *start = ar->base + ar->header->sections[kind].offset;
+  return ar->firsts[kind] +
+    (size_t) ((const uint8_t *) node - start) / kind_sizes[kind];
+}
+
+/* The edges that own a node. Links back to a declaration, which are what
+ * make a valid module cyclic, are left out: variable entries named by
+ * uses, and the record a type or entry stands for. */
+static size_t children(NodeKind kind, void *node, Child *out)
+{
+  size_t n = 0;
+#define CHILD(_kind, _node) \
+  do { \
+    if ((_node) != NULL) \
+    { \
+      out[n++] = (Child) { (_kind), (_node) }; \
+    } \
+  } while (0)
+
+  switch (kind)
+  {
+    case KIND_TOPLEVEL: {
+      Toplevel *toplevel = node;
+      if (toplevel->t == TOPLEVEL_RECORD)
+      {
+        CHILD(KIND_RECORD_ENTRY, toplevel->record.entries);
+      } else
+      {
+        CHILD(KIND_VAR_ENTRY, toplevel->proc.scope.entries);
+        CHILD(KIND_STATEMENT, toplevel->proc.stmts);
+        CHILD(KIND_PARAMETER, toplevel->proc.params);
+        CHILD(KIND_TYPE, toplevel->proc.return_type);
+      }
+      CHILD(KIND_TOPLEVEL, toplevel->next);
+      break;
+    }
+    case KIND_RECORD_ENTRY: {
+      RecordEntry *entry = node;
+      CHILD(KIND_TYPE, entry->type);
+      CHILD(KIND_RECORD_ENTRY, entry->next);
+      break;
+    }
+    case KIND_TYPE: {
+      Type *type = node;
+      if (type->t == TYPE_VECTOR)
+      {
+        CHILD(KIND_TYPE, type->vec.type);
+      } else if (type->t == TYPE_RECORD)
+      {
+        CHILD(KIND_RECORD_ENTRY, type->record.entries);
+      } else if (type->t == TYPE_PROC)
+      {
+        CHILD(KIND_TYPE, type->proc.return_type);
+        CHILD(KIND_PARAMETER, type->proc.params);
+      }
+      break;
+    }
+    case KIND_PARAMETER: {
+      Parameter *param = node;
+      CHILD(KIND_TYPE, param->type);
+      CHILD(KIND_PARAMETER, param->next);
+      break;
+    }
+    case KIND_STATEMENT: {
+      Statement *stmt = node;
+      if (stmt->t == STATEMENT_RETURN)
+      {
+        CHILD(KIND_EXPR, stmt->ret.expr);
+      } else
+      {
+        CHILD(KIND_EXPR, stmt->var.expr);
+        CHILD(KIND_TYPE, stmt->var.type);
+      }
+      CHILD(KIND_STATEMENT, stmt->next);
+      break;
+    }
+    case KIND_EXPR: {
+      Expr *expr = node;
+      switch (expr->t)
+      {
+        case EXPR_RECORD:
+          CHILD(KIND_MEMBER, expr->record.members);
+          break;
+        case EXPR_MEMBER:
+          CHILD(KIND_EXPR, expr->member.lhs);
+          CHILD(KIND_RECORD_ENTRY, expr->member.entry);
+          break;
+        case EXPR_VECTOR:
+          CHILD(KIND_EXPR, expr->vec.exprs);
+          break;
+        case EXPR_BINARY:
+          CHILD(KIND_EXPR, expr->binary.lhs);
+          CHILD(KIND_EXPR, expr->binary.rhs);
+          break;
+        case EXPR_FMA:
+          CHILD(KIND_EXPR, expr->fma.lhs);
+          CHILD(KIND_EXPR, expr->fma.rhs);
+          CHILD(KIND_EXPR, expr->fma.addend);
+          break;
+        default:
+          break;
+      }
+      CHILD(KIND_TYPE, expr->type);
+      CHILD(KIND_EXPR, expr->next);
+      break;
+    }
+    case KIND_MEMBER: {
+      RecordExprMember *member = node;
+      CHILD(KIND_EXPR, member->expr);
+      CHILD(KIND_RECORD_ENTRY, member->entry);
+      CHILD(KIND_MEMBER, member->next);
+      break;
+    }
+    case KIND_VAR_ENTRY: {
+      VarEntry *entry = node;
+      CHILD(KIND_TYPE, entry->type);
+      CHILD(KIND_EXPR, entry->constant);
+      CHILD(KIND_VAR_ENTRY, entry->next);
+      break;
+    }
+    default:
+      break;
+  }
+#undef CHILD
+  return n;
+}
+
+/* Every pass walks lists and expression trees to their end, so an archive
+ * where a node owns itself, directly or not, is refused. Depth first with
+ * an explicit stack, as the trees can be deeper than the C stack. Passes
+ * do recurse over types, which are held to the depth the parser
+ * allows. */
+static bool check_acyclic(Archive *ar)
+{
+  BSLAlloc *alloc = ar->alloc;
+  enum { WHITE, GRAY, BLACK };
+  uint8_t *marks = zeroed(alloc, ar->node_count);
+  uint32_t *heights = zeroed(alloc, ar->node_count * sizeof(uint32_t));
+  Frame *stack = NULL;
+  size_t cap = 0, depth = 0;
+  bool ok = true;
+
+  for (int kind = 0; ok && kind < KIND_COUNT; kind++)
+  {
+    uint8_t *nodes = ar->base + ar->header->sections[kind].offset;
+    for (size_t i = 0; ok && i < ar->header->sections[kind].count; i++)
+    {
+      if (marks[ar->firsts[kind] + i] != WHITE)
+      {
+        continue;
+      }
+
+      stack = grow(alloc, stack, &cap, 1, sizeof(Frame));
+      stack[0] = (Frame) { { kind, nodes + i * kind_sizes[kind] }, 0 };
+      marks[ar->firsts[kind] + i] = GRAY;
+      depth = 1;
+      while (ok && depth > 0)
+      {
+        Frame *top = &stack[depth - 1];
+        Child kids[MAX_CHILDREN];
+        size_t count = children(top->child.kind, top->child.node, kids);
+        if (top->next == count)
+        {
+          size_t id = node_id(ar, top->child.kind, top->child.node);
+          marks[id] = BLACK;
+          heights[id] = nest_height(ar, top->child, kids, count, heights);
+          ok = heights[id] <= AST_MAX_TYPE_DEPTH;
+          depth--;
+          continue;
+        }
+
+        Child kid = kids[top->next++];
+        size_t id = node_id(ar, kid.kind, kid.node);
+        if (marks[id] == GRAY)
+        {
+          ok = false;
+        } else if (marks[id] == WHITE)
+        {
+          marks[id] = GRAY;
+          stack = grow(alloc, stack, &cap, depth + 1, sizeof(Frame));
+          stack[depth++] = (Frame) { kid, 0 };
+        }
+      }
+    }
+  }
+
+  if (cap > 0)
+  {
+    alloc->fn(stack, cap * sizeof(Frame), 0, alloc->ud);
+  }
+  alloc->fn(heights, ar->node_count * sizeof(uint32_t), 0, alloc->ud);
+  alloc->fn(marks, ar->node_count, 0, alloc->ud);
+  return ok;
+}
+
+/* How deep a pass recurses from node, a level per nested type. */
+static uint32_t nest_height(Archive *ar, Child node, const Child *kids,
+    size_t count, const uint32_t *heights)
+{
+  if (node.kind != KIND_TYPE)
+  {
+    return 0;
+  }
+
+  uint32_t below = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (kids[i].kind == KIND_TYPE)
+    {
+      uint32_t height = heights[node_id(ar, kids[i].kind, kids[i].node)];
+      below = height > below ? height : below;
+    }
+  }
+  return 1 + below;
+}
+
+/* Passes number a procedure's variables by their index into tables of
+ * entry_count slots, so its list has to match its count. An entry is in
+ * at most one scope. */
+static bool check_scope(Archive *ar, VarEntry *entries, size_t count,
+    size_t *owners, size_t owner)
+{
+  size_t n = 0;
+  for (VarEntry *entry = entries; entry != NULL; entry = entry->next)
+  {
+    size_t *slot = &owners[node_id(ar, KIND_VAR_ENTRY, entry) -
+      ar->firsts[KIND_VAR_ENTRY]];
+    if (*slot != OWNER_NONE ||
+        (owner != OWNER_GLOBAL && entry->index >= count))
+    {
+      return false;
+    }
+    *slot = owner;
+    n++;
+  }
+  return owner == OWNER_GLOBAL || n == count;
+}
+
+/* Checks what the acyclic walk leaves out: that declarations are of the
+ * right kind, and that indices into per record and per procedure tables
+ * are in range. */
+static bool check_refs(Archive *ar)
+{
+  BSLAlloc *alloc = ar->alloc;
+  const ArchiveHeader *header = ar->header;
+  Toplevel *toplevels = (Toplevel *) (ar->base +
+      header->sections[KIND_TOPLEVEL].offset);
+  Type *types = (Type *) (ar->base + header->sections[KIND_TYPE].offset);
+  VarEntry *vars = (VarEntry *) (ar->base +
+      header->sections[KIND_VAR_ENTRY].offset);
+  size_t toplevel_count = header->sections[KIND_TOPLEVEL].count;
+  size_t var_count = header->sections[KIND_VAR_ENTRY].count;
+
+  for (size_t i = 0; i < header->sections[KIND_TYPE].count; i++)
+  {
+    if (types[i].t == TYPE_RECORD && types[i].record.toplevel != NULL &&
+        types[i].record.toplevel->t != TOPLEVEL_RECORD)
+    {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < var_count; i++)
+  {
+    if (vars[i].record != NULL && vars[i].record->t != TOPLEVEL_RECORD)
+    {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < toplevel_count; i++)
+  {
+    Toplevel *record = &toplevels[i];
+    if (record->t != TOPLEVEL_RECORD)
+    {
+      continue;
+    }
+
+    size_t n = 0;
+    for (RecordEntry *entry = record->record.entries; entry != NULL;
+        entry = entry->next, n++)
+    {
+      if ((size_t) entry->index >= record->record.entry_count)
+      {
+        return false;
+      }
+    }
+    if (n != record->record.entry_count)
+    {
+      return false;
+    }
+  }
+
+  size_t owners_size = var_count * sizeof(size_t);
+  size_t *owners = zeroed(alloc, owners_size);
+  size_t seen_size = header->sections[KIND_EXPR].count * sizeof(size_t);
+  size_t *seen = zeroed(alloc, seen_size);
+  Expr **stack = NULL;
+  size_t cap = 0;
+
+  bool ok = check_scope(ar, header->roots.scope, 0, owners, OWNER_GLOBAL) &&
+    check_scope(ar, header->roots.type_scope, 0, owners, OWNER_GLOBAL);
+  for (size_t i = 0; ok && i < toplevel_count; i++)
+  {
+    Toplevel *proc = &toplevels[i];
+    size_t owner = OWNER_PROC + i;
+    ok = proc->t != TOPLEVEL_PROC ||
+      (check_scope(ar, proc->proc.scope.entries,
+                   proc->proc.scope.entry_count, owners, owner) &&
+       check_proc(ar, proc, owners, owner, seen, &stack, &cap));
+  }
+
+  if (cap > 0)
+  {
+    alloc->fn(stack, cap * sizeof(Expr *), 0, alloc->ud);
+  }
+  alloc->fn(seen, seen_size, 0, alloc->ud);
+  alloc->fn(owners, owners_size, 0, alloc->ud);
+  return ok;
+}
+
+/* Parameters and declarations have to be the procedure's own, and the
+ * variables it reads its own or global, so every index it looks up stays
+ * inside its tables. Import summaries keep only signatures, which nothing
+ * numbers. */
+static bool check_proc(Archive *ar, Toplevel *proc, const size_t *owners,
+    size_t owner, size_t *seen, Expr ***stack, size_t *cap)
+{
+  if (proc->proc.stmts == NULL && proc->proc.entry_point == 0)
+  {
+    return true;
+  }
+
+#define OWNER(_entry) \
+  owners[node_id(ar, KIND_VAR_ENTRY, (_entry)) - ar->firsts[KIND_VAR_ENTRY]]
+
+  for (Parameter *param = proc->proc.params; param != NULL;
+      param = param->next)
+  {
+    if (param->entry != NULL && OWNER(param->entry) != owner)
+    {
+      return false;
+    }
+  }
+
+  size_t depth = 0;
+  for (Statement *stmt = proc->proc.stmts; stmt != NULL; stmt = stmt->next)
+  {
+    if (stmt->t == STATEMENT_VAR && stmt->var.entry != NULL &&
+        OWNER(stmt->var.entry) != owner)
+    {
+      return false;
+    }
+
+    Expr *root = stmt->t == STATEMENT_RETURN ? stmt->ret.expr :
+      stmt->var.expr;
+    if (root == NULL)
+    {
+      continue;
+    }
+
+    *stack = grow(ar->alloc, *stack, cap, depth + 1, sizeof(Expr *));
+    (*stack)[depth++] = root;
+    while (depth > 0)
+    {
+      Expr *expr = (*stack)[--depth];
+      size_t id = node_id(ar, KIND_EXPR, expr) - ar->firsts[KIND_EXPR];
+      if (seen[id] == owner)
+      {
+        continue;
+      }
+      seen[id] = owner;
+
+      if (expr->t == EXPR_VAR && expr->var.entry != NULL &&
+          OWNER(expr->var.entry) != owner &&
+          OWNER(expr->var.entry) != OWNER_GLOBAL)
+      {
+        return false;
+      }
+
+      Child kids[MAX_CHILDREN];
+      size_t count = children(KIND_EXPR, expr, kids);
+      *stack = grow(ar->alloc, *stack, cap, depth + count, sizeof(Expr *));
+      for (size_t i = 0; i < count; i++)
+      {
+        if (kids[i].kind == KIND_EXPR)
+        {
+          (*stack)[depth++] = kids[i].node;
+        }
+      }
+
+      if (expr->t == EXPR_RECORD)
+      {
+        for (RecordExprMember *member = expr->record.members;
+            member != NULL; member = member->next)
+        {
+          if (member->expr != NULL)
+          {
+            *stack = grow(ar->alloc, *stack, cap, depth + 1,
+                sizeof(Expr *));
+            (*stack)[depth++] = member->expr;
+          }
+        }
+      }
+    }
+  }
+#undef OWNER
+  return true;
+}
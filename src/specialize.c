@@ -0,0 +1,249 @@
+#include <string.h>
+
+#include <bsl/specialize.h>
+
+/* === PROTOTYPES === */
+
+static void fold_expr(AST *ast, Expr *expr, bool fast_math);
+static bool fold_numbers(Expr *expr);
+static void fold_identity(AST *ast, Expr *expr);
+static float number_value(Expr *expr);
+static bool number_is(Expr *expr, float value);
+static bool same_shape(Expr *expr, Expr *with);
+static void replace_expr(Expr *expr, Expr *with);
+static void make_zero(AST *ast, Expr *expr);
+
+/* === PUBLIC FUNCTIONS === */
+
+bool specialize_constants(AST *ast, const BSLConstant *constants,
+    size_t constant_count, bool fast_math)
+{
+  for (size_t i = 0; i < constant_count; i++)
+  {
+    size_t name_len = strlen(constants[i].name);
+    VarEntry *entry = ast->scope.entries;
+    while (entry != NULL && (entry->constant == NULL ||
+          entry->name_len != name_len ||
+          strncmp((const char *) entry->name, constants[i].name,
+            name_len) != 0))
+    {
+      entry = entry->next;
+    }
+
+    if (entry == NULL)
+    {
+      result_error_code(ast->result, BSL_ERROR_CONSTANT, 0, 0,
+          "no specialization constant named '%s'", constants[i].name);
+      return false;
+    }
+    entry->constant->num.t = NUMBER_REAL;
+    entry->constant->num.f = constants[i].value;
+  }
+
+  /* Modules without constants compile exactly as written. */
+  bool has_constants = false;
+  VarEntry *entry = ast->scope.entries;
+  while (entry != NULL)
+  {
+    has_constants = has_constants || entry->constant != NULL;
+    entry = entry->next;
+  }
+  if (!has_constants)
+  {
+    return true;
+  }
+
+  Toplevel *iter = ast->toplevels;
+  while (iter != NULL)
+  {
+    if (iter->t == TOPLEVEL_PROC)
+    {
+      Statement *stmt = iter->proc.stmts;
+      while (stmt != NULL)
+      {
+        fold_expr(ast,
+            stmt->t == STATEMENT_VAR ? stmt->var.expr : stmt->ret.expr,
+            fast_math);
+        stmt = stmt->next;
+      }
+    }
+    iter = iter->next;
+  }
+  return true;
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static void fold_expr(AST *ast, Expr *expr, bool fast_math)
+{
+  ExprWalk walk;
+  expr_walk_init(&walk, ast->alloc, expr);
+  bool leaving;
+  while ((expr = expr_walk_next(&walk, &leaving)) != NULL)
+  {
+    if (!leaving)
+    {
+      continue;
+    }
+
+    if (expr->t == EXPR_VAR && expr->var.entry->constant != NULL)
+    {
+      Number num = expr->var.entry->constant->num;
+      expr->t = EXPR_NUM;
+      expr->num = num;
+    } else if (expr->t == EXPR_BINARY && !fold_numbers(expr) && fast_math)
+    {
+      fold_identity(ast, expr);
+    }
+  }
+}
+
+/* Folds an operation on two numbers with the float arithmetic the backends
+ * run, so the result is the one they would compute. */
+static bool fold_numbers(Expr *expr)
+{
+  Expr *lhs = expr->binary.lhs;
+  Expr *rhs = expr->binary.rhs;
+  if (lhs->t == EXPR_NUM && rhs->t == EXPR_NUM)
+  {
+    float a = number_value(lhs), b = number_value(rhs), value = 0.0f;
+    switch (expr->binary.op)
+    {
+      case BINOP_ADD:
+        value = a + b;
+        break;
+      case BINOP_SUB:
+        value = a - b;
+        break;
+      case BINOP_MUL:
+        value = a * b;
+        break;
+      case BINOP_DIV:
+        value = a / b;
+        break;
+    }
+    expr->t = EXPR_NUM;
+    expr->num.t = NUMBER_REAL;
+    expr->num.f = value;
+    return true;
+  }
+  return false;
+}
+
+/* Fast math folds constants the way shader compilers treat them: x * 0 is
+ * zero whatever x holds, which is what lets a switch drop the code behind
+ * it. */
+static void fold_identity(AST *ast, Expr *expr)
+{
+  Expr *lhs = expr->binary.lhs;
+  Expr *rhs = expr->binary.rhs;
+  switch (expr->binary.op)
+  {
+    case BINOP_ADD:
+      if (number_is(lhs, 0.0f) && same_shape(expr, rhs))
+      {
+        replace_expr(expr, rhs);
+      } else if (number_is(rhs, 0.0f) && same_shape(expr, lhs))
+      {
+        replace_expr(expr, lhs);
+      }
+      break;
+    case BINOP_SUB:
+      if (number_is(rhs, 0.0f) && same_shape(expr, lhs))
+      {
+        replace_expr(expr, lhs);
+      }
+      break;
+    case BINOP_MUL:
+      if (number_is(lhs, 0.0f) || number_is(rhs, 0.0f))
+      {
+        make_zero(ast, expr);
+      } else if (number_is(lhs, 1.0f) && same_shape(expr, rhs))
+      {
+        replace_expr(expr, rhs);
+      } else if (number_is(rhs, 1.0f) && same_shape(expr, lhs))
+      {
+        replace_expr(expr, lhs);
+      }
+      break;
+    case BINOP_DIV:
+      if (number_is(rhs, 1.0f) && same_shape(expr, lhs))
+      {
+        replace_expr(expr, lhs);
+      }
+      break;
+  }
+}
+
+static float number_value(Expr *expr)
+{
+  return expr->num.t == NUMBER_INT ? (float) expr->num.i : (float) expr->num.f;
+}
+
+/* Vector literals count when every component does. */
+static bool number_is(Expr *expr, float value)
+{
+  if (expr->t == EXPR_NUM)
+  {
+    return number_value(expr) == value;
+  } else if (expr->t != EXPR_VECTOR)
+  {
+    return false;
+  }
+
+  Expr *iter = expr->vec.exprs;
+  while (iter != NULL)
+  {
+    if (!number_is(iter, value))
+    {
+      return false;
+    }
+    iter = iter->next;
+  }
+  return true;
+}
+
+/* A scalar operand cannot stand in for a vector result. */
+static bool same_shape(Expr *expr, Expr *with)
+{
+  return (expr->type->t == TYPE_VECTOR) == (with->type->t == TYPE_VECTOR);
+}
+
+static void replace_expr(Expr *expr, Expr *with)
+{
+  Expr *next = expr->next;
+  *expr = *with;
+  expr->next = next;
+}
+
+static void make_zero(AST *ast, Expr *expr)
+{
+  Type *type = expr->type;
+  if (type->t == TYPE_F32)
+  {
+    expr->t = EXPR_NUM;
+    expr->num.t = NUMBER_REAL;
+    expr->num.f = 0.0;
+    return;
+  }
+  if (type->t != TYPE_VECTOR || type->vec.type->t != TYPE_F32)
+  {
+    return;
+  }
+
+  Expr *exprs = NULL;
+  for (int i = 0; i < type->vec.size; i++)
+  {
+    Expr *zero = BSL_NEW(ast->alloc, Expr);
+    zero->t = EXPR_NUM;
+    zero->line = expr->line;
+    zero->col = expr->col;
+    zero->num.t = NUMBER_REAL;
+    zero->num.f = 0.0;
+    zero->type = type->vec.type;
+    zero->next = exprs;
+    exprs = zero;
+  }
+  expr->t = EXPR_VECTOR;
+  expr->vec.exprs = exprs;
+}
@@ -0,0 +1,306 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <bsl/trace.h>
+
+#define TRACE_CHUNK_EVENTS 1024
+#define TRACE_NAME_LEN 48
+
+typedef struct
+{
+  uint64_t ts;
+  char ph;
+  const char *cat;
+  char name[TRACE_NAME_LEN];
+} TraceEvent;
+
+typedef struct TraceChunk
+{
+  size_t count;
+  struct TraceChunk *next;
+  TraceEvent events[TRACE_CHUNK_EVENTS];
+} TraceChunk;
+
+/* Only the owning thread appends to a buffer and buffers are only ever
+ * pushed onto the trace, so recording an event never takes a lock. */
+typedef struct TraceBuffer
+{
+  const void *owner;
+  int tid;
+  TraceChunk *first, *last;
+  struct TraceBuffer *next;
+} TraceBuffer;
+
+struct BSLTrace
+{
+  BSLAlloc alloc;
+  uint64_t id;
+  uint64_t start;
+  _Atomic(TraceBuffer *) buffers;
+  atomic_int thread_count;
+};
+
+static const char *phase_names[BSL_PHASE_COUNT] = {
+  [BSL_PHASE_CACHE] = "cache",
+  [BSL_PHASE_LEX] = "lex",
+  [BSL_PHASE_PARSE] = "parse",
+  [BSL_PHASE_IMPORT] = "import",
+  [BSL_PHASE_RESOLVE] = "resolve",
+  [BSL_PHASE_SPECIALIZE] = "specialize",
+  [BSL_PHASE_DCE] = "dce",
+  [BSL_PHASE_LINK] = "link",
+  [BSL_PHASE_HASH] = "hash",
+  [BSL_PHASE_SLP] = "slp",
+  [BSL_PHASE_FMA] = "fma",
+  [BSL_PHASE_CODEGEN] = "codegen",
+};
+
+static atomic_uint_fast64_t next_trace_id = 1;
+
+/* The address of owner_token tells live threads apart. The cache skips
+ * the buffer search while a thread keeps recording into one trace; ids
+ * are never reused, so a freed trace cannot be mistaken for a new one. */
+static _Thread_local char owner_token;
+static _Thread_local uint64_t cached_id;
+static _Thread_local TraceBuffer *cached_buffer;
+
+/* === PROTOTYPES === */
+
+static void record(BSLTrace *trace, char ph, const char *cat,
+    const char *name, size_t name_len, uint64_t ts);
+static TraceBuffer *thread_buffer(BSLTrace *trace);
+static void write_string(FILE *file, const char *str);
+
+/* === PUBLIC FUNCTIONS === */
+
+BSLTrace *bsl_trace_create(BSLAllocFn alloc_fn, void *alloc_ud)
+{
+  BSLTrace *trace = alloc_fn(NULL, 0, sizeof(BSLTrace), alloc_ud);
+  trace->alloc.fn = alloc_fn;
+  trace->alloc.ud = alloc_ud;
+  trace->id = atomic_fetch_add(&next_trace_id, 1);
+  trace->start = now_ns();
+  atomic_init(&trace->buffers, NULL);
+  atomic_init(&trace->thread_count, 0);
+  return trace;
+}
+
+void bsl_trace_begin(BSLTrace *trace, const char *name)
+{
+  if (trace != NULL)
+  {
+    record(trace, 'B', "user", name, strlen(name), now_ns());
+  }
+}
+
+void bsl_trace_end(BSLTrace *trace)
+{
+  trace_end(trace);
+}
+
+bool bsl_trace_write(BSLTrace *trace, const char *path,
+    BSLCompileResult *result)
+{
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+  {
+    result_error(result, 0, 0, "could not open '%s' for writing", path);
+    return false;
+  }
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  bool first = true;
+  TraceBuffer *buffer = atomic_load(&trace->buffers);
+  while (buffer != NULL)
+  {
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+        "\"tid\":%d,\"args\":{\"name\":\"compile thread %d\"}}",
+        first ? "" : ",\n", buffer->tid, buffer->tid);
+    first = false;
+
+    TraceChunk *chunk = buffer->first;
+    while (chunk != NULL)
+    {
+      for (size_t i = 0; i < chunk->count; i++)
+      {
+        TraceEvent *event = &chunk->events[i];
+        uint64_t ts = event->ts - trace->start;
+        fprintf(file, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%" PRIu64 ".%03u", event->ph, buffer->tid, ts / 1000,
+            (unsigned) (ts % 1000));
+        if (event->ph == 'B')
+        {
+          fprintf(file, ",\"cat\":\"%s\",\"name\":", event->cat);
+          write_string(file, event->name);
+        }
+        fputc('}', file);
+      }
+      chunk = chunk->next;
+    }
+    buffer = buffer->next;
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+  if (fclose(file) != 0)
+  {
+    result_error(result, 0, 0, "could not write '%s'", path);
+    return false;
+  }
+  return true;
+}
+
+void bsl_trace_free(BSLTrace *trace)
+{
+  BSLAlloc alloc = trace->alloc;
+  TraceBuffer *buffer = atomic_load(&trace->buffers);
+  while (buffer != NULL)
+  {
+    TraceChunk *chunk = buffer->first;
+    while (chunk != NULL)
+    {
+      TraceChunk *next = chunk->next;
+      alloc.fn(chunk, sizeof(TraceChunk), 0, alloc.ud);
+      chunk = next;
+    }
+
+    TraceBuffer *next = buffer->next;
+    alloc.fn(buffer, sizeof(TraceBuffer), 0, alloc.ud);
+    buffer = next;
+  }
+  alloc.fn(trace, sizeof(BSLTrace), 0, alloc.ud);
+}
+
+void trace_begin(BSLTrace *trace, const char *cat, const char *name,
+    size_t name_len)
+{
+  if (trace != NULL)
+  {
+    record(trace, 'B', cat, name, name_len, now_ns());
+  }
+}
+
+void trace_phase(BSLTrace *trace, BSLPhase phase)
+{
+  if (trace != NULL)
+  {
+    const char *name = phase_names[phase];
+    record(trace, 'B', "phase", name, strlen(name), now_ns());
+  }
+}
+
+void trace_toplevel(BSLTrace *trace, Toplevel *toplevel, uint64_t start)
+{
+  if (trace == NULL)
+  {
+    return;
+  }
+
+  if (toplevel->t == TOPLEVEL_PROC)
+  {
+    record(trace, 'B', "parse", (const char *) toplevel->proc.name,
+        toplevel->proc.name_len, start);
+  } else
+  {
+    record(trace, 'B', "parse", (const char *) toplevel->record.name,
+        toplevel->record.name_len, start);
+  }
+  trace_end(trace);
+}
+
+void trace_end(BSLTrace *trace)
+{
+  if (trace != NULL)
+  {
+    record(trace, 'E', NULL, NULL, 0, now_ns());
+  }
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static void record(BSLTrace *trace, char ph, const char *cat,
+    const char *name, size_t name_len, uint64_t ts)
+{
+  TraceBuffer *buffer = thread_buffer(trace);
+  TraceChunk *chunk = buffer->last;
+  if (chunk == NULL || chunk->count == TRACE_CHUNK_EVENTS)
+  {
+    TraceChunk *next = trace->alloc.fn(NULL, 0, sizeof(TraceChunk),
+        trace->alloc.ud);
+    next->count = 0;
+    next->next = NULL;
+    if (chunk == NULL)
+    {
+      buffer->first = next;
+    } else
+    {
+      chunk->next = next;
+    }
+    buffer->last = chunk = next;
+  }
+
+  TraceEvent *event = &chunk->events[chunk->count++];
+  event->ts = ts;
+  event->ph = ph;
+  event->cat = cat;
+  if (name_len >= TRACE_NAME_LEN)
+  {
+    name_len = TRACE_NAME_LEN - 1;
+  }
+  if (name_len > 0)
+  {
+    memcpy(event->name, name, name_len);
+  }
+  event->name[name_len] = '\0';
+}
+
+static TraceBuffer *thread_buffer(BSLTrace *trace)
+{
+  if (cached_id == trace->id)
+  {
+    return cached_buffer;
+  }
+
+  TraceBuffer *buffer = atomic_load(&trace->buffers);
+  while (buffer != NULL && buffer->owner != &owner_token)
+  {
+    buffer = buffer->next;
+  }
+
+  if (buffer == NULL)
+  {
+    buffer = trace->alloc.fn(NULL, 0, sizeof(TraceBuffer), trace->alloc.ud);
+    buffer->owner = &owner_token;
+    buffer->tid = atomic_fetch_add(&trace->thread_count, 1) + 1;
+    buffer->first = buffer->last = NULL;
+    buffer->next = atomic_load(&trace->buffers);
+    while (!atomic_compare_exchange_weak(&trace->buffers, &buffer->next,
+          buffer))
+      ;
+  }
+
+  cached_id = trace->id;
+  cached_buffer = buffer;
+  return buffer;
+}
+
+static void write_string(FILE *file, const char *str)
+{
+  fputc('"', file);
+  for (; *str != '\0'; str++)
+  {
+    unsigned char c = (unsigned char) *str;
+    if (c == '"' || c == '\\')
+    {
+      fprintf(file, "\\%c", c);
+    } else if (c < 0x20)
+    {
+      fprintf(file, "\\u%04x", c);
+    } else
+    {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
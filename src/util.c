@@ -1,13 +1,23 @@
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <bsl/util.h>
+#include <bsl/stats.h>
 
-void vresult_error(BSLCompileResult *result, int line, int col, 
-    const char *msg, va_list args) 
+static size_t hash_ptr(const void *ptr);
+static void track_add(TrackAlloc *track, const void *ptr, size_t size);
+static void *track_alloc_fn(void *ptr, size_t osz, size_t nsz, void *ud);
+#ifdef BSL_STATS
+static void *stats_alloc_fn(void *ptr, size_t osz, size_t nsz, void *ud);
+#endif
+
+void vresult_error(BSLCompileResult *result, BSLErrorCode code, int line,
+    int col, const char *msg, va_list args) 
 {
   result->line = line;
   result->col = col;
+  result->code = code;
   vsnprintf(result->msg, BSL_RESULT_MAX_MESSAGE_LEN, msg, args); 
 }
 
@@ -17,5 +27,310 @@ void result_error(BSLCompileResult *result, int line, int col,
   va_list args;
   va_start(args, msg);
 
-  vresult_error(result, line, col, msg, args);
+  vresult_error(result, BSL_ERROR_OTHER, line, col, msg, args);
+}
+
+void result_error_code(BSLCompileResult *result, BSLErrorCode code, int line,
+    int col, const char *msg, ...)
+{
+  va_list args;
+  va_start(args, msg);
+  vresult_error(result, code, line, col, msg, args);
+  va_end(args);
+}
+
+void result_report(BSLCompileResult *result, BSLAlloc *alloc)
+{
+  if (result->code == BSL_ERROR_NONE)
+  {
+    return;
+  }
+
+  /* Lists stay exactly as long as their count, which is what the caller
+   * frees them by. */
+  size_t count = result->diagnostic_count;
+  result->diagnostics = alloc->fn(result->diagnostics,
+      count * sizeof(BSLDiagnostic), (count + 1) * sizeof(BSLDiagnostic),
+      alloc->ud);
+  BSLDiagnostic *diagnostic = &result->diagnostics[count];
+  diagnostic->line = result->line;
+  diagnostic->col = result->col;
+  diagnostic->code = result->code;
+  memcpy(diagnostic->msg, result->msg, BSL_RESULT_MAX_MESSAGE_LEN);
+  result->diagnostic_count = count + 1;
+  result->code = BSL_ERROR_NONE;
+}
+
+uint64_t hash_name(const uint8_t *name, size_t name_len)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < name_len; i++)
+  {
+    hash = (hash ^ name[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+void *name_table_find(const NameTable *table, const uint8_t *name,
+    size_t name_len)
+{
+  if (table->cap == 0)
+  {
+    return NULL;
+  }
+
+  size_t mask = table->cap - 1;
+  for (size_t i = hash_name(name, name_len) & mask; ; i = (i + 1) & mask)
+  {
+    NameSlot *slot = &table->slots[i];
+    if (slot->name == NULL)
+    {
+      return NULL;
+    }
+    if (slot->name_len == name_len &&
+        memcmp(slot->name, name, name_len) == 0)
+    {
+      return slot->value;
+    }
+  }
 }
+
+void name_table_add(NameTable *table, BSLAlloc *alloc, const uint8_t *name,
+    size_t name_len, void *value)
+{
+  if ((table->count + 1) * 2 > table->cap)
+  {
+    NameTable grown = {
+      .cap = table->cap == 0 ? NAME_TABLE_MIN * 4 : table->cap * 2,
+    };
+    grown.slots = alloc->fn(NULL, 0, grown.cap * sizeof(NameSlot), alloc->ud);
+    memset(grown.slots, 0, grown.cap * sizeof(NameSlot));
+    for (size_t i = 0; i < table->cap; i++)
+    {
+      NameSlot *slot = &table->slots[i];
+      if (slot->name != NULL)
+      {
+        name_table_add(&grown, alloc, slot->name, slot->name_len, slot->value);
+      }
+    }
+    if (table->cap > 0)
+    {
+      alloc->fn(table->slots, table->cap * sizeof(NameSlot), 0, alloc->ud);
+    }
+    *table = grown;
+  }
+
+  size_t mask = table->cap - 1;
+  size_t i = hash_name(name, name_len) & mask;
+  while (table->slots[i].name != NULL)
+  {
+    i = (i + 1) & mask;
+  }
+  table->slots[i].name = name;
+  table->slots[i].name_len = name_len;
+  table->slots[i].value = value;
+  table->count++;
+}
+
+void track_wrap(TrackAlloc *track, BSLAlloc *alloc)
+{
+  track->inner = *alloc;
+  track->slots = NULL;
+  track->cap = 0;
+  track->count = 0;
+  alloc->fn = track_alloc_fn;
+  alloc->ud = track;
+}
+
+/* Linear probing, so removal shifts later slots of the run back instead of
+ * leaving a tombstone. */
+void track_forget(TrackAlloc *track, const void *ptr)
+{
+  if (track->cap == 0 || ptr == NULL)
+  {
+    return;
+  }
+
+  size_t mask = track->cap - 1;
+  size_t i = hash_ptr(ptr) & mask;
+  while (track->slots[i].ptr != ptr)
+  {
+    if (track->slots[i].ptr == NULL)
+    {
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+
+  size_t hole = i;
+  for (;;)
+  {
+    i = (i + 1) & mask;
+    if (track->slots[i].ptr == NULL)
+    {
+      break;
+    }
+
+    size_t home = hash_ptr(track->slots[i].ptr) & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask))
+    {
+      track->slots[hole] = track->slots[i];
+      hole = i;
+    }
+  }
+  track->slots[hole].ptr = NULL;
+  track->count--;
+}
+
+void track_release(TrackAlloc *track)
+{
+  BSLAlloc *inner = &track->inner;
+  for (size_t i = 0; i < track->cap; i++)
+  {
+    if (track->slots[i].ptr != NULL)
+    {
+      inner->fn((void *) track->slots[i].ptr, track->slots[i].size, 0,
+          inner->ud);
+    }
+  }
+  if (track->cap > 0)
+  {
+    inner->fn(track->slots, track->cap * sizeof(TrackSlot), 0, inner->ud);
+  }
+  track->slots = NULL;
+  track->cap = 0;
+  track->count = 0;
+}
+
+uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+bool cpu_has_fma(void)
+{
+#if defined(__FMA__)
+  return true;
+#elif defined(__GNUC__) && defined(__x86_64__)
+  return __builtin_cpu_supports("fma") && __builtin_cpu_supports("avx");
+#else
+  return false;
+#endif
+}
+
+#ifdef BSL_STATS
+
+void stats_wrap(StatsAlloc *wrap, BSLAlloc *alloc, BSLCompileStats *stats)
+{
+  if (stats == NULL)
+  {
+    return;
+  }
+  wrap->inner = *alloc;
+  wrap->stats = stats;
+  alloc->fn = stats_alloc_fn;
+  alloc->ud = wrap;
+}
+
+void stats_unwrap(BSLAlloc *alloc)
+{
+  if (alloc->fn == stats_alloc_fn)
+  {
+    *alloc = ((StatsAlloc *) alloc->ud)->inner;
+  }
+}
+
+BSLCompileStats *stats_of(BSLAlloc *alloc)
+{
+  return alloc->fn == stats_alloc_fn ? ((StatsAlloc *) alloc->ud)->stats : NULL;
+}
+
+void *stats_new(BSLAlloc *alloc, size_t size, BSLNodeKind kind)
+{
+  BSLCompileStats *stats = stats_of(alloc);
+  STATS_ADD(stats, nodes[kind], 1);
+  STATS_ADD(stats, node_bytes[kind], size);
+  return alloc->fn(NULL, 0, size, alloc->ud);
+}
+
+static void *stats_alloc_fn(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  StatsAlloc *wrap = ud;
+  if (nsz > 0)
+  {
+    wrap->stats->alloc_calls++;
+  }
+  if (nsz > osz)
+  {
+    wrap->stats->bytes_requested += nsz - osz;
+    wrap->stats->bytes_current += nsz - osz;
+    if (wrap->stats->bytes_current > wrap->stats->bytes_peak)
+    {
+      wrap->stats->bytes_peak = wrap->stats->bytes_current;
+    }
+  } else
+  {
+    wrap->stats->bytes_current -= osz - nsz;
+  }
+  return wrap->inner.fn(ptr, osz, nsz, wrap->inner.ud);
+}
+
+#endif
+
+static size_t hash_ptr(const void *ptr)
+{
+  return (size_t) (((uint64_t) (uintptr_t) ptr >> 4) * 0x9e3779b97f4a7c15ull);
+}
+
+static void track_add(TrackAlloc *track, const void *ptr, size_t size)
+{
+  if ((track->count + 1) * 2 > track->cap)
+  {
+    TrackAlloc grown = {
+      .inner = track->inner,
+      .cap = track->cap == 0 ? 256 : track->cap * 2,
+    };
+    grown.slots = grown.inner.fn(NULL, 0, grown.cap * sizeof(TrackSlot),
+        grown.inner.ud);
+    memset(grown.slots, 0, grown.cap * sizeof(TrackSlot));
+    for (size_t i = 0; i < track->cap; i++)
+    {
+      if (track->slots[i].ptr != NULL)
+      {
+        track_add(&grown, track->slots[i].ptr, track->slots[i].size);
+      }
+    }
+    if (track->cap > 0)
+    {
+      track->inner.fn(track->slots, track->cap * sizeof(TrackSlot), 0,
+          track->inner.ud);
+    }
+    *track = grown;
+  }
+
+  size_t mask = track->cap - 1;
+  size_t i = hash_ptr(ptr) & mask;
+  while (track->slots[i].ptr != NULL)
+  {
+    i = (i + 1) & mask;
+  }
+  track->slots[i].ptr = ptr;
+  track->slots[i].size = size;
+  track->count++;
+}
+
+static void *track_alloc_fn(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  TrackAlloc *track = ud;
+  track_forget(track, ptr);
+  void *out = track->inner.fn(ptr, osz, nsz, track->inner.ud);
+  if (out != NULL && nsz > 0)
+  {
+    track_add(track, out, nsz);
+  }
+  return out;
+}
+
+/* FNV-1a. */
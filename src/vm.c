@@ -0,0 +1,827 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include <bsl/vm.h>
+#include <bsl/eval.h>
+#include <bsl/module.h>
+
+typedef struct
+{
+  BSLAlloc *alloc;
+  BSLCompileResult *result;
+  Toplevel *proc;
+  BSLProgram *program;
+  /* Registers of the proc's variables, by VarEntry index. */
+  int *slots;
+  size_t top;
+} VMCompiler;
+
+/* An expression being compiled: where its registers start, the vector or
+ * record it builds, and the results of the operands it still has to
+ * combine. Constants and members of parameters an operation takes are
+ * only loaded once the operation is reached, so they hold no register
+ * while its other operands compile. */
+typedef struct
+{
+  size_t start;
+  int dst;
+  size_t offset;
+  int operands[3];
+  Expr *deferred[3];
+  size_t operand_count;
+} VMFrame;
+
+#if defined(__SSE__)
+#define VEC_OP(_d, _a, _b, _sse, _op) \
+  _mm_store_ps(_d, _sse(_mm_load_ps(_a), _mm_load_ps(_b)))
+#define VEC_OP_BX(_d, _a, _b, _sse, _op) \
+  _mm_store_ps(_d, _sse(_mm_load_ps(_a), _mm_set1_ps((_b)[0])))
+#define VEC_OP_AX(_d, _a, _b, _sse, _op) \
+  _mm_store_ps(_d, _sse(_mm_set1_ps((_a)[0]), _mm_load_ps(_b)))
+#else
+#define VEC_OP(_d, _a, _b, _sse, _op) \
+  for (int i = 0; i < 4; i++) (_d)[i] = (_a)[i] _op (_b)[i]
+#define VEC_OP_BX(_d, _a, _b, _sse, _op) \
+  { float _s = (_b)[0]; for (int i = 0; i < 4; i++) (_d)[i] = (_a)[i] _op _s; }
+#define VEC_OP_AX(_d, _a, _b, _sse, _op) \
+  { float _s = (_a)[0]; for (int i = 0; i < 4; i++) (_d)[i] = _s _op (_b)[i]; }
+#endif
+
+/* Fused multiply-adds round once on every path, so results do not depend
+ * on the CPU. Without the instructions fmaf does it in software. */
+#if defined(__GNUC__) && defined(__x86_64__)
+#if !defined(__FMA__)
+__attribute__((target("fma")))
+#endif
+static inline void fma_fused(float *d, const float *a, __m128 b)
+{
+  _mm_store_ps(d, _mm_fmadd_ps(_mm_load_ps(a), b, _mm_load_ps(d)));
+}
+#endif
+
+#if defined(__FMA__)
+#define VEC_FMA(_d, _a, _b, _fused) \
+  fma_fused(_d, _a, _mm_load_ps(_b))
+#define VEC_FMA_BX(_d, _a, _b, _fused) \
+  fma_fused(_d, _a, _mm_set1_ps((_b)[0]))
+#elif defined(__GNUC__) && defined(__x86_64__)
+#define VEC_FMA(_d, _a, _b, _fused) \
+  if (_fused) fma_fused(_d, _a, _mm_load_ps(_b)); \
+  else for (int i = 0; i < 4; i++) (_d)[i] = fmaf((_a)[i], (_b)[i], (_d)[i])
+#define VEC_FMA_BX(_d, _a, _b, _fused) \
+  if (_fused) fma_fused(_d, _a, _mm_set1_ps((_b)[0])); \
+  else for (int i = 0; i < 4; i++) (_d)[i] = fmaf((_a)[i], (_b)[0], (_d)[i])
+#else
+#define VEC_FMA(_d, _a, _b, _fused) \
+  for (int i = 0; i < 4; i++) (_d)[i] = fmaf((_a)[i], (_b)[i], (_d)[i])
+#define VEC_FMA_BX(_d, _a, _b, _fused) \
+  for (int i = 0; i < 4; i++) (_d)[i] = fmaf((_a)[i], (_b)[0], (_d)[i])
+#endif
+
+/* === PROTOTYPES === */
+
+static size_t type_regs(Type *type);
+static size_t type_components(Type *type);
+static int param_index(Toplevel *proc, VarEntry *entry);
+static bool emit(VMCompiler *c, Opcode op, int dst, int a, int b);
+static int alloc_regs(VMCompiler *c, size_t count);
+static int add_const(VMCompiler *c, float value);
+static int compile_expr(VMCompiler *c, Expr *expr);
+static bool enter_expr(VMCompiler *c, ExprWalk *walk, Expr *expr,
+    VMFrame *frame);
+static int leave_expr(VMCompiler *c, Expr *expr, VMFrame *frame);
+static bool defers(Expr *parent, Expr *expr, VMFrame *frame);
+static bool load_deferred(VMCompiler *c, VMFrame *frame);
+static void take_operand(VMCompiler *c, const ExprVisit *parent,
+    VMFrame *frame, Expr *operand, int src);
+static bool compile_return(VMCompiler *c, Statement *stmt);
+static bool compile_proc(VMCompiler *c);
+
+/* === PUBLIC FUNCTIONS === */
+
+bool bsl_vm_compile(BSLModule *module, const char *entry_point,
+    BSLProgram **program_out, BSLCompileResult *result)
+{
+  Toplevel *proc = eval_find_entry_point(&module->ast, entry_point,
+      ENTRY_POINT_VERTEX | ENTRY_POINT_FRAGMENT, result);
+  if (proc == NULL)
+  {
+    return false;
+  }
+
+  BSLProgram *program = BSL_NEW(&module->alloc, BSLProgram);
+  program->alloc = &module->alloc;
+  program->code = NULL;
+  program->code_len = 0;
+  program->code_cap = 0;
+  program->consts = NULL;
+  program->const_count = 0;
+  program->const_cap = 0;
+  program->reg_count = 0;
+  program->param_count = 0;
+
+  VMCompiler c = {
+    .alloc = &module->alloc,
+    .result = result,
+    .proc = proc,
+    .program = program,
+    .top = 0,
+  };
+
+  size_t slots_size = proc->proc.scope.entry_count * sizeof(int);
+  c.slots = module->alloc.fn(NULL, 0, slots_size, module->alloc.ud);
+  bool ok = compile_proc(&c);
+  module->alloc.fn(c.slots, slots_size, 0, module->alloc.ud);
+  if (!ok)
+  {
+    bsl_vm_free(program);
+    return false;
+  }
+
+  *program_out = program;
+  return true;
+}
+
+void bsl_vm_free(BSLProgram *program)
+{
+  BSLAlloc *alloc = program->alloc;
+  alloc->fn(program->code, program->code_cap * sizeof(Instr), 0, alloc->ud);
+  alloc->fn(program->consts, program->const_cap * sizeof(float), 0,
+      alloc->ud);
+  alloc->fn(program, sizeof(BSLProgram), 0, alloc->ud);
+}
+
+size_t bsl_vm_output_size(const BSLProgram *program)
+{
+  return program->output_size;
+}
+
+void bsl_vm_run(const BSLProgram *program, const float *const *inputs,
+    float *output)
+{
+  _Alignas(16) float regs[VM_MAX_REGS][4];
+  const Instr *ip = program->code;
+  const float *consts = program->consts;
+  bool fused = cpu_has_fma();
+  (void) fused;
+  Instr in;
+
+#if defined(__GNUC__)
+  static const void *dispatch[OP_COUNT] = {
+    [OP_CONST] = &&op_const,
+    [OP_MOV] = &&op_mov,
+    [OP_INSERT] = &&op_insert,
+    [OP_LOAD] = &&op_load,
+    [OP_STORE] = &&op_store,
+    [OP_ADD] = &&op_add,
+    [OP_SUB] = &&op_sub,
+    [OP_MUL] = &&op_mul,
+    [OP_DIV] = &&op_div,
+    [OP_MULS] = &&op_muls,
+    [OP_DIVS] = &&op_divs,
+    [OP_SDIV] = &&op_sdiv,
+    [OP_FMA] = &&op_fma,
+    [OP_FMAS] = &&op_fmas,
+    [OP_RET] = &&op_ret,
+  };
+#define CASE(_op, _label) _label
+#define NEXT() in = *ip++; goto *dispatch[in.op]
+  NEXT();
+#else
+#define CASE(_op, _label) case _op
+#define NEXT() break
+  for (;;)
+  {
+    in = *ip++;
+    switch (in.op)
+    {
+#endif
+
+  CASE(OP_CONST, op_const): {
+    float v = consts[in.a | in.b << 8];
+    regs[in.dst][0] = regs[in.dst][1] = regs[in.dst][2] = regs[in.dst][3] = v;
+    NEXT();
+  }
+  CASE(OP_MOV, op_mov):
+    memcpy(regs[in.dst], regs[in.a], sizeof(regs[0]));
+    NEXT();
+  CASE(OP_INSERT, op_insert):
+    memcpy(&regs[in.dst][in.b & 3], regs[in.a], (in.b >> 2) * sizeof(float));
+    NEXT();
+  CASE(OP_LOAD, op_load):
+    memcpy(regs[in.dst], inputs[in.a] + in.b * 4, sizeof(regs[0]));
+    NEXT();
+  CASE(OP_STORE, op_store):
+    memcpy(output + in.dst * 4, regs[in.a], sizeof(regs[0]));
+    NEXT();
+  CASE(OP_ADD, op_add):
+    VEC_OP(regs[in.dst], regs[in.a], regs[in.b], _mm_add_ps, +);
+    NEXT();
+  CASE(OP_SUB, op_sub):
+    VEC_OP(regs[in.dst], regs[in.a], regs[in.b], _mm_sub_ps, -);
+    NEXT();
+  CASE(OP_MUL, op_mul):
+    VEC_OP(regs[in.dst], regs[in.a], regs[in.b], _mm_mul_ps, *);
+    NEXT();
+  CASE(OP_DIV, op_div):
+    VEC_OP(regs[in.dst], regs[in.a], regs[in.b], _mm_div_ps, /);
+    NEXT();
+  CASE(OP_MULS, op_muls):
+    VEC_OP_BX(regs[in.dst], regs[in.a], regs[in.b], _mm_mul_ps, *);
+    NEXT();
+  CASE(OP_DIVS, op_divs):
+    VEC_OP_BX(regs[in.dst], regs[in.a], regs[in.b], _mm_div_ps, /);
+    NEXT();
+  CASE(OP_SDIV, op_sdiv):
+    VEC_OP_AX(regs[in.dst], regs[in.a], regs[in.b], _mm_div_ps, /);
+    NEXT();
+  CASE(OP_FMA, op_fma):
+    VEC_FMA(regs[in.dst], regs[in.a], regs[in.b], fused);
+    NEXT();
+  CASE(OP_FMAS, op_fmas):
+    VEC_FMA_BX(regs[in.dst], regs[in.a], regs[in.b], fused);
+    NEXT();
+  CASE(OP_RET, op_ret):
+    return;
+
+#if !defined(__GNUC__)
+    }
+  }
+#endif
+#undef CASE
+#undef NEXT
+}
+
+/* === PRIVATE FUNCTIONS === */
+
+static size_t type_regs(Type *type)
+{
+  switch (type->t)
+  {
+    case TYPE_F32:
+      return 1;
+    case TYPE_VECTOR:
+      return type->vec.type->t == TYPE_F32 ? 1 : 0;
+    case TYPE_RECORD: {
+      RecordEntry *iter = type->record.entries;
+      while (iter != NULL)
+      {
+        if (iter->type->t == TYPE_RECORD || type_regs(iter->type) == 0)
+        {
+          return 0;
+        }
+        iter = iter->next;
+      }
+      return type->record.toplevel->record.entry_count;
+    }
+    default:
+      return 0;
+  }
+}
+
+static size_t type_components(Type *type)
+{
+  return type->t == TYPE_VECTOR ? type->vec.size : 1;
+}
+
+/* Parameters are kept in reverse declaration order. */
+static int param_index(Toplevel *proc, VarEntry *entry)
+{
+  int index = -1, count = 0;
+  Parameter *iter = proc->proc.params;
+  while (iter != NULL)
+  {
+    if (iter->entry == entry)
+    {
+      index = count;
+    }
+    count++;
+    iter = iter->next;
+  }
+  return index < 0 ? -1 : count - 1 - index;
+}
+
+static bool emit(VMCompiler *c, Opcode op, int dst, int a, int b)
+{
+  BSLProgram *program = c->program;
+  if (program->code_len == program->code_cap)
+  {
+    size_t cap = program->code_cap == 0 ? 64 : program->code_cap * 2;
+    program->code = c->alloc->fn(program->code,
+        program->code_cap * sizeof(Instr), cap * sizeof(Instr), c->alloc->ud);
+    program->code_cap = cap;
+  }
+
+  Instr *in = &program->code[program->code_len++];
+  in->op = op;
+  in->dst = dst;
+  in->a = a;
+  in->b = b;
+  return true;
+}
+
+static int alloc_regs(VMCompiler *c, size_t count)
+{
+  if (c->top + count > VM_MAX_REGS)
+  {
+    result_error(c->result, c->proc->line, c->proc->col,
+        "procedure needs more than %d registers", VM_MAX_REGS);
+    return -1;
+  }
+
+  int base = c->top;
+  c->top += count;
+  if (c->top > c->program->reg_count)
+  {
+    c->program->reg_count = c->top;
+  }
+  return base;
+}
+
+static int add_const(VMCompiler *c, float value)
+{
+  BSLProgram *program = c->program;
+  for (size_t i = 0; i < program->const_count; i++)
+  {
+    if (memcmp(&program->consts[i], &value, sizeof(float)) == 0)
+    {
+      return i;
+    }
+  }
+
+  if (program->const_count == 1 << 16)
+  {
+    result_error(c->result, c->proc->line, c->proc->col,
+        "procedure has too many constants");
+    return -1;
+  }
+
+  if (program->const_count == program->const_cap)
+  {
+    size_t cap = program->const_cap == 0 ? 16 : program->const_cap * 2;
+    program->consts = c->alloc->fn(program->consts,
+        program->const_cap * sizeof(float), cap * sizeof(float), c->alloc->ud);
+    program->const_cap = cap;
+  }
+  program->consts[program->const_count] = value;
+  return program->const_count++;
+}
+
+/* Compiles in postorder over a stack of frames rather than by recursion,
+ * so the depth of an expression costs no native stack. Once an expression
+ * has its operands its temporaries are free again, and a fresh result
+ * takes the lowest free register at the time the expression started, so
+ * registers go as deep as the expression branches rather than as deep as
+ * it nests. */
+static int compile_expr(VMCompiler *c, Expr *expr)
+{
+  VMFrame inline_frames[EXPR_WALK_INLINE];
+  VMFrame *frames = inline_frames;
+  size_t count = 0, cap = EXPR_WALK_INLINE;
+  int result = -1;
+  ExprWalk walk;
+  expr_walk_init(&walk, c->alloc, expr);
+  bool leaving;
+  while ((expr = expr_walk_next(&walk, &leaving)) != NULL)
+  {
+    if (!leaving)
+    {
+      if (count == cap)
+      {
+        VMFrame *grown = c->alloc->fn(NULL, 0, cap * 2 * sizeof(VMFrame),
+            c->alloc->ud);
+        memcpy(grown, frames, count * sizeof(VMFrame));
+        if (frames != inline_frames)
+        {
+          c->alloc->fn(frames, cap * sizeof(VMFrame), 0, c->alloc->ud);
+        }
+        frames = grown;
+        cap *= 2;
+      }
+      if (!enter_expr(c, &walk, expr, &frames[count++]))
+      {
+        expr_walk_release(&walk);
+        break;
+      }
+      continue;
+    }
+
+    VMFrame *frame = &frames[--count];
+    const ExprVisit *parent = expr_walk_parent(&walk);
+    if (parent != NULL && defers(parent->expr, expr, frame))
+    {
+      VMFrame *up = &frames[count - 1];
+      up->deferred[up->operand_count] = expr;
+      up->operands[up->operand_count++] = -1;
+      continue;
+    }
+
+    int src = leave_expr(c, expr, frame);
+    if (src < 0)
+    {
+      expr_walk_release(&walk);
+      break;
+    } else if (parent == NULL)
+    {
+      result = src;
+    } else
+    {
+      take_operand(c, parent, &frames[count - 1], expr, src);
+    }
+  }
+
+  if (frames != inline_frames)
+  {
+    c->alloc->fn(frames, cap * sizeof(VMFrame), 0, c->alloc->ud);
+  }
+  return result;
+}
+
+/* Vectors and records take their registers up front and fill them in as
+ * their operands come; entries a record leaves out are zero. */
+static bool enter_expr(VMCompiler *c, ExprWalk *walk, Expr *expr,
+    VMFrame *frame)
+{
+  if (type_regs(expr->type) == 0)
+  {
+    result_error(c->result, expr->line, expr->col,
+        "expression type is not supported by the VM");
+    return false;
+  }
+
+  frame->start = c->top;
+  frame->dst = -1;
+  frame->offset = 0;
+  frame->operand_count = 0;
+  switch (expr->t)
+  {
+    case EXPR_MEMBER: {
+      /* Members of parameters load on their own. */
+      Expr *lhs = expr->member.lhs;
+      if (lhs->t == EXPR_VAR && param_index(c->proc, lhs->var.entry) >= 0)
+      {
+        expr_walk_skip(walk);
+      }
+      return true;
+    }
+    case EXPR_VECTOR:
+      frame->dst = alloc_regs(c, 1);
+      return frame->dst >= 0;
+    case EXPR_RECORD: {
+      frame->dst = alloc_regs(c, type_regs(expr->type));
+      int zero = add_const(c, 0.0f);
+      if (frame->dst < 0 || zero < 0)
+      {
+        return false;
+      }
+
+      RecordEntry *entry = expr->type->record.entries;
+      while (entry != NULL)
+      {
+        RecordExprMember *member = expr->record.members;
+        while (member != NULL && member->entry != entry)
+        {
+          member = member->next;
+        }
+        if (member == NULL)
+        {
+          emit(c, OP_CONST, frame->dst + entry->index, zero & 0xFF,
+              zero >> 8);
+        }
+        entry = entry->next;
+      }
+      return true;
+    }
+    default:
+      return true;
+  }
+}
+
+static int leave_expr(VMCompiler *c, Expr *expr, VMFrame *frame)
+{
+  int *operands = frame->operands;
+  switch (expr->t)
+  {
+    case EXPR_VAR: {
+      int param = param_index(c->proc, expr->var.entry);
+      if (param < 0)
+      {
+        return c->slots[expr->var.entry->index];
+      }
+
+      size_t count = type_regs(expr->type);
+      int base = alloc_regs(c, count);
+      if (base < 0)
+      {
+        return -1;
+      }
+      for (size_t i = 0; i < count; i++)
+      {
+        emit(c, OP_LOAD, base + i, param, expr->type->t == TYPE_RECORD ? i : 0);
+      }
+      return base;
+    }
+    case EXPR_MEMBER: {
+      Expr *lhs = expr->member.lhs;
+      if (frame->operand_count == 0)
+      {
+        int dst = alloc_regs(c, 1);
+        if (dst < 0)
+        {
+          return -1;
+        }
+        emit(c, OP_LOAD, dst, param_index(c->proc, lhs->var.entry),
+            expr->member.entry->index);
+        return dst;
+      }
+      return operands[0] + expr->member.entry->index;
+    }
+    case EXPR_NUM: {
+      int dst = alloc_regs(c, 1);
+      int k = add_const(c, expr->num.t == NUMBER_INT ?
+          (float) expr->num.i : (float) expr->num.f);
+      if (dst < 0 || k < 0)
+      {
+        return -1;
+      }
+      emit(c, OP_CONST, dst, k & 0xFF, k >> 8);
+      return dst;
+    }
+    case EXPR_BINARY: {
+      if (!load_deferred(c, frame))
+      {
+        return -1;
+      }
+      int a = operands[0], b = operands[1];
+      c->top = frame->start;
+      int dst = alloc_regs(c, 1);
+      if (dst < 0)
+      {
+        return -1;
+      }
+
+      bool lhs_vec = expr->binary.lhs->type->t == TYPE_VECTOR;
+      bool rhs_vec = expr->binary.rhs->type->t == TYPE_VECTOR;
+      static const Opcode ops[] = {
+        [BINOP_ADD] = OP_ADD,
+        [BINOP_SUB] = OP_SUB,
+        [BINOP_MUL] = OP_MUL,
+        [BINOP_DIV] = OP_DIV,
+      };
+      if (lhs_vec == rhs_vec)
+      {
+        emit(c, ops[expr->binary.op], dst, a, b);
+      } else if (lhs_vec)
+      {
+        emit(c, expr->binary.op == BINOP_MUL ? OP_MULS : OP_DIVS, dst, a, b);
+      } else if (expr->binary.op == BINOP_MUL)
+      {
+        emit(c, OP_MULS, dst, b, a);
+      } else
+      {
+        emit(c, OP_SDIV, dst, a, b);
+      }
+      return dst;
+    }
+    case EXPR_FMA: {
+      if (!load_deferred(c, frame))
+      {
+        return -1;
+      }
+      int a = operands[0], b = operands[1], addend = operands[2];
+      size_t end = c->top;
+      c->top = frame->start;
+      int dst = alloc_regs(c, 1);
+      if (dst < 0)
+      {
+        return -1;
+      }
+
+      /* The sum accumulates where the addend is, so when a product
+       * operand holds the result register it goes elsewhere: into the
+       * addend when that is a temporary, above the operands otherwise. */
+      int acc = dst;
+      if ((a == dst || b == dst) && addend >= (int) frame->start)
+      {
+        acc = addend;
+      } else if (a == dst || b == dst)
+      {
+        c->top = end;
+        acc = alloc_regs(c, 1);
+        c->top = dst + 1;
+        if (acc < 0)
+        {
+          return -1;
+        }
+      }
+
+      bool lhs_vec = expr->fma.lhs->type->t == TYPE_VECTOR;
+      bool rhs_vec = expr->fma.rhs->type->t == TYPE_VECTOR;
+      if (addend != acc)
+      {
+        emit(c, OP_MOV, acc, addend, 0);
+      }
+      if (lhs_vec == rhs_vec)
+      {
+        emit(c, OP_FMA, acc, a, b);
+      } else if (lhs_vec)
+      {
+        emit(c, OP_FMAS, acc, a, b);
+      } else
+      {
+        emit(c, OP_FMAS, acc, b, a);
+      }
+      if (acc != dst)
+      {
+        emit(c, OP_MOV, dst, acc, 0);
+      }
+      return dst;
+    }
+    case EXPR_VECTOR:
+    case EXPR_RECORD:
+      return frame->dst;
+    default:
+      return -1;
+  }
+}
+
+static bool defers(Expr *parent, Expr *expr, VMFrame *frame)
+{
+  if (parent->t != EXPR_BINARY && parent->t != EXPR_FMA)
+  {
+    return false;
+  }
+  return expr->t == EXPR_NUM ||
+    (expr->t == EXPR_MEMBER && frame->operand_count == 0);
+}
+
+static bool load_deferred(VMCompiler *c, VMFrame *frame)
+{
+  for (size_t i = 0; i < frame->operand_count; i++)
+  {
+    if (frame->operands[i] < 0)
+    {
+      VMFrame leaf = { .start = c->top, .dst = -1 };
+      frame->operands[i] = leave_expr(c, frame->deferred[i], &leaf);
+      if (frame->operands[i] < 0)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/* Vector elements and record members go to their place as soon as they
+ * are compiled, after which their temporaries are free again. */
+static void take_operand(VMCompiler *c, const ExprVisit *parent,
+    VMFrame *frame, Expr *operand, int src)
+{
+  switch (parent->expr->t)
+  {
+    case EXPR_VECTOR: {
+      size_t comps = type_components(operand->type);
+      emit(c, OP_INSERT, frame->dst, src, frame->offset | comps << 2);
+      frame->offset += comps;
+      c->top = frame->dst + 1;
+      break;
+    }
+    case EXPR_RECORD:
+      emit(c, OP_MOV, frame->dst + parent->member->entry->index, src, 0);
+      c->top = frame->dst + type_regs(parent->expr->type);
+      break;
+    default:
+      frame->operands[frame->operand_count++] = src;
+      break;
+  }
+}
+
+static bool compile_return(VMCompiler *c, Statement *stmt)
+{
+  Expr *expr = stmt->ret.expr;
+  if (expr->t == EXPR_RECORD)
+  {
+    /* Store members straight to the output instead of building the record
+     * in registers first. */
+    RecordEntry *entry = expr->type->record.entries;
+    while (entry != NULL)
+    {
+      RecordExprMember *member = expr->record.members;
+      while (member != NULL && member->entry != entry)
+      {
+        member = member->next;
+      }
+
+      size_t top = c->top;
+      int src;
+      if (member == NULL)
+      {
+        src = alloc_regs(c, 1);
+        int zero = add_const(c, 0.0f);
+        if (src < 0 || zero < 0)
+        {
+          return false;
+        }
+        emit(c, OP_CONST, src, zero & 0xFF, zero >> 8);
+      } else
+      {
+        src = compile_expr(c, member->expr);
+        if (src < 0)
+        {
+          return false;
+        }
+      }
+
+      emit(c, OP_STORE, entry->index, src, 0);
+      c->top = top;
+      entry = entry->next;
+    }
+  } else
+  {
+    int src = compile_expr(c, expr);
+    if (src < 0)
+    {
+      return false;
+    }
+
+    size_t count = expr->type->t == TYPE_RECORD ? type_regs(expr->type) : 1;
+    for (size_t i = 0; i < count; i++)
+    {
+      emit(c, OP_STORE, i, src + i, 0);
+    }
+  }
+
+  return emit(c, OP_RET, 0, 0, 0);
+}
+
+static bool compile_proc(VMCompiler *c)
+{
+  Toplevel *proc = c->proc;
+  Parameter *param = proc->proc.params;
+  while (param != NULL)
+  {
+    if (type_regs(param->type) == 0)
+    {
+      result_error(c->result, param->line, param->col,
+          "type of parameter '%.*s' is not supported by the VM",
+          param->name_len, param->name);
+      return false;
+    }
+    c->program->param_count++;
+    param = param->next;
+  }
+
+  Type *ret = proc->proc.return_type;
+  if (type_regs(ret) == 0)
+  {
+    result_error(c->result, proc->line, proc->col,
+        "return type is not supported by the VM");
+    return false;
+  }
+  c->program->output_size = 4 * (ret->t == TYPE_RECORD ? type_regs(ret) : 1);
+
+  Statement *stmt = proc->proc.stmts;
+  while (stmt != NULL)
+  {
+    switch (stmt->t)
+    {
+      case STATEMENT_VAR: {
+        size_t base = c->top;
+        size_t count = type_regs(stmt->var.type);
+        int src = compile_expr(c, stmt->var.expr);
+        if (src < 0)
+        {
+          return false;
+        }
+
+        /* A fresh result already sits at the base, otherwise copy it. */
+        if (src != (int) base)
+        {
+          c->top = base;
+          if (alloc_regs(c, count) < 0)
+          {
+            return false;
+          }
+          for (size_t i = 0; i < count; i++)
+          {
+            emit(c, OP_MOV, base + i, src + i, 0);
+          }
+        }
+        c->slots[stmt->var.entry->index] = (int) base;
+        c->top = base + count;
+        break;
+      }
+      case STATEMENT_RETURN:
+        return compile_return(c, stmt);
+    }
+    stmt = stmt->next;
+  }
+
+  return emit(c, OP_RET, 0, 0, 0);
+}
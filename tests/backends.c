@@ -0,0 +1,288 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bsl.h>
+
+/* More live vectors than the JIT has registers for, so some are spilled,
+ * and products added up for contraction to fuse. */
+#define LIVE 24
+#define VERTICES 4
+
+static void *test_alloc(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  (void) osz;
+  (void) ud;
+  if (nsz == 0)
+  {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, nsz);
+}
+
+static char *spill_source(size_t *len)
+{
+  size_t cap = 256 * LIVE + 1024;
+  char *src = malloc(cap);
+  size_t n = (size_t) snprintf(src, cap,
+      "record In\n"
+      "  [input(0)] pos: vec3<f32>\n"
+      "  [input(1)] w: f32\n"
+      "end\n"
+      "record Out\n"
+      "  [builtin(position)] pos: vec4<f32>\n"
+      "  [output(0)] col: vec3<f32>\n"
+      "end\n"
+      "[entry_point(vertex)]\n"
+      "proc vs(v: In) Out\n");
+  for (int i = 0; i < LIVE; i++)
+  {
+    n += (size_t) snprintf(src + n, cap - n,
+        "  var a%d = v.pos * %d.0 + {v.w, %d.5, 2.0}\n", i, i + 1, i);
+  }
+  n += (size_t) snprintf(src + n, cap - n, "  var s = a0");
+  for (int i = 1; i < LIVE; i++)
+  {
+    n += (size_t) snprintf(src + n, cap - n, " + a%d", i);
+  }
+  n += (size_t) snprintf(src + n, cap - n,
+      "\n  var t = a0 * a%d - a5 / a7\n"
+      "  return record Out .pos = {s, v.w / 3.0},\n"
+      "    .col = {v.w - 1.0, v.w * v.w, 3.0 / v.w} + t, end\n"
+      "end\n", LIVE - 1);
+  *len = n;
+  return src;
+}
+
+/* What the shader computes, in the same order. */
+static void reference(const float *pos, float w, float *out_pos,
+    float *out_col)
+{
+  float a[LIVE][3];
+  for (int i = 0; i < LIVE; i++)
+  {
+    const float add[3] = {w, i + 0.5f, 2.0f};
+    for (int c = 0; c < 3; c++)
+    {
+      a[i][c] = pos[c] * (float) (i + 1) + add[c];
+    }
+  }
+  const float col[3] = {w - 1.0f, w * w, 3.0f / w};
+  for (int c = 0; c < 3; c++)
+  {
+    float s = a[0][c];
+    for (int i = 1; i < LIVE; i++)
+    {
+      s += a[i][c];
+    }
+    out_pos[c] = s;
+    out_col[c] = col[c] + (a[0][c] * a[LIVE - 1][c] - a[5][c] / a[7][c]);
+  }
+  out_pos[3] = w / 3.0f;
+}
+
+static bool close_to(float got, float expected)
+{
+  return fabsf(got - expected) <= 1e-4f * fmaxf(1.0f, fabsf(expected));
+}
+
+static bool check(const char *what, int vertex, const float *pos,
+    const float *col, const float *expected_pos, const float *expected_col)
+{
+  bool ok = true;
+  for (int c = 0; c < 4; c++)
+  {
+    ok = ok && close_to(pos[c], expected_pos[c]);
+  }
+  for (int c = 0; c < 3; c++)
+  {
+    ok = ok && close_to(col[c], expected_col[c]);
+  }
+  if (!ok)
+  {
+    fprintf(stderr, "%s: vertex %d: got pos {%g, %g, %g, %g} col "
+        "{%g, %g, %g}\n", what, vertex, pos[0], pos[1], pos[2], pos[3],
+        col[0], col[1], col[2]);
+  }
+  return ok;
+}
+
+static bool run_vertex(const char *what, BSLModule *module)
+{
+  float pos_in[VERTICES][3], w_in[VERTICES];
+  float expected_pos[VERTICES][4], expected_col[VERTICES][3];
+  for (int v = 0; v < VERTICES; v++)
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      pos_in[v][c] = 0.25f * (float) (v + 1) + 0.125f * (float) c;
+    }
+    w_in[v] = 1.5f + (float) v;
+    reference(pos_in[v], w_in[v], expected_pos[v], expected_col[v]);
+  }
+
+  BSLCompileResult result = {0};
+  BSLProgram *program;
+  if (!bsl_vm_compile(module, "vs", &program, &result))
+  {
+    fprintf(stderr, "%s: vm: %s\n", what, result.msg);
+    return false;
+  }
+  BSLJitFn fn = NULL;
+  bool jit = bsl_jit_compile(program, &fn, &result);
+
+  /* Records take four floats per entry, here pos then w, and pos then
+   * col out. */
+  bool ok = true;
+  for (int v = 0; v < VERTICES; v++)
+  {
+    float input[8] = {0};
+    memcpy(input, pos_in[v], sizeof(pos_in[v]));
+    input[4] = w_in[v];
+    const float *inputs[1] = {input};
+    float output[8];
+    memset(output, 0, sizeof(output));
+    bsl_vm_run(program, inputs, output);
+    ok = check("vm", v, output, output + 4, expected_pos[v],
+        expected_col[v]) && ok;
+
+    float jit_output[8];
+    memset(jit_output, 0, sizeof(jit_output));
+    if (jit)
+    {
+      fn(inputs, jit_output);
+      ok = check("jit", v, jit_output, jit_output + 4, expected_pos[v],
+          expected_col[v]) && ok;
+      ok = ok && memcmp(output, jit_output, 4 * sizeof(float)) == 0 &&
+        memcmp(output + 4, jit_output + 4, 3 * sizeof(float)) == 0;
+    }
+  }
+  if (jit)
+  {
+    bsl_jit_free(fn);
+  }
+  bsl_vm_free(program);
+
+  float pos_out[VERTICES][4], col_out[VERTICES][3];
+  memset(pos_out, 0, sizeof(pos_out));
+  memset(col_out, 0, sizeof(col_out));
+  BSLVertexInput inputs[2] = {
+    {0, 3, &pos_in[0][0]},
+    {1, 1, w_in},
+  };
+  BSLVertexOutput outputs[2] = {
+    {BSL_LOCATION_POSITION, 4, &pos_out[0][0]},
+    {0, 3, &col_out[0][0]},
+  };
+  if (!bsl_eval_vertex(module, "vs", inputs, 2, outputs, 2, VERTICES,
+        &result))
+  {
+    fprintf(stderr, "%s: eval: %s\n", what, result.msg);
+    return false;
+  }
+  for (int v = 0; v < VERTICES; v++)
+  {
+    ok = check("eval", v, pos_out[v], col_out[v], expected_pos[v],
+        expected_col[v]) && ok;
+  }
+  if (!ok)
+  {
+    fprintf(stderr, "%s: backends disagree\n", what);
+  }
+  return ok;
+}
+
+/* Interpolated inputs and the clip position reach a fragment shader. */
+static bool run_fragment(void)
+{
+  static const char src[] =
+    "record FragIn\n"
+    "  [input(0)] uv: vec2<f32>\n"
+    "  [builtin(position)] p: vec4<f32>\n"
+    "end\n"
+    "record FragOut\n"
+    "  [output(0)] color: vec4<f32>\n"
+    "end\n"
+    "[entry_point(fragment)]\n"
+    "proc fs(i: FragIn) FragOut\n"
+    "  return record FragOut .color = i.p + {i.uv * 2.0, 0.0, 0.0}, end\n"
+    "end\n";
+  BSLCompileInfo info = {
+    .internal_fn = test_alloc,
+    .src = (const uint8_t *) src,
+    .src_len = sizeof(src) - 1,
+  };
+  BSLCompileResult result = {0};
+  if (!bsl_compile(&info, &result))
+  {
+    fprintf(stderr, "fragment: %s\n", result.msg);
+    return false;
+  }
+
+  enum { WIDTH = 5, HEIGHT = 3 };
+  float color[WIDTH * HEIGHT * 4];
+  memset(color, 0, sizeof(color));
+  BSLFragmentInput input = {
+    .location = 0,
+    .components = 2,
+    .a = {0.5f, -1.0f},
+    .dx = {1.0f, 0.0f},
+    .dy = {0.0f, 0.25f},
+  };
+  BSLFragmentOutput output = {0, 4, color};
+  bool ok = bsl_eval_fragment(result.module, "fs", &input, 1, &output, 1,
+      WIDTH, HEIGHT, 2, &result);
+  if (!ok)
+  {
+    fprintf(stderr, "fragment: eval: %s\n", result.msg);
+  }
+  for (int y = 0; ok && y < HEIGHT; y++)
+  {
+    for (int x = 0; ok && x < WIDTH; x++)
+    {
+      const float *got = &color[(y * WIDTH + x) * 4];
+      float u = 0.5f + (x + 0.5f);
+      float v = -1.0f + 0.25f * (y + 0.5f);
+      ok = close_to(got[0], x + 0.5f + 2.0f * u) &&
+        close_to(got[1], y + 0.5f + 2.0f * v);
+      if (!ok)
+      {
+        fprintf(stderr, "fragment: pixel %d, %d: got {%g, %g}\n", x, y,
+            got[0], got[1]);
+      }
+    }
+  }
+  bsl_module_unload(result.module);
+  return ok;
+}
+
+int main(void)
+{
+  size_t len;
+  char *src = spill_source(&len);
+  bool ok = true;
+  for (int contract = 0; contract < 2; contract++)
+  {
+    const char *what = contract ? "contracted" : "plain";
+    BSLCompileInfo info = {
+      .internal_fn = test_alloc,
+      .src = (const uint8_t *) src,
+      .src_len = len,
+      .contract_fma = contract,
+    };
+    BSLCompileResult result = {0};
+    if (!bsl_compile(&info, &result))
+    {
+      fprintf(stderr, "%s: %d:%d: %s\n", what, result.line, result.col,
+          result.msg);
+      ok = false;
+      continue;
+    }
+    ok = run_vertex(what, result.module) && ok;
+    bsl_module_unload(result.module);
+  }
+  free(src);
+  return run_fragment() && ok ? 0 : 1;
+}
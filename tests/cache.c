@@ -0,0 +1,273 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bsl.h>
+
+static const char base_src[] =
+  "record Out\n"
+  "  [builtin(position)] pos: vec4<f32>\n"
+  "end\n";
+
+static const char main_src[] =
+  "import base\n"
+  "record In\n"
+  "  [input(0)] x: f32\n"
+  "end\n"
+  "[entry_point(vertex)]\n"
+  "proc vs(v: In) Out\n"
+  "  return record Out .pos = {v.x, v.x * 2.0, 0.0, 1.0}, end\n"
+  "end\n";
+
+/* K only takes part in constant arithmetic, so variants differing in it
+ * alone fold to the same code. */
+static const char variant_src[] =
+  "const K = 1.0\n"
+  "const M = 2.0\n"
+  "record In\n"
+  "  [input(0)] x: f32\n"
+  "end\n"
+  "record Out\n"
+  "  [builtin(position)] pos: vec4<f32>\n"
+  "end\n"
+  "[entry_point(vertex)]\n"
+  "proc vs(v: In) Out\n"
+  "  return record Out .pos = {v.x * (K - K + 2.0), v.x * M, 0.0, 1.0}, end\n"
+  "end\n";
+
+static void *test_alloc(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  (void) osz;
+  (void) ud;
+  if (nsz == 0)
+  {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, nsz);
+}
+
+static bool write_file(const char *dir, const char *name, const char *text)
+{
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+  {
+    return false;
+  }
+  bool ok = fputs(text, file) >= 0;
+  return fclose(file) == 0 && ok;
+}
+
+/* Entries and summaries, failing on a temporary left behind. */
+static int count_files(const char *dir)
+{
+  DIR *d = opendir(dir);
+  if (d == NULL)
+  {
+    return -1;
+  }
+  int count = 0;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL)
+  {
+    if (ent->d_name[0] == '.' && strncmp(ent->d_name, ".tmp", 4) == 0)
+    {
+      count = -1000;
+    } else if (ent->d_name[0] != '.')
+    {
+      count++;
+    }
+  }
+  closedir(d);
+  return count;
+}
+
+static void remove_dir(const char *dir)
+{
+  DIR *d = opendir(dir);
+  if (d == NULL)
+  {
+    return;
+  }
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL)
+  {
+    if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+    {
+      char path[4096];
+      snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+      unlink(path);
+    }
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+static void free_result(BSLCompileResult *result)
+{
+  if (result->output != NULL)
+  {
+    test_alloc((char *) result->output, result->output_len + 1, 0, NULL);
+  }
+  for (size_t i = 0; i < result->entry_hash_count; i++)
+  {
+    free((char *) result->entry_hashes[i].name);
+    free(result->entry_hashes[i].varyings);
+  }
+  free(result->entry_hashes);
+  if (result->module != NULL)
+  {
+    bsl_module_unload(result->module);
+  }
+}
+
+static bool check_cache(const char *dir)
+{
+  char cache_dir[4096], import_dir[4096];
+  snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dir);
+  snprintf(import_dir, sizeof(import_dir), "%s", dir);
+  if (!write_file(dir, "base.bsl", base_src))
+  {
+    fprintf(stderr, "could not write the imported module\n");
+    return false;
+  }
+
+  const char *import_dirs[1] = {import_dir};
+  BSLCompileInfo info = {
+    .internal_fn = test_alloc,
+    .src = (const uint8_t *) main_src,
+    .src_len = sizeof(main_src) - 1,
+    .backend = BSL_BACKEND_C,
+    .cache_dir = cache_dir,
+    .import_dirs = import_dirs,
+    .import_dir_count = 1,
+  };
+
+  BSLCompileResult miss = {0}, hit = {0};
+  if (!bsl_compile(&info, &miss) || miss.cache_hit)
+  {
+    fprintf(stderr, "first compile: %s\n", miss.msg);
+    return false;
+  }
+  /* The compile and the summary of base. */
+  bool ok = count_files(cache_dir) == 2;
+  if (!ok)
+  {
+    fprintf(stderr, "cache holds %d files\n", count_files(cache_dir));
+  }
+
+  if (!bsl_compile(&info, &hit) || !hit.cache_hit || hit.module != NULL)
+  {
+    fprintf(stderr, "second compile was not a hit: %s\n", hit.msg);
+    ok = false;
+  } else if (hit.output_len != miss.output_len ||
+      memcmp(hit.output, miss.output, miss.output_len) != 0 ||
+      hit.entry_hash_count != 1 || miss.entry_hash_count != 1 ||
+      memcmp(hit.entry_hashes[0].hash, miss.entry_hashes[0].hash,
+        BSL_HASH_LEN) != 0)
+  {
+    fprintf(stderr, "hit differs from the compile it replays\n");
+    ok = false;
+  }
+  free_result(&miss);
+  free_result(&hit);
+
+  /* An import that changed is a different compile. */
+  BSLCompileResult changed = {0};
+  if (ok && (!write_file(dir, "base.bsl", "# changed\nrecord Out\n"
+          "  [builtin(position)] pos: vec4<f32>\nend\n") ||
+        !bsl_compile(&info, &changed) || changed.cache_hit))
+  {
+    fprintf(stderr, "a changed import hit the cache: %s\n", changed.msg);
+    ok = false;
+  }
+  free_result(&changed);
+  return ok;
+}
+
+static bool check_variants(void)
+{
+  BSLCompileInfo info = {
+    .internal_fn = test_alloc,
+    .src = (const uint8_t *) variant_src,
+    .src_len = sizeof(variant_src) - 1,
+  };
+  const BSLConstant first[] = {{"K", 1.0f}, {"M", 2.0f}};
+  const BSLConstant same[] = {{"K", 5.0f}, {"M", 2.0f}};
+  const BSLConstant other[] = {{"K", 1.0f}, {"M", 3.0f}};
+  const BSLVariantInfo infos[3] = {
+    {first, 2},
+    {same, 2},
+    {other, 2},
+  };
+  BSLVariant variants[3];
+  BSLCompileResult result = {0};
+  if (!bsl_compile_variants(&info, infos, variants, 3, &result))
+  {
+    fprintf(stderr, "variants: %s\n", result.msg);
+    return false;
+  }
+
+  bool ok = variants[0].same_as == 0 && variants[1].same_as == 0 &&
+    variants[2].same_as == 2 && variants[1].module == variants[0].module;
+  if (!ok)
+  {
+    fprintf(stderr, "variants share as %zu, %zu, %zu\n", variants[0].same_as,
+        variants[1].same_as, variants[2].same_as);
+  }
+
+  const float input[4] = {0.5f};
+  const float *inputs[1] = {input};
+  for (size_t i = 0; ok && i < 3; i++)
+  {
+    BSLProgram *program;
+    float output[4];
+    if (!bsl_vm_compile(variants[i].module, "vs", &program, &result))
+    {
+      fprintf(stderr, "variant %zu: %s\n", i, result.msg);
+      ok = false;
+      break;
+    }
+    bsl_vm_run(program, inputs, output);
+    bsl_vm_free(program);
+    float m = i == 2 ? 3.0f : 2.0f;
+    if (output[0] != 1.0f || output[1] != 0.5f * m)
+    {
+      fprintf(stderr, "variant %zu: got {%g, %g}\n", i, output[0],
+          output[1]);
+      ok = false;
+    }
+  }
+
+  for (size_t i = 0; i < 3; i++)
+  {
+    if (variants[i].same_as == i)
+    {
+      bsl_module_unload(variants[i].module);
+    }
+  }
+  return ok;
+}
+
+int main(void)
+{
+  char dir[] = "cache_test.XXXXXX";
+  if (mkdtemp(dir) == NULL)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  bool ok = check_cache(dir);
+  char cache_dir[4096];
+  snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dir);
+  remove_dir(cache_dir);
+  remove_dir(dir);
+
+  ok = check_variants() && ok;
+  return ok ? 0 : 1;
+}
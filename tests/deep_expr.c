@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bsl.h>
+
+/* Terms in each of the flat sums below. */
+#define TERMS 10000
+
+static const char *const archive_path = "deep_expr.bslm";
+
+static void *test_alloc(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  (void) ud;
+  if (nsz == 0)
+  {
+    free(ptr);
+    return NULL;
+  }
+
+  void *new = realloc(ptr, nsz);
+  if (nsz > osz)
+  {
+    memset((char *) new + osz, 0, nsz - osz);
+  }
+  return new;
+}
+
+/* A left leaning sum, a sum of products whose spine is the addend once
+ * contracted, and a right leaning sum through parentheses. */
+static char *deep_source(size_t *len)
+{
+  size_t cap = 64 * TERMS + 1024;
+  char *src = malloc(cap);
+  size_t n = (size_t) snprintf(src, cap,
+      "record In\n"
+      "  [input(0)] x: f32\n"
+      "end\n"
+      "record Out\n"
+      "  [builtin(position)] pos: vec4<f32>\n"
+      "end\n"
+      "[entry_point(vertex)]\n"
+      "proc vs(v: In) Out\n"
+      "  var s = v.x");
+  for (int i = 0; i < TERMS; i++)
+  {
+    n += (size_t) snprintf(src + n, cap - n, " + 1.0");
+  }
+  n += (size_t) snprintf(src + n, cap - n, "\n  var p = v.x * 0.5");
+  for (int i = 1; i < TERMS; i++)
+  {
+    n += (size_t) snprintf(src + n, cap - n, " + v.x * 0.5");
+  }
+  n += (size_t) snprintf(src + n, cap - n, "\n  var r = ");
+  for (int i = 0; i < TERMS; i++)
+  {
+    n += (size_t) snprintf(src + n, cap - n, "1.0 + (");
+  }
+  n += (size_t) snprintf(src + n, cap - n, "v.x");
+  for (int i = 0; i < TERMS; i++)
+  {
+    src[n++] = ')';
+  }
+  n += (size_t) snprintf(src + n, cap - n,
+      "\n  return record Out .pos = {s, p, r, 1.0}, end\n"
+      "end\n");
+  *len = n;
+  return src;
+}
+
+static bool check(const char *what, const float *pos)
+{
+  const float expected[4] = {0.5f + TERMS, 0.25f * TERMS, 0.5f + TERMS, 1.0f};
+  if (memcmp(pos, expected, sizeof(expected)) != 0)
+  {
+    fprintf(stderr, "%s: got {%g, %g, %g, %g}\n", what, pos[0], pos[1],
+        pos[2], pos[3]);
+    return false;
+  }
+  return true;
+}
+
+static bool run_module(const char *what, BSLModule *module)
+{
+  BSLCompileResult result = {0};
+  BSLProgram *program;
+  if (!bsl_vm_compile(module, "vs", &program, &result))
+  {
+    fprintf(stderr, "%s: vm: %d:%d: %s\n", what, result.line, result.col,
+        result.msg);
+    return false;
+  }
+
+  const float input[4] = {0.5f};
+  const float *inputs[1] = {input};
+  float output[4];
+  bsl_vm_run(program, inputs, output);
+  bool ok = check(what, output);
+
+  BSLJitFn fn;
+  if (ok && bsl_jit_compile(program, &fn, &result))
+  {
+    memset(output, 0, sizeof(output));
+    fn(inputs, output);
+    ok = check(what, output);
+    bsl_jit_free(fn);
+  }
+  bsl_vm_free(program);
+
+  BSLVertexInput vertex_input = {0, 1, input};
+  BSLVertexOutput vertex_output = {BSL_LOCATION_POSITION, 4, output};
+  memset(output, 0, sizeof(output));
+  if (ok && !bsl_eval_vertex(module, "vs", &vertex_input, 1, &vertex_output,
+        1, 1, &result))
+  {
+    fprintf(stderr, "%s: eval: %s\n", what, result.msg);
+    return false;
+  }
+  return ok && check(what, output);
+}
+
+int main(void)
+{
+  size_t len;
+  char *src = deep_source(&len);
+  bool ok = true;
+
+  for (int contract = 0; ok && contract < 2; contract++)
+  {
+    const char *what = contract ? "contracted" : "plain";
+    BSLCompileInfo info = {
+      .internal_fn = test_alloc,
+      .src = (const uint8_t *) src,
+      .src_len = len,
+      .contract_fma = contract,
+    };
+    BSLCompileResult result = {0};
+    if (!bsl_compile(&info, &result))
+    {
+      fprintf(stderr, "%s: %d:%d: %s\n", what, result.line, result.col,
+          result.msg);
+      ok = false;
+      break;
+    }
+    ok = run_module(what, result.module);
+
+    BSLModule *loaded;
+    if (ok && (!bsl_module_save(result.module, archive_path, &result) ||
+          !bsl_module_load(archive_path, test_alloc, NULL, &loaded, &result)))
+    {
+      fprintf(stderr, "%s: archive: %s\n", what, result.msg);
+      ok = false;
+    } else if (ok)
+    {
+      ok = run_module("loaded", loaded);
+      bsl_module_unload(loaded);
+    }
+    remove(archive_path);
+    bsl_module_unload(result.module);
+
+    info.backend = BSL_BACKEND_C;
+    if (ok && (!bsl_compile(&info, &result) || result.output_len == 0))
+    {
+      fprintf(stderr, "%s: c backend: %s\n", what, result.msg);
+      ok = false;
+    } else if (ok)
+    {
+      test_alloc((void *) result.output, result.output_len + 1, 0, NULL);
+      bsl_module_unload(result.module);
+    }
+  }
+
+  free(src);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bsl.h>
+
+/* A statement that fails to parse poisons only the variable it declares,
+ * so errors in the statements around it are still reported. */
+static const char src[] =
+  "record In\n"
+  "  [input(0)] x: f32\n"
+  "end\n"
+  "record Out\n"
+  "  [builtin(position)] pos: vec4<f32>\n"
+  "end\n"
+  "[entry_point(vertex)]\n"
+  "proc vs(v: In) Out\n"
+  "  var y: f32 = 1.0 +\n"
+  "  var z: f32 = qq\n"
+  "  var w = y + v.x\n"
+  "  var u = w + undefined2\n"
+  "  return record Out .pos = {z, w, u, 1.0}, end\n"
+  "end\n"
+  "[entry_point(vertex)]\n"
+  "proc broken_return(v: In) Out\n"
+  "  return {1.0 +\n"
+  "end\n";
+
+static const struct
+{
+  int line;
+  BSLErrorCode code;
+} expected[] = {
+  {10, BSL_ERROR_SYNTAX},
+  {10, BSL_ERROR_UNDECLARED},
+  {12, BSL_ERROR_UNDECLARED},
+  {18, BSL_ERROR_SYNTAX},
+};
+
+static void *test_alloc(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  (void) osz;
+  (void) ud;
+  if (nsz == 0)
+  {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, nsz);
+}
+
+int main(void)
+{
+  BSLCompileInfo info = {
+    .internal_fn = test_alloc,
+    .src = (const uint8_t *) src,
+    .src_len = sizeof(src) - 1,
+  };
+  BSLCompileResult result = {0};
+  if (bsl_compile(&info, &result))
+  {
+    fprintf(stderr, "compiled despite the errors\n");
+    return 1;
+  }
+
+  size_t count = sizeof(expected) / sizeof(expected[0]);
+  bool ok = result.diagnostic_count == count;
+  for (size_t i = 0; ok && i < count; i++)
+  {
+    ok = result.diagnostics[i].line == expected[i].line &&
+      result.diagnostics[i].code == expected[i].code;
+  }
+  if (!ok)
+  {
+    for (size_t i = 0; i < result.diagnostic_count; i++)
+    {
+      const BSLDiagnostic *diagnostic = &result.diagnostics[i];
+      fprintf(stderr, "%d:%d: [%d] %s\n", diagnostic->line, diagnostic->col,
+          diagnostic->code, diagnostic->msg);
+    }
+  }
+  test_alloc(result.diagnostics,
+      result.diagnostic_count * sizeof(BSLDiagnostic), 0, NULL);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bsl.h>
+
+static const char *const pack_path = "pack_test.bslp";
+
+static void *test_alloc(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  (void) osz;
+  (void) ud;
+  if (nsz == 0)
+  {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, nsz);
+}
+
+static bool add(BSLPackWriter *writer, const char *name, const char *code,
+    const uint8_t *hash)
+{
+  /* The name is the caller's, the writer has to keep its own copy. */
+  char *copy = strdup(name);
+  BSLPackEntry entry = {
+    .name = copy,
+    .stage = BSL_STAGE_VERTEX,
+    .hash = hash,
+    .code = code,
+    .code_len = strlen(code),
+  };
+  BSLCompileResult result = {0};
+  bool ok = bsl_pack_add(writer, &entry, &result);
+  memset(copy, 0, strlen(copy));
+  free(copy);
+  return ok;
+}
+
+static bool expect_entry(const BSLPack *pack, const char *name,
+    const char *code)
+{
+  BSLPackEntry entry;
+  if (!bsl_pack_find(pack, name, &entry) || entry.code_len != strlen(code) ||
+      memcmp(entry.code, code, entry.code_len) != 0)
+  {
+    fprintf(stderr, "entry '%s' not read back\n", name);
+    return false;
+  }
+  return true;
+}
+
+int main(void)
+{
+  uint8_t hash[BSL_HASH_LEN];
+  memset(hash, 0x5a, sizeof(hash));
+
+  BSLPackWriter *writer = bsl_pack_writer_create(test_alloc, NULL);
+  bool ok = add(writer, "plain", "void plain(void) {}", NULL) &&
+    add(writer, "hashed", "void hashed(void) {}", hash) &&
+    add(writer, "shared", "void plain(void) {}", NULL);
+  if (!ok)
+  {
+    fprintf(stderr, "could not add entries\n");
+  }
+  if (ok && add(writer, "hashed", "void other(void) {}", NULL))
+  {
+    fprintf(stderr, "a duplicate name was added\n");
+    ok = false;
+  }
+
+  BSLCompileResult result = {0};
+  if (ok && !bsl_pack_write(writer, pack_path, &result))
+  {
+    fprintf(stderr, "write: %s\n", result.msg);
+    ok = false;
+  }
+  bsl_pack_writer_free(writer);
+
+  BSLPack *pack;
+  if (ok && !bsl_pack_open(pack_path, test_alloc, NULL, &pack, &result))
+  {
+    fprintf(stderr, "open: %s\n", result.msg);
+    ok = false;
+  } else if (ok)
+  {
+    BSLPackEntry entry;
+    ok = bsl_pack_count(pack) == 3 &&
+      expect_entry(pack, "plain", "void plain(void) {}") &&
+      expect_entry(pack, "hashed", "void hashed(void) {}") &&
+      expect_entry(pack, "shared", "void plain(void) {}") &&
+      !bsl_pack_find(pack, "missing", &entry) &&
+      bsl_pack_find_hash(pack, hash, &entry) &&
+      strcmp(entry.name, "hashed") == 0;
+    if (!ok)
+    {
+      fprintf(stderr, "pack did not read back as written\n");
+    }
+    bsl_pack_close(pack);
+  }
+  remove(pack_path);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bsl.h>
+
+/* The vertex stage writes n, which the fragment stage never reads, and
+ * Unused is never used. */
+static const char link_src[] =
+  "record VIn\n"
+  "  [input(0)] p: vec2<f32>\n"
+  "end\n"
+  "record VOut\n"
+  "  [builtin(position)] pos: vec4<f32>\n"
+  "  [output(0)] uv: vec2<f32>\n"
+  "  [output(1)] n: vec3<f32>\n"
+  "  [output(2)] w: f32\n"
+  "end\n"
+  "record FIn\n"
+  "  [input(0)] uv: vec2<f32>\n"
+  "  [input(2)] w: f32\n"
+  "end\n"
+  "record FOut\n"
+  "  [output(0)] color: vec4<f32>\n"
+  "end\n"
+  "record Unused\n"
+  "  x: f32\n"
+  "end\n"
+  "[entry_point(vertex)]\n"
+  "proc vs(v: VIn) VOut\n"
+  "  var dead = v.p * 3.0\n"
+  "  return record VOut .pos = {v.p, 0.0, 1.0}, .uv = v.p,\n"
+  "    .n = {1.0, 2.0, 3.0}, .w = 7.0, end\n"
+  "end\n"
+  "[entry_point(fragment)]\n"
+  "proc fs(i: FIn) FOut\n"
+  "  return record FOut .color = {i.uv, i.w, 1.0}, end\n"
+  "end\n";
+
+/* Elements alike but for their operands, and a product to fuse. */
+static const char c_src[] =
+  "record In\n"
+  "  [input(0)] a: f32\n"
+  "  [input(1)] b: f32\n"
+  "  [input(2)] c: f32\n"
+  "end\n"
+  "record Out\n"
+  "  [builtin(position)] pos: vec4<f32>\n"
+  "end\n"
+  "[entry_point(vertex)]\n"
+  "proc vs(i: In) Out\n"
+  "  var s = i.a\n"
+  "  var v = {i.a * s, i.b * s, i.c * s}\n"
+  "  var f = i.a * i.b + i.c\n"
+  "  return record Out .pos = {v, f}, end\n"
+  "end\n";
+
+static void *test_alloc(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  (void) osz;
+  (void) ud;
+  if (nsz == 0)
+  {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, nsz);
+}
+
+static bool check_link(void)
+{
+  BSLCompileInfo info = {
+    .internal_fn = test_alloc,
+    .src = (const uint8_t *) link_src,
+    .src_len = sizeof(link_src) - 1,
+    .link_stages = true,
+  };
+  BSLCompileResult result = {0};
+  if (!bsl_compile(&info, &result))
+  {
+    fprintf(stderr, "link: %d:%d: %s\n", result.line, result.col,
+        result.msg);
+    return false;
+  }
+
+  /* w fits beside uv, n is gone. */
+  bool ok = result.removed_vars == 1 && result.removed_toplevels == 1 &&
+    result.removed_varyings == 1 && result.varying_count == 3 &&
+    result.varyings[0].location == 0 && result.varyings[0].component == 0 &&
+    result.varyings[1].location == -1 &&
+    result.varyings[2].location == 0 && result.varyings[2].component == 2;
+  if (!ok)
+  {
+    fprintf(stderr, "link: removed %zu vars, %zu toplevels, %zu varyings\n",
+        result.removed_vars, result.removed_toplevels,
+        result.removed_varyings);
+  }
+
+  const float p[2] = {0.25f, 0.75f};
+  float out[3] = {0};
+  BSLVertexInput vertex_input = {0, 2, p};
+  BSLVertexOutput vertex_output = {0, 3, out};
+  if (ok && (!bsl_eval_vertex(result.module, "vs", &vertex_input, 1,
+          &vertex_output, 1, 1, &result) ||
+        out[0] != 0.25f || out[1] != 0.75f || out[2] != 7.0f))
+  {
+    fprintf(stderr, "link: vertex wrote {%g, %g, %g}\n", out[0], out[1],
+        out[2]);
+    ok = false;
+  }
+
+  float color[4] = {0};
+  BSLFragmentInput fragment_input = {
+    .location = 0,
+    .components = 3,
+    .a = {0.25f, 0.75f, 7.0f},
+  };
+  BSLFragmentOutput fragment_output = {0, 4, color};
+  if (ok && (!bsl_eval_fragment(result.module, "fs", &fragment_input, 1,
+          &fragment_output, 1, 1, 1, 1, &result) ||
+        color[0] != 0.25f || color[1] != 0.75f || color[2] != 7.0f))
+  {
+    fprintf(stderr, "link: fragment wrote {%g, %g, %g}\n", color[0],
+        color[1], color[2]);
+    ok = false;
+  }
+
+  test_alloc(result.varyings,
+      result.varying_count * sizeof(BSLVaryingLocation), 0, NULL);
+  bsl_module_unload(result.module);
+  return ok;
+}
+
+static const char *find_line(const char *output, const char *start)
+{
+  const char *line = strstr(output, start);
+  return line != NULL ? line : "";
+}
+
+static size_t count_in_line(const char *line, char c)
+{
+  size_t count = 0;
+  for (; *line != '\0' && *line != '\n'; line++)
+  {
+    count += *line == c;
+  }
+  return count;
+}
+
+static bool check_c(bool contract)
+{
+  BSLCompileInfo info = {
+    .internal_fn = test_alloc,
+    .src = (const uint8_t *) c_src,
+    .src_len = sizeof(c_src) - 1,
+    .contract_fma = contract,
+    .backend = BSL_BACKEND_C,
+  };
+  BSLCompileResult result = {0};
+  if (!bsl_compile(&info, &result) || result.output == NULL)
+  {
+    fprintf(stderr, "c: %s\n", result.msg);
+    return false;
+  }
+
+  /* SLP leaves one vector product for the three in v. */
+  const char *v = find_line(result.output, "bsl_vec3 bsl_u_v =");
+  const char *f = find_line(result.output, "float bsl_u_f =");
+  bool fused = strstr(f, "__builtin_fmaf") != NULL &&
+    strstr(f, "__builtin_fmaf") < strchr(f, '\n');
+  bool ok = count_in_line(v, '*') == 1 && fused == contract;
+  if (!ok)
+  {
+    fprintf(stderr, "c%s:\n%s\n", contract ? " contracted" : "",
+        result.output);
+  }
+
+  test_alloc((char *) result.output, result.output_len + 1, 0, NULL);
+  bsl_module_unload(result.module);
+  return ok;
+}
+
+int main(void)
+{
+  bool ok = check_link();
+  ok = check_c(false) && ok;
+  ok = check_c(true) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bsl.h>
+
+static const char src[] =
+  "const K = 0.0\n"
+  "record In\n"
+  "  [input(0)] x: f32\n"
+  "end\n"
+  "record Out\n"
+  "  [builtin(position)] pos: vec4<f32>\n"
+  "end\n"
+  "[entry_point(vertex)]\n"
+  "proc vs(v: In) Out\n"
+  "  return record Out .pos = {v.x * K, v.x + K, K * 2.0 + 1.0, 1.0}, end\n"
+  "end\n";
+
+static void *test_alloc(void *ptr, size_t osz, size_t nsz, void *ud)
+{
+  (void) osz;
+  (void) ud;
+  if (nsz == 0)
+  {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, nsz);
+}
+
+/* Without fast math x * 0 and x + 0 keep what IEEE arithmetic gives for x,
+ * while operations on constants fold either way. */
+static bool check(const char *what, bool fast_math, float x, const float *pos)
+{
+  bool ok = pos[2] == 1.0f && pos[3] == 1.0f;
+  if (fast_math)
+  {
+    ok = ok && pos[0] == 0.0f && !signbit(pos[0]) &&
+      (pos[1] == x || (isnan(x) && isnan(pos[1]))) &&
+      signbit(pos[1]) == signbit(x);
+  } else if (isinf(x) || isnan(x))
+  {
+    ok = ok && isnan(pos[0]) && (pos[1] == x || isnan(x));
+  } else
+  {
+    ok = ok && pos[0] == 0.0f && pos[1] == x + 0.0f && !signbit(pos[1]);
+  }
+
+  if (!ok)
+  {
+    fprintf(stderr, "%s%s: x = %g: got {%g, %g, %g, %g}\n", what,
+        fast_math ? " fast math" : "", x, pos[0], pos[1], pos[2], pos[3]);
+  }
+  return ok;
+}
+
+static bool run(BSLModule *module, bool fast_math, float x)
+{
+  BSLCompileResult result = {0};
+  BSLProgram *program;
+  if (!bsl_vm_compile(module, "vs", &program, &result))
+  {
+    fprintf(stderr, "vm: %s\n", result.msg);
+    return false;
+  }
+
+  const float input[4] = {x};
+  const float *inputs[1] = {input};
+  float output[4];
+  bsl_vm_run(program, inputs, output);
+  bool ok = check("vm", fast_math, x, output);
+
+  BSLJitFn fn;
+  if (bsl_jit_compile(program, &fn, &result))
+  {
+    memset(output, 0, sizeof(output));
+    fn(inputs, output);
+    ok = check("jit", fast_math, x, output) && ok;
+    bsl_jit_free(fn);
+  }
+  bsl_vm_free(program);
+
+  BSLVertexInput vertex_input = {0, 1, input};
+  BSLVertexOutput vertex_output = {BSL_LOCATION_POSITION, 4, output};
+  memset(output, 0, sizeof(output));
+  if (!bsl_eval_vertex(module, "vs", &vertex_input, 1, &vertex_output, 1, 1,
+        &result))
+  {
+    fprintf(stderr, "eval: %s\n", result.msg);
+    return false;
+  }
+  return check("eval", fast_math, x, output) && ok;
+}
+
+int main(void)
+{
+  const float xs[] = {INFINITY, -INFINITY, NAN, -0.0f, 2.0f};
+  bool ok = true;
+
+  for (int fast_math = 0; fast_math < 2; fast_math++)
+  {
+    BSLCompileInfo info = {
+      .internal_fn = test_alloc,
+      .src = (const uint8_t *) src,
+      .src_len = sizeof(src) - 1,
+      .fast_math = fast_math,
+    };
+    BSLCompileResult result = {0};
+    if (!bsl_compile(&info, &result))
+    {
+      fprintf(stderr, "%d:%d: %s\n", result.line, result.col, result.msg);
+      return 1;
+    }
+    for (size_t i = 0; i < sizeof(xs) / sizeof(xs[0]); i++)
+    {
+      ok = run(result.module, fast_math, xs[i]) && ok;
+    }
+    bsl_module_unload(result.module);
+  }
+  return ok ? 0 : 1;
+}